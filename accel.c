@@ -36,11 +36,15 @@
 #include "hw/boards.h"
 
 int tcg_tb_size;
+bool tcg_tb_prefetch;
 static bool tcg_allowed = true;
 
 static int tcg_init(MachineState *ms)
 {
     tcg_exec_init(tcg_tb_size * 1024 * 1024);
+    if (tcg_tb_prefetch) {
+        tcg_exec_enable_prefetch();
+    }
     return 0;
 }
 
@@ -18,19 +18,30 @@
 #include "block/block.h"
 #include "qemu/queue.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
+#include "trace.h"
 #ifdef CONFIG_EPOLL_CREATE1
 #include <sys/epoll.h>
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+#include <poll.h>
+#endif
 
 struct AioHandler
 {
     GPollFD pfd;
     IOHandler *io_read;
     IOHandler *io_write;
+    AioPollFn *io_poll;
     int deleted;
     void *opaque;
     bool is_external;
     QLIST_ENTRY(AioHandler) node;
+#ifdef CONFIG_LINUX_IO_URING
+    QSLIST_ENTRY(AioHandler) uring_submitted;
+    unsigned uring_flags;   /* AIO_URING_* */
+    int uring_events;       /* poll mask of the armed POLL_ADD */
+#endif
 };
 
 #ifdef CONFIG_EPOLL_CREATE1
@@ -189,6 +200,242 @@ static bool aio_epoll_check_poll(AioContext *ctx, GPollFD *pfds,
 
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+
+/* Each handler has at most one IORING_OP_POLL_ADD in flight.  Polls are
+ * one-shot, so a handler is re-armed after every completion.  Changes to
+ * the ring are queued on ctx->uring_submit_list and turned into sqes by the
+ * thread that waits on the ring, because the submission queue must not be
+ * touched by two threads at once.
+ */
+#define AIO_URING_ENTRIES       128
+
+#define AIO_URING_PENDING       1   /* on ctx->uring_submit_list */
+#define AIO_URING_ARMED         2   /* POLL_ADD in flight */
+#define AIO_URING_CANCELING     4   /* POLL_REMOVE in flight */
+
+static void aio_uring_disable(AioContext *ctx)
+{
+    AioHandler *node;
+
+    if (!ctx->uring_enabled) {
+        return;
+    }
+    ctx->uring_enabled = false;
+    io_uring_queue_exit(&ctx->uring);
+
+    /* Requests die with the ring, so nothing refers to the nodes anymore */
+    QSLIST_INIT(&ctx->uring_submit_list);
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        node->uring_flags = 0;
+    }
+}
+
+static inline int poll_events_from_pfd(int pfd_events)
+{
+    return (pfd_events & G_IO_IN ? POLLIN : 0) |
+           (pfd_events & G_IO_OUT ? POLLOUT : 0) |
+           (pfd_events & G_IO_HUP ? POLLHUP : 0) |
+           (pfd_events & G_IO_ERR ? POLLERR : 0);
+}
+
+static inline int pfd_events_from_poll(int poll_events)
+{
+    return (poll_events & POLLIN ? G_IO_IN : 0) |
+           (poll_events & POLLOUT ? G_IO_OUT : 0) |
+           (poll_events & POLLHUP ? G_IO_HUP : 0) |
+           (poll_events & POLLERR ? G_IO_ERR : 0);
+}
+
+static bool aio_node_busy(AioHandler *node)
+{
+    return node->uring_flags != 0;
+}
+
+static void aio_uring_update(AioContext *ctx, AioHandler *node)
+{
+    if (!ctx->uring_enabled || (node->uring_flags & AIO_URING_PENDING)) {
+        return;
+    }
+    /* A deleted node only needs an sqe if a poll must be cancelled */
+    if (node->deleted && !(node->uring_flags & AIO_URING_ARMED)) {
+        return;
+    }
+    node->uring_flags |= AIO_URING_PENDING;
+    QSLIST_INSERT_HEAD(&ctx->uring_submit_list, node, uring_submitted);
+}
+
+static struct io_uring_sqe *aio_uring_get_sqe(AioContext *ctx)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ctx->uring);
+
+    if (!sqe) {
+        /* Submission queue is full, push it to the kernel and retry */
+        io_uring_submit(&ctx->uring);
+        ctx->uring_sqes = 0;
+        sqe = io_uring_get_sqe(&ctx->uring);
+        assert(sqe);
+    }
+    ctx->uring_sqes++;
+    return sqe;
+}
+
+static void aio_uring_fill_sq(AioContext *ctx)
+{
+    AioHandler *node;
+    struct io_uring_sqe *sqe;
+
+    while ((node = QSLIST_FIRST(&ctx->uring_submit_list))) {
+        int events = node->deleted ? 0 : poll_events_from_pfd(node->pfd.events);
+
+        QSLIST_REMOVE_HEAD(&ctx->uring_submit_list, uring_submitted);
+        node->uring_flags &= ~AIO_URING_PENDING;
+
+        if (node->uring_flags & AIO_URING_ARMED) {
+            /* The new poll mask is applied when the old poll completes */
+            if (events != node->uring_events &&
+                !(node->uring_flags & AIO_URING_CANCELING)) {
+                sqe = aio_uring_get_sqe(ctx);
+                io_uring_prep_rw(IORING_OP_POLL_REMOVE, sqe, -1, NULL, 0, 0);
+                sqe->addr = (uintptr_t)node;
+                io_uring_sqe_set_data(sqe, NULL);
+                node->uring_flags |= AIO_URING_CANCELING;
+            }
+        } else if (events) {
+            sqe = aio_uring_get_sqe(ctx);
+            io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+            io_uring_sqe_set_data(sqe, node);
+            node->uring_flags |= AIO_URING_ARMED;
+            node->uring_events = events;
+        }
+    }
+}
+
+/* Called with the AioContext acquired.  Returns true if this thread may wait
+ * on the ring; aio_uring_wait() must then be bracketed by
+ * aio_uring_begin()/aio_uring_end().
+ */
+static bool aio_uring_check_poll(AioContext *ctx)
+{
+    /* Fall back to ppoll when external clients are disabled, or when another
+     * thread is already blocked on the ring.
+     */
+    return ctx->uring_enabled && !ctx->uring_busy &&
+           !aio_external_disabled(ctx);
+}
+
+static void aio_uring_begin(AioContext *ctx)
+{
+    ctx->uring_busy = true;
+    aio_uring_fill_sq(ctx);
+}
+
+/* Called without the AioContext acquired, but uring_busy keeps other threads
+ * away from the ring.
+ */
+static void aio_uring_wait(AioContext *ctx, int64_t timeout)
+{
+    struct __kernel_timespec ts;
+    struct io_uring_sqe *sqe;
+
+    if (timeout == 0) {
+        /* Completions are posted without a syscall, so only submit if some
+         * polls must be armed or cancelled.
+         */
+        if (ctx->uring_sqes) {
+            io_uring_submit(&ctx->uring);
+        }
+    } else {
+        if (timeout > 0) {
+            ts.tv_sec = timeout / NANOSECONDS_PER_SECOND;
+            ts.tv_nsec = timeout % NANOSECONDS_PER_SECOND;
+
+            /* Completes on expiry or as soon as any other cqe is posted */
+            sqe = aio_uring_get_sqe(ctx);
+            io_uring_prep_timeout(sqe, &ts, 1, 0);
+            io_uring_sqe_set_data(sqe, NULL);
+        }
+        io_uring_submit_and_wait(&ctx->uring, 1);
+    }
+    ctx->uring_sqes = 0;
+}
+
+/* Called with the AioContext acquired.  Returns the number of ready
+ * handlers.
+ */
+static int aio_uring_end(AioContext *ctx)
+{
+    struct io_uring_cqe *cqe;
+    int ready = 0;
+
+    while (io_uring_peek_cqe(&ctx->uring, &cqe) == 0 && cqe) {
+        AioHandler *node = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+
+        io_uring_cqe_seen(&ctx->uring, cqe);
+
+        /* POLL_REMOVE and timeout completions carry no handler */
+        if (!node) {
+            continue;
+        }
+
+        node->uring_flags &= ~(AIO_URING_ARMED | AIO_URING_CANCELING);
+        if (node->deleted) {
+            /* Freed by aio_dispatch() once it is no longer busy */
+            continue;
+        }
+        if (res > 0) {
+            node->pfd.revents = pfd_events_from_poll(res);
+            ready++;
+        }
+
+        /* Polls are one-shot, re-arm for the next aio_poll() */
+        if (node->pfd.events) {
+            aio_uring_update(ctx, node);
+        }
+    }
+
+    ctx->uring_busy = false;
+    return ready;
+}
+
+#else
+
+static void aio_uring_disable(AioContext *ctx)
+{
+}
+
+static bool aio_node_busy(AioHandler *node)
+{
+    return false;
+}
+
+static void aio_uring_update(AioContext *ctx, AioHandler *node)
+{
+}
+
+static bool aio_uring_check_poll(AioContext *ctx)
+{
+    return false;
+}
+
+static void aio_uring_begin(AioContext *ctx)
+{
+    assert(false);
+}
+
+static void aio_uring_wait(AioContext *ctx, int64_t timeout)
+{
+    assert(false);
+}
+
+static int aio_uring_end(AioContext *ctx)
+{
+    assert(false);
+}
+
+#endif
+
 static AioHandler *find_aio_handler(AioContext *ctx, int fd)
 {
     AioHandler *node;
@@ -207,6 +454,7 @@ void aio_set_fd_handler(AioContext *ctx,
                         bool is_external,
                         IOHandler *io_read,
                         IOHandler *io_write,
+                        AioPollFn *io_poll,
                         void *opaque)
 {
     AioHandler *node;
@@ -216,12 +464,21 @@ void aio_set_fd_handler(AioContext *ctx,
     node = find_aio_handler(ctx, fd);
 
     /* Are we deleting the fd handler? */
-    if (!io_read && !io_write) {
+    if (!io_read && !io_write && !io_poll) {
         if (node) {
             g_source_remove_poll(&ctx->source, &node->pfd);
 
-            /* If the lock is held, just mark the node as deleted */
-            if (ctx->walking_handlers) {
+            if (!node->io_poll) {
+                ctx->poll_disable_cnt--;
+            }
+
+            /* Clean events in order to unregister fd from the ctx epoll. */
+            node->pfd.events = 0;
+
+            /* If the lock is held, or io_uring still refers to the node,
+             * just mark the node as deleted
+             */
+            if (ctx->walking_handlers || aio_node_busy(node)) {
                 node->deleted = 1;
                 node->pfd.revents = 0;
             } else {
@@ -242,10 +499,16 @@ void aio_set_fd_handler(AioContext *ctx,
 
             g_source_add_poll(&ctx->source, &node->pfd);
             is_new = true;
+
+            ctx->poll_disable_cnt += !io_poll;
+        } else {
+            ctx->poll_disable_cnt += !io_poll - !node->io_poll;
         }
+
         /* Update handler with latest information */
         node->io_read = io_read;
         node->io_write = io_write;
+        node->io_poll = io_poll;
         node->opaque = opaque;
         node->is_external = is_external;
 
@@ -254,6 +517,9 @@ void aio_set_fd_handler(AioContext *ctx,
     }
 
     aio_epoll_update(ctx, node, is_new);
+    if (node && !deleted) {
+        aio_uring_update(ctx, node);
+    }
     aio_notify(ctx);
     if (deleted) {
         g_free(node);
@@ -263,10 +529,11 @@ void aio_set_fd_handler(AioContext *ctx,
 void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             bool is_external,
-                            EventNotifierHandler *io_read)
+                            EventNotifierHandler *io_read,
+                            AioPollFn *io_poll)
 {
-    aio_set_fd_handler(ctx, event_notifier_get_fd(notifier),
-                       is_external, (IOHandler *)io_read, NULL, notifier);
+    aio_set_fd_handler(ctx, event_notifier_get_fd(notifier), is_external,
+                       (IOHandler *)io_read, NULL, io_poll, notifier);
 }
 
 bool aio_prepare(AioContext *ctx)
@@ -347,7 +614,7 @@ bool aio_dispatch(AioContext *ctx)
 
         ctx->walking_handlers--;
 
-        if (!ctx->walking_handlers && tmp->deleted) {
+        if (!ctx->walking_handlers && tmp->deleted && !aio_node_busy(tmp)) {
             QLIST_REMOVE(tmp, node);
             g_free(tmp);
         }
@@ -405,12 +672,91 @@ static void add_pollfd(AioHandler *node)
     npfd++;
 }
 
+static bool run_poll_handlers_once(AioContext *ctx)
+{
+    bool progress = false;
+    AioHandler *node;
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll &&
+            aio_node_check(ctx, node->is_external) &&
+            node->io_poll(node->opaque)) {
+            progress = true;
+        }
+
+        /* Caller handles freeing deleted nodes.  Don't do it here. */
+    }
+
+    return progress;
+}
+
+/* run_poll_handlers:
+ * @ctx: the AioContext
+ * @max_ns: maximum time to poll for, in nanoseconds
+ *
+ * Polls for a given time.
+ *
+ * Note that ctx->notify_me must be non-zero so this function can detect
+ * aio_notify().
+ *
+ * Note that the caller must have incremented ctx->walking_handlers.
+ *
+ * Returns: true if progress was made, false otherwise
+ */
+static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
+{
+    bool progress;
+    int64_t end_time;
+
+    assert(ctx->notify_me);
+    assert(ctx->walking_handlers > 0);
+    assert(ctx->poll_disable_cnt == 0);
+
+    trace_run_poll_handlers_begin(ctx, max_ns);
+
+    end_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + max_ns;
+
+    do {
+        progress = run_poll_handlers_once(ctx);
+    } while (!progress && qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < end_time);
+
+    trace_run_poll_handlers_end(ctx, progress);
+
+    return progress;
+}
+
+/* try_poll_mode:
+ * @ctx: the AioContext
+ * @blocking: busy polling is only attempted when blocking is true
+ *
+ * ctx->notify_me must be non-zero so this function can detect aio_notify().
+ *
+ * Note that the caller must have incremented ctx->walking_handlers.
+ *
+ * Returns: true if progress was made, false otherwise
+ */
+static bool try_poll_mode(AioContext *ctx, bool blocking)
+{
+    if (blocking && ctx->poll_max_ns && ctx->poll_disable_cnt == 0) {
+        /* See qemu_soonest_timeout() uint64_t hack */
+        int64_t max_ns = MIN((uint64_t)aio_compute_timeout(ctx),
+                             (uint64_t)ctx->poll_ns);
+
+        if (max_ns) {
+            return run_poll_handlers(ctx, max_ns);
+        }
+    }
+
+    return false;
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
-    int i, ret;
+    int i, ret = 0;
     bool progress;
     int64_t timeout;
+    int64_t start = 0;
 
     aio_context_acquire(ctx);
     progress = false;
@@ -428,39 +774,101 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     ctx->walking_handlers++;
 
-    assert(npfd == 0);
+    if (ctx->poll_max_ns) {
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
 
-    /* fill pollfds */
-    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
-        if (!node->deleted && node->pfd.events
-            && !aio_epoll_enabled(ctx)
-            && aio_node_check(ctx, node->is_external)) {
-            add_pollfd(node);
+    if (try_poll_mode(ctx, blocking)) {
+        progress = true;
+    } else {
+        bool use_uring = aio_uring_check_poll(ctx);
+
+        assert(npfd == 0);
+
+        /* fill pollfds */
+        QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+            if (!node->deleted && node->pfd.events
+                && !use_uring
+                && !aio_epoll_enabled(ctx)
+                && aio_node_check(ctx, node->is_external)) {
+                add_pollfd(node);
+            }
         }
-    }
 
-    timeout = blocking ? aio_compute_timeout(ctx) : 0;
+        timeout = blocking ? aio_compute_timeout(ctx) : 0;
 
-    /* wait until next event */
-    if (timeout) {
-        aio_context_release(ctx);
-    }
-    if (aio_epoll_check_poll(ctx, pollfds, npfd, timeout)) {
-        AioHandler epoll_handler;
+        if (use_uring) {
+            aio_uring_begin(ctx);
+        }
 
-        epoll_handler.pfd.fd = ctx->epollfd;
-        epoll_handler.pfd.events = G_IO_IN | G_IO_OUT | G_IO_HUP | G_IO_ERR;
-        npfd = 0;
-        add_pollfd(&epoll_handler);
-        ret = aio_epoll(ctx, pollfds, npfd, timeout);
-    } else  {
-        ret = qemu_poll_ns(pollfds, npfd, timeout);
+        /* wait until next event */
+        if (timeout) {
+            aio_context_release(ctx);
+        }
+        if (use_uring) {
+            aio_uring_wait(ctx, timeout);
+        } else if (aio_epoll_check_poll(ctx, pollfds, npfd, timeout)) {
+            AioHandler epoll_handler;
+
+            epoll_handler.pfd.fd = ctx->epollfd;
+            epoll_handler.pfd.events = G_IO_IN | G_IO_OUT | G_IO_HUP | G_IO_ERR;
+            npfd = 0;
+            add_pollfd(&epoll_handler);
+            ret = aio_epoll(ctx, pollfds, npfd, timeout);
+        } else  {
+            ret = qemu_poll_ns(pollfds, npfd, timeout);
+        }
+        if (timeout) {
+            aio_context_acquire(ctx);
+        }
+        if (use_uring) {
+            ret = aio_uring_end(ctx);
+        }
     }
+
     if (blocking) {
         atomic_sub(&ctx->notify_me, 2);
     }
-    if (timeout) {
-        aio_context_acquire(ctx);
+
+    /* Adjust polling time */
+    if (ctx->poll_max_ns) {
+        int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+
+        if (block_ns <= ctx->poll_ns) {
+            /* This is the sweet spot, no adjustment needed */
+        } else if (block_ns > ctx->poll_max_ns) {
+            /* We'd have to poll for too long, poll less */
+            int64_t old = ctx->poll_ns;
+
+            if (ctx->poll_shrink) {
+                ctx->poll_ns /= ctx->poll_shrink;
+            } else {
+                ctx->poll_ns = 0;
+            }
+
+            trace_poll_shrink(ctx, old, ctx->poll_ns);
+        } else if (ctx->poll_ns < ctx->poll_max_ns &&
+                   block_ns < ctx->poll_max_ns) {
+            /* There is room to grow, poll longer */
+            int64_t old = ctx->poll_ns;
+            int64_t grow = ctx->poll_grow;
+
+            if (grow == 0) {
+                grow = 2;
+            }
+
+            if (ctx->poll_ns) {
+                ctx->poll_ns *= grow;
+            } else {
+                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
+            }
+
+            if (ctx->poll_ns > ctx->poll_max_ns) {
+                ctx->poll_ns = ctx->poll_max_ns;
+            }
+
+            trace_poll_grow(ctx, old, ctx->poll_ns);
+        }
     }
 
     aio_notify_accept(ctx);
@@ -487,6 +895,14 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
 void aio_context_setup(AioContext *ctx)
 {
+#ifdef CONFIG_LINUX_IO_URING
+    /* io_uring takes precedence over epoll, which remains available in case
+     * the AioContext ends up being polled through its GSource.
+     */
+    QSLIST_INIT(&ctx->uring_submit_list);
+    ctx->uring_enabled =
+        io_uring_queue_init(AIO_URING_ENTRIES, &ctx->uring, 0) == 0;
+#endif
 #ifdef CONFIG_EPOLL_CREATE1
     assert(!ctx->epollfd);
     ctx->epollfd = epoll_create1(EPOLL_CLOEXEC);
@@ -498,3 +914,30 @@ void aio_context_setup(AioContext *ctx)
     }
 #endif
 }
+
+void aio_context_destroy(AioContext *ctx)
+{
+    aio_uring_disable(ctx);
+}
+
+void aio_context_use_g_source(AioContext *ctx)
+{
+    /* glib polls the AioHandlers' GPollFDs itself, and one-shot io_uring
+     * polls would go stale behind its back.
+     */
+    aio_uring_disable(ctx);
+}
+
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink, Error **errp)
+{
+    /* No thread synchronization here, it doesn't matter if an incorrect value
+     * is used once.
+     */
+    ctx->poll_max_ns = max_ns;
+    ctx->poll_ns = 0;
+    ctx->poll_grow = grow;
+    ctx->poll_shrink = shrink;
+
+    aio_notify(ctx);
+}
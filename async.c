@@ -251,6 +251,14 @@ aio_ctx_finalize(GSource     *source)
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->linux_io_uring) {
+        luring_detach_aio_context(ctx->linux_io_uring, ctx);
+        luring_cleanup(ctx->linux_io_uring);
+        ctx->linux_io_uring = NULL;
+    }
+#endif
+
     qemu_mutex_lock(&ctx->bh_lock);
     while (ctx->first_bh) {
         QEMUBH *next = ctx->first_bh->next;
@@ -263,7 +271,8 @@ aio_ctx_finalize(GSource     *source)
     }
     qemu_mutex_unlock(&ctx->bh_lock);
 
-    aio_set_event_notifier(ctx, &ctx->notifier, false, NULL);
+    aio_context_destroy(ctx);
+    aio_set_event_notifier(ctx, &ctx->notifier, false, NULL, NULL);
     event_notifier_cleanup(&ctx->notifier);
     rfifolock_destroy(&ctx->lock);
     qemu_mutex_destroy(&ctx->bh_lock);
@@ -279,6 +288,7 @@ static GSourceFuncs aio_source_funcs = {
 
 GSource *aio_get_g_source(AioContext *ctx)
 {
+    aio_context_use_g_source(ctx);
     g_source_ref(&ctx->source);
     return &ctx->source;
 }
@@ -286,11 +296,48 @@ GSource *aio_get_g_source(AioContext *ctx)
 ThreadPool *aio_get_thread_pool(AioContext *ctx)
 {
     if (!ctx->thread_pool) {
-        ctx->thread_pool = thread_pool_new(ctx);
+        ThreadPool *pool = thread_pool_new(ctx);
+
+        /* The parameters can be changed from another thread; pick up
+         * whatever was set while the pool was not visible yet.
+         */
+        atomic_mb_set(&ctx->thread_pool, pool);
+        thread_pool_update_params(pool, ctx);
     }
     return ctx->thread_pool;
 }
 
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, int64_t idle_timeout,
+                                        Error **errp)
+{
+    ThreadPool *pool;
+
+    if (min < 0 || max < 1 || min > max || max > INT_MAX) {
+        error_setg(errp, "bad thread pool limits: min %" PRId64
+                   ", max %" PRId64, min, max);
+        return;
+    }
+    if (idle_timeout < 1 || idle_timeout > INT_MAX) {
+        error_setg(errp, "thread pool idle timeout must be in range "
+                   "[1, %d] ms", INT_MAX);
+        return;
+    }
+
+    ctx->thread_pool_min = min;
+    ctx->thread_pool_max = max;
+    ctx->thread_pool_idle_timeout = idle_timeout;
+
+    /* Write the parameters before reading thread_pool.  Pairs with
+     * atomic_mb_set() in aio_get_thread_pool().
+     */
+    smp_mb();
+    pool = atomic_read(&ctx->thread_pool);
+    if (pool) {
+        thread_pool_update_params(pool, ctx);
+    }
+}
+
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 {
@@ -302,6 +349,19 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+LuringState *aio_get_linux_io_uring(AioContext *ctx)
+{
+    if (!ctx->linux_io_uring) {
+        ctx->linux_io_uring = luring_init();
+        if (ctx->linux_io_uring) {
+            luring_attach_aio_context(ctx->linux_io_uring, ctx);
+        }
+    }
+    return ctx->linux_io_uring;
+}
+#endif
+
 void aio_notify(AioContext *ctx)
 {
     /* Write e.g. bh->scheduled before reading ctx->notify_me.  Pairs
@@ -343,6 +403,15 @@ static void event_notifier_dummy_cb(EventNotifier *e)
 {
 }
 
+/* Returns true if aio_notify() was called (e.g. a BH was scheduled) */
+static bool event_notifier_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    AioContext *ctx = container_of(e, AioContext, notifier);
+
+    return atomic_read(&ctx->notified);
+}
+
 AioContext *aio_context_new(Error **errp)
 {
     int ret;
@@ -360,17 +429,29 @@ AioContext *aio_context_new(Error **errp)
     aio_set_event_notifier(ctx, &ctx->notifier,
                            false,
                            (EventNotifierHandler *)
-                           event_notifier_dummy_cb);
+                           event_notifier_dummy_cb,
+                           event_notifier_poll);
 #ifdef CONFIG_LINUX_AIO
     ctx->linux_aio = NULL;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    ctx->linux_io_uring = NULL;
 #endif
     ctx->thread_pool = NULL;
+    ctx->thread_pool_min = THREAD_POOL_MIN_THREADS_DEFAULT;
+    ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    ctx->thread_pool_idle_timeout = THREAD_POOL_IDLE_TIMEOUT_DEFAULT;
     qemu_mutex_init(&ctx->bh_lock);
     rfifolock_init(&ctx->lock, aio_rfifolock_cb, ctx);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
     ctx->notify_dummy_bh = aio_bh_new(ctx, notify_dummy_bh, NULL);
 
+    ctx->poll_ns = 0;
+    ctx->poll_max_ns = 0;
+    ctx->poll_grow = 0;
+    ctx->poll_shrink = 0;
+
     return ctx;
 fail:
     g_source_destroy(&ctx->source);
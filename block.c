@@ -678,6 +678,28 @@ int bdrv_parse_discard_flags(const char *mode, int *flags)
     return 0;
 }
 
+/**
+ * Set open flags for a given AIO engine
+ *
+ * Return 0 on success, -1 if the engine was invalid.
+ */
+int bdrv_parse_aio(const char *mode, int *flags)
+{
+    *flags &= ~(BDRV_O_NATIVE_AIO | BDRV_O_IO_URING);
+
+    if (!strcmp(mode, "threads")) {
+        /* this is the default */
+    } else if (!strcmp(mode, "native")) {
+        *flags |= BDRV_O_NATIVE_AIO;
+    } else if (!strcmp(mode, "io_uring")) {
+        *flags |= BDRV_O_IO_URING;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
  * Set open flags for a given cache mode
  *
@@ -1877,6 +1899,7 @@ BlockDriverState *bdrv_open(const char *filename, const char *reference,
 
 typedef struct BlockReopenQueueEntry {
      bool prepared;
+     bool made_writable;
      BDRVReopenState state;
      QSIMPLEQ_ENTRY(BlockReopenQueueEntry) entry;
 } BlockReopenQueueEntry;
@@ -2056,7 +2079,27 @@ int bdrv_reopen_multiple(BlockReopenQueue *bs_queue, Error **errp)
      * changes
      */
     QSIMPLEQ_FOREACH(bs_entry, bs_queue, entry) {
+        bool was_read_only = bdrv_is_read_only(bs_entry->state.bs);
+
         bdrv_reopen_commit(&bs_entry->state);
+        bs_entry->made_writable = was_read_only &&
+                                  !bdrv_is_read_only(bs_entry->state.bs);
+    }
+
+    /* Only now are the children writable too, so persistent bitmaps can be
+     * marked as in use.  The reopen can't be undone anymore, so a failure
+     * is only reported. */
+    QSIMPLEQ_FOREACH(bs_entry, bs_queue, entry) {
+        BlockDriverState *bs = bs_entry->state.bs;
+
+        if (bs_entry->made_writable && bs->drv &&
+            bs->drv->bdrv_reopen_bitmaps_rw) {
+            bs->drv->bdrv_reopen_bitmaps_rw(bs, &local_err);
+            if (local_err) {
+                error_report_err(local_err);
+                local_err = NULL;
+            }
+        }
     }
 
     ret = 0;
@@ -2267,9 +2310,6 @@ static void bdrv_close(BlockDriverState *bs)
     bdrv_flush(bs);
     bdrv_drain(bs); /* in case flush left pending I/O */
 
-    bdrv_release_named_dirty_bitmaps(bs);
-    assert(QLIST_EMPTY(&bs->dirty_bitmaps));
-
     if (bs->drv) {
         BdrvChild *child, *next;
 
@@ -2308,6 +2348,10 @@ static void bdrv_close(BlockDriverState *bs)
         bs->full_open_options = NULL;
     }
 
+    /* Only now that the driver had a chance to store persistent bitmaps */
+    bdrv_release_named_dirty_bitmaps(bs);
+    assert(QLIST_EMPTY(&bs->dirty_bitmaps));
+
     QLIST_FOREACH_SAFE(ban, &bs->aio_notifiers, list, ban_next) {
         g_free(ban);
     }
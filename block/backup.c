@@ -42,6 +42,8 @@ typedef struct BackupBlockJob {
     unsigned long *done_bitmap;
     int64_t cluster_size;
     bool compress;
+    /* try bdrv_co_copy_range() before reading into a bounce buffer */
+    bool use_copy_range;
     NotifierWithReturn before_write;
     QLIST_HEAD(, CowRequest) inflight_reqs;
 } BackupBlockJob;
@@ -89,15 +91,78 @@ static void cow_request_end(CowRequest *req)
     qemu_co_queue_restart_all(&req->wait_queue);
 }
 
+/* Copy @n sectors of cluster @start through a bounce buffer */
+static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
+                                                      int64_t start, int n,
+                                                      bool is_write_notifier,
+                                                      bool *error_is_read,
+                                                      void **bounce_buffer)
+{
+    BlockBackend *blk = job->common.blk;
+    struct iovec iov;
+    QEMUIOVector bounce_qiov;
+    int ret;
+
+    if (!*bounce_buffer) {
+        *bounce_buffer = blk_blockalign(blk, job->cluster_size);
+    }
+    iov.iov_base = *bounce_buffer;
+    iov.iov_len = n * BDRV_SECTOR_SIZE;
+    qemu_iovec_init_external(&bounce_qiov, &iov, 1);
+
+    ret = blk_co_preadv(blk, start * job->cluster_size,
+                        bounce_qiov.size, &bounce_qiov,
+                        is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0);
+    if (ret < 0) {
+        trace_backup_do_cow_read_fail(job, start, ret);
+        if (error_is_read) {
+            *error_is_read = true;
+        }
+        return ret;
+    }
+
+    if (buffer_is_zero(iov.iov_base, iov.iov_len)) {
+        ret = blk_co_pwrite_zeroes(job->target, start * job->cluster_size,
+                                   bounce_qiov.size, BDRV_REQ_MAY_UNMAP);
+    } else {
+        ret = blk_co_pwritev(job->target, start * job->cluster_size,
+                             bounce_qiov.size, &bounce_qiov,
+                             job->compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
+    }
+    if (ret < 0) {
+        trace_backup_do_cow_write_fail(job, start, ret);
+        if (error_is_read) {
+            *error_is_read = false;
+        }
+        return ret;
+    }
+
+    return 0;
+}
+
+/* Copy @n sectors of cluster @start without passing them through QEMU */
+static int coroutine_fn backup_cow_with_offload(BackupBlockJob *job,
+                                                int64_t start, int n,
+                                                bool is_write_notifier)
+{
+    int ret;
+
+    ret = blk_co_copy_range(job->common.blk, start * job->cluster_size,
+                            job->target, start * job->cluster_size,
+                            n * BDRV_SECTOR_SIZE,
+                            is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0);
+    if (ret < 0) {
+        trace_backup_do_cow_copy_range_fail(job, start, ret);
+    }
+    return ret;
+}
+
 static int coroutine_fn backup_do_cow(BackupBlockJob *job,
                                       int64_t sector_num, int nb_sectors,
                                       bool *error_is_read,
                                       bool is_write_notifier)
 {
-    BlockBackend *blk = job->common.blk;
     CowRequest cow_request;
-    struct iovec iov;
-    QEMUIOVector bounce_qiov;
     void *bounce_buffer = NULL;
     int ret = 0;
     int64_t sectors_per_cluster = cluster_size_sectors(job);
@@ -126,38 +191,21 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
                 job->common.len / BDRV_SECTOR_SIZE -
                 start * sectors_per_cluster);
 
-        if (!bounce_buffer) {
-            bounce_buffer = blk_blockalign(blk, job->cluster_size);
-        }
-        iov.iov_base = bounce_buffer;
-        iov.iov_len = n * BDRV_SECTOR_SIZE;
-        qemu_iovec_init_external(&bounce_qiov, &iov, 1);
-
-        ret = blk_co_preadv(blk, start * job->cluster_size,
-                            bounce_qiov.size, &bounce_qiov,
-                            is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0);
-        if (ret < 0) {
-            trace_backup_do_cow_read_fail(job, start, ret);
-            if (error_is_read) {
-                *error_is_read = true;
+        if (job->use_copy_range) {
+            ret = backup_cow_with_offload(job, start, n, is_write_notifier);
+            if (ret < 0) {
+                /* Retry through the bounce buffer, which also tells source
+                 * errors from target errors, and don't offload again */
+                job->use_copy_range = false;
             }
-            goto out;
-        }
-
-        if (buffer_is_zero(iov.iov_base, iov.iov_len)) {
-            ret = blk_co_pwrite_zeroes(job->target, start * job->cluster_size,
-                                       bounce_qiov.size, BDRV_REQ_MAY_UNMAP);
-        } else {
-            ret = blk_co_pwritev(job->target, start * job->cluster_size,
-                                 bounce_qiov.size, &bounce_qiov,
-                                 job->compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
         }
-        if (ret < 0) {
-            trace_backup_do_cow_write_fail(job, start, ret);
-            if (error_is_read) {
-                *error_is_read = false;
+        if (!job->use_copy_range) {
+            ret = backup_cow_with_bounce_buffer(job, start, n,
+                                                is_write_notifier,
+                                                error_is_read, &bounce_buffer);
+            if (ret < 0) {
+                goto out;
             }
-            goto out;
         }
 
         set_bit(start, job->done_bitmap);
@@ -610,6 +658,8 @@ void backup_start(const char *job_id, BlockDriverState *bs,
     job->sync_bitmap = sync_mode == MIRROR_SYNC_MODE_INCREMENTAL ?
                        sync_bitmap : NULL;
     job->compress = compress;
+    /* Compressed clusters must be written by the format driver */
+    job->use_copy_range = !compress;
 
     /* If there is no backing file on the target, we cannot rely on COW if our
      * backup cluster size is smaller than the target cluster size. Even for
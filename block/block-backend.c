@@ -1504,6 +1504,44 @@ int coroutine_fn blk_co_pwrite_zeroes(BlockBackend *blk, int64_t offset,
                           flags | BDRV_REQ_ZERO_WRITE);
 }
 
+int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
+                                   BlockBackend *blk_out, int64_t off_out,
+                                   int count, BdrvRequestFlags flags)
+{
+    int ret;
+
+    trace_blk_co_copy_range(blk_in, off_in, blk_out, off_out, count, flags);
+
+    ret = blk_check_byte_request(blk_in, off_in, count);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = blk_check_byte_request(blk_out, off_out, count);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* throttling disk I/O */
+    if (blk_in->public.throttle_state) {
+        throttle_group_co_io_limits_intercept(blk_in, count, false);
+    }
+    if (blk_out->public.throttle_state) {
+        throttle_group_co_io_limits_intercept(blk_out, count, true);
+    }
+
+    ret = bdrv_co_copy_range(blk_in->root, off_in, blk_out->root, off_out,
+                             count, flags);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* There is no way to ask for FUA semantics here, so flush instead */
+    if (!blk_out->enable_write_cache) {
+        ret = bdrv_co_flush(blk_bs(blk_out));
+    }
+    return ret;
+}
+
 int blk_pwrite_compressed(BlockBackend *blk, int64_t offset, const void *buf,
                           int count)
 {
@@ -1619,6 +1619,140 @@ int coroutine_fn bdrv_co_pwrite_zeroes(BdrvChild *child, int64_t offset,
                            BDRV_REQ_ZERO_WRITE | flags);
 }
 
+static int coroutine_fn bdrv_co_copy_range_internal(BdrvChild *src,
+                                                    int64_t src_offset,
+                                                    BdrvChild *dst,
+                                                    int64_t dst_offset,
+                                                    int bytes,
+                                                    BdrvRequestFlags flags,
+                                                    bool recurse_src)
+{
+    BlockDriverState *src_bs, *dst_bs;
+    BdrvTrackedRequest req;
+    uint64_t align;
+    int ret;
+
+    if (!dst || !dst->bs || !dst->bs->drv) {
+        return -ENOMEDIUM;
+    }
+    dst_bs = dst->bs;
+    if (dst_bs->read_only) {
+        return -EPERM;
+    }
+    assert(!(dst_bs->open_flags & BDRV_O_INACTIVE));
+
+    ret = bdrv_check_byte_request(dst_bs, dst_offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (flags & BDRV_REQ_ZERO_WRITE) {
+        return bdrv_co_pwrite_zeroes(dst, dst_offset, bytes,
+                                     flags & ~BDRV_REQ_NO_SERIALISING);
+    }
+
+    if (!src || !src->bs || !src->bs->drv) {
+        return -ENOMEDIUM;
+    }
+    src_bs = src->bs;
+
+    ret = bdrv_check_byte_request(src_bs, src_offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+    if (!bytes) {
+        return 0;
+    }
+
+    if (!src_bs->drv->bdrv_co_copy_range_from ||
+        !dst_bs->drv->bdrv_co_copy_range_to ||
+        src_bs->encrypted || dst_bs->encrypted) {
+        return -ENOTSUP;
+    }
+
+    /* Unaligned requests need a read-modify-write cycle; leave that to the
+     * caller's bounce buffer path */
+    align = MAX(src_bs->bl.request_alignment, dst_bs->bl.request_alignment);
+    if ((src_offset | dst_offset | bytes) & (align - 1)) {
+        return -ENOTSUP;
+    }
+
+    /* Each node is visited once: the source chain while recurse_src is set,
+     * then the destination chain.  Only the node being dispatched to is
+     * tracked, so the destination sees exactly one write request. */
+    if (recurse_src) {
+        tracked_request_begin(&req, src_bs, src_offset, bytes,
+                              BDRV_TRACKED_READ);
+        if (!(flags & BDRV_REQ_NO_SERIALISING)) {
+            wait_serialising_requests(&req);
+        }
+
+        ret = src_bs->drv->bdrv_co_copy_range_from(src_bs, src, src_offset,
+                                                   dst, dst_offset, bytes,
+                                                   flags);
+        tracked_request_end(&req);
+        return ret;
+    }
+
+    tracked_request_begin(&req, dst_bs, dst_offset, bytes,
+                          BDRV_TRACKED_WRITE);
+    wait_serialising_requests(&req);
+
+    ret = notifier_with_return_list_notify(&dst_bs->before_write_notifiers,
+                                           &req);
+    if (ret == 0) {
+        ret = dst_bs->drv->bdrv_co_copy_range_to(dst_bs, src, src_offset,
+                                                 dst, dst_offset, bytes,
+                                                 flags);
+    }
+
+    ++dst_bs->write_gen;
+    bdrv_set_dirty(dst_bs, dst_offset >> BDRV_SECTOR_BITS,
+                   DIV_ROUND_UP(bytes, BDRV_SECTOR_SIZE));
+
+    if (dst_bs->wr_highest_offset < dst_offset + bytes) {
+        dst_bs->wr_highest_offset = dst_offset + bytes;
+    }
+
+    if (ret >= 0) {
+        dst_bs->total_sectors = MAX(dst_bs->total_sectors,
+                                    DIV_ROUND_UP(dst_offset + bytes,
+                                                 BDRV_SECTOR_SIZE));
+        ret = 0;
+    }
+
+    tracked_request_end(&req);
+    return ret;
+}
+
+int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, int64_t src_offset,
+                                         BdrvChild *dst, int64_t dst_offset,
+                                         int bytes, BdrvRequestFlags flags)
+{
+    trace_bdrv_co_copy_range_from(src, src_offset, dst, dst_offset,
+                                  bytes, flags);
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, true);
+}
+
+int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, int64_t src_offset,
+                                       BdrvChild *dst, int64_t dst_offset,
+                                       int bytes, BdrvRequestFlags flags)
+{
+    trace_bdrv_co_copy_range_to(src, src_offset, dst, dst_offset,
+                                bytes, flags);
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, false);
+}
+
+int coroutine_fn bdrv_co_copy_range(BdrvChild *src, int64_t src_offset,
+                                    BdrvChild *dst, int64_t dst_offset,
+                                    int bytes, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_from(src, src_offset, dst, dst_offset,
+                                   bytes, flags);
+}
+
 typedef struct BdrvCoGetBlockStatusData {
     BlockDriverState *bs;
     BlockDriverState *base;
@@ -0,0 +1,540 @@
+/*
+ * Linux io_uring support.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qemu/coroutine.h"
+
+#include <liburing.h>
+
+/*
+ * Queue size (per-AioContext).  Requests beyond this are kept on the
+ * submit queue until the ring has room again.
+ */
+#define MAX_ENTRIES 128
+
+/*
+ * Number of file descriptors that can be registered with the ring.  Fixed
+ * files save the kernel an fget/fput pair per request; descriptors that do
+ * not fit are passed as plain fds.
+ */
+#define MAX_FIXED_FILES 64
+
+typedef struct LuringAIOCB {
+    Coroutine *co;
+    struct io_uring_sqe sqeq;
+    /* The sqe in the ring, while the request waits on ring_queue */
+    struct io_uring_sqe *sqe;
+    ssize_t ret;
+    QEMUIOVector *qiov;
+    bool is_read;
+    QSIMPLEQ_ENTRY(LuringAIOCB) next;
+
+    /*
+     * Buffered I/O can complete a read partially.  The rest is resubmitted
+     * from resubmit_qiov, and total_read counts the bytes done so far.
+     */
+    int total_read;
+    QEMUIOVector resubmit_qiov;
+} LuringAIOCB;
+
+typedef struct {
+    int plugged;
+    unsigned int in_queue;
+    unsigned int in_flight;
+    bool blocked;
+    QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
+
+    /*
+     * Requests whose sqes are in the ring but were not accepted by the
+     * kernel yet, in ring order.  They are preceded in the ring by
+     * @ring_nops sqes of failed requests, which were turned into nops.
+     * in_queue counts both, as well as submit_queue.
+     */
+    QSIMPLEQ_HEAD(, LuringAIOCB) ring_queue;
+    unsigned int ring_nops;
+} LuringQueue;
+
+struct LuringState {
+    AioContext *aio_context;
+
+    struct io_uring ring;
+
+    /* io queue for submit at batch */
+    LuringQueue io_q;
+
+    /* I/O completion processing */
+    QEMUBH *completion_bh;
+
+    /* Submission retry when the kernel refused sqes with nothing in flight */
+    QEMUBH *retry_bh;
+
+    /* Registered files, -1 for free slots */
+    bool fixed_files;
+    int fixed_fds[MAX_FIXED_FILES];
+};
+
+static void ioq_submit(LuringState *s);
+
+/**
+ * luring_resubmit:
+ *
+ * Resubmit a request by appending it to submit_queue.  The caller must ensure
+ * that ioq_submit() is called later so that submit_queue requests are started.
+ */
+static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
+{
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+}
+
+/**
+ * luring_resubmit_short_read:
+ *
+ * Before Linux commit 9d93a3f5a0c ("io_uring: punt short reads to async
+ * context") a buffered I/O request with the start of the file range in the
+ * page cache could result in a short read.  Applications need to resubmit
+ * the remaining read request.
+ */
+static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
+                                       int nread)
+{
+    QEMUIOVector *resubmit_qiov;
+    size_t remaining;
+
+    /* Update read position */
+    luringcb->total_read += nread;
+    remaining = luringcb->qiov->size - luringcb->total_read;
+
+    /* Shorten qiov */
+    resubmit_qiov = &luringcb->resubmit_qiov;
+    if (resubmit_qiov->iov == NULL) {
+        qemu_iovec_init(resubmit_qiov, luringcb->qiov->niov);
+    } else {
+        qemu_iovec_reset(resubmit_qiov);
+    }
+    qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
+                      remaining);
+
+    /* Update sqe */
+    luringcb->sqeq.off += nread;
+    luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
+    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+
+    luring_resubmit(s, luringcb);
+}
+
+/*
+ * Complete a request.  Jump and continue completion for foreign requests,
+ * don't do anything for the current request, it will be completed shortly.
+ */
+static void luring_complete(LuringAIOCB *luringcb, int ret)
+{
+    luringcb->ret = ret;
+    qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    if (luringcb->co != qemu_coroutine_self()) {
+        qemu_coroutine_enter(luringcb->co);
+    }
+}
+
+/**
+ * luring_process_completions:
+ * @s: AIO state
+ *
+ * Fetches completed I/O requests, consumes cqes and invokes their callbacks.
+ * The function is somewhat tricky because it supports nested event loops,
+ * for example when a request callback invokes aio_poll().  The completion BH
+ * is scheduled so it can be called again in a nested event loop.  When there
+ * are no events left to complete the BH is being canceled.
+ */
+static void luring_process_completions(LuringState *s)
+{
+    struct io_uring_cqe *cqes;
+    int total_bytes;
+
+    /* Reschedule so nested event loops see currently pending completions */
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
+        LuringAIOCB *luringcb;
+        int ret;
+
+        if (!cqes) {
+            break;
+        }
+
+        luringcb = io_uring_cqe_get_data(cqes);
+        ret = cqes->res;
+        io_uring_cqe_seen(&s->ring, cqes);
+        cqes = NULL;
+
+        /* Change counters one-by-one because we can be nested. */
+        s->io_q.in_flight--;
+
+        /* A nop left in the ring by luring_fail_queued() */
+        if (!luringcb) {
+            continue;
+        }
+
+        /* total_read is non-zero only for resubmitted read requests */
+        total_bytes = ret + luringcb->total_read;
+
+        if (ret < 0) {
+            if (ret == -EINTR || ret == -EAGAIN) {
+                luring_resubmit(s, luringcb);
+                continue;
+            }
+        } else if (!luringcb->qiov) {
+            ret = 0;
+        } else if (total_bytes == luringcb->qiov->size) {
+            ret = 0;
+        } else if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_resubmit_short_read(s, luringcb, ret);
+                continue;
+            }
+            /* Short reads mean EOF, pad with zeros. */
+            qemu_iovec_memset(luringcb->qiov, luringcb->total_read, 0,
+                              luringcb->qiov->size - luringcb->total_read);
+            ret = 0;
+        } else {
+            ret = -ENOSPC;
+        }
+
+        luring_complete(luringcb, ret);
+    }
+
+    qemu_bh_cancel(s->completion_bh);
+}
+
+/*
+ * Fail every request that the kernel has not accepted.  Their sqes that
+ * are already in the ring cannot be taken back, so they become nops that
+ * the next successful io_uring_submit() flushes out.
+ */
+static void luring_fail_queued(LuringState *s, int ret)
+{
+    LuringAIOCB *luringcb;
+
+    while ((luringcb = QSIMPLEQ_FIRST(&s->io_q.ring_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.ring_queue, next);
+        io_uring_prep_nop(luringcb->sqe);
+        io_uring_sqe_set_data(luringcb->sqe, NULL);
+        s->io_q.ring_nops++;
+        luring_complete(luringcb, ret);
+    }
+    while ((luringcb = QSIMPLEQ_FIRST(&s->io_q.submit_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        s->io_q.in_queue--;
+        luring_complete(luringcb, ret);
+    }
+}
+
+/* The first @n sqes in the ring were accepted by the kernel */
+static void luring_ring_consumed(LuringState *s, int n)
+{
+    unsigned int nops = MIN(n, s->io_q.ring_nops);
+
+    s->io_q.ring_nops -= nops;
+    n -= nops;
+    while (n-- > 0) {
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.ring_queue, next);
+    }
+}
+
+static void ioq_submit(LuringState *s)
+{
+    int ret;
+    LuringAIOCB *luringcb, *luringcb_next;
+
+    while (s->io_q.in_queue > 0) {
+        /*
+         * Try to fetch sqes from the ring for requests waiting in
+         * the overflow queue
+         */
+        QSIMPLEQ_FOREACH_SAFE(luringcb, &s->io_q.submit_queue, next,
+                              luringcb_next) {
+            struct io_uring_sqe *sqes = io_uring_get_sqe(&s->ring);
+            if (!sqes) {
+                break;
+            }
+            /* Prep sqe for submission */
+            *sqes = luringcb->sqeq;
+            luringcb->sqe = sqes;
+            QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+            QSIMPLEQ_INSERT_TAIL(&s->io_q.ring_queue, luringcb, next);
+        }
+        ret = io_uring_submit(&s->ring);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret < 0 && ret != -EAGAIN && ret != -EBUSY) {
+            luring_fail_queued(s, ret);
+            break;
+        }
+        /*
+         * The kernel is short of resources or its completion queue is
+         * full.  The sqes stay queued and are retried when requests
+         * complete or, if none are in flight, from a bottom half.
+         */
+        if (ret <= 0) {
+            if (!s->io_q.in_flight) {
+                qemu_bh_schedule(s->retry_bh);
+            }
+            break;
+        }
+        s->io_q.in_flight += ret;
+        s->io_q.in_queue  -= ret;
+        luring_ring_consumed(s, ret);
+    }
+    s->io_q.blocked = (s->io_q.in_queue > 0);
+
+    if (s->io_q.in_flight) {
+        /* We can try to complete something just right away if there are
+         * still requests in-flight. */
+        luring_process_completions(s);
+    }
+}
+
+static void qemu_luring_retry_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    if (s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+}
+
+static void luring_process_completions_and_submit(LuringState *s)
+{
+    luring_process_completions(s);
+
+    if (!s->io_q.plugged && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+}
+
+static void qemu_luring_completion_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static void qemu_luring_completion_cb(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static bool qemu_luring_poll_cb(void *opaque)
+{
+    LuringState *s = opaque;
+    struct io_uring_cqe *cqes;
+
+    if (io_uring_peek_cqe(&s->ring, &cqes) != 0 || !cqes) {
+        return false;
+    }
+
+    luring_process_completions_and_submit(s);
+    return true;
+}
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->submit_queue);
+    QSIMPLEQ_INIT(&io_q->ring_queue);
+    io_q->ring_nops = 0;
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+}
+
+void luring_io_plug(BlockDriverState *bs, LuringState *s)
+{
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, LuringState *s)
+{
+    assert(s->io_q.plugged);
+    if (--s->io_q.plugged == 0 &&
+        !s->io_q.blocked && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+}
+
+/* Returns the fixed file index for @fd, registering it if possible, or -1 */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, free_slot = -1;
+
+    if (!s->fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            return i;
+        }
+        if (free_slot < 0 && s->fixed_fds[i] == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return -1;
+    }
+
+    if (io_uring_register_files_update(&s->ring, free_slot, &fd, 1) != 1) {
+        return -1;
+    }
+    s->fixed_fds[free_slot] = fd;
+    return free_slot;
+}
+
+/*
+ * Must be called before @fd is closed or used with another AioContext, so
+ * that the ring neither keeps the file open nor confuses it with a new file
+ * that reuses the descriptor number.
+ */
+void luring_unregister_fd(LuringState *s, int fd)
+{
+    int i, unused = -1;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_fds[i] == fd) {
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            s->fixed_fds[i] = -1;
+        }
+    }
+}
+
+/**
+ * luring_do_submit:
+ * @fd: file descriptor for I/O
+ * @luringcb: AIO control block
+ * @s: AIO state
+ * @offset: offset for request
+ * @type: type of request
+ *
+ * Fetches sqes from ring, adds to pending queue and preps them
+ */
+static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
+                            uint64_t offset, int type)
+{
+    int fixed = luring_fixed_file(s, fd);
+    struct io_uring_sqe *sqes = &luringcb->sqeq;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                             luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                            luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return -EIO;
+    }
+    if (fixed >= 0) {
+        sqes->fd = fixed;
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
+    io_uring_sqe_set_data(sqes, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged ||
+         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
+        ioq_submit(s);
+    }
+
+    return 0;
+}
+
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type)
+{
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+        .qiov       = qiov,
+        .is_read    = (type == QEMU_AIO_READ),
+    };
+
+    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+
+void luring_detach_aio_context(LuringState *s, AioContext *old_context)
+{
+    aio_set_fd_handler(old_context, s->ring.ring_fd, false,
+                       NULL, NULL, NULL, s);
+    qemu_bh_delete(s->completion_bh);
+    qemu_bh_delete(s->retry_bh);
+    s->aio_context = NULL;
+}
+
+void luring_attach_aio_context(LuringState *s, AioContext *new_context)
+{
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    s->retry_bh = aio_bh_new(new_context, qemu_luring_retry_bh, s);
+    aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
+                       qemu_luring_completion_cb, NULL,
+                       qemu_luring_poll_cb, s);
+}
+
+LuringState *luring_init(void)
+{
+    LuringState *s;
+    int i;
+
+    s = g_new0(LuringState, 1);
+    if (io_uring_queue_init(MAX_ENTRIES, &s->ring, 0) < 0) {
+        g_free(s);
+        return NULL;
+    }
+
+    ioq_init(&s->io_q);
+
+    /* Sparse file tables need Linux 5.5; run without fixed files before */
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
+    s->fixed_files = io_uring_register_files(&s->ring, s->fixed_fds,
+                                             MAX_FIXED_FILES) == 0;
+
+    return s;
+}
+
+void luring_cleanup(LuringState *s)
+{
+    io_uring_queue_exit(&s->ring);
+    g_free(s);
+}
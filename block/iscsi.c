@@ -360,7 +360,7 @@ iscsi_set_events(IscsiLun *iscsilun)
         aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsi),
                            false,
                            (ev & POLLIN) ? iscsi_process_read : NULL,
-                           (ev & POLLOUT) ? iscsi_process_write : NULL,
+                           (ev & POLLOUT) ? iscsi_process_write : NULL, NULL,
                            iscsilun);
         iscsilun->events = ev;
     }
@@ -1489,7 +1489,7 @@ static void iscsi_detach_aio_context(BlockDriverState *bs)
     IscsiLun *iscsilun = bs->opaque;
 
     aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsilun->iscsi),
-                       false, NULL, NULL, NULL);
+                       false, NULL, NULL, NULL, NULL);
     iscsilun->events = 0;
 
     if (iscsilun->nop_timer) {
@@ -0,0 +1,110 @@
+/*
+ * Adaptive request limits of the mirror block job
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "block/mirror-adapt.h"
+
+/* A latency per byte that grows to MIRROR_ADAPT_CONGESTION_FACTOR times the
+ * best one seen so far means requests are queueing up in the target. */
+#define MIRROR_ADAPT_CONGESTION_FACTOR 2
+
+void mirror_adapt_init(MirrorAdapt *a, int max_in_flight, int max_io_sectors,
+                       int io_sectors_min, int io_sectors_max, int64_t now)
+{
+    *a = (MirrorAdapt) {
+        .max_in_flight  = max_in_flight,
+        .max_io_sectors = max_io_sectors,
+        .io_sectors_min = io_sectors_min,
+        .io_sectors_max = MAX(io_sectors_max, io_sectors_min),
+        .start_ns       = now,
+    };
+}
+
+/* Grow the current knob, remembering the limits to undo the step */
+static void mirror_adapt_step(MirrorAdapt *a)
+{
+    a->stepped = true;
+    a->prev_in_flight = a->max_in_flight;
+    a->prev_io_sectors = a->max_io_sectors;
+
+    if (a->io_size) {
+        a->max_io_sectors = MIN(MAX(a->max_io_sectors * 2, a->io_sectors_min),
+                                a->io_sectors_max);
+    } else {
+        a->max_in_flight = MIN(a->max_in_flight + 2,
+                               MIRROR_ADAPT_MAX_IN_FLIGHT);
+    }
+}
+
+static void mirror_adapt_undo(MirrorAdapt *a)
+{
+    if (a->stepped) {
+        a->max_in_flight = a->prev_in_flight;
+        a->max_io_sectors = a->prev_io_sectors;
+        a->stepped = false;
+    }
+}
+
+/* Hill climbing on throughput, with a multiplicative decrease of the
+ * queue depth as soon as the target shows signs of congestion. */
+static void mirror_adapt(MirrorAdapt *a, int64_t elapsed)
+{
+    /* In bytes per second, scaled in two steps to avoid overflow */
+    uint64_t throughput = a->bytes * SCALE_MS / elapsed * 1000;
+    /* Per KiB, so that larger requests don't look like congestion */
+    uint64_t latency = a->latency_ns / MAX(a->bytes >> 10, 1);
+
+    if (!a->min_latency || latency < a->min_latency) {
+        a->min_latency = latency;
+    }
+
+    if (latency > MIRROR_ADAPT_CONGESTION_FACTOR * a->min_latency) {
+        a->max_in_flight = MAX(a->max_in_flight / 2, 1);
+        a->stepped = false;
+    } else if (throughput * 10 >= a->last_throughput * 11) {
+        /* At least 10% better, keep going */
+        mirror_adapt_step(a);
+    } else if (throughput * 10 <= a->last_throughput * 9) {
+        /* Worse, undo the last step and try the other knob next */
+        mirror_adapt_undo(a);
+        a->io_size = !a->io_size;
+    } else {
+        /* No change, probe the other knob */
+        a->io_size = !a->io_size;
+        mirror_adapt_step(a);
+    }
+    a->last_throughput = throughput;
+    a->last_latency = latency;
+}
+
+bool mirror_adapt_request_done(MirrorAdapt *a, uint64_t bytes,
+                               uint64_t latency_ns, int64_t now)
+{
+    int64_t elapsed = now - a->start_ns;
+    bool adapted = false;
+
+    a->bytes += bytes;
+    a->latency_ns += latency_ns;
+    a->ops++;
+
+    if (elapsed < MIRROR_ADAPT_INTERVAL || a->ops < MIRROR_ADAPT_MIN_OPS) {
+        return false;
+    }
+
+    if (a->saturated) {
+        mirror_adapt(a, elapsed);
+        adapted = true;
+    }
+
+    a->start_ns = now;
+    a->bytes = 0;
+    a->latency_ns = 0;
+    a->ops = 0;
+    a->saturated = false;
+    return adapted;
+}
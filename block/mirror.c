@@ -20,12 +20,13 @@
 #include "qapi/qmp/qerror.h"
 #include "qemu/ratelimit.h"
 #include "qemu/bitmap.h"
+#include "block/mirror-adapt.h"
 
 #define SLICE_TIME    100000000ULL /* ns */
-#define MAX_IN_FLIGHT 16
+#define DEFAULT_IN_FLIGHT 16
 #define MAX_IO_SECTORS ((1 << 20) >> BDRV_SECTOR_BITS) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE \
-    (MAX_IN_FLIGHT * MAX_IO_SECTORS * BDRV_SECTOR_SIZE)
+    (DEFAULT_IN_FLIGHT * MAX_IO_SECTORS * BDRV_SECTOR_SIZE)
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -66,9 +67,15 @@ typedef struct MirrorBlockJob {
     int64_t sectors_in_flight;
     int ret;
     bool unmap;
+    /* try bdrv_co_copy_range() before reading into the buffers */
+    bool copy_range;
     bool waiting_for_io;
     int target_cluster_sectors;
     int max_iov;
+
+    /* The request size and the number of requests in flight, tuned
+     * while the job runs */
+    MirrorAdapt adapt;
 } MirrorBlockJob;
 
 typedef struct MirrorOp {
@@ -76,6 +83,9 @@ typedef struct MirrorOp {
     QEMUIOVector qiov;
     int64_t sector_num;
     int nb_sectors;
+    bool is_discard;
+    /* When a copy was issued, 0 for writes of zeroes and discards */
+    int64_t start_ns;
 } MirrorOp;
 
 static BlockErrorAction mirror_error_action(MirrorBlockJob *s, bool read,
@@ -100,6 +110,20 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
 
     trace_mirror_iteration_done(s, op->sector_num, op->nb_sectors, ret);
 
+    if (ret >= 0 && op->start_ns) {
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        if (mirror_adapt_request_done(&s->adapt,
+                                      (uint64_t)op->nb_sectors *
+                                      BDRV_SECTOR_SIZE,
+                                      now - op->start_ns, now)) {
+            trace_mirror_adapt(s, s->adapt.last_throughput,
+                               s->adapt.last_latency,
+                               s->adapt.max_in_flight,
+                               s->adapt.max_io_sectors);
+        }
+    }
+
     s->in_flight--;
     s->sectors_in_flight -= op->nb_sectors;
     iov = op->qiov.iov;
@@ -128,9 +152,8 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
     }
 }
 
-static void mirror_write_complete(void *opaque, int ret)
+static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
 {
-    MirrorOp *op = opaque;
     MirrorBlockJob *s = op->s;
     if (ret < 0) {
         BlockErrorAction action;
@@ -144,9 +167,8 @@ static void mirror_write_complete(void *opaque, int ret)
     mirror_iteration_done(op, ret);
 }
 
-static void mirror_read_complete(void *opaque, int ret)
+static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
 {
-    MirrorOp *op = opaque;
     MirrorBlockJob *s = op->s;
     if (ret < 0) {
         BlockErrorAction action;
@@ -160,8 +182,59 @@ static void mirror_read_complete(void *opaque, int ret)
         mirror_iteration_done(op, ret);
         return;
     }
-    blk_aio_pwritev(s->target, op->sector_num * BDRV_SECTOR_SIZE, &op->qiov,
-                    0, mirror_write_complete, op);
+
+    ret = blk_co_pwritev(s->target, op->sector_num * BDRV_SECTOR_SIZE,
+                         op->qiov.size, &op->qiov, 0);
+    mirror_write_complete(op, ret);
+}
+
+static void coroutine_fn mirror_co_read(void *opaque)
+{
+    MirrorOp *op = opaque;
+    MirrorBlockJob *s = op->s;
+    int ret;
+
+    ret = blk_co_preadv(s->common.blk, op->sector_num * BDRV_SECTOR_SIZE,
+                        op->qiov.size, &op->qiov, 0);
+    mirror_read_complete(op, ret);
+}
+
+static void coroutine_fn mirror_co_zero_or_discard(void *opaque)
+{
+    MirrorOp *op = opaque;
+    MirrorBlockJob *s = op->s;
+    int ret;
+
+    if (op->is_discard) {
+        ret = blk_co_pdiscard(s->target, op->sector_num << BDRV_SECTOR_BITS,
+                              op->nb_sectors << BDRV_SECTOR_BITS);
+    } else {
+        ret = blk_co_pwrite_zeroes(s->target,
+                                   op->sector_num * BDRV_SECTOR_SIZE,
+                                   op->nb_sectors * BDRV_SECTOR_SIZE,
+                                   s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
+    }
+    mirror_write_complete(op, ret);
+}
+
+static void coroutine_fn mirror_co_copy_range(void *opaque)
+{
+    MirrorOp *op = opaque;
+    MirrorBlockJob *s = op->s;
+    int ret;
+
+    ret = blk_co_copy_range(s->common.blk, op->sector_num * BDRV_SECTOR_SIZE,
+                            s->target, op->sector_num * BDRV_SECTOR_SIZE,
+                            op->nb_sectors * BDRV_SECTOR_SIZE, 0);
+    if (ret < 0) {
+        /* Not an error for the job: the area is dirtied again and copied
+         * through the buffers, which also tells source and target errors
+         * apart */
+        trace_mirror_copy_range_fail(s, op->sector_num, op->nb_sectors, ret);
+        s->copy_range = false;
+        bdrv_set_dirty_bitmap(s->dirty_bitmap, op->sector_num, op->nb_sectors);
+    }
+    mirror_iteration_done(op, ret);
 }
 
 static inline void mirror_clip_sectors(MirrorBlockJob *s,
@@ -220,7 +293,7 @@ static inline void mirror_wait_for_io(MirrorBlockJob *s)
     s->waiting_for_io = false;
 }
 
-/* Submit async read while handling COW.
+/* Submit a copy coroutine while handling COW.
  * Returns: The number of sectors copied after and including sector_num,
  *          excluding any sectors copied prior to sector_num due to alignment.
  *          This will be nb_sectors if no alignment is necessary, or
@@ -230,7 +303,6 @@ static inline void mirror_wait_for_io(MirrorBlockJob *s)
 static int mirror_do_read(MirrorBlockJob *s, int64_t sector_num,
                           int nb_sectors)
 {
-    BlockBackend *source = s->common.blk;
     int sectors_per_chunk, nb_chunks;
     int ret;
     MirrorOp *op;
@@ -255,13 +327,32 @@ static int mirror_do_read(MirrorBlockJob *s, int64_t sector_num,
     assert(!(sector_num % sectors_per_chunk));
     nb_chunks = DIV_ROUND_UP(nb_sectors, sectors_per_chunk);
 
+    if (s->copy_range) {
+        Coroutine *co;
+
+        /* The qiov stays empty, the data never passes through QEMU */
+        op = g_new0(MirrorOp, 1);
+        op->s = s;
+        op->sector_num = sector_num;
+        op->nb_sectors = nb_sectors;
+        op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        s->in_flight++;
+        s->sectors_in_flight += nb_sectors;
+        trace_mirror_one_iteration(s, sector_num, nb_sectors);
+
+        co = qemu_coroutine_create(mirror_co_copy_range, op);
+        qemu_coroutine_enter(co);
+        return ret;
+    }
+
     while (s->buf_free_count < nb_chunks) {
         trace_mirror_yield_in_flight(s, sector_num, s->in_flight);
+        s->adapt.saturated = true;
         mirror_wait_for_io(s);
     }
 
-    /* Allocate a MirrorOp that is used as an AIO callback.  */
-    op = g_new(MirrorOp, 1);
+    op = g_new0(MirrorOp, 1);
     op->s = s;
     op->sector_num = sector_num;
     op->nb_sectors = nb_sectors;
@@ -284,8 +375,8 @@ static int mirror_do_read(MirrorBlockJob *s, int64_t sector_num,
     s->sectors_in_flight += nb_sectors;
     trace_mirror_one_iteration(s, sector_num, nb_sectors);
 
-    blk_aio_preadv(source, sector_num * BDRV_SECTOR_SIZE, &op->qiov, 0,
-                   mirror_read_complete, op);
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    qemu_coroutine_enter(qemu_coroutine_create(mirror_co_read, op));
     return ret;
 }
 
@@ -296,25 +387,16 @@ static void mirror_do_zero_or_discard(MirrorBlockJob *s,
 {
     MirrorOp *op;
 
-    /* Allocate a MirrorOp that is used as an AIO callback. The qiov is zeroed
-     * so the freeing in mirror_iteration_done is nop. */
+    /* The qiov is zeroed so the freeing in mirror_iteration_done is nop. */
     op = g_new0(MirrorOp, 1);
     op->s = s;
     op->sector_num = sector_num;
     op->nb_sectors = nb_sectors;
+    op->is_discard = is_discard;
 
     s->in_flight++;
     s->sectors_in_flight += nb_sectors;
-    if (is_discard) {
-        blk_aio_pdiscard(s->target, sector_num << BDRV_SECTOR_BITS,
-                         op->nb_sectors << BDRV_SECTOR_BITS,
-                         mirror_write_complete, op);
-    } else {
-        blk_aio_pwrite_zeroes(s->target, sector_num * BDRV_SECTOR_SIZE,
-                              op->nb_sectors * BDRV_SECTOR_SIZE,
-                              s->unmap ? BDRV_REQ_MAY_UNMAP : 0,
-                              mirror_write_complete, op);
-    }
+    qemu_coroutine_enter(qemu_coroutine_create(mirror_co_zero_or_discard, op));
 }
 
 static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
@@ -327,8 +409,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     int64_t end = s->bdev_length / BDRV_SECTOR_SIZE;
     int sectors_per_chunk = s->granularity >> BDRV_SECTOR_BITS;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_sectors = MAX((s->buf_size >> BDRV_SECTOR_BITS) / MAX_IN_FLIGHT,
-                             MAX_IO_SECTORS);
+    int max_io_sectors = s->adapt.max_io_sectors;
 
     sector_num = hbitmap_iter_next(&s->hbi);
     if (sector_num < 0) {
@@ -414,8 +495,9 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->adapt.max_in_flight) {
             trace_mirror_yield_in_flight(s, sector_num, s->in_flight);
+            s->adapt.saturated = true;
             mirror_wait_for_io(s);
         }
 
@@ -572,7 +654,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->adapt.max_in_flight) {
                 trace_mirror_yield(s, s->in_flight, s->buf_free_count, -1);
                 mirror_wait_for_io(s);
                 continue;
@@ -708,9 +790,12 @@ static void coroutine_fn mirror_run(void *opaque)
         delta = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->last_pause_ns;
         if (delta < SLICE_TIME &&
             s->common.iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
-                (cnt == 0 && s->in_flight > 0)) {
+            if (s->in_flight >= s->adapt.max_in_flight ||
+                s->buf_free_count == 0 || (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, s->in_flight, s->buf_free_count, cnt);
+                if (cnt != 0) {
+                    s->adapt.saturated = true;
+                }
                 mirror_wait_for_io(s);
                 continue;
             } else if (cnt != 0) {
@@ -953,6 +1038,13 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->copy_range = true;
+    mirror_adapt_init(&s->adapt, DEFAULT_IN_FLIGHT,
+                      MAX((s->buf_size >> BDRV_SECTOR_BITS) / DEFAULT_IN_FLIGHT,
+                          MAX_IO_SECTORS),
+                      granularity >> BDRV_SECTOR_BITS,
+                      s->buf_size >> BDRV_SECTOR_BITS,
+                      qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
     if (auto_complete) {
         s->should_complete = true;
     }
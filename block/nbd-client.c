@@ -27,12 +27,20 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/range.h"
 #include "nbd-client.h"
 
-#define HANDLE_TO_INDEX(bs, handle) ((handle) ^ ((uint64_t)(intptr_t)bs))
-#define INDEX_TO_HANDLE(bs, index)  ((index)  ^ ((uint64_t)(intptr_t)bs))
+#define HANDLE_TO_INDEX(s, handle) ((handle) ^ ((uint64_t)(intptr_t)(s)))
+#define INDEX_TO_HANDLE(s, index)  ((index)  ^ ((uint64_t)(intptr_t)(s)))
 
-static void nbd_recv_coroutines_enter_all(NbdClientSession *s)
+/* First extent of a NBD_CMD_BLOCK_STATUS reply */
+typedef struct NbdExtent {
+    uint32_t length;
+    uint32_t flags;
+} NbdExtent;
+
+static void nbd_recv_coroutines_enter_all(NbdConnection *s)
 {
     int i;
 
@@ -43,31 +51,34 @@ static void nbd_recv_coroutines_enter_all(NbdClientSession *s)
     }
 }
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_connection_detach_aio_context(NbdConnection *s)
 {
-    NbdClientSession *client = nbd_get_client_session(bs);
+    aio_set_fd_handler(bdrv_get_aio_context(s->bs), s->sioc->fd,
+                       false, NULL, NULL, NULL, NULL);
+}
 
-    if (!client->ioc) { /* Already closed */
+static void nbd_teardown_connection(NbdConnection *s)
+{
+    if (!s->ioc) { /* Already closed */
         return;
     }
 
     /* finish any pending coroutines */
-    qio_channel_shutdown(client->ioc,
+    qio_channel_shutdown(s->ioc,
                          QIO_CHANNEL_SHUTDOWN_BOTH,
                          NULL);
-    nbd_recv_coroutines_enter_all(client);
+    nbd_recv_coroutines_enter_all(s);
 
-    nbd_client_detach_aio_context(bs);
-    object_unref(OBJECT(client->sioc));
-    client->sioc = NULL;
-    object_unref(OBJECT(client->ioc));
-    client->ioc = NULL;
+    nbd_connection_detach_aio_context(s);
+    object_unref(OBJECT(s->sioc));
+    s->sioc = NULL;
+    object_unref(OBJECT(s->ioc));
+    s->ioc = NULL;
 }
 
 static void nbd_reply_ready(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    NbdClientSession *s = nbd_get_client_session(bs);
+    NbdConnection *s = opaque;
     uint64_t i;
     int ret;
 
@@ -104,21 +115,43 @@ static void nbd_reply_ready(void *opaque)
     }
 
 fail:
-    nbd_teardown_connection(bs);
+    nbd_teardown_connection(s);
 }
 
 static void nbd_restart_write(void *opaque)
 {
-    BlockDriverState *bs = opaque;
+    NbdConnection *s = opaque;
 
-    qemu_coroutine_enter(nbd_get_client_session(bs)->send_coroutine);
+    qemu_coroutine_enter(s->send_coroutine);
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+/* Pick the open connection with the fewest requests in flight, rotating
+ * among equally loaded ones.  Returns NULL if all connections are closed.
+ */
+static NbdConnection *nbd_client_pick_connection(NbdClientSession *client)
+{
+    NbdConnection *best = NULL;
+    int i, best_index = 0;
+
+    for (i = 0; i < client->nb_conns; i++) {
+        int index = (client->next_conn + i) % client->nb_conns;
+        NbdConnection *s = client->conns[index];
+
+        if (s->ioc && (!best || s->in_flight < best->in_flight)) {
+            best = s;
+            best_index = index;
+        }
+    }
+    if (best) {
+        client->next_conn = (best_index + 1) % client->nb_conns;
+    }
+    return best;
+}
+
+static int nbd_co_send_request(NbdConnection *s,
                                struct nbd_request *request,
                                QEMUIOVector *qiov)
 {
-    NbdClientSession *s = nbd_get_client_session(bs);
     AioContext *aio_context;
     int rc, ret, i;
 
@@ -141,10 +174,10 @@ static int nbd_co_send_request(BlockDriverState *bs,
     }
 
     s->send_coroutine = qemu_coroutine_self();
-    aio_context = bdrv_get_aio_context(bs);
+    aio_context = bdrv_get_aio_context(s->bs);
 
     aio_set_fd_handler(aio_context, s->sioc->fd, false,
-                       nbd_reply_ready, nbd_restart_write, bs);
+                       nbd_reply_ready, nbd_restart_write, NULL, s);
     if (qiov) {
         qio_channel_set_cork(s->ioc, true);
         rc = nbd_send_request(s->ioc, request);
@@ -160,41 +193,240 @@ static int nbd_co_send_request(BlockDriverState *bs,
         rc = nbd_send_request(s->ioc, request);
     }
     aio_set_fd_handler(aio_context, s->sioc->fd, false,
-                       nbd_reply_ready, NULL, bs);
+                       nbd_reply_ready, NULL, NULL, s);
     s->send_coroutine = NULL;
     qemu_co_mutex_unlock(&s->send_mutex);
     return rc;
 }
 
-static void nbd_co_receive_reply(NbdClientSession *s,
-                                 struct nbd_request *request,
-                                 struct nbd_reply *reply,
-                                 QEMUIOVector *qiov)
+static int nbd_co_read(NbdConnection *s, void *buf, size_t size)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+
+    return nbd_wr_syncv(s->ioc, &iov, 1, size, true) == size ? 0 : -EIO;
+}
+
+static int nbd_co_drop(NbdConnection *s, size_t size)
 {
+    uint8_t buf[4096];
+    int ret = 0;
+
+    while (size > 0 && ret == 0) {
+        size_t len = MIN(size, sizeof(buf));
+
+        ret = nbd_co_read(s, buf, len);
+        size -= len;
+    }
+    return ret;
+}
+
+/* Record in @covered, a list of Ranges, that a chunk answered @size bytes
+ * at @offset into the request.  Returns false if some of them were already
+ * answered by an earlier chunk.
+ */
+static bool nbd_reply_cover(GList **covered, uint64_t offset, uint32_t size)
+{
+    GList *l;
+    Range *r;
+
+    if (!size) {
+        return true;
+    }
+    for (l = *covered; l; l = l->next) {
+        r = l->data;
+        if (ranges_overlap(range_lob(r), range_upb(r) - range_lob(r) + 1,
+                           offset, size)) {
+            return false;
+        }
+    }
+    r = g_new0(Range, 1);
+    range_set_bounds(r, offset, offset + size - 1);
+    *covered = range_list_insert(*covered, r);
+    return true;
+}
+
+/* Whether the chunks recorded in @covered answered all @len bytes */
+static bool nbd_reply_covers_all(GList *covered, uint32_t len)
+{
+    Range *r;
+
+    if (!len) {
+        return true;
+    }
+    if (!covered || covered->next) {
+        return false;
+    }
+    r = covered->data;
+    return range_lob(r) == 0 && range_upb(r) == len - 1;
+}
+
+/* Consume the payload of one structured reply chunk.  Returns 0 if the
+ * chunk was valid, -errno if the chunk reports an error for the request, or
+ * -EPROTO if the stream cannot be trusted anymore.  The parts of a read
+ * that data and hole chunks answer are recorded in @covered; answering
+ * some bytes twice fails the request with -EIO.
+ */
+static int nbd_co_receive_chunk(NbdConnection *s,
+                                struct nbd_request *request,
+                                QEMUIOVector *qiov, NbdExtent *extent,
+                                GList **covered)
+{
+    NbdClientSession *client = nbd_get_client_session(s->bs);
+    uint32_t length = s->reply.length;
+    uint8_t buf[8 + 4];
+    uint64_t offset;
+    uint32_t size;
+    uint32_t error;
+    uint16_t msg_len;
     int ret;
 
-    /* Wait until we're woken up by the read handler.  TODO: perhaps
-     * peek at the next reply and avoid yielding if it's ours?  */
-    qemu_coroutine_yield();
-    *reply = s->reply;
-    if (reply->handle != request->handle ||
-        !s->ioc) {
-        reply->error = EIO;
-    } else {
-        if (qiov && reply->error == 0) {
-            ret = nbd_wr_syncv(s->ioc, qiov->iov, qiov->niov, request->len,
+    switch (s->reply.type) {
+    case NBD_REPLY_TYPE_NONE:
+        return length ? -EPROTO : 0;
+
+    case NBD_REPLY_TYPE_OFFSET_DATA:
+        if (!qiov || length <= 8 || nbd_co_read(s, buf, 8) < 0) {
+            return -EPROTO;
+        }
+        offset = ldq_be_p(buf);
+        size = length - 8;
+        if (offset < request->from || size > request->len ||
+            offset - request->from > request->len - size) {
+            return -EPROTO;
+        } else if (!nbd_reply_cover(covered, offset - request->from, size)) {
+            return nbd_co_drop(s, size) < 0 ? -EPROTO : -EIO;
+        } else {
+            QEMUIOVector sub_qiov;
+
+            qemu_iovec_init(&sub_qiov, qiov->niov);
+            qemu_iovec_concat(&sub_qiov, qiov, offset - request->from, size);
+            ret = nbd_wr_syncv(s->ioc, sub_qiov.iov, sub_qiov.niov, size,
                                true);
-            if (ret != request->len) {
-                reply->error = EIO;
+            qemu_iovec_destroy(&sub_qiov);
+            return ret == size ? 0 : -EPROTO;
+        }
+
+    case NBD_REPLY_TYPE_OFFSET_HOLE:
+        if (!qiov || length != 8 + 4 || nbd_co_read(s, buf, 8 + 4) < 0) {
+            return -EPROTO;
+        }
+        offset = ldq_be_p(buf);
+        size = ldl_be_p(buf + 8);
+        if (offset < request->from || size > request->len ||
+            offset - request->from > request->len - size) {
+            return -EPROTO;
+        }
+        if (!nbd_reply_cover(covered, offset - request->from, size)) {
+            return -EIO;
+        }
+        qemu_iovec_memset(qiov, offset - request->from, 0, size);
+        return 0;
+
+    case NBD_REPLY_TYPE_BLOCK_STATUS:
+        /* Only the first extent is used, REQ_ONE asks for no more */
+        if (!extent || length < 4 + 8 || (length - 4) % 8 ||
+            nbd_co_read(s, buf, 4 + 8) < 0 ||
+            ldl_be_p(buf) != client->info.meta_base_allocation_id) {
+            return -EPROTO;
+        }
+        extent->length = ldl_be_p(buf + 4);
+        extent->flags = ldl_be_p(buf + 8);
+        if (!extent->length) {
+            return -EPROTO;
+        }
+        return nbd_co_drop(s, length - 4 - 8) < 0 ? -EPROTO : 0;
+
+    default:
+        if (!NBD_REPLY_TYPE_IS_ERR(s->reply.type)) {
+            return -EPROTO;
+        }
+        /* Error chunk
+           [ 0 ..  3]    error
+           [ 4 ..  5]    message length
+           ...           message, then the offset for ERROR_OFFSET
+         */
+        if (length < 4 + 2 || nbd_co_read(s, buf, 4 + 2) < 0) {
+            return -EPROTO;
+        }
+        error = nbd_errno_to_system_errno(ldl_be_p(buf));
+        msg_len = lduw_be_p(buf + 4);
+        if (msg_len > length - 4 - 2 || !error) {
+            return -EPROTO;
+        }
+        if (nbd_co_drop(s, length - 4 - 2) < 0) {
+            return -EPROTO;
+        }
+        logout("server reported error %" PRIu32 " for handle %" PRIu64 "\n",
+               error, request->handle);
+        return -(int)error;
+    }
+}
+
+/* Wait for the reply to @request, storing read data in @qiov and the block
+ * status in @extent.  Returns 0 or -errno; a structured reply to a read
+ * must answer every byte of it exactly once.
+ */
+static int nbd_co_receive_reply(NbdConnection *s,
+                                struct nbd_request *request,
+                                QEMUIOVector *qiov, NbdExtent *extent)
+{
+    GList *covered = NULL;
+    bool done = false;
+    int error = 0;
+    int ret;
+
+    while (!done) {
+        /* Wait until we're woken up by the read handler.  TODO: perhaps
+         * peek at the next reply and avoid yielding if it's ours?  */
+        qemu_coroutine_yield();
+        if (s->reply.handle != request->handle ||
+            !s->ioc) {
+            error = -EIO;
+            goto out;
+        }
+
+        if (!s->reply.structured) {
+            ret = -s->reply.error;
+            if (qiov && ret == 0) {
+                ret = nbd_wr_syncv(s->ioc, qiov->iov, qiov->niov,
+                                   request->len, true);
+                ret = ret == request->len ? 0 : -EIO;
+            }
+            done = true;
+        } else {
+            ret = nbd_co_receive_chunk(s, request, qiov, extent, &covered);
+            if (ret == -EPROTO) {
+                /* The rest of the stream is garbage, make the read handler
+                 * fail and tear the connection down */
+                logout("invalid reply chunk type %" PRIu16 "\n",
+                       s->reply.type);
+                qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+                error = -EIO;
+                goto out;
+            }
+            done = s->reply.flags & NBD_REPLY_FLAG_DONE;
+            if (done && qiov && ret == 0 && !error &&
+                !nbd_reply_covers_all(covered, request->len)) {
+                /* Whatever was not answered would be stale memory */
+                logout("reply for handle %" PRIu64 " left parts of the "
+                       "read unanswered\n", request->handle);
+                ret = -EIO;
             }
         }
+        if (ret < 0 && !error) {
+            error = ret;
+        }
 
         /* Tell the read handler to read another header.  */
         s->reply.handle = 0;
     }
+
+out:
+    g_list_free_full(covered, g_free);
+    return error;
 }
 
-static void nbd_coroutine_start(NbdClientSession *s,
+static void nbd_coroutine_start(NbdConnection *s,
    struct nbd_request *request)
 {
     /* Poor man semaphore.  The free_sema is locked when no other request
@@ -208,7 +440,7 @@ static void nbd_coroutine_start(NbdClientSession *s,
     /* s->recv_coroutine[i] is set as soon as we get the send_lock.  */
 }
 
-static void nbd_coroutine_end(NbdClientSession *s,
+static void nbd_coroutine_end(NbdConnection *s,
     struct nbd_request *request)
 {
     int i = HANDLE_TO_INDEX(s, request->handle);
@@ -218,30 +450,39 @@ static void nbd_coroutine_end(NbdClientSession *s,
     }
 }
 
+static int nbd_co_request(BlockDriverState *bs, struct nbd_request *request,
+                          QEMUIOVector *write_qiov, QEMUIOVector *read_qiov,
+                          NbdExtent *extent)
+{
+    NbdConnection *s = nbd_client_pick_connection(nbd_get_client_session(bs));
+    int ret;
+
+    if (!s) {
+        return -EPIPE;
+    }
+
+    nbd_coroutine_start(s, request);
+    ret = nbd_co_send_request(s, request, write_qiov);
+    if (ret >= 0) {
+        ret = nbd_co_receive_reply(s, request, read_qiov, extent);
+    }
+    nbd_coroutine_end(s, request);
+    return ret;
+}
+
 int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
                          uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
-    NbdClientSession *client = nbd_get_client_session(bs);
     struct nbd_request request = {
         .type = NBD_CMD_READ,
         .from = offset,
         .len = bytes,
     };
-    struct nbd_reply reply;
-    ssize_t ret;
 
     assert(bytes <= NBD_MAX_BUFFER_SIZE);
     assert(!flags);
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, NULL);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, qiov);
-    }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    return nbd_co_request(bs, &request, NULL, qiov, NULL);
 }
 
 int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
@@ -253,50 +494,32 @@ int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
         .from = offset,
         .len = bytes,
     };
-    struct nbd_reply reply;
-    ssize_t ret;
 
     if (flags & BDRV_REQ_FUA) {
-        assert(client->nbdflags & NBD_FLAG_SEND_FUA);
+        assert(client->info.flags & NBD_FLAG_SEND_FUA);
         request.type |= NBD_CMD_FLAG_FUA;
     }
 
     assert(bytes <= NBD_MAX_BUFFER_SIZE);
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, qiov);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL);
-    }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    return nbd_co_request(bs, &request, qiov, NULL, NULL);
 }
 
 int nbd_client_co_flush(BlockDriverState *bs)
 {
     NbdClientSession *client = nbd_get_client_session(bs);
     struct nbd_request request = { .type = NBD_CMD_FLUSH };
-    struct nbd_reply reply;
-    ssize_t ret;
 
-    if (!(client->nbdflags & NBD_FLAG_SEND_FLUSH)) {
+    if (!(client->info.flags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
     }
 
     request.from = 0;
     request.len = 0;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, NULL);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL);
-    }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    /* With more than one connection, the server advertised that a flush
+     * covers the writes completed on all of them. */
+    return nbd_co_request(bs, &request, NULL, NULL, NULL);
 }
 
 int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int count)
@@ -307,37 +530,84 @@ int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int count)
         .from = offset,
         .len = count,
     };
-    struct nbd_reply reply;
-    ssize_t ret;
 
-    if (!(client->nbdflags & NBD_FLAG_SEND_TRIM)) {
+    if (!(client->info.flags & NBD_FLAG_SEND_TRIM)) {
         return 0;
     }
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(bs, &request, NULL);
+    return nbd_co_request(bs, &request, NULL, NULL, NULL);
+}
+
+int64_t coroutine_fn nbd_client_co_get_block_status(BlockDriverState *bs,
+                                                    int64_t sector_num,
+                                                    int nb_sectors, int *pnum,
+                                                    BlockDriverState **file)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+    struct nbd_request request = {
+        .type = NBD_CMD_BLOCK_STATUS | NBD_CMD_FLAG_REQ_ONE,
+        .from = sector_num << BDRV_SECTOR_BITS,
+        .len = MIN((uint64_t)nb_sectors << BDRV_SECTOR_BITS,
+                   QEMU_ALIGN_DOWN(UINT32_MAX, BDRV_SECTOR_SIZE)),
+    };
+    NbdExtent extent = { 0 };
+    int ret;
+
+    *file = bs;
+    *pnum = nb_sectors;
+    if (!client->info.base_allocation) {
+        return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID |
+               (sector_num << BDRV_SECTOR_BITS);
+    }
+
+    ret = nbd_co_request(bs, &request, NULL, NULL, &extent);
     if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL);
+        return ret;
+    }
+    if (!extent.length) {
+        /* A simple reply carries no status */
+        return -EIO;
+    }
+
+    /* Extents shorter than a sector can't be represented, assume data */
+    *pnum = MIN(extent.length >> BDRV_SECTOR_BITS, nb_sectors);
+    if (!*pnum) {
+        *pnum = 1;
+        return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID |
+               (sector_num << BDRV_SECTOR_BITS);
     }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
 
+    return (extent.flags & NBD_STATE_HOLE ? 0 : BDRV_BLOCK_DATA) |
+           (extent.flags & NBD_STATE_ZERO ? BDRV_BLOCK_ZERO : 0) |
+           BDRV_BLOCK_OFFSET_VALID | (sector_num << BDRV_SECTOR_BITS);
 }
 
 void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
-    aio_set_fd_handler(bdrv_get_aio_context(bs),
-                       nbd_get_client_session(bs)->sioc->fd,
-                       false, NULL, NULL, NULL);
+    NbdClientSession *client = nbd_get_client_session(bs);
+    int i;
+
+    for (i = 0; i < client->nb_conns; i++) {
+        if (client->conns[i]->sioc) {
+            nbd_connection_detach_aio_context(client->conns[i]);
+        }
+    }
 }
 
 void nbd_client_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
-    aio_set_fd_handler(new_context, nbd_get_client_session(bs)->sioc->fd,
-                       false, nbd_reply_ready, NULL, bs);
+    NbdClientSession *client = nbd_get_client_session(bs);
+    int i;
+
+    for (i = 0; i < client->nb_conns; i++) {
+        NbdConnection *s = client->conns[i];
+
+        if (s->sioc) {
+            aio_set_fd_handler(new_context, s->sioc->fd,
+                               false, nbd_reply_ready, NULL, NULL, s);
+        }
+    }
 }
 
 void nbd_client_close(BlockDriverState *bs)
@@ -348,59 +618,127 @@ void nbd_client_close(BlockDriverState *bs)
         .from = 0,
         .len = 0
     };
+    int i;
 
-    if (client->ioc == NULL) {
-        return;
-    }
-
-    nbd_send_request(client->ioc, &request);
+    for (i = 0; i < client->nb_conns; i++) {
+        NbdConnection *s = client->conns[i];
 
-    nbd_teardown_connection(bs);
+        if (s->ioc) {
+            nbd_send_request(s->ioc, &request);
+            nbd_teardown_connection(s);
+        }
+        g_free(s);
+    }
+    client->nb_conns = 0;
 }
 
-int nbd_client_init(BlockDriverState *bs,
-                    QIOChannelSocket *sioc,
-                    const char *export,
-                    QCryptoTLSCreds *tlscreds,
-                    const char *hostname,
-                    Error **errp)
+static int nbd_client_connect(BlockDriverState *bs,
+                              QIOChannelSocket *sioc,
+                              const char *export,
+                              QCryptoTLSCreds *tlscreds,
+                              const char *hostname,
+                              NBDExportInfo *info,
+                              Error **errp)
 {
     NbdClientSession *client = nbd_get_client_session(bs);
+    NbdConnection *s;
+    QIOChannel *ioc;
     int ret;
 
+    assert(client->nb_conns < MAX_NBD_CONNECTIONS);
+
     /* NBD handshake */
     logout("session init %s\n", export);
     qio_channel_set_blocking(QIO_CHANNEL(sioc), true, NULL);
 
+    info->structured_reply = true;
+    info->base_allocation = true;
     ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), export,
-                                &client->nbdflags,
                                 tlscreds, hostname,
-                                &client->ioc,
-                                &client->size, errp);
+                                &ioc, info, errp);
     if (ret < 0) {
         logout("Failed to negotiate with the NBD server\n");
         return ret;
     }
-    if (client->nbdflags & NBD_FLAG_SEND_FUA) {
-        bs->supported_write_flags = BDRV_REQ_FUA;
-    }
 
-    qemu_co_mutex_init(&client->send_mutex);
-    qemu_co_mutex_init(&client->free_sema);
-    client->sioc = sioc;
-    object_ref(OBJECT(client->sioc));
+    s = g_new0(NbdConnection, 1);
+    s->bs = bs;
+    qemu_co_mutex_init(&s->send_mutex);
+    qemu_co_mutex_init(&s->free_sema);
+    s->sioc = sioc;
+    object_ref(OBJECT(s->sioc));
 
-    if (!client->ioc) {
-        client->ioc = QIO_CHANNEL(sioc);
-        object_ref(OBJECT(client->ioc));
+    if (ioc) {
+        s->ioc = ioc;
+    } else {
+        s->ioc = QIO_CHANNEL(sioc);
+        object_ref(OBJECT(s->ioc));
     }
 
     /* Now that we're connected, set the socket to be non-blocking and
      * kick the reply mechanism.  */
     qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
 
-    nbd_client_attach_aio_context(bs, bdrv_get_aio_context(bs));
+    client->conns[client->nb_conns++] = s;
+    aio_set_fd_handler(bdrv_get_aio_context(bs), s->sioc->fd,
+                       false, nbd_reply_ready, NULL, NULL, s);
 
     logout("Established connection with NBD server\n");
     return 0;
 }
+
+int nbd_client_init(BlockDriverState *bs,
+                    QIOChannelSocket *sioc,
+                    const char *export,
+                    QCryptoTLSCreds *tlscreds,
+                    const char *hostname,
+                    Error **errp)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+    int ret;
+
+    ret = nbd_client_connect(bs, sioc, export, tlscreds, hostname,
+                             &client->info, errp);
+    if (ret < 0) {
+        return ret;
+    }
+    if (client->info.flags & NBD_FLAG_SEND_FUA) {
+        bs->supported_write_flags = BDRV_REQ_FUA;
+    }
+    return 0;
+}
+
+/* Open one more connection to the export, which must look the same as
+ * through the first one.  Only valid if the server advertised
+ * NBD_FLAG_CAN_MULTI_CONN.
+ */
+int nbd_client_add_connection(BlockDriverState *bs,
+                              QIOChannelSocket *sioc,
+                              const char *export,
+                              QCryptoTLSCreds *tlscreds,
+                              const char *hostname,
+                              Error **errp)
+{
+    NbdClientSession *client = nbd_get_client_session(bs);
+    NBDExportInfo info;
+    int ret;
+
+    assert(client->nb_conns > 0);
+    assert(client->info.flags & NBD_FLAG_CAN_MULTI_CONN);
+
+    ret = nbd_client_connect(bs, sioc, export, tlscreds, hostname,
+                             &info, errp);
+    if (ret < 0) {
+        return ret;
+    }
+    if (info.size != client->info.size || info.flags != client->info.flags ||
+        info.structured_reply != client->info.structured_reply ||
+        info.base_allocation != client->info.base_allocation ||
+        (info.base_allocation && info.meta_base_allocation_id !=
+                                 client->info.meta_base_allocation_id)) {
+        error_setg(errp, "NBD server changed the export between "
+                   "connections");
+        return -EINVAL;
+    }
+    return 0;
+}
@@ -16,12 +16,15 @@
 #endif
 
 #define MAX_NBD_REQUESTS    16
+#define MAX_NBD_CONNECTIONS 16
 
-typedef struct NbdClientSession {
+/* One socket to the server.  With multiple connections, each request is
+ * sent on the connection with the fewest requests in flight.
+ */
+typedef struct NbdConnection {
+    BlockDriverState *bs;
     QIOChannelSocket *sioc; /* The master data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
-    uint16_t nbdflags;
-    off_t size;
 
     CoMutex send_mutex;
     CoMutex free_sema;
@@ -30,6 +33,14 @@ typedef struct NbdClientSession {
 
     Coroutine *recv_coroutine[MAX_NBD_REQUESTS];
     struct nbd_reply reply;
+} NbdConnection;
+
+typedef struct NbdClientSession {
+    NBDExportInfo info;
+
+    NbdConnection *conns[MAX_NBD_CONNECTIONS];
+    int nb_conns;
+    int next_conn;
 
     bool is_unix;
 } NbdClientSession;
@@ -42,6 +53,12 @@ int nbd_client_init(BlockDriverState *bs,
                     QCryptoTLSCreds *tlscreds,
                     const char *hostname,
                     Error **errp);
+int nbd_client_add_connection(BlockDriverState *bs,
+                              QIOChannelSocket *sock,
+                              const char *export_name,
+                              QCryptoTLSCreds *tlscreds,
+                              const char *hostname,
+                              Error **errp);
 void nbd_client_close(BlockDriverState *bs);
 
 int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int count);
@@ -50,6 +67,10 @@ int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                           uint64_t bytes, QEMUIOVector *qiov, int flags);
 int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
                          uint64_t bytes, QEMUIOVector *qiov, int flags);
+int64_t coroutine_fn nbd_client_co_get_block_status(BlockDriverState *bs,
+                                                    int64_t sector_num,
+                                                    int nb_sectors, int *pnum,
+                                                    BlockDriverState **file);
 
 void nbd_client_detach_aio_context(BlockDriverState *bs);
 void nbd_client_attach_aio_context(BlockDriverState *bs,
@@ -45,6 +45,7 @@ typedef struct BDRVNBDState {
 
     /* For nbd_refresh_filename() */
     char *path, *host, *port, *export, *tlscredsid;
+    int connections;
 } BDRVNBDState;
 
 static int nbd_parse_uri(const char *filename, QDict *options)
@@ -322,6 +323,12 @@ static QemuOptsList nbd_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "ID of the TLS credentials to use",
         },
+        {
+            .name = "connections",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open if the server supports "
+                    "multiple connections (default: 1)",
+        },
     },
 };
 
@@ -335,7 +342,9 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     SocketAddress *saddr = NULL;
     QCryptoTLSCreds *tlscreds = NULL;
     const char *hostname = NULL;
+    uint64_t connections;
     int ret = -EINVAL;
+    int i;
 
     opts = qemu_opts_create(&nbd_runtime_opts, NULL, 0, &error_abort);
     qemu_opts_absorb_qdict(opts, options, &local_err);
@@ -364,6 +373,14 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         hostname = saddr->u.inet.data->host;
     }
 
+    connections = qemu_opt_get_number(opts, "connections", 1);
+    if (connections < 1 || connections > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "connections must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+    s->connections = connections;
+
     /* establish TCP connection, return error if it fails
      * TODO: Configurable retry-until-timeout behaviour.
      */
@@ -376,6 +393,30 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     /* NBD handshake */
     ret = nbd_client_init(bs, sioc, s->export,
                           tlscreds, hostname, errp);
+    if (ret < 0) {
+        goto error;
+    }
+
+    /* Further connections only help if the server keeps them coherent,
+     * otherwise stay with one */
+    if (!(s->client.info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        s->connections = 1;
+    }
+    for (i = 1; i < s->connections; i++) {
+        object_unref(OBJECT(sioc));
+        sioc = nbd_establish_connection(saddr, errp);
+        if (!sioc) {
+            ret = -ECONNREFUSED;
+        } else {
+            ret = nbd_client_add_connection(bs, sioc, s->export,
+                                            tlscreds, hostname, errp);
+        }
+        if (ret < 0) {
+            nbd_client_close(bs);
+            goto error;
+        }
+    }
+
  error:
     if (sioc) {
         object_unref(OBJECT(sioc));
@@ -423,7 +464,7 @@ static int64_t nbd_getlength(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
 
-    return s->client.size;
+    return s->client.info.size;
 }
 
 static void nbd_detach_aio_context(BlockDriverState *bs)
@@ -479,6 +520,10 @@ static void nbd_refresh_filename(BlockDriverState *bs, QDict *options)
         qdict_put_obj(opts, "tls-creds",
                       QOBJECT(qstring_from_str(s->tlscredsid)));
     }
+    if (s->connections > 1) {
+        qdict_put_obj(opts, "connections",
+                      QOBJECT(qint_from_int(s->connections)));
+    }
 
     bs->full_open_options = opts;
 }
@@ -494,6 +539,7 @@ static BlockDriver bdrv_nbd = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -512,6 +558,7 @@ static BlockDriver bdrv_nbd_tcp = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -530,6 +577,7 @@ static BlockDriver bdrv_nbd_unix = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/block_int.h"
 #include "qemu-common.h"
+#include "qemu/host-utils.h"
 #include "qcow2.h"
 #include "trace.h"
 
@@ -34,43 +35,153 @@ typedef struct Qcow2CachedTable {
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    /* Next entry in the same hash bucket, or -1 */
+    int      hash_next;
+    /* Neighbours in the LRU list while ref == 0, or -1 */
+    int      lru_prev;
+    int      lru_next;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
     struct Qcow2Cache      *depends;
     int                     size;
+    int                     table_size;
     bool                    depends_on_flush;
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Entries with a non-zero offset, hashed by offset */
+    int                    *buckets;
+    int                     bucket_bits;
+
+    /* Unreferenced entries, least recently used (or empty) first */
+    int                     lru_head;
+    int                     lru_tail;
 };
 
 static inline void *qcow2_cache_get_table_addr(BlockDriverState *bs,
                     Qcow2Cache *c, int table)
 {
-    BDRVQcow2State *s = bs->opaque;
-    return (uint8_t *) c->table_array + (size_t) table * s->cluster_size;
+    return (uint8_t *) c->table_array + (size_t) table * c->table_size;
 }
 
 static inline int qcow2_cache_get_table_idx(BlockDriverState *bs,
                   Qcow2Cache *c, void *table)
 {
-    BDRVQcow2State *s = bs->opaque;
     ptrdiff_t table_offset = (uint8_t *) table - (uint8_t *) c->table_array;
-    int idx = table_offset / s->cluster_size;
-    assert(idx >= 0 && idx < c->size && table_offset % s->cluster_size == 0);
+    int idx = table_offset / c->table_size;
+    assert(idx >= 0 && idx < c->size && table_offset % c->table_size == 0);
     return idx;
 }
 
+static inline int *qcow2_cache_bucket(Qcow2Cache *c, uint64_t offset)
+{
+    /* Offsets are multiples of table_size; mix the remaining bits */
+    uint64_t key = (offset / c->table_size) * 0x9e3779b97f4a7c15ULL;
+
+    return &c->buckets[key >> (64 - c->bucket_bits)];
+}
+
+static void qcow2_cache_hash_insert(Qcow2Cache *c, int i)
+{
+    int *bucket = qcow2_cache_bucket(c, c->entries[i].offset);
+
+    c->entries[i].hash_next = *bucket;
+    *bucket = i;
+}
+
+static void qcow2_cache_hash_remove(Qcow2Cache *c, int i)
+{
+    int *p = qcow2_cache_bucket(c, c->entries[i].offset);
+
+    while (*p != i) {
+        assert(*p != -1);
+        p = &c->entries[*p].hash_next;
+    }
+    *p = c->entries[i].hash_next;
+    c->entries[i].hash_next = -1;
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i = *qcow2_cache_bucket(c, offset);
+
+    while (i != -1 && c->entries[i].offset != offset) {
+        i = c->entries[i].hash_next;
+    }
+    return i;
+}
+
+static void qcow2_cache_lru_remove(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->lru_prev != -1) {
+        c->entries[t->lru_prev].lru_next = t->lru_next;
+    } else {
+        c->lru_head = t->lru_next;
+    }
+    if (t->lru_next != -1) {
+        c->entries[t->lru_next].lru_prev = t->lru_prev;
+    } else {
+        c->lru_tail = t->lru_prev;
+    }
+    t->lru_prev = t->lru_next = -1;
+}
+
+/* Add entry @i as the most recently used one, or as the first victim */
+static void qcow2_cache_lru_insert(Qcow2Cache *c, int i, bool victim)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (victim) {
+        t->lru_prev = -1;
+        t->lru_next = c->lru_head;
+        if (c->lru_head != -1) {
+            c->entries[c->lru_head].lru_prev = i;
+        } else {
+            c->lru_tail = i;
+        }
+        c->lru_head = i;
+    } else {
+        t->lru_next = -1;
+        t->lru_prev = c->lru_tail;
+        if (c->lru_tail != -1) {
+            c->entries[c->lru_tail].lru_next = i;
+        } else {
+            c->lru_head = i;
+        }
+        c->lru_tail = i;
+    }
+}
+
+/* Forget all cached tables; none may be in use */
+static void qcow2_cache_reset(Qcow2Cache *c)
+{
+    int i;
+
+    for (i = 0; i < (1 << c->bucket_bits); i++) {
+        c->buckets[i] = -1;
+    }
+    c->lru_head = c->lru_tail = -1;
+    for (i = 0; i < c->size; i++) {
+        assert(c->entries[i].ref == 0);
+        c->entries[i].offset = 0;
+        c->entries[i].lru_counter = 0;
+        c->entries[i].hash_next = -1;
+        qcow2_cache_lru_insert(c, i, false);
+    }
+}
+
 static void qcow2_cache_table_release(BlockDriverState *bs, Qcow2Cache *c,
                                       int i, int num_tables)
 {
 #if QEMU_MADV_DONTNEED != QEMU_MADV_INVALID
-    BDRVQcow2State *s = bs->opaque;
     void *t = qcow2_cache_get_table_addr(bs, c, i);
     int align = getpagesize();
-    size_t mem_size = (size_t) s->cluster_size * num_tables;
+    size_t mem_size = (size_t) c->table_size * num_tables;
     size_t offset = QEMU_ALIGN_UP((uintptr_t) t, align) - (uintptr_t) t;
     size_t length = QEMU_ALIGN_DOWN(mem_size - offset, align);
     if (length > 0) {
@@ -99,6 +210,9 @@ void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
+            qcow2_cache_hash_remove(c, i);
+            qcow2_cache_lru_remove(c, i);
+            qcow2_cache_lru_insert(c, i, true);
             c->entries[i].offset = 0;
             c->entries[i].lru_counter = 0;
             i++;
@@ -113,24 +227,40 @@ void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
     c->cache_clean_lru_counter = c->lru_counter;
 }
 
-Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables)
+/*
+ * Create a cache of @num_tables tables of @table_size bytes each.  The
+ * table size is a power of two no larger than a cluster, so that the L2
+ * cache can hold slices of L2 tables.
+ */
+Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
+                               int table_size)
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
 
+    assert(num_tables > 0);
+    assert(is_power_of_2(table_size));
+    assert(table_size >= 512 && table_size <= s->cluster_size);
+
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
+    c->table_size = table_size;
+    /* At least one bucket per entry, so that chains stay short */
+    c->bucket_bits = MIN(30, MAX(1, 64 - clz64(num_tables - 1)));
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->buckets = g_try_new(int, 1 << c->bucket_bits);
     c->table_array = qemu_try_blockalign(bs->file->bs,
-                                         (size_t) num_tables * s->cluster_size);
+                                         (size_t) num_tables * table_size);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->buckets || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
     }
 
+    qcow2_cache_reset(c);
     return c;
 }
 
@@ -143,6 +273,7 @@ int qcow2_cache_destroy(BlockDriverState *bs, Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -191,13 +322,13 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
 
     if (c == s->refcount_block_cache) {
         ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_REFCOUNT_BLOCK,
-                c->entries[i].offset, s->cluster_size);
+                c->entries[i].offset, c->table_size);
     } else if (c == s->l2_table_cache) {
         ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2,
-                c->entries[i].offset, s->cluster_size);
+                c->entries[i].offset, c->table_size);
     } else {
         ret = qcow2_pre_write_overlap_check(bs, 0,
-                c->entries[i].offset, s->cluster_size);
+                c->entries[i].offset, c->table_size);
     }
 
     if (ret < 0) {
@@ -211,7 +342,7 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     }
 
     ret = bdrv_pwrite(bs->file, c->entries[i].offset,
-                      qcow2_cache_get_table_addr(bs, c, i), s->cluster_size);
+                      qcow2_cache_get_table_addr(bs, c, i), c->table_size);
     if (ret < 0) {
         return ret;
     }
@@ -284,19 +415,14 @@ void qcow2_cache_depends_on_flush(Qcow2Cache *c)
 
 int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 {
-    int ret, i;
+    int ret;
 
     ret = qcow2_cache_flush(bs, c);
     if (ret < 0) {
         return ret;
     }
 
-    for (i = 0; i < c->size; i++) {
-        assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
-    }
-
+    qcow2_cache_reset(c);
     qcow2_cache_table_release(bs, c, 0, c->size);
 
     c->lru_counter = 0;
@@ -310,37 +436,26 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     trace_qcow2_cache_get(qemu_coroutine_self(), c == s->l2_table_cache,
                           offset, read_from_disk);
 
+    assert(offset != 0 && offset % c->table_size == 0);
+
     /* Check if the table is already cached */
-    i = lookup_index = (offset / s->cluster_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_lookup(c, offset);
+    if (i != -1) {
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    if (c->lru_head == -1) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    i = c->lru_head;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -351,7 +466,10 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    if (c->entries[i].offset) {
+        qcow2_cache_hash_remove(c, i);
+        c->entries[i].offset = 0;
+    }
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -359,17 +477,20 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
         ret = bdrv_pread(bs->file, offset,
                          qcow2_cache_get_table_addr(bs, c, i),
-                         s->cluster_size);
+                         c->table_size);
         if (ret < 0) {
             return ret;
         }
     }
 
     c->entries[i].offset = offset;
+    qcow2_cache_hash_insert(c, i);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    if (c->entries[i].ref++ == 0) {
+        qcow2_cache_lru_remove(c, i);
+    }
     *table = qcow2_cache_get_table_addr(bs, c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -399,6 +520,7 @@ void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        qcow2_cache_lru_insert(c, i, false);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -411,3 +533,26 @@ void qcow2_cache_entry_mark_dirty(BlockDriverState *bs, Qcow2Cache *c,
     assert(c->entries[i].offset != 0);
     c->entries[i].dirty = true;
 }
+
+/*
+ * Drop the table at @offset from the cache without writing it back, if it
+ * is cached.  The table must not be in use.
+ */
+void qcow2_cache_discard(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset)
+{
+    int i = qcow2_cache_lookup(c, offset);
+
+    if (i == -1) {
+        return;
+    }
+
+    assert(c->entries[i].ref == 0);
+    qcow2_cache_hash_remove(c, i);
+    qcow2_cache_lru_remove(c, i);
+    qcow2_cache_lru_insert(c, i, true);
+    c->entries[i].offset = 0;
+    c->entries[i].lru_counter = 0;
+    c->entries[i].dirty = false;
+
+    qcow2_cache_table_release(bs, c, i, 1);
+}
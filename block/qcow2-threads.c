@@ -0,0 +1,248 @@
+/*
+ * Threaded data processing for qcow2: cluster compression
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+#include "qemu-common.h"
+#include "block/block_int.h"
+#include "block/thread-pool.h"
+#include "qcow2.h"
+
+/* Upper bound for compression jobs in flight per image */
+#define QCOW2_MAX_COMPRESS_THREADS 16
+
+#ifndef ZSTD_CLEVEL_DEFAULT
+#define ZSTD_CLEVEL_DEFAULT 3
+#endif
+
+typedef ssize_t Qcow2CompressFunc(void *dest, size_t dest_size,
+                                  const void *src, size_t src_size);
+
+typedef struct Qcow2CompressData {
+    void *dest;
+    size_t dest_size;
+    const void *src;
+    size_t src_size;
+    ssize_t ret;
+    Qcow2CompressFunc *func;
+} Qcow2CompressData;
+
+/*
+ * The compress functions return the compressed size, or -ENOMEM if the
+ * result does not fit in @dest_size bytes (the caller then stores the
+ * cluster uncompressed) and -EIO on other errors.
+ *
+ * The decompress functions return 0 if exactly @dest_size bytes were
+ * produced and -EIO otherwise.  @src may extend past the end of the
+ * compressed data, because its size is only known to sector granularity.
+ */
+
+static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
+                                   const void *src, size_t src_size)
+{
+    z_stream strm;
+    ssize_t ret;
+
+    /* best compression, small window, no zlib header */
+    memset(&strm, 0, sizeof(strm));
+    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -12,
+                       9, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        return -EIO;
+    }
+
+    strm.avail_in = src_size;
+    strm.next_in = (uint8_t *)src;
+    strm.avail_out = dest_size;
+    strm.next_out = dest;
+
+    ret = deflate(&strm, Z_FINISH);
+    if (ret == Z_STREAM_END) {
+        ret = dest_size - strm.avail_out;
+    } else {
+        ret = (ret == Z_OK ? -ENOMEM : -EIO);
+    }
+
+    deflateEnd(&strm);
+    return ret;
+}
+
+static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
+                                     const void *src, size_t src_size)
+{
+    z_stream strm;
+    int ret;
+
+    memset(&strm, 0, sizeof(strm));
+    strm.next_in = (uint8_t *)src;
+    strm.avail_in = src_size;
+    strm.next_out = dest;
+    strm.avail_out = dest_size;
+
+    ret = inflateInit2(&strm, -12);
+    if (ret != Z_OK) {
+        return -EIO;
+    }
+
+    ret = inflate(&strm, Z_FINISH);
+    if ((ret == Z_STREAM_END || ret == Z_BUF_ERROR) && strm.avail_out == 0) {
+        ret = 0;
+    } else {
+        ret = -EIO;
+    }
+
+    inflateEnd(&strm);
+    return ret;
+}
+
+#ifdef CONFIG_ZSTD
+static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
+                                   const void *src, size_t src_size)
+{
+    size_t ret = ZSTD_compress(dest, dest_size, src, src_size,
+                               ZSTD_CLEVEL_DEFAULT);
+
+    /* Most likely @dest is too small; either way, store it uncompressed */
+    return ZSTD_isError(ret) ? -ENOMEM : ret;
+}
+
+static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
+                                     const void *src, size_t src_size)
+{
+    ZSTD_outBuffer output = { dest, dest_size, 0 };
+    ZSTD_inBuffer input = { src, src_size, 0 };
+    ZSTD_DCtx *dctx;
+    size_t zstd_ret = 0;
+    ssize_t ret = 0;
+
+    dctx = ZSTD_createDCtx();
+    if (!dctx) {
+        return -EIO;
+    }
+
+    /* Stream, because ZSTD_decompress() rejects trailing bytes in @src */
+    while (output.pos < output.size) {
+        size_t last_in_pos = input.pos;
+        size_t last_out_pos = output.pos;
+
+        zstd_ret = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(zstd_ret) ||
+            (input.pos == last_in_pos && output.pos == last_out_pos)) {
+            ret = -EIO;
+            break;
+        }
+    }
+
+    /* The frame must end exactly at the end of the cluster */
+    if (ret == 0 && zstd_ret != 0) {
+        ret = -EIO;
+    }
+
+    ZSTD_freeDCtx(dctx);
+    return ret;
+}
+#endif
+
+static Qcow2CompressFunc *qcow2_compress_func(BDRVQcow2State *s)
+{
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return qcow2_zlib_compress;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return qcow2_zstd_compress;
+#endif
+    default:
+        /* qcow2_open() refuses compression types this build can't handle */
+        abort();
+    }
+}
+
+/* Called from qcow2_open() */
+void qcow2_init_compress_threads(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    long cpus = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    s->nb_compress_threads = 0;
+    s->max_compress_threads = MIN(MAX(cpus, 1), QCOW2_MAX_COMPRESS_THREADS);
+    qemu_co_queue_init(&s->compress_wait_queue);
+}
+
+static int qcow2_compress_pool_func(void *opaque)
+{
+    Qcow2CompressData *data = opaque;
+
+    data->ret = data->func(data->dest, data->dest_size,
+                           data->src, data->src_size);
+    return 0;
+}
+
+/*
+ * qcow2_co_compress: compress @src_size bytes at @src into @dest using
+ * the image's compression type, in a worker thread
+ *
+ * Up to s->max_compress_threads calls run at the same time; further
+ * callers wait for a slot.
+ *
+ * Returns: as for the compress functions above.
+ */
+ssize_t coroutine_fn qcow2_co_compress(BlockDriverState *bs,
+                                       void *dest, size_t dest_size,
+                                       const void *src, size_t src_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    Qcow2CompressData arg = {
+        .dest       = dest,
+        .dest_size  = dest_size,
+        .src        = src,
+        .src_size   = src_size,
+        .func       = qcow2_compress_func(s),
+    };
+
+    while (s->nb_compress_threads >= s->max_compress_threads) {
+        qemu_co_queue_wait(&s->compress_wait_queue);
+    }
+
+    s->nb_compress_threads++;
+    thread_pool_submit_co(pool, qcow2_compress_pool_func, &arg);
+    s->nb_compress_threads--;
+
+    qemu_co_queue_next(&s->compress_wait_queue);
+
+    return arg.ret;
+}
+
+/*
+ * qcow2_decompress: decompress one cluster's worth of data
+ *
+ * This runs in the calling thread: readers already serialize on the
+ * single-cluster decompression cache.
+ */
+ssize_t qcow2_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
+                         const void *src, size_t src_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return qcow2_zlib_decompress(dest, dest_size, src, src_size);
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return qcow2_zstd_decompress(dest, dest_size, src, src_size);
+#endif
+    default:
+        abort();
+    }
+}
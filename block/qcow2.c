@@ -25,7 +25,6 @@
 #include "block/block_int.h"
 #include "sysemu/block-backend.h"
 #include "qemu/module.h"
-#include <zlib.h>
 #include "block/qcow2.h"
 #include "qemu/error-report.h"
 #include "qapi/qmp/qerror.h"
@@ -63,6 +62,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_END 0
 #define  QCOW2_EXT_MAGIC_BACKING_FORMAT 0xE2792ACA
 #define  QCOW2_EXT_MAGIC_FEATURE_TABLE 0x6803f857
+#define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -162,6 +162,83 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             break;
 
+        case QCOW2_EXT_MAGIC_BITMAPS:
+        {
+            Qcow2BitmapHeaderExt bitmaps_ext;
+
+            if (ext.len != sizeof(bitmaps_ext)) {
+                error_setg(errp, "ERROR: bitmaps_ext: Invalid extension "
+                           "length");
+                return -EINVAL;
+            }
+
+            if (!(s->autoclear_features & QCOW2_AUTOCLEAR_BITMAPS)) {
+                /* A program without bitmap support wrote to the image and
+                 * dropped the autoclear bit, so the bitmaps are stale.  The
+                 * extension is not written back, which removes them. */
+                error_report("WARNING: a program lacking bitmap support "
+                             "modified this file, so all bitmaps are now "
+                             "considered inconsistent. Some clusters may be "
+                             "leaked, run 'qemu-img check -r' on the image "
+                             "file to fix.");
+                break;
+            }
+
+            ret = bdrv_pread(bs->file, offset, &bitmaps_ext, ext.len);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "ERROR: bitmaps_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            if (bitmaps_ext.reserved32 != 0) {
+                error_setg(errp, "ERROR: bitmaps_ext: "
+                           "Reserved field is not zero");
+                return -EINVAL;
+            }
+
+            be32_to_cpus(&bitmaps_ext.nb_bitmaps);
+            be64_to_cpus(&bitmaps_ext.bitmap_directory_size);
+            be64_to_cpus(&bitmaps_ext.bitmap_directory_offset);
+
+            if (bitmaps_ext.nb_bitmaps > QCOW2_MAX_BITMAPS) {
+                error_setg(errp, "ERROR: bitmaps_ext: "
+                           "Image has %" PRIu32 " bitmaps, "
+                           "exceeding the QEMU supported maximum of %d",
+                           bitmaps_ext.nb_bitmaps, QCOW2_MAX_BITMAPS);
+                return -EINVAL;
+            }
+
+            if (bitmaps_ext.nb_bitmaps == 0) {
+                error_setg(errp, "ERROR: bitmaps_ext: "
+                           "found bitmaps extension with zero bitmaps");
+                return -EINVAL;
+            }
+
+            if (bitmaps_ext.bitmap_directory_offset & (s->cluster_size - 1)) {
+                error_setg(errp, "ERROR: bitmaps_ext: "
+                           "invalid bitmap directory offset");
+                return -EINVAL;
+            }
+
+            if (bitmaps_ext.bitmap_directory_size >
+                QCOW2_MAX_BITMAP_DIRECTORY_SIZE) {
+                error_setg(errp, "ERROR: bitmaps_ext: "
+                           "bitmap directory size (%" PRIu64 ") exceeds "
+                           "the maximum supported size (%d)",
+                           bitmaps_ext.bitmap_directory_size,
+                           QCOW2_MAX_BITMAP_DIRECTORY_SIZE);
+                return -EINVAL;
+            }
+
+            s->nb_bitmaps = bitmaps_ext.nb_bitmaps;
+            s->bitmap_directory_offset =
+                    bitmaps_ext.bitmap_directory_offset;
+            s->bitmap_directory_size =
+                    bitmaps_ext.bitmap_directory_size;
+            break;
+        }
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             {
@@ -451,6 +528,11 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_SIZE,
             .help = "Maximum L2 table cache size",
         },
+        {
+            .name = QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of each entry in the L2 cache",
+        },
         {
             .name = QCOW2_OPT_REFCOUNT_CACHE_SIZE,
             .type = QEMU_OPT_SIZE,
@@ -521,6 +603,7 @@ static void qcow2_attach_aio_context(BlockDriverState *bs,
 
 static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                              uint64_t *l2_cache_size,
+                             uint64_t *l2_cache_entry_size,
                              uint64_t *refcount_cache_size, Error **errp)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -536,6 +619,17 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     *refcount_cache_size = qemu_opt_get_size(opts,
                                              QCOW2_OPT_REFCOUNT_CACHE_SIZE, 0);
 
+    *l2_cache_entry_size = qemu_opt_get_size(
+        opts, QCOW2_OPT_L2_CACHE_ENTRY_SIZE, s->cluster_size);
+    if (*l2_cache_entry_size < (1 << MIN_CLUSTER_BITS) ||
+        *l2_cache_entry_size > s->cluster_size ||
+        !is_power_of_2(*l2_cache_entry_size)) {
+        error_setg(errp, QCOW2_OPT_L2_CACHE_ENTRY_SIZE " must be a power of "
+                   "two between %d and the cluster size (%d)",
+                   1 << MIN_CLUSTER_BITS, s->cluster_size);
+        return;
+    }
+
     if (combined_cache_size_set) {
         if (l2_cache_size_set && refcount_cache_size_set) {
             error_setg(errp, QCOW2_OPT_CACHE_SIZE ", " QCOW2_OPT_L2_CACHE_SIZE
@@ -581,6 +675,7 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
 typedef struct Qcow2ReopenState {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
+    int l2_slice_size; /* Number of entries in a slice of the L2 table */
     bool use_lazy_refcounts;
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
@@ -596,7 +691,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     QemuOpts *opts = NULL;
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
-    uint64_t l2_cache_size, refcount_cache_size;
+    uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
     int i;
     Error *local_err = NULL;
     int ret;
@@ -610,15 +705,15 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     }
 
     /* get L2 table/refcount block cache size from command line options */
-    read_cache_sizes(bs, opts, &l2_cache_size, &refcount_cache_size,
-                     &local_err);
+    read_cache_sizes(bs, opts, &l2_cache_size, &l2_cache_entry_size,
+                     &refcount_cache_size, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         ret = -EINVAL;
         goto fail;
     }
 
-    l2_cache_size /= s->cluster_size;
+    l2_cache_size /= l2_cache_entry_size;
     if (l2_cache_size < MIN_L2_CACHE_SIZE) {
         l2_cache_size = MIN_L2_CACHE_SIZE;
     }
@@ -656,8 +751,11 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         }
     }
 
-    r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size);
-    r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size);
+    r->l2_slice_size = l2_cache_entry_size / l2_entry_size(s);
+    r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size,
+                                           l2_cache_entry_size);
+    r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size,
+                                                 s->cluster_size);
     if (r->l2_table_cache == NULL || r->refcount_block_cache == NULL) {
         error_setg(errp, "Could not allocate metadata caches");
         ret = -ENOMEM;
@@ -764,6 +862,7 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
     s->l2_table_cache = r->l2_table_cache;
     s->refcount_block_cache = r->refcount_block_cache;
+    s->l2_slice_size = r->l2_slice_size;
 
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
@@ -816,6 +915,7 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
     Error *local_err = NULL;
     uint64_t ext_end;
     uint64_t l1_vm_state_index;
+    bool update_header;
 
     ret = bdrv_pread(bs->file, 0, &header, sizeof(header));
     if (ret < 0) {
@@ -889,6 +989,14 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    /* The compression type is only stored if it isn't zlib (or if there are
+     * unknown fields after it) */
+    if (header.header_length > offsetof(QCowHeader, compression_type)) {
+        s->compression_type = header.compression_type;
+    } else {
+        s->compression_type = QCOW2_COMPRESSION_TYPE_ZLIB;
+    }
+
     if (header.header_length > sizeof(header)) {
         s->unknown_header_fields_size = header.header_length - sizeof(header);
         s->unknown_header_fields = g_malloc(s->unknown_header_fields_size);
@@ -930,6 +1038,35 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    if (!!(s->incompatible_features & QCOW2_INCOMPAT_COMPRESSION) !=
+        (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB)) {
+        error_setg(errp, "qcow2: Compression type bit and compression type "
+                   "field are inconsistent");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (s->compression_type >= QCOW2_COMPRESSION_TYPE__MAX) {
+        error_setg(errp, "qcow2: Unknown compression type %d",
+                   s->compression_type);
+        ret = -ENOTSUP;
+        goto fail;
+    }
+#ifndef CONFIG_ZSTD
+    if (s->compression_type == QCOW2_COMPRESSION_TYPE_ZSTD) {
+        error_setg(errp, "qcow2: zstd compression is not supported by this "
+                   "build");
+        ret = -ENOTSUP;
+        goto fail;
+    }
+#endif
+
+    if (has_subclusters(s) && s->cluster_bits < MIN_EXTL2_CLUSTER_BITS) {
+        error_setg(errp, "qcow2: Extended L2 entries require a cluster size "
+                   "of at least %d bytes", 1 << MIN_EXTL2_CLUSTER_BITS);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     if (s->incompatible_features & QCOW2_INCOMPAT_CORRUPT) {
         /* Corrupt images may not be written to unless they are being repaired
          */
@@ -983,8 +1120,13 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
         bs->encrypted = true;
     }
 
-    s->l2_bits = s->cluster_bits - 3; /* L2 is always one cluster */
+    /* L2 is always one cluster */
+    s->l2_bits = s->cluster_bits - ctz32(l2_entry_size(s));
     s->l2_size = 1 << s->l2_bits;
+    s->subclusters_per_cluster =
+        has_subclusters(s) ? QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER : 1;
+    s->subcluster_size = s->cluster_size / s->subclusters_per_cluster;
+    s->subcluster_bits = ctz32(s->subcluster_size);
     /* 2^(s->refcount_order - 3) is the refcount width in bytes */
     s->refcount_block_bits = s->cluster_bits - (s->refcount_order - 3);
     s->refcount_block_size = 1 << s->refcount_block_bits;
@@ -1142,9 +1284,15 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    /* Clear unknown autoclear feature bits */
-    if (!bs->read_only && !(flags & BDRV_O_INACTIVE) && s->autoclear_features) {
-        s->autoclear_features = 0;
+    /* Clear unknown autoclear feature bits, and the bitmaps bit if the
+     * extension is missing */
+    update_header = (s->autoclear_features & ~QCOW2_AUTOCLEAR_MASK) ||
+        (!s->nb_bitmaps && (s->autoclear_features & QCOW2_AUTOCLEAR_BITMAPS));
+    if (!bs->read_only && !(flags & BDRV_O_INACTIVE) && update_header) {
+        s->autoclear_features &= QCOW2_AUTOCLEAR_MASK;
+        if (!s->nb_bitmaps) {
+            s->autoclear_features &= ~(uint64_t)QCOW2_AUTOCLEAR_BITMAPS;
+        }
         ret = qcow2_update_header(bs);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Could not update qcow2 header");
@@ -1154,6 +1302,7 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* Initialise locks */
     qemu_co_mutex_init(&s->lock);
+    qcow2_init_compress_threads(bs);
 
     /* Repair image if dirty */
     if (!(flags & (BDRV_O_CHECK | BDRV_O_INACTIVE)) && !bs->read_only &&
@@ -1167,6 +1316,15 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    /* Persistent bitmaps are loaded when the image becomes active */
+    if (!(flags & BDRV_O_INACTIVE)) {
+        ret = qcow2_load_autoloading_dirty_bitmaps(bs, &local_err);
+        if (ret < 0) {
+            error_propagate(errp, local_err);
+            goto fail;
+        }
+    }
+
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
@@ -1203,7 +1361,7 @@ static void qcow2_refresh_limits(BlockDriverState *bs, Error **errp)
         /* Encryption works on a sector granularity */
         bs->bl.request_alignment = BDRV_SECTOR_SIZE;
     }
-    bs->bl.pwrite_zeroes_alignment = s->cluster_size;
+    bs->bl.pwrite_zeroes_alignment = s->subcluster_size;
 }
 
 static int qcow2_set_key(BlockDriverState *bs, const char *key)
@@ -1258,6 +1416,15 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
 
     /* We need to write out any unwritten data if we reopen read-only. */
     if ((state->flags & BDRV_O_RDWR) == 0) {
+        Error *local_err = NULL;
+
+        qcow2_store_persistent_dirty_bitmaps(state->bs, &local_err);
+        if (local_err != NULL) {
+            error_propagate(errp, local_err);
+            ret = -EINVAL;
+            goto fail;
+        }
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -1551,6 +1718,43 @@ fail:
     return ret;
 }
 
+/*
+ * Complete the allocations in @l2meta: with @link_l2, link the new clusters
+ * into the L2 tables (performing any COW); otherwise just drop them, as on
+ * the error path.  Either way, requests waiting on them are restarted.
+ */
+static int qcow2_handle_l2meta(BlockDriverState *bs, QCowL2Meta **pl2meta,
+                               bool link_l2)
+{
+    int ret = 0;
+    QCowL2Meta *l2meta = *pl2meta;
+
+    while (l2meta != NULL) {
+        QCowL2Meta *next;
+
+        if (link_l2) {
+            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
+        /* Take the request off the list of running requests */
+        if (l2meta->nb_clusters != 0) {
+            QLIST_REMOVE(l2meta, next_in_flight);
+        }
+
+        qemu_co_queue_restart_all(&l2meta->dependent_requests);
+
+        next = l2meta->next;
+        g_free(l2meta);
+        l2meta = next;
+    }
+out:
+    *pl2meta = l2meta;
+    return ret;
+}
+
 static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                          uint64_t bytes, QEMUIOVector *qiov,
                                          int flags)
@@ -1645,24 +1849,9 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             goto fail;
         }
 
-        while (l2meta != NULL) {
-            QCowL2Meta *next;
-
-            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
-            if (ret < 0) {
-                goto fail;
-            }
-
-            /* Take the request off the list of running requests */
-            if (l2meta->nb_clusters != 0) {
-                QLIST_REMOVE(l2meta, next_in_flight);
-            }
-
-            qemu_co_queue_restart_all(&l2meta->dependent_requests);
-
-            next = l2meta->next;
-            g_free(l2meta);
-            l2meta = next;
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret < 0) {
+            goto fail;
         }
 
         bytes -= cur_bytes;
@@ -1675,18 +1864,7 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
 fail:
     qemu_co_mutex_unlock(&s->lock);
 
-    while (l2meta != NULL) {
-        QCowL2Meta *next;
-
-        if (l2meta->nb_clusters != 0) {
-            QLIST_REMOVE(l2meta, next_in_flight);
-        }
-        qemu_co_queue_restart_all(&l2meta->dependent_requests);
-
-        next = l2meta->next;
-        g_free(l2meta);
-        l2meta = next;
-    }
+    qcow2_handle_l2meta(bs, &l2meta, false);
 
     qemu_iovec_destroy(&hd_qiov);
     qemu_vfree(cluster_data);
@@ -1699,6 +1877,17 @@ static int qcow2_inactivate(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
     int ret, result = 0;
+    Error *local_err = NULL;
+
+    /* Whoever activates the image next loads the bitmaps from it */
+    qcow2_store_persistent_dirty_bitmaps(bs, &local_err);
+    if (local_err != NULL) {
+        result = -EINVAL;
+        error_report_err(local_err);
+        error_report("Persistent bitmaps are lost for node '%s'",
+                     bdrv_get_device_or_node_name(bs));
+    }
+    bdrv_release_persistent_dirty_bitmaps(bs);
 
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
@@ -1842,7 +2031,13 @@ int qcow2_update_header(BlockDriverState *bs)
         goto fail;
     }
 
-    header_length = sizeof(*header) + s->unknown_header_fields_size;
+    /* Keep the header short unless fields after refcount_order are used */
+    if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB ||
+        s->unknown_header_fields_size) {
+        header_length = sizeof(*header) + s->unknown_header_fields_size;
+    } else {
+        header_length = offsetof(QCowHeader, compression_type);
+    }
     total_size = bs->total_sectors * BDRV_SECTOR_SIZE;
     refcount_table_clusters = s->refcount_table_size >> (s->cluster_bits - 3);
 
@@ -1868,6 +2063,7 @@ int qcow2_update_header(BlockDriverState *bs)
         .autoclear_features     = cpu_to_be64(s->autoclear_features),
         .refcount_order         = cpu_to_be32(s->refcount_order),
         .header_length          = cpu_to_be32(header_length),
+        .compression_type       = s->compression_type,
     };
 
     /* For older versions, write a shorter header */
@@ -1876,7 +2072,7 @@ int qcow2_update_header(BlockDriverState *bs)
         ret = offsetof(QCowHeader, incompatible_features);
         break;
     case 3:
-        ret = sizeof(*header);
+        ret = MIN(header_length, sizeof(*header));
         break;
     default:
         ret = -EINVAL;
@@ -1913,6 +2109,25 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Bitmaps extension */
+    if (s->nb_bitmaps > 0) {
+        Qcow2BitmapHeaderExt bitmaps_header = {
+            .nb_bitmaps = cpu_to_be32(s->nb_bitmaps),
+            .bitmap_directory_size =
+                    cpu_to_be64(s->bitmap_directory_size),
+            .bitmap_directory_offset =
+                    cpu_to_be64(s->bitmap_directory_offset)
+        };
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_BITMAPS,
+                             &bitmaps_header, sizeof(bitmaps_header),
+                             buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* Feature table */
     if (s->qcow_version >= 3) {
         Qcow2Feature features[] = {
@@ -1926,11 +2141,26 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_INCOMPAT_CORRUPT_BITNR,
                 .name = "corrupt bit",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_COMPRESSION_BITNR,
+                .name = "compression type",
+            },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_EXTL2_BITNR,
+                .name = "extended L2 entries",
+            },
             {
                 .type = QCOW2_FEAT_TYPE_COMPATIBLE,
                 .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
                 .name = "lazy refcounts",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_AUTOCLEAR,
+                .bit  = QCOW2_AUTOCLEAR_BITMAPS_BITNR,
+                .name = "bitmaps",
+            },
         };
 
         ret = header_ext_add(buf, QCOW2_EXT_MAGIC_FEATURE_TABLE,
@@ -2076,7 +2306,8 @@ static int qcow2_create2(const char *filename, int64_t total_size,
                          const char *backing_file, const char *backing_format,
                          int flags, size_t cluster_size, PreallocMode prealloc,
                          QemuOpts *opts, int version, int refcount_order,
-                         Error **errp)
+                         Qcow2CompressionType compression_type,
+                         bool extended_l2, Error **errp)
 {
     int cluster_bits;
     QDict *options;
@@ -2130,12 +2361,14 @@ static int qcow2_create2(const char *filename, int64_t total_size,
         meta_size += cluster_size;
 
         /* total size of L2 tables */
+        size_t l2e_size = extended_l2 ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
+
         nl2e = aligned_total_size / cluster_size;
-        nl2e = align_offset(nl2e, cluster_size / sizeof(uint64_t));
-        meta_size += nl2e * sizeof(uint64_t);
+        nl2e = align_offset(nl2e, cluster_size / l2e_size);
+        meta_size += nl2e * l2e_size;
 
         /* total size of L1 tables */
-        nl1e = nl2e * sizeof(uint64_t) / cluster_size;
+        nl1e = nl2e * l2e_size / cluster_size;
         nl1e = align_offset(nl1e, cluster_size / sizeof(uint64_t));
         meta_size += nl1e * sizeof(uint64_t);
 
@@ -2203,6 +2436,19 @@ static int qcow2_create2(const char *filename, int64_t total_size,
         .header_length              = cpu_to_be32(sizeof(*header)),
     };
 
+    if (compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        header->compression_type = compression_type;
+        header->incompatible_features |=
+            cpu_to_be64(QCOW2_INCOMPAT_COMPRESSION);
+    } else {
+        header->header_length =
+            cpu_to_be32(offsetof(QCowHeader, compression_type));
+    }
+
+    if (extended_l2) {
+        header->incompatible_features |= cpu_to_be64(QCOW2_INCOMPAT_EXTL2);
+    }
+
     if (flags & BLOCK_FLAG_ENCRYPT) {
         header->crypt_method = cpu_to_be32(QCOW_CRYPT_AES);
     } else {
@@ -2331,6 +2577,8 @@ static int qcow2_create(const char *filename, QemuOpts *opts, Error **errp)
     int version = 3;
     uint64_t refcount_bits = 16;
     int refcount_order;
+    Qcow2CompressionType compression_type;
+    bool extended_l2;
     Error *local_err = NULL;
     int ret;
 
@@ -2404,9 +2652,55 @@ static int qcow2_create(const char *filename, QemuOpts *opts, Error **errp)
 
     refcount_order = ctz32(refcount_bits);
 
+    g_free(buf);
+    buf = qemu_opt_get_del(opts, BLOCK_OPT_COMPRESSION_TYPE);
+    compression_type = qapi_enum_parse(Qcow2CompressionType_lookup, buf,
+                                       QCOW2_COMPRESSION_TYPE__MAX,
+                                       QCOW2_COMPRESSION_TYPE_ZLIB,
+                                       &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto finish;
+    }
+
+#ifndef CONFIG_ZSTD
+    if (compression_type == QCOW2_COMPRESSION_TYPE_ZSTD) {
+        error_setg(errp, "zstd compression is not supported by this build");
+        ret = -ENOTSUP;
+        goto finish;
+    }
+#endif
+
+    if (version < 3 && compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        error_setg(errp, "Compression types other than zlib require "
+                   "compatibility level 1.1 or above (use compat=1.1 or "
+                   "greater)");
+        ret = -EINVAL;
+        goto finish;
+    }
+
+    extended_l2 = qemu_opt_get_bool_del(opts, BLOCK_OPT_EXTL2, false);
+    if (extended_l2) {
+        if (version < 3) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "compatibility level 1.1 and above (use compat=1.1 or "
+                       "greater)");
+            ret = -EINVAL;
+            goto finish;
+        }
+        if (cluster_size < (1 << MIN_EXTL2_CLUSTER_BITS)) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "cluster sizes of at least %d bytes",
+                       1 << MIN_EXTL2_CLUSTER_BITS);
+            ret = -EINVAL;
+            goto finish;
+        }
+    }
+
     ret = qcow2_create2(filename, size, backing_file, backing_fmt, flags,
                         cluster_size, prealloc, opts, version, refcount_order,
-                        &local_err);
+                        compression_type, extended_l2, &local_err);
     error_propagate(errp, local_err);
 
 finish:
@@ -2438,8 +2732,9 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
-    uint32_t head = offset % s->cluster_size;
-    uint32_t tail = (offset + count) % s->cluster_size;
+    /* With extended L2 entries, whole subclusters can be made zero */
+    uint32_t head = offset_into_subcluster(s, offset);
+    uint32_t tail = offset_into_subcluster(s, offset + count);
 
     trace_qcow2_pwrite_zeroes_start_req(qemu_coroutine_self(), offset, count);
 
@@ -2448,13 +2743,13 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
         uint64_t off;
         unsigned int nr;
 
-        assert(head + count <= s->cluster_size);
+        assert(head + count <= s->subcluster_size);
 
-        /* check whether remainder of cluster already reads as zero */
+        /* check whether remainder of (sub)cluster already reads as zero */
         if (!(is_zero_sectors(bs, cl_start,
                               DIV_ROUND_UP(head, BDRV_SECTOR_SIZE)) &&
               is_zero_sectors(bs, (offset + count) >> BDRV_SECTOR_BITS,
-                              DIV_ROUND_UP(-tail & (s->cluster_size - 1),
+                              DIV_ROUND_UP(-tail & (s->subcluster_size - 1),
                                            BDRV_SECTOR_SIZE)))) {
             return -ENOTSUP;
         }
@@ -2462,10 +2757,11 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
         qemu_co_mutex_lock(&s->lock);
         /* We can have new write after previous check */
         offset = cl_start << BDRV_SECTOR_BITS;
-        count = s->cluster_size;
-        nr = s->cluster_size;
+        count = s->subcluster_size;
+        nr = s->subcluster_size;
         ret = qcow2_get_cluster_offset(bs, offset, &nr, &off);
-        if (ret != QCOW2_CLUSTER_UNALLOCATED && ret != QCOW2_CLUSTER_ZERO) {
+        if ((ret != QCOW2_CLUSTER_UNALLOCATED && ret != QCOW2_CLUSTER_ZERO) ||
+            nr < count) {
             qemu_co_mutex_unlock(&s->lock);
             return -ENOTSUP;
         }
@@ -2495,6 +2791,164 @@ static coroutine_fn int qcow2_co_pdiscard(BlockDriverState *bs,
     return ret;
 }
 
+static int coroutine_fn
+qcow2_co_copy_range_from(BlockDriverState *bs,
+                         BdrvChild *src, int64_t src_offset,
+                         BdrvChild *dst, int64_t dst_offset,
+                         int count, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    BdrvChild *child = NULL;
+    BdrvRequestFlags cur_flags;
+
+    assert(!bs->encrypted);
+    qemu_co_mutex_lock(&s->lock);
+
+    while (count != 0) {
+        uint64_t copy_offset = 0;
+
+        /* prepare next request */
+        cur_bytes = count;
+        cur_flags = flags;
+
+        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes,
+                                       &copy_offset);
+        if (ret < 0) {
+            goto out;
+        }
+
+        switch (ret) {
+        case QCOW2_CLUSTER_UNALLOCATED:
+            if (bs->backing && bs->backing->bs) {
+                int64_t backing_length = bdrv_getlength(bs->backing->bs);
+                if (src_offset >= backing_length) {
+                    cur_flags |= BDRV_REQ_ZERO_WRITE;
+                } else {
+                    child = bs->backing;
+                    cur_bytes = MIN(cur_bytes, backing_length - src_offset);
+                    copy_offset = src_offset;
+                }
+            } else {
+                cur_flags |= BDRV_REQ_ZERO_WRITE;
+            }
+            break;
+
+        case QCOW2_CLUSTER_ZERO:
+            cur_flags |= BDRV_REQ_ZERO_WRITE;
+            break;
+
+        case QCOW2_CLUSTER_COMPRESSED:
+            /* The data has to be decompressed in QEMU */
+            ret = -ENOTSUP;
+            goto out;
+
+        case QCOW2_CLUSTER_NORMAL:
+            child = bs->file;
+            copy_offset += offset_into_cluster(s, src_offset);
+            if ((copy_offset & 511) != 0) {
+                ret = -EIO;
+                goto out;
+            }
+            break;
+
+        default:
+            g_assert_not_reached();
+            ret = -EIO;
+            goto out;
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_from(child, copy_offset, dst, dst_offset,
+                                      cur_bytes, cur_flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto out;
+        }
+
+        count -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
+    }
+    ret = 0;
+
+out:
+    qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
+
+static int coroutine_fn
+qcow2_co_copy_range_to(BlockDriverState *bs,
+                       BdrvChild *src, int64_t src_offset,
+                       BdrvChild *dst, int64_t dst_offset,
+                       int count, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    uint64_t cluster_offset;
+    QCowL2Meta *l2meta = NULL;
+
+    assert(!bs->encrypted);
+    trace_qcow2_writev_start_req(qemu_coroutine_self(), dst_offset, count);
+
+    s->cluster_cache_offset = -1; /* disable compressed cache */
+
+    qemu_co_mutex_lock(&s->lock);
+
+    while (count != 0) {
+
+        l2meta = NULL;
+
+        offset_in_cluster = offset_into_cluster(s, dst_offset);
+        cur_bytes = count;
+
+        ret = qcow2_alloc_cluster_offset(bs, dst_offset, &cur_bytes,
+                                         &cluster_offset, &l2meta);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        assert((cluster_offset & 511) == 0);
+
+        ret = qcow2_pre_write_overlap_check(bs, 0,
+                cluster_offset + offset_in_cluster, cur_bytes);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_to(src, src_offset, bs->file,
+                                    cluster_offset + offset_in_cluster,
+                                    cur_bytes, flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        count -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
+    }
+    ret = 0;
+
+fail:
+    qcow2_handle_l2meta(bs, &l2meta, false);
+
+    qemu_co_mutex_unlock(&s->lock);
+
+    trace_qcow2_writev_done_req(qemu_coroutine_self(), ret);
+
+    return ret;
+}
+
 static int qcow2_truncate(BlockDriverState *bs, int64_t offset)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -2512,6 +2966,13 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset)
         return -ENOTSUP;
     }
 
+    /* cannot proceed if image has bitmaps */
+    if (s->nb_bitmaps) {
+        /* TODO: resize bitmaps in the image */
+        error_report("Can't resize an image which has bitmaps");
+        return -ENOTSUP;
+    }
+
     /* shrinking is currently not supported */
     if (offset < bs->total_sectors * 512) {
         error_report("qcow2 doesn't support shrinking images yet");
@@ -2536,90 +2997,61 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset)
     return 0;
 }
 
-/* XXX: put compressed sectors first, then all the cluster aligned
-   tables to avoid losing bytes in alignment */
+/*
+ * Compress and write the cluster at @offset (cluster aligned; @bytes may
+ * be less than a cluster only at the end of the image), taking the data
+ * from @buf.
+ */
 static coroutine_fn int
-qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
-                            uint64_t bytes, QEMUIOVector *qiov)
+qcow2_co_pwrite_compressed_cluster(BlockDriverState *bs, uint64_t offset,
+                                   uint64_t bytes, uint8_t *buf)
 {
     BDRVQcow2State *s = bs->opaque;
     QEMUIOVector hd_qiov;
     struct iovec iov;
-    z_stream strm;
-    int ret, out_len;
-    uint8_t *buf, *out_buf;
+    ssize_t out_len;
+    uint8_t *out_buf;
     uint64_t cluster_offset;
+    int ret;
 
-    if (bytes == 0) {
-        /* align end of file to a sector boundary to ease reading with
-           sector based I/Os */
-        cluster_offset = bdrv_getlength(bs->file->bs);
-        return bdrv_truncate(bs->file->bs, cluster_offset);
-    }
-
-    buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes != s->cluster_size) {
-        if (bytes > s->cluster_size ||
-            offset + bytes != bs->total_sectors << BDRV_SECTOR_BITS)
-        {
-            qemu_vfree(buf);
-            return -EINVAL;
-        }
         /* Zero-pad last write if image size is not cluster aligned */
         memset(buf + bytes, 0, s->cluster_size - bytes);
     }
-    qemu_iovec_to_buf(qiov, 0, buf, bytes);
 
     out_buf = g_malloc(s->cluster_size);
 
-    /* best compression, small window, no zlib header */
-    memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
-                       Z_DEFLATED, -12,
-                       9, Z_DEFAULT_STRATEGY);
-    if (ret != 0) {
-        ret = -EINVAL;
-        goto fail;
-    }
-
-    strm.avail_in = s->cluster_size;
-    strm.next_in = (uint8_t *)buf;
-    strm.avail_out = s->cluster_size;
-    strm.next_out = out_buf;
-
-    ret = deflate(&strm, Z_FINISH);
-    if (ret != Z_STREAM_END && ret != Z_OK) {
-        deflateEnd(&strm);
-        ret = -EINVAL;
-        goto fail;
-    }
-    out_len = strm.next_out - out_buf;
-
-    deflateEnd(&strm);
-
-    if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
+    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
+                                buf, s->cluster_size);
+    if (out_len == -ENOMEM) {
         /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev(bs, offset, bytes, qiov, 0);
-        if (ret < 0) {
-            goto fail;
-        }
-        goto success;
+        iov = (struct iovec) {
+            .iov_base   = buf,
+            .iov_len    = bytes,
+        };
+        qemu_iovec_init_external(&hd_qiov, &iov, 1);
+        ret = qcow2_co_pwritev(bs, offset, bytes, &hd_qiov, 0);
+        goto out;
+    } else if (out_len < 0) {
+        ret = -EINVAL;
+        goto out;
     }
 
+    /* Compression ran outside the lock; allocate in completion order */
     qemu_co_mutex_lock(&s->lock);
     cluster_offset =
         qcow2_alloc_compressed_cluster_offset(bs, offset, out_len);
     if (!cluster_offset) {
         qemu_co_mutex_unlock(&s->lock);
         ret = -EIO;
-        goto fail;
+        goto out;
     }
     cluster_offset &= s->cluster_offset_mask;
 
     ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len);
     qemu_co_mutex_unlock(&s->lock);
     if (ret < 0) {
-        goto fail;
+        goto out;
     }
 
     iov = (struct iovec) {
@@ -2630,17 +3062,104 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
 
     BLKDBG_EVENT(bs->file, BLKDBG_WRITE_COMPRESSED);
     ret = bdrv_co_pwritev(bs->file, cluster_offset, out_len, &hd_qiov, 0);
-    if (ret < 0) {
-        goto fail;
-    }
-success:
-    ret = 0;
-fail:
-    qemu_vfree(buf);
+
+out:
     g_free(out_buf);
     return ret;
 }
 
+typedef struct Qcow2CompressedWrite {
+    BlockDriverState *bs;
+    QEMUIOVector *qiov;
+    uint64_t offset;            /* start of the request */
+    uint64_t bytes;
+    uint64_t next;              /* next cluster to hand out, from offset */
+    int in_flight;              /* worker coroutines still running */
+    int ret;
+    Coroutine *co;              /* request coroutine, set while it waits */
+} Qcow2CompressedWrite;
+
+static void coroutine_fn qcow2_compressed_write_worker(void *opaque)
+{
+    Qcow2CompressedWrite *w = opaque;
+    BDRVQcow2State *s = w->bs->opaque;
+    uint8_t *buf = qemu_blockalign(w->bs, s->cluster_size);
+
+    while (w->ret == 0 && w->next < w->bytes) {
+        uint64_t pos = w->next;
+        uint64_t len = MIN(w->bytes - pos, s->cluster_size);
+        int ret;
+
+        w->next += len;
+        qemu_iovec_to_buf(w->qiov, pos, buf, len);
+        ret = qcow2_co_pwrite_compressed_cluster(w->bs, w->offset + pos,
+                                                 len, buf);
+        if (ret < 0 && w->ret == 0) {
+            w->ret = ret;
+        }
+    }
+
+    qemu_vfree(buf);
+    if (--w->in_flight == 0 && w->co) {
+        qemu_coroutine_enter(w->co);
+    }
+}
+
+/* XXX: put compressed sectors first, then all the cluster aligned
+   tables to avoid losing bytes in alignment */
+static coroutine_fn int
+qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
+                            uint64_t bytes, QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedWrite w;
+    uint64_t nb_clusters;
+    int i;
+
+    if (bytes == 0) {
+        /* align end of file to a sector boundary to ease reading with
+           sector based I/Os */
+        int64_t len = bdrv_getlength(bs->file->bs);
+        if (len < 0) {
+            return len;
+        }
+        return bdrv_truncate(bs->file->bs, len);
+    }
+
+    /* Whole clusters only, except for a partial cluster at the end of the
+     * image */
+    if (offset_into_cluster(s, offset) ||
+        (offset_into_cluster(s, bytes) &&
+         offset + bytes != bs->total_sectors << BDRV_SECTOR_BITS))
+    {
+        return -EINVAL;
+    }
+
+    /* Compress several clusters at once, each in its own coroutine; every
+     * one allocates its host space under s->lock once compressed */
+    nb_clusters = size_to_clusters(s, bytes);
+    w = (Qcow2CompressedWrite) {
+        .bs         = bs,
+        .qiov       = qiov,
+        .offset     = offset,
+        .bytes      = bytes,
+        .in_flight  = MIN(nb_clusters, s->max_compress_threads),
+    };
+
+    for (i = w.in_flight; i > 0; i--) {
+        Coroutine *co = qemu_coroutine_create(qcow2_compressed_write_worker,
+                                              &w);
+        qemu_coroutine_enter(co);
+    }
+
+    while (w.in_flight > 0) {
+        w.co = qemu_coroutine_self();
+        qemu_coroutine_yield();
+    }
+
+    return w.ret;
+}
+
 static int make_completely_empty(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -2797,13 +3316,13 @@ static int qcow2_make_empty(BlockDriverState *bs)
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / sizeof(uint64_t));
 
-    if (s->qcow_version >= 3 && !s->snapshots &&
+    if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size) {
         /* The following function only works for qcow2 v3 images (it requires
-         * the dirty flag) and only as long as there are no snapshots (because
-         * it completely empties the image). Furthermore, the L1 table and three
-         * additional clusters (image header, refcount table, one refcount
-         * block) have to fit inside one refcount block. */
+         * the dirty flag) and only as long as there are no snapshots or
+         * bitmaps (because it completely empties the image). Furthermore, the
+         * L1 table and three additional clusters (image header, refcount
+         * table, one refcount block) have to fit inside one refcount block. */
         return make_completely_empty(bs);
     }
 
@@ -2858,6 +3377,7 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     BDRVQcow2State *s = bs->opaque;
     bdi->unallocated_blocks_are_zero = true;
     bdi->can_write_zeroes_with_unmap = (s->qcow_version >= 3);
+    bdi->can_compress_multiple_clusters = true;
     bdi->cluster_size = s->cluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
     return 0;
@@ -2887,6 +3407,11 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
                                   QCOW2_INCOMPAT_CORRUPT,
             .has_corrupt        = true,
             .refcount_bits      = s->refcount_bits,
+            .compression_type   = s->compression_type,
+            .has_compression_type = s->compression_type !=
+                                    QCOW2_COMPRESSION_TYPE_ZLIB,
+            .extended_l2        = has_subclusters(s),
+            .has_extended_l2    = has_subclusters(s),
         };
     } else {
         /* if this assertion fails, this probably means a new version was
@@ -2962,6 +3487,21 @@ static int qcow2_downgrade(BlockDriverState *bs, int target_version,
         return -ENOTSUP;
     }
 
+    if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        error_report("compat=0.10 requires compression_type=zlib");
+        return -ENOTSUP;
+    }
+
+    if (has_subclusters(s)) {
+        error_report("compat=0.10 does not support extended L2 entries");
+        return -ENOTSUP;
+    }
+
+    if (s->nb_bitmaps) {
+        error_report("compat=0.10 does not support persistent bitmaps");
+        return -ENOTSUP;
+    }
+
     /* clear incompatible features */
     if (s->incompatible_features & QCOW2_INCOMPAT_DIRTY) {
         ret = qcow2_mark_clean(bs);
@@ -3144,6 +3684,22 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
                              "not exceed 64 bits");
                 return -EINVAL;
             }
+        } else if (!strcmp(desc->name, BLOCK_OPT_COMPRESSION_TYPE)) {
+            const char *type = qemu_opt_get(opts, BLOCK_OPT_COMPRESSION_TYPE);
+            const char *cur = Qcow2CompressionType_lookup[s->compression_type];
+
+            if (type && strcmp(type, cur)) {
+                error_report("Changing the compression type is not supported");
+                return -ENOTSUP;
+            }
+        } else if (!strcmp(desc->name, BLOCK_OPT_EXTL2)) {
+            bool extended_l2 = qemu_opt_get_bool(opts, BLOCK_OPT_EXTL2,
+                                                 has_subclusters(s));
+
+            if (extended_l2 != has_subclusters(s)) {
+                error_report("Toggling extended L2 entries is not supported");
+                return -ENOTSUP;
+            }
         } else {
             /* if this point is reached, this probably means a new option was
              * added without having it covered here */
@@ -3355,6 +3911,17 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Width of a reference count entry in bits",
             .def_value_str = "16"
         },
+        {
+            .name = BLOCK_OPT_COMPRESSION_TYPE,
+            .type = QEMU_OPT_STRING,
+            .help = "Compression method used for compressed clusters "
+                    "(allowed values: zlib, zstd)",
+        },
+        {
+            .name = BLOCK_OPT_EXTL2,
+            .type = QEMU_OPT_BOOL,
+            .help = "Extended L2 tables with 32 subclusters per cluster",
+        },
         { /* end of list */ }
     }
 };
@@ -3379,6 +3946,8 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_co_flush_to_os    = qcow2_co_flush_to_os,
 
     .bdrv_co_pwrite_zeroes  = qcow2_co_pwrite_zeroes,
+    .bdrv_co_copy_range_from = qcow2_co_copy_range_from,
+    .bdrv_co_copy_range_to  = qcow2_co_copy_range_to,
     .bdrv_co_pdiscard       = qcow2_co_pdiscard,
     .bdrv_truncate          = qcow2_truncate,
     .bdrv_co_pwritev_compressed = qcow2_co_pwritev_compressed,
@@ -3408,6 +3977,10 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_detach_aio_context  = qcow2_detach_aio_context,
     .bdrv_attach_aio_context  = qcow2_attach_aio_context,
+
+    .bdrv_reopen_bitmaps_rw = qcow2_reopen_bitmaps_rw,
+    .bdrv_can_store_new_dirty_bitmap = qcow2_can_store_new_dirty_bitmap,
+    .bdrv_remove_persistent_dirty_bitmap = qcow2_remove_persistent_dirty_bitmap,
 };
 
 static void bdrv_qcow2_init(void)
@@ -67,6 +67,9 @@
 #ifndef FS_NOCOW_FL
 #define FS_NOCOW_FL                     0x00800000 /* Do not cow file */
 #endif
+#ifndef CONFIG_COPY_FILE_RANGE
+#include <sys/syscall.h>
+#endif
 #endif
 #if defined(CONFIG_FALLOCATE_PUNCH_HOLE) || defined(CONFIG_FALLOCATE_ZERO_RANGE)
 #include <linux/falloc.h>
@@ -167,6 +170,9 @@ typedef struct RawPosixAIOData {
 #define aio_ioctl_cmd   aio_nbytes /* for QEMU_AIO_IOCTL */
     off_t aio_offset;
     int aio_type;
+    /* destination of QEMU_AIO_COPY_RANGE, aio_fildes is the source */
+    int aio_fd2;
+    off_t aio_offset2;
 } RawPosixAIOData;
 
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -459,6 +465,23 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
+#ifdef CONFIG_LINUX_IO_URING
+    if ((bdrv_flags & BDRV_O_IO_URING) &&
+        !aio_get_linux_io_uring(bdrv_get_aio_context(bs))) {
+        error_setg(errp, "aio=io_uring was specified, but the io_uring "
+                         "instance could not be created.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#else
+    if (bdrv_flags & BDRV_O_IO_URING) {
+        error_setg(errp, "aio=io_uring was specified, but is not supported "
+                         "in this build.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif /* !defined(CONFIG_LINUX_IO_URING) */
+
     s->has_discard = true;
     s->has_write_zeroes = true;
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
@@ -610,6 +633,17 @@ static int raw_reopen_prepare(BDRVReopenState *state,
     return ret;
 }
 
+static void raw_luring_unregister(BlockDriverState *bs, int fd)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    AioContext *ctx = bdrv_get_aio_context(bs);
+
+    if (ctx->linux_io_uring) {
+        luring_unregister_fd(ctx->linux_io_uring, fd);
+    }
+#endif
+}
+
 static void raw_reopen_commit(BDRVReopenState *state)
 {
     BDRVRawReopenState *raw_s = state->opaque;
@@ -617,6 +651,7 @@ static void raw_reopen_commit(BDRVReopenState *state)
 
     s->open_flags = raw_s->open_flags;
 
+    raw_luring_unregister(state->bs, s->fd);
     qemu_close(s->fd);
     s->fd = raw_s->fd;
 
@@ -1138,6 +1173,70 @@ static ssize_t handle_aiocb_discard(RawPosixAIOData *aiocb)
     return ret;
 }
 
+#ifndef CONFIG_COPY_FILE_RANGE
+static off_t copy_file_range(int in_fd, off_t *in_off, int out_fd,
+                             off_t *out_off, size_t len, unsigned int flags)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, in_fd, in_off, out_fd,
+                   out_off, len, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+#endif
+
+static ssize_t handle_aiocb_copy_range(RawPosixAIOData *aiocb)
+{
+    uint64_t bytes = aiocb->aio_nbytes;
+    off_t in_off = aiocb->aio_offset;
+    off_t out_off = aiocb->aio_offset2;
+
+#ifdef FICLONERANGE
+    /* Sharing the extents is cheapest; it only works for block-aligned
+     * ranges on file systems with reflink support (btrfs, XFS), so just
+     * fall back to copy_file_range if it fails */
+    do {
+        struct file_clone_range range = {
+            .src_fd = aiocb->aio_fildes,
+            .src_offset = in_off,
+            .src_length = bytes,
+            .dest_offset = out_off,
+        };
+
+        if (ioctl(aiocb->aio_fd2, FICLONERANGE, &range) == 0) {
+            return 0;
+        }
+    } while (errno == EINTR);
+#endif
+
+    while (bytes) {
+        ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
+                                      aiocb->aio_fd2, &out_off,
+                                      bytes, 0);
+        if (ret == 0) {
+            /* No progress, e.g. the source range is past EOF; let the
+             * caller copy through its own buffer */
+            return -ENOTSUP;
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* Kernels before 5.3 refuse copies across file systems, and
+             * file systems or files that cannot do the copy (e.g. procfs,
+             * O_APPEND) fail with EINVAL */
+            if (errno == EXDEV || errno == EINVAL) {
+                return -ENOTSUP;
+            }
+            return translate_err(-errno);
+        }
+        bytes -= ret;
+    }
+    return 0;
+}
+
 static int aio_worker(void *arg)
 {
     RawPosixAIOData *aiocb = arg;
@@ -1178,6 +1277,9 @@ static int aio_worker(void *arg)
     case QEMU_AIO_WRITE_ZEROES:
         ret = handle_aiocb_write_zeroes(aiocb);
         break;
+    case QEMU_AIO_COPY_RANGE:
+        ret = handle_aiocb_copy_range(aiocb);
+        break;
     default:
         fprintf(stderr, "invalid aio request (0x%x)\n", aiocb->aio_type);
         ret = -EINVAL;
@@ -1188,9 +1290,9 @@ static int aio_worker(void *arg)
     return ret;
 }
 
-static int paio_submit_co(BlockDriverState *bs, int fd,
-                          int64_t offset, QEMUIOVector *qiov,
-                          int count, int type)
+static int paio_submit_co_full(BlockDriverState *bs, int fd,
+                               int64_t offset, int fd2, int64_t offset2,
+                               QEMUIOVector *qiov, int count, int type)
 {
     RawPosixAIOData *acb = g_new(RawPosixAIOData, 1);
     ThreadPool *pool;
@@ -1202,6 +1304,9 @@ static int paio_submit_co(BlockDriverState *bs, int fd,
     acb->aio_nbytes = count;
     acb->aio_offset = offset;
 
+    acb->aio_fd2 = fd2;
+    acb->aio_offset2 = offset2;
+
     if (qiov) {
         acb->aio_iov = qiov->iov;
         acb->aio_niov = qiov->niov;
@@ -1213,6 +1318,13 @@ static int paio_submit_co(BlockDriverState *bs, int fd,
     return thread_pool_submit_co(pool, aio_worker, acb);
 }
 
+static inline int paio_submit_co(BlockDriverState *bs, int fd,
+                                 int64_t offset, QEMUIOVector *qiov,
+                                 int count, int type)
+{
+    return paio_submit_co_full(bs, fd, offset, -1, 0, qiov, count, type);
+}
+
 static BlockAIOCB *paio_submit(BlockDriverState *bs, int fd,
         int64_t offset, QEMUIOVector *qiov, int count,
         BlockCompletionFunc *cb, void *opaque, int type)
@@ -1264,6 +1376,18 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
         }
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Unlike Linux AIO, io_uring is asynchronous for buffered I/O too */
+    if ((bs->open_flags & BDRV_O_IO_URING) &&
+        !(type & QEMU_AIO_MISALIGNED)) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        if (aio) {
+            assert(qiov->size == bytes);
+            return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+        }
+    }
+#endif
+
     return paio_submit_co(bs, s->fd, offset, qiov, bytes, type);
 }
 
@@ -1290,6 +1414,14 @@ static void raw_aio_plug(BlockDriverState *bs)
         laio_io_plug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (bs->open_flags & BDRV_O_IO_URING) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        if (aio) {
+            luring_io_plug(bs, aio);
+        }
+    }
+#endif
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
@@ -1300,6 +1432,42 @@ static void raw_aio_unplug(BlockDriverState *bs)
         laio_io_unplug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (bs->open_flags & BDRV_O_IO_URING) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        if (aio) {
+            luring_io_unplug(bs, aio);
+        }
+    }
+#endif
+}
+
+static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    int ret;
+
+    ret = fd_open(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (bs->open_flags & BDRV_O_IO_URING) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        if (aio) {
+            return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        }
+    }
+#endif
+    return paio_submit_co(bs, s->fd, 0, NULL, 0, QEMU_AIO_FLUSH);
+}
+
+static void raw_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    raw_luring_unregister(bs, s->fd);
 }
 
 static BlockAIOCB *raw_aio_flush(BlockDriverState *bs,
@@ -1318,6 +1486,7 @@ static void raw_close(BlockDriverState *bs)
     BDRVRawState *s = bs->opaque;
 
     if (s->fd >= 0) {
+        raw_luring_unregister(bs, s->fd);
         qemu_close(s->fd);
         s->fd = -1;
     }
@@ -1812,6 +1981,42 @@ static int coroutine_fn raw_co_pwrite_zeroes(
     return -ENOTSUP;
 }
 
+static int coroutine_fn raw_co_copy_range_from(BlockDriverState *bs,
+                                               BdrvChild *src,
+                                               int64_t src_offset,
+                                               BdrvChild *dst,
+                                               int64_t dst_offset,
+                                               int count,
+                                               BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_to(src, src_offset, dst, dst_offset, count,
+                                 flags);
+}
+
+static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
+                                             BdrvChild *src,
+                                             int64_t src_offset,
+                                             BdrvChild *dst,
+                                             int64_t dst_offset,
+                                             int count,
+                                             BdrvRequestFlags flags)
+{
+    BDRVRawState *s = bs->opaque;
+    BDRVRawState *src_s;
+
+    assert(dst->bs == bs);
+    if (src->bs->drv->bdrv_co_copy_range_to != raw_co_copy_range_to) {
+        return -ENOTSUP;
+    }
+
+    src_s = src->bs->opaque;
+    if (fd_open(src->bs) < 0 || fd_open(bs) < 0) {
+        return -EIO;
+    }
+    return paio_submit_co_full(bs, src_s->fd, src_offset, s->fd, dst_offset,
+                               NULL, count, QEMU_AIO_COPY_RANGE);
+}
+
 static int raw_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BDRVRawState *s = bs->opaque;
@@ -1863,11 +2068,14 @@ BlockDriver bdrv_file = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
-    .bdrv_aio_flush = raw_aio_flush,
+    .bdrv_co_flush_to_disk  = raw_co_flush_to_disk,
+    .bdrv_co_copy_range_from = raw_co_copy_range_from,
+    .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_aio_pdiscard = raw_aio_pdiscard,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
 
     .bdrv_truncate = raw_truncate,
     .bdrv_getlength = raw_getlength,
@@ -2311,6 +2519,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -2432,6 +2641,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -2487,8 +2697,10 @@ static int cdrom_reopen(BlockDriverState *bs)
      * Force reread of possibly changed/newly loaded disc,
      * FreeBSD seems to not notice sometimes...
      */
-    if (s->fd >= 0)
+    if (s->fd >= 0) {
+        raw_luring_unregister(bs, s->fd);
         qemu_close(s->fd);
+    }
     fd = qemu_open(bs->filename, s->open_flags, 0644);
     if (fd < 0) {
         s->fd = -1;
@@ -2562,6 +2774,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -28,6 +28,7 @@
 #include "exec/address-spaces.h"
 #include "qemu/rcu.h"
 #include "exec/tb-hash.h"
+#include "exec/cpu_ldst.h"
 #include "exec/log.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
 #include "hw/i386/apic.h"
@@ -280,6 +281,113 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu,
     return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
 }
 
+#ifndef CONFIG_USER_ONLY
+/* Speculative translation of successor blocks.
+ *
+ * When a TB is translated, its fall-through address and the direct
+ * branch targets reported by the frontend are queued.  Whenever all
+ * CPUs are idle, the TCG thread translates queued blocks that are not
+ * in the hash table yet, so that tb_find hits the first time they are
+ * reached.  Only successors of TBs translated on demand are queued.
+ *
+ * Translating must never fault, so a block is only translated if the
+ * CPU state still matches the one of its predecessor and both pages
+ * it may span are mapped in the TLB.
+ */
+#define TB_PREFETCH_QUEUE_SIZE 64
+
+typedef struct TBPrefetch {
+    CPUState *cpu;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    int mmu_idx;
+} TBPrefetch;
+
+static bool tb_prefetch_enabled;
+static bool tb_prefetch_running;
+static TBPrefetch tb_prefetch_queue[TB_PREFETCH_QUEUE_SIZE];
+static unsigned tb_prefetch_head;
+static unsigned tb_prefetch_len;
+
+void tcg_exec_enable_prefetch(void)
+{
+    tb_prefetch_enabled = true;
+}
+
+/* Called while translating 'tb', with tcg_ctx.cpu set.  */
+void tb_prefetch_note(TranslationBlock *tb, target_ulong pc)
+{
+    CPUState *cpu = tcg_ctx.cpu;
+    TBPrefetch *p;
+
+    if (!tb_prefetch_enabled || tb_prefetch_running || use_icount ||
+        !cpu || (tb->cflags & CF_NOCACHE) || pc == tb->pc) {
+        return;
+    }
+
+    /* The queue is a ring; the newest predictions overwrite the oldest.  */
+    p = &tb_prefetch_queue[tb_prefetch_head];
+    tb_prefetch_head = (tb_prefetch_head + 1) % TB_PREFETCH_QUEUE_SIZE;
+    tb_prefetch_len = MIN(tb_prefetch_len + 1, TB_PREFETCH_QUEUE_SIZE);
+
+    p->cpu = cpu;
+    p->pc = pc;
+    p->cs_base = tb->cs_base;
+    p->flags = tb->flags;
+    p->mmu_idx = cpu_mmu_index((CPUArchState *)cpu->env_ptr, true);
+}
+
+static bool tb_prefetch_mapped(CPUArchState *env, target_ulong pc,
+                               int mmu_idx)
+{
+    target_ulong next_page = (pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+
+    return tlb_vaddr_to_host(env, pc, 2, mmu_idx) &&
+           tlb_vaddr_to_host(env, next_page, 2, mmu_idx);
+}
+
+/* Translate the most recently queued block, if any.  Return false if
+   the queue is empty.  Called with the iothread lock held.  */
+bool tb_prefetch_run(void)
+{
+    TBPrefetch p;
+    CPUArchState *env;
+    target_ulong pc, cs_base;
+    uint32_t flags;
+
+    if (!tb_prefetch_len) {
+        return false;
+    }
+    tb_prefetch_head = (tb_prefetch_head + TB_PREFETCH_QUEUE_SIZE - 1)
+                       % TB_PREFETCH_QUEUE_SIZE;
+    tb_prefetch_len--;
+    p = tb_prefetch_queue[tb_prefetch_head];
+
+    env = p.cpu->env_ptr;
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    if (cs_base != p.cs_base || flags != p.flags ||
+        cpu_mmu_index(env, true) != p.mmu_idx ||
+        !tb_prefetch_mapped(env, p.pc, p.mmu_idx)) {
+        return true;
+    }
+
+    tb_lock();
+    if (!tb_htable_lookup(p.cpu, p.pc, p.cs_base, p.flags)) {
+        tb_prefetch_running = true;
+        tb_gen_code(p.cpu, p.pc, p.cs_base, p.flags, 0);
+        tb_prefetch_running = false;
+        tcg_ctx.tb_ctx.tb_prefetch_count++;
+    }
+    tb_unlock();
+    return true;
+}
+#else
+void tcg_exec_enable_prefetch(void)
+{
+}
+#endif
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit)
@@ -1032,6 +1032,11 @@ static void qemu_wait_io_event_common(CPUState *cpu)
 static void qemu_tcg_wait_io_event(CPUState *cpu)
 {
     while (all_cpu_threads_idle()) {
+        /* Use the idle time to translate predicted blocks, but let
+           the iothread in as soon as it asks for the lock.  */
+        if (!atomic_read(&iothread_requesting_mutex) && tb_prefetch_run()) {
+            continue;
+        }
         qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
     }
 
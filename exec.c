@@ -146,6 +146,14 @@ struct AddressSpaceDispatch {
     PhysPageEntry phys_map;
     PhysPageMap map;
     AddressSpace *as;
+
+    /* The map before phys_page_compact_all(), from which the next
+     * dispatch is derived by applying only the changed sections.
+     */
+    PhysPageEntry raw_phys_map;
+    Node *raw_nodes;
+    /* Derived from the previous dispatch rather than built from scratch. */
+    bool incremental;
 };
 
 #define SUBPAGE_IDX(addr) ((addr) & ~TARGET_PAGE_MASK)
@@ -161,6 +169,11 @@ typedef struct subpage_t {
 #define PHYS_SECTION_ROM 2
 #define PHYS_SECTION_WATCH 3
 
+/* Build a fresh dispatch once this many sections, live or dead, have
+ * accumulated in an incrementally updated one.
+ */
+#define PHYS_SECTION_INCREMENTAL_MAX (TARGET_PAGE_SIZE / 4)
+
 static void io_mem_init(void);
 static void memory_map_init(void);
 static void tcg_commit(MemoryListener *listener);
@@ -222,9 +235,24 @@ static void phys_page_set_level(PhysPageMap *map, PhysPageEntry *lp,
 {
     PhysPageEntry *p;
     hwaddr step = (hwaddr)1 << (level * P_L2_BITS);
+    unsigned i;
 
     if (lp->skip && lp->ptr == PHYS_MAP_NODE_NIL) {
         lp->ptr = phys_map_node_alloc(map, level == 0);
+    } else if (!lp->skip) {
+        /* A leaf covering the whole node, as left behind by an earlier
+         * update of an incrementally built map.  Split it, so that only
+         * part of the range can be changed.
+         */
+        uint32_t old = lp->ptr;
+
+        lp->skip = 1;
+        lp->ptr = phys_map_node_alloc(map, level == 0);
+        p = map->nodes[lp->ptr];
+        for (i = 0; i < P_L2_SIZE; ++i) {
+            p[i].skip = 0;
+            p[i].ptr = old;
+        }
     }
     p = map->nodes[lp->ptr];
     lp = &p[(*index >> (level * P_L2_BITS)) & (P_L2_SIZE - 1)];
@@ -1206,6 +1234,99 @@ static void mem_add(MemoryListener *listener, MemoryRegionSection *section)
     }
 }
 
+/* Drop the reference held by a section that is no longer mapped.  The
+ * slot itself stays allocated until the next full rebuild.
+ */
+static void phys_section_release(PhysPageMap *map, uint16_t index)
+{
+    MemoryRegionSection *section = &map->sections[index];
+
+    if (index > PHYS_SECTION_WATCH && section->mr != &io_mem_unassigned) {
+        assert(!section->mr->subpage);
+        memory_region_unref(section->mr);
+        section->mr = &io_mem_unassigned;
+    }
+}
+
+static void unregister_subpage(AddressSpaceDispatch *d,
+                               MemoryRegionSection *section)
+{
+    hwaddr base = section->offset_within_address_space & TARGET_PAGE_MASK;
+    MemoryRegionSection *existing = phys_page_find(d->phys_map, base,
+                                                   d->map.nodes, d->map.sections);
+    subpage_t *subpage;
+    hwaddr start, end;
+
+    assert(existing->mr->subpage);
+    subpage = container_of(existing->mr, subpage_t, iomem);
+    start = section->offset_within_address_space & ~TARGET_PAGE_MASK;
+    end = start + int128_get64(section->size) - 1;
+    phys_section_release(&d->map, subpage->sub_section[SUBPAGE_IDX(start)]);
+    subpage_register(subpage, start, end, PHYS_SECTION_UNASSIGNED);
+}
+
+static void unregister_multipage(AddressSpaceDispatch *d,
+                                 MemoryRegionSection *section)
+{
+    hwaddr start_addr = section->offset_within_address_space;
+    MemoryRegionSection *existing = phys_page_find(d->phys_map, start_addr,
+                                                   d->map.nodes, d->map.sections);
+    uint64_t num_pages = int128_get64(int128_rshift(section->size,
+                                                    TARGET_PAGE_BITS));
+
+    phys_section_release(&d->map, existing - d->map.sections);
+    phys_page_set(d, start_addr >> TARGET_PAGE_BITS, num_pages,
+                  PHYS_SECTION_UNASSIGNED);
+}
+
+/* Undo mem_add(), splitting @section the same way. */
+static void mem_del(MemoryListener *listener, MemoryRegionSection *section)
+{
+    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
+    AddressSpaceDispatch *d = as->next_dispatch;
+    MemoryRegionSection now = *section, remain = *section;
+    Int128 page_size = int128_make64(TARGET_PAGE_SIZE);
+
+    if (!d->incremental) {
+        return;
+    }
+
+    if (now.offset_within_address_space & ~TARGET_PAGE_MASK) {
+        uint64_t left = TARGET_PAGE_ALIGN(now.offset_within_address_space)
+                       - now.offset_within_address_space;
+
+        now.size = int128_min(int128_make64(left), now.size);
+        unregister_subpage(d, &now);
+    } else {
+        now.size = int128_zero();
+    }
+    while (int128_ne(remain.size, now.size)) {
+        remain.size = int128_sub(remain.size, now.size);
+        remain.offset_within_address_space += int128_get64(now.size);
+        remain.offset_within_region += int128_get64(now.size);
+        now = remain;
+        if (int128_lt(remain.size, page_size)) {
+            unregister_subpage(d, &now);
+        } else if (remain.offset_within_address_space & ~TARGET_PAGE_MASK) {
+            now.size = page_size;
+            unregister_subpage(d, &now);
+        } else {
+            now.size = int128_and(now.size, int128_neg(page_size));
+            unregister_multipage(d, &now);
+        }
+    }
+}
+
+static void mem_nop(MemoryListener *listener, MemoryRegionSection *section)
+{
+    AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
+
+    /* An incremental dispatch already has the section mapped. */
+    if (!as->next_dispatch->incremental) {
+        mem_add(listener, section);
+    }
+}
+
 void qemu_flush_coalesced_mmio_buffer(void)
 {
     if (kvm_enabled())
@@ -1320,7 +1441,7 @@ static void *file_ram_alloc(RAMBlock *block,
     }
 
     if (mem_prealloc) {
-        os_mem_prealloc(fd, area, memory, errp);
+        os_mem_prealloc(fd, area, memory, smp_cpus, errp);
         if (errp && *errp) {
             goto error;
         }
@@ -2292,12 +2413,62 @@ static void io_mem_init(void)
                           NULL, UINT64_MAX);
 }
 
+/* Copy @cur so that the next topology update only has to apply the
+ * sections that changed.  Subpages are modified in place by
+ * subpage_register(), so each gets its own copy.
+ *
+ * The node array is copied whole instead of only along the paths that
+ * change: RCU readers may still walk @cur, and mem_commit() compacts
+ * every node of the new map anyway, so sharing untouched nodes would
+ * not make a commit cheaper than a pass over the map.
+ */
+static AddressSpaceDispatch *address_space_dispatch_clone(
+    AddressSpaceDispatch *cur)
+{
+    AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
+    unsigned i;
+
+    d->as = cur->as;
+    d->incremental = true;
+    d->phys_map = cur->raw_phys_map;
+    d->map.nodes_nb = d->map.nodes_nb_alloc = cur->map.nodes_nb;
+    d->map.nodes = g_memdup(cur->raw_nodes,
+                            cur->map.nodes_nb * sizeof(Node));
+    d->map.sections_nb = d->map.sections_nb_alloc = cur->map.sections_nb;
+    d->map.sections = g_memdup(cur->map.sections,
+                               cur->map.sections_nb *
+                               sizeof(MemoryRegionSection));
+
+    for (i = 0; i < d->map.sections_nb; i++) {
+        MemoryRegionSection *section = &d->map.sections[i];
+
+        if (section->mr->subpage) {
+            subpage_t *old = container_of(section->mr, subpage_t, iomem);
+            subpage_t *subpage = subpage_init(d->as, old->base);
+
+            memcpy(subpage->sub_section, old->sub_section,
+                   sizeof(subpage->sub_section));
+            section->mr = &subpage->iomem;
+        }
+        memory_region_ref(section->mr);
+    }
+    return d;
+}
+
 static void mem_begin(MemoryListener *listener)
 {
     AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
-    AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
+    AddressSpaceDispatch *cur = as->dispatch;
+    AddressSpaceDispatch *d;
     uint16_t n;
 
+    if (cur && cur->map.sections_nb < PHYS_SECTION_INCREMENTAL_MAX) {
+        as->next_dispatch = address_space_dispatch_clone(cur);
+        return;
+    }
+
+    d = g_new0(AddressSpaceDispatch, 1);
+
     n = dummy_section(&d->map, as, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
     n = dummy_section(&d->map, as, &io_mem_notdirty);
@@ -2315,6 +2486,7 @@ static void mem_begin(MemoryListener *listener)
 static void address_space_dispatch_free(AddressSpaceDispatch *d)
 {
     phys_sections_free(&d->map);
+    g_free(d->raw_nodes);
     g_free(d);
 }
 
@@ -2324,6 +2496,9 @@ static void mem_commit(MemoryListener *listener)
     AddressSpaceDispatch *cur = as->dispatch;
     AddressSpaceDispatch *next = as->next_dispatch;
 
+    next->raw_phys_map = next->phys_map;
+    next->raw_nodes = g_memdup(next->map.nodes,
+                               next->map.nodes_nb * sizeof(Node));
     phys_page_compact_all(next, next->map.nodes_nb);
 
     atomic_rcu_set(&as->dispatch, next);
@@ -2357,7 +2532,8 @@ void address_space_init_dispatch(AddressSpace *as)
         .begin = mem_begin,
         .commit = mem_commit,
         .region_add = mem_add,
-        .region_nop = mem_add,
+        .region_del = mem_del,
+        .region_nop = mem_nop,
         .priority = 0,
     };
     memory_listener_register(&as->dispatch_listener, as);
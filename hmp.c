@@ -213,6 +213,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        monitor_printf(mon, "dirty sync time: %" PRIu64 " us"
+                       " (total %" PRIu64 " us)\n",
+                       info->ram->dirty_sync_time,
+                       info->ram->dirty_sync_time_total);
         if (info->ram->dirty_pages_rate) {
             monitor_printf(mon, "dirty pages rate: %" PRIu64 " pages\n",
                            info->ram->dirty_pages_rate);
@@ -245,6 +249,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->cache_miss_rate);
         monitor_printf(mon, "xbzrle overflow : %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        monitor_printf(mon, "xbzrle cache hit: %" PRIu64 "\n",
+                       info->xbzrle_cache->cache_hit);
+        monitor_printf(mon, "xbzrle cache hit rate: %0.2f\n",
+                       info->xbzrle_cache->cache_hit_rate);
     }
 
     if (info->has_cpu_throttle_percentage) {
@@ -304,6 +312,15 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, " %s: '%s'",
             MigrationParameter_lookup[MIGRATION_PARAMETER_TLS_HOSTNAME],
             params->tls_hostname ? : "");
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_X_MULTIFD_CHANNELS],
+            params->x_multifd_channels);
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_X_MULTIFD_PAGE_COUNT],
+            params->x_multifd_page_count);
+        monitor_printf(mon, " %s: %s",
+            MigrationParameter_lookup[MIGRATION_PARAMETER_COMPRESS_METHOD],
+            MigrationCompressMethod_lookup[params->compress_method]);
         monitor_printf(mon, "\n");
     }
 
@@ -1262,6 +1279,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
     bool has_cpu_throttle_increment = false;
     bool has_tls_creds = false;
     bool has_tls_hostname = false;
+    bool has_x_multifd_channels = false;
+    bool has_x_multifd_page_count = false;
+    bool has_compress_method = false;
+    int compress_method = 0;
     bool use_int_value = false;
     int i;
 
@@ -1293,6 +1314,23 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
             case MIGRATION_PARAMETER_TLS_HOSTNAME:
                 has_tls_hostname = true;
                 break;
+            case MIGRATION_PARAMETER_X_MULTIFD_CHANNELS:
+                has_x_multifd_channels = true;
+                use_int_value = true;
+                break;
+            case MIGRATION_PARAMETER_X_MULTIFD_PAGE_COUNT:
+                has_x_multifd_page_count = true;
+                use_int_value = true;
+                break;
+            case MIGRATION_PARAMETER_COMPRESS_METHOD:
+                has_compress_method = true;
+                compress_method =
+                    qapi_enum_parse(MigrationCompressMethod_lookup, valuestr,
+                                    MIGRATION_COMPRESS_METHOD__MAX, -1, &err);
+                if (err) {
+                    goto cleanup;
+                }
+                break;
             }
 
             if (use_int_value) {
@@ -1310,6 +1348,9 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
                                        has_cpu_throttle_increment, valueint,
                                        has_tls_creds, valuestr,
                                        has_tls_hostname, valuestr,
+                                       has_x_multifd_channels, valueint,
+                                       has_x_multifd_page_count, valueint,
+                                       has_compress_method, compress_method,
                                        &err);
             break;
         }
@@ -2043,8 +2084,31 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     IOThreadInfoList *info;
 
     for (info = info_list; info; info = info->next) {
-        monitor_printf(mon, "%s: thread_id=%" PRId64 "\n",
-                       info->value->id, info->value->thread_id);
+        IOThreadInfo *value = info->value;
+
+        monitor_printf(mon, "%s:\n", value->id);
+        monitor_printf(mon, "  thread_id=%" PRId64 "\n", value->thread_id);
+        monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
+        monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
+        monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  thread-pool-min=%" PRId64 "\n",
+                       value->thread_pool_min);
+        monitor_printf(mon, "  thread-pool-max=%" PRId64 "\n",
+                       value->thread_pool_max);
+        monitor_printf(mon, "  thread-pool-idle-timeout=%" PRId64 "\n",
+                       value->thread_pool_idle_timeout);
+        if (value->has_thread_pool) {
+            ThreadPoolInfo *pool = value->thread_pool;
+
+            monitor_printf(mon, "  thread pool: %" PRId64 " threads "
+                           "(%" PRId64 " idle), %" PRId64 " queued\n",
+                           pool->cur_threads, pool->idle_threads,
+                           pool->queue_depth);
+            monitor_printf(mon, "    requests=%" PRIu64 " stolen=%" PRIu64
+                           " avg-wait-ns=%" PRIu64 " max-wait-ns=%" PRIu64
+                           "\n", pool->requests, pool->stolen,
+                           pool->avg_wait_ns, pool->max_wait_ns);
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -20,6 +20,9 @@
 #include "qemu/thread.h"
 #include "qemu/rfifolock.h"
 #include "qemu/timer.h"
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+#endif
 
 typedef struct BlockAIOCB BlockAIOCB;
 typedef void BlockCompletionFunc(void *opaque, int ret);
@@ -46,9 +49,11 @@ void qemu_aio_ref(void *p);
 typedef struct AioHandler AioHandler;
 typedef void QEMUBHFunc(void *opaque);
 typedef void IOHandler(void *opaque);
+typedef bool AioPollFn(void *opaque);
 
 struct ThreadPool;
 struct LinuxAioState;
+struct LuringState;
 
 struct AioContext {
     GSource source;
@@ -122,22 +127,54 @@ struct AioContext {
     /* Thread pool for performing work and receiving completion callbacks */
     struct ThreadPool *thread_pool;
 
+    /* Thread pool parameters, see aio_context_set_thread_pool_params() */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+    int64_t thread_pool_idle_timeout;
+
 #ifdef CONFIG_LINUX_AIO
     /* State for native Linux AIO.  Uses aio_context_acquire/release for
      * locking.
      */
     struct LinuxAioState *linux_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    /* State for Linux io_uring.  Uses aio_context_acquire/release for
+     * locking.
+     */
+    struct LuringState *linux_io_uring;
+#endif
 
     /* TimerLists for calling timers - one per clock type */
     QEMUTimerListGroup tlg;
 
     int external_disable_cnt;
 
+    /* Number of AioHandlers without .io_poll() */
+    int poll_disable_cnt;
+
+    /* Polling mode parameters */
+    int64_t poll_ns;        /* current polling time in nanoseconds */
+    int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
+    int64_t poll_grow;      /* polling time growth factor */
+    int64_t poll_shrink;    /* polling time shrink factor */
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
     bool epoll_enabled;
     bool epoll_available;
+
+#ifdef CONFIG_LINUX_IO_URING
+    /* io_uring(7) state used for fd monitoring when the kernel supports it.
+     * Only one thread at a time may drive the ring; uring_busy is set (with
+     * the AioContext acquired) while a thread waits on it.
+     */
+    struct io_uring uring;
+    bool uring_enabled;
+    bool uring_busy;
+    unsigned uring_sqes;
+    QSLIST_HEAD(, AioHandler) uring_submit_list;
+#endif
 };
 
 /**
@@ -315,6 +352,11 @@ bool aio_poll(AioContext *ctx, bool blocking);
  * to qemu_set_fd_handler.  Unlike qemu_set_fd_handler, these callbacks will
  * be invoked when using aio_poll().
  *
+ * @io_poll, if non-NULL, is a cheap check for work that aio_poll() can busy
+ * wait on instead of sleeping in the kernel.  It must process the work it
+ * finds and return true if it made progress.  Polling is only used while
+ * every handler in the AioContext has an @io_poll callback.
+ *
  * Code that invokes AIO completion functions should rely on this function
  * instead of qemu_set_fd_handler[2].
  */
@@ -323,6 +365,7 @@ void aio_set_fd_handler(AioContext *ctx,
                         bool is_external,
                         IOHandler *io_read,
                         IOHandler *io_write,
+                        AioPollFn *io_poll,
                         void *opaque);
 
 /* Register an event notifier and associated callbacks.  Behaves very similarly
@@ -335,7 +378,8 @@ void aio_set_fd_handler(AioContext *ctx,
 void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             bool is_external,
-                            EventNotifierHandler *io_read);
+                            EventNotifierHandler *io_read,
+                            AioPollFn *io_poll);
 
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
@@ -348,6 +392,11 @@ struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
+/* Return the LuringState bound to this AioContext, or NULL if io_uring
+ * could not be set up.
+ */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
 /**
  * aio_timer_new:
  * @ctx: the aio context
@@ -454,4 +503,50 @@ static inline bool aio_node_check(AioContext *ctx, bool is_external)
  */
 void aio_context_setup(AioContext *ctx);
 
+/**
+ * aio_context_destroy:
+ * @ctx: the aio context
+ *
+ * Release OS-specific resources allocated by aio_context_setup().
+ */
+void aio_context_destroy(AioContext *ctx);
+
+/**
+ * aio_context_use_g_source:
+ * @ctx: the aio context
+ *
+ * Called when the AioContext is going to be polled through its GSource.
+ * File descriptor monitoring mechanisms that glib cannot cooperate with
+ * (io_uring) are switched off.
+ */
+void aio_context_use_g_source(AioContext *ctx);
+
+/**
+ * aio_context_set_poll_params:
+ * @ctx: the aio context
+ * @max_ns: how long to busy poll for, in nanoseconds
+ * @grow: polling time growth factor, or 0 to double it
+ * @shrink: polling time shrink divisor, or 0 to reset it to 0
+ *
+ * Poll mode can be disabled by setting poll_max_ns to 0.
+ */
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink,
+                                 Error **errp);
+
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: number of worker threads kept around even when idle
+ * @max: maximum number of worker threads
+ * @idle_timeout: how long a worker above @min may sit idle before it exits,
+ *                in milliseconds
+ *
+ * The values apply to the thread pool returned by aio_get_thread_pool(),
+ * whether it already exists or not.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, int64_t idle_timeout,
+                                        Error **errp);
+
 #endif
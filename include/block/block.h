@@ -44,6 +44,10 @@ typedef struct BlockDriverInfo {
      * True if this block driver only supports compressed writes
      */
     bool needs_compressed_writes;
+    /*
+     * True if one compressed write may cover several clusters
+     */
+    bool can_compress_multiple_clusters;
 } BlockDriverInfo;
 
 typedef struct BlockFragInfo {
@@ -98,6 +102,7 @@ typedef struct HDGeometry {
                                       select an appropriate protocol driver,
                                       ignoring the format layer */
 #define BDRV_O_NO_IO       0x10000 /* don't initialize for I/O */
+#define BDRV_O_IO_URING    0x20000 /* use io_uring instead of the thread pool */
 
 #define BDRV_O_CACHE_MASK  (BDRV_O_NOCACHE | BDRV_O_NO_FLUSH)
 
@@ -204,6 +209,7 @@ void bdrv_replace_in_backing_chain(BlockDriverState *old,
 
 int bdrv_parse_cache_mode(const char *mode, int *flags, bool *writethrough);
 int bdrv_parse_discard_flags(const char *mode, int *flags);
+int bdrv_parse_aio(const char *mode, int *flags);
 BdrvChild *bdrv_open_child(const char *filename,
                            QDict *options, const char *bdref_key,
                            BlockDriverState* parent,
@@ -248,6 +254,18 @@ int coroutine_fn bdrv_co_writev(BdrvChild *child, int64_t sector_num,
  */
 int coroutine_fn bdrv_co_pwrite_zeroes(BdrvChild *child, int64_t offset,
                                        int count, BdrvRequestFlags flags);
+/*
+ * Copy a range from @src to @dst without going through a bounce buffer,
+ * for example with copy_file_range() when both are files on the same host
+ * file system.  Returns -ENOTSUP if the drivers involved cannot offload the
+ * copy; callers are expected to fall back to reading and writing the data
+ * themselves.  The only flags honoured are BDRV_REQ_NO_SERIALISING, which
+ * applies to the source, and BDRV_REQ_ZERO_WRITE, which makes this a zero
+ * write to @dst.
+ */
+int coroutine_fn bdrv_co_copy_range(BdrvChild *src, int64_t src_offset,
+                                    BdrvChild *dst, int64_t dst_offset,
+                                    int bytes, BdrvRequestFlags flags);
 BlockDriverState *bdrv_find_backing_image(BlockDriverState *bs,
     const char *backing_file);
 int bdrv_get_backing_file_depth(BlockDriverState *bs);
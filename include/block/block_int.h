@@ -56,6 +56,8 @@
 #define BLOCK_OPT_NOCOW             "nocow"
 #define BLOCK_OPT_OBJECT_SIZE       "object_size"
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
+#define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
+#define BLOCK_OPT_EXTL2             "extended_l2"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -167,6 +169,24 @@ struct BlockDriver {
         int64_t offset, int count, BdrvRequestFlags flags);
     int coroutine_fn (*bdrv_co_pdiscard)(BlockDriverState *bs,
         int64_t offset, int count);
+
+    /*
+     * Offloaded copy between two nodes.  The source chain is walked first:
+     * a driver's .bdrv_co_copy_range_from() maps @src_offset and passes the
+     * request on with bdrv_co_copy_range_from() on the child that holds the
+     * data.  The protocol driver at the bottom turns around and calls
+     * bdrv_co_copy_range_to(), and the destination chain maps @dst_offset
+     * the same way until a protocol driver performs the copy.  Return
+     * -ENOTSUP if the copy cannot be offloaded.
+     */
+    int coroutine_fn (*bdrv_co_copy_range_from)(BlockDriverState *bs,
+        BdrvChild *src, int64_t src_offset,
+        BdrvChild *dst, int64_t dst_offset,
+        int count, BdrvRequestFlags flags);
+    int coroutine_fn (*bdrv_co_copy_range_to)(BlockDriverState *bs,
+        BdrvChild *src, int64_t src_offset,
+        BdrvChild *dst, int64_t dst_offset,
+        int count, BdrvRequestFlags flags);
     int64_t coroutine_fn (*bdrv_co_get_block_status)(BlockDriverState *bs,
         int64_t sector_num, int nb_sectors, int *pnum,
         BlockDriverState **file);
@@ -320,6 +340,22 @@ struct BlockDriver {
     void (*bdrv_del_child)(BlockDriverState *parent, BdrvChild *child,
                            Error **errp);
 
+    /**
+     * Persistent dirty bitmaps.  Bitmaps stored in the image are loaded as
+     * named dirty bitmaps by bdrv_open and written back by bdrv_inactivate
+     * and bdrv_close; these two callbacks only deal with the stored copy.
+     */
+    bool (*bdrv_can_store_new_dirty_bitmap)(BlockDriverState *bs,
+                                            const char *name,
+                                            uint32_t granularity,
+                                            Error **errp);
+    void (*bdrv_remove_persistent_dirty_bitmap)(BlockDriverState *bs,
+                                                const char *name,
+                                                Error **errp);
+    /* Called once a read-only node and its children were reopened
+     * read-write, to mark the stored bitmaps as in use again */
+    int (*bdrv_reopen_bitmaps_rw)(BlockDriverState *bs, Error **errp);
+
     QLIST_ENTRY(BlockDriver) list;
 };
 
@@ -568,6 +604,12 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
 int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
     int64_t offset, unsigned int bytes, QEMUIOVector *qiov,
     BdrvRequestFlags flags);
+int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, int64_t src_offset,
+                                         BdrvChild *dst, int64_t dst_offset,
+                                         int bytes, BdrvRequestFlags flags);
+int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, int64_t src_offset,
+                                       BdrvChild *dst, int64_t dst_offset,
+                                       int bytes, BdrvRequestFlags flags);
 
 int get_tmp_filename(char *filename, int size);
 BlockDriver *bdrv_probe_all(const uint8_t *buf, int buf_size,
@@ -0,0 +1,68 @@
+/*
+ * Adaptive request limits of the mirror block job
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#ifndef BLOCK_MIRROR_ADAPT_H
+#define BLOCK_MIRROR_ADAPT_H
+
+/* Each adjustment looks at the requests that completed in the last
+ * MIRROR_ADAPT_INTERVAL nanoseconds, if there were at least
+ * MIRROR_ADAPT_MIN_OPS of them.
+ */
+#define MIRROR_ADAPT_INTERVAL 100000000LL
+#define MIRROR_ADAPT_MIN_OPS 4
+#define MIRROR_ADAPT_MAX_IN_FLIGHT 64
+
+typedef struct MirrorAdapt {
+    /* Current limits */
+    int max_in_flight;
+    int max_io_sectors;
+    /* Range of max_io_sectors */
+    int io_sectors_min;
+    int io_sectors_max;
+
+    /* Completed copies since start_ns */
+    int64_t start_ns;
+    uint64_t bytes;
+    uint64_t latency_ns;
+    int ops;
+    /* Whether the job ran out of requests or buffers since start_ns;
+     * if it did not, throughput was limited by the amount of dirty data */
+    bool saturated;
+
+    /* Measurements of the last adjustment */
+    uint64_t last_throughput;
+    uint64_t last_latency;
+    uint64_t min_latency;
+    /* Whether the next step changes the request size or the request count */
+    bool io_size;
+    /* Limits before the last step, restored if throughput drops after it */
+    bool stepped;
+    int prev_in_flight;
+    int prev_io_sectors;
+} MirrorAdapt;
+
+/*
+ * mirror_adapt_init:
+ *
+ * Start tuning from @max_in_flight requests of @max_io_sectors each;
+ * the request size stays between @io_sectors_min and @io_sectors_max.
+ */
+void mirror_adapt_init(MirrorAdapt *a, int max_in_flight, int max_io_sectors,
+                       int io_sectors_min, int io_sectors_max, int64_t now);
+
+/*
+ * mirror_adapt_request_done:
+ *
+ * Account a copy of @bytes that took @latency_ns and completed at @now,
+ * and adjust the limits once an interval has passed.
+ *
+ * Returns: true if the limits were reconsidered; last_throughput and
+ * last_latency then hold the measurements they were based on.
+ */
+bool mirror_adapt_request_done(MirrorAdapt *a, uint64_t bytes,
+                               uint64_t latency_ns, int64_t now);
+
+#endif
@@ -24,8 +24,27 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+/* Default worker limits, used until aio_context_set_thread_pool_params()
+ * is called on the pool's AioContext.
+ */
+#define THREAD_POOL_MIN_THREADS_DEFAULT     0
+#define THREAD_POOL_MAX_THREADS_DEFAULT     64
+#define THREAD_POOL_IDLE_TIMEOUT_DEFAULT    10000   /* milliseconds */
+
+typedef struct ThreadPoolStats {
+    int cur_threads;            /* workers, including those being created */
+    int idle_threads;           /* workers waiting for a request */
+    int queue_depth;            /* requests not yet picked up by a worker */
+    uint64_t requests;          /* requests picked up by a worker */
+    uint64_t stolen;            /* ... from another worker's queue */
+    uint64_t total_wait_ns;     /* time spent queued by those requests */
+    uint64_t max_wait_ns;
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
+void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
@@ -270,6 +270,15 @@ void tb_free(TranslationBlock *tb);
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 
+#if !defined(CONFIG_USER_ONLY)
+void tb_prefetch_note(TranslationBlock *tb, target_ulong pc);
+bool tb_prefetch_run(void);
+#else
+static inline void tb_prefetch_note(TranslationBlock *tb, target_ulong pc)
+{
+}
+#endif
+
 #if defined(USE_DIRECT_JUMP)
 
 #if defined(CONFIG_TCG_INTERPRETER)
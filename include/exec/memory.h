@@ -197,6 +197,8 @@ struct MemoryRegion {
     int32_t priority;
     QTAILQ_HEAD(subregions, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
+    QTAILQ_HEAD(aliases, MemoryRegion) aliases;
+    QTAILQ_ENTRY(MemoryRegion) aliases_link;
     QTAILQ_HEAD(coalesced_ranges, CoalescedMemoryRange) coalesced;
     const char *name;
     unsigned ioeventfd_nb;
@@ -36,6 +36,12 @@ struct RAMBlock {
     /* RCU-enabled, writes protected by the ramlist lock */
     QLIST_ENTRY(RAMBlock) next;
     int fd;
+    /* x-mapped-ram migration: pages stored in the file, and where the
+     * bitmap and the pages of the block are in it
+     */
+    unsigned long *file_bmap;
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
 };
 
 static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
@@ -419,8 +425,10 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(unsigned long *dest,
             if (src[idx][offset]) {
                 unsigned long bits = atomic_xchg(&src[idx][offset], 0);
                 unsigned long new_dirty;
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
+                /* @dest words at either end of the range may be shared
+                 * with a range synced by another thread.
+                 */
+                new_dirty = ~atomic_fetch_or(&dest[k], bits);
                 new_dirty &= bits;
                 num_dirty += ctpopl(new_dirty);
             }
@@ -439,7 +447,8 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(unsigned long *dest,
                         TARGET_PAGE_SIZE,
                         DIRTY_MEMORY_MIGRATION)) {
                 long k = (start + addr) >> TARGET_PAGE_BITS;
-                if (!test_and_set_bit(k, dest)) {
+                /* Ranges that are not word aligned share @dest words too */
+                if (!test_and_set_bit_atomic(k, dest)) {
                     num_dirty++;
                 }
             }
@@ -26,19 +26,48 @@
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
+/* The code buffer is split into at most TB_REGION_COUNT regions of at
+ * least TB_REGION_MIN_SIZE bytes each.  Regions are filled in order and,
+ * once the buffer is full, recycled oldest first.
+ */
+#define TB_REGION_COUNT          8
+#define TB_REGION_MIN_SIZE       (1 * 1024 * 1024)
+
 typedef struct TranslationBlock TranslationBlock;
 typedef struct TBContext TBContext;
+typedef struct TBRegion TBRegion;
+
+struct TBRegion {
+    void *start;
+    void *end;
+    /* end of the generated code; only valid if this is not the
+       current region (use tcg_ctx.code_gen_ptr for that one) */
+    void *ptr;
+    /* slice of TBContext.tbs holding the TBs of this region */
+    TranslationBlock *tbs;
+    int nb_tbs;
+};
 
 struct TBContext {
 
     TranslationBlock *tbs;
     struct qht htable;
+    /* number of live TBs, summed over all regions */
     int nb_tbs;
+
+    TBRegion regions[TB_REGION_COUNT];
+    int nb_regions;
+    int cur_region;
+    size_t region_size;
+    int region_max_blocks;
     /* any access to the tbs or the page table must use this lock */
     QemuMutex tb_lock;
 
     /* statistics */
     int tb_flush_count;
+    int tb_region_evict_count;
+    int tb_evict_count;
+    int tb_prefetch_count;
     int tb_phys_invalidate_count;
 };
 
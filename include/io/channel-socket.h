@@ -48,6 +48,9 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    /* sendmsg() calls made with MSG_ZEROCOPY, and those completed */
+    uint64_t zero_copy_queued;
+    uint64_t zero_copy_sent;
 };
 
 
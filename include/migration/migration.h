@@ -160,6 +160,9 @@ struct MigrationState
     int64_t xbzrle_cache_size;
     int64_t setup_time;
     int64_t dirty_sync_count;
+    /* Duration of the last and of all dirty bitmap syncs, in us */
+    int64_t dirty_sync_time;
+    int64_t dirty_sync_time_total;
     /* Count of requests incoming from destination */
     int64_t postcopy_requests;
 
@@ -189,6 +192,10 @@ void qemu_start_incoming_migration(const char *uri, Error **errp);
 
 void migration_channel_process_incoming(MigrationState *s,
                                         QIOChannel *ioc);
+/* False while multifd connections are still expected on the listener */
+bool migration_has_all_channels(void);
+/* A multifd channel is running, or has failed with @err */
+void migration_multifd_channel_ready(Error *err);
 
 void migration_tls_channel_process_incoming(MigrationState *s,
                                             QIOChannel *ioc,
@@ -221,11 +228,17 @@ void fd_start_incoming_migration(const char *path, Error **errp);
 
 void fd_start_outgoing_migration(MigrationState *s, const char *fdname, Error **errp);
 
+void file_start_incoming_migration(const char *filename, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp);
+
 void rdma_start_outgoing_migration(void *opaque, const char *host_port, Error **errp);
 
 void rdma_start_incoming_migration(const char *host_port, Error **errp);
 
 void migrate_fd_error(MigrationState *s, const Error *error);
+void migrate_set_error(MigrationState *s, const Error *error);
 
 void migrate_fd_connect(MigrationState *s);
 
@@ -246,6 +259,14 @@ void migrate_compress_threads_create(void);
 void migrate_compress_threads_join(void);
 void migrate_decompress_threads_create(void);
 void migrate_decompress_threads_join(void);
+int multifd_save_setup(QIOChannel *ioc, Error **errp);
+void multifd_save_shutdown(void);
+void multifd_save_cleanup(void);
+void multifd_load_setup(void);
+void multifd_load_cleanup(void);
+void multifd_recv_new_channel(QIOChannel *ioc);
+bool multifd_recv_all_channels_accepted(void);
+bool multifd_recv_all_channels_created(void);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_transferred(void);
 uint64_t ram_bytes_total(void);
@@ -262,6 +283,8 @@ uint64_t norm_mig_pages_transferred(void);
 uint64_t xbzrle_mig_bytes_transferred(void);
 uint64_t xbzrle_mig_pages_transferred(void);
 uint64_t xbzrle_mig_pages_overflow(void);
+uint64_t xbzrle_mig_pages_cache_hit(void);
+double xbzrle_mig_cache_hit_rate(void);
 uint64_t xbzrle_mig_pages_cache_miss(void);
 double xbzrle_mig_cache_miss_rate(void);
 
@@ -296,6 +319,31 @@ bool migrate_auto_converge(void);
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
+bool test_xbzrle_next_accel(void);
+
+typedef struct MigrationCompressCtx MigrationCompressCtx;
+
+bool migration_compress_supported(MigrationCompressMethod method);
+int migration_compress_level_max(MigrationCompressMethod method);
+size_t migration_compress_bound(MigrationCompressMethod method, size_t size);
+MigrationCompressCtx *migration_compress_ctx_new(void);
+void migration_compress_ctx_free(MigrationCompressCtx *ctx);
+ssize_t migration_compress(MigrationCompressCtx *ctx,
+                           MigrationCompressMethod method, int level,
+                           uint8_t *dst, size_t dlen,
+                           const uint8_t *src, size_t slen);
+ssize_t migration_decompress(MigrationCompressCtx *ctx,
+                             MigrationCompressMethod method,
+                             uint8_t *dst, size_t dlen,
+                             const uint8_t *src, size_t slen);
+
+bool migrate_use_multifd(void);
+bool migrate_use_mapped_ram(void);
+bool migrate_use_zero_copy_send(void);
+int migrate_multifd_channels(void);
+int migrate_multifd_page_count(void);
+/* Upper bound of the x-multifd-page-count parameter */
+#define MULTIFD_PAGE_COUNT_MAX 1024
 
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
@@ -304,6 +352,7 @@ int64_t xbzrle_cache_resize(int64_t new_size);
 
 bool migrate_use_compression(void);
 int migrate_compress_level(void);
+MigrationCompressMethod migrate_compress_method(void);
 int migrate_compress_threads(void);
 int migrate_decompress_threads(void);
 bool migrate_use_events(void);
@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is set associative, indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -37,7 +37,8 @@ PageCache *cache_init(int64_t num_pages, unsigned int page_size);
 void cache_fini(PageCache *cache);
 
 /**
- * cache_is_cached: Checks to see if the page is cached
+ * cache_is_cached: Checks to see if the page is cached, and marks it
+ * as most recently used if so
  *
  * Returns %true if page is cached
  *
@@ -45,8 +46,7 @@ void cache_fini(PageCache *cache);
  * @addr: page addr
  * @current_age: current bitmap generation
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age);
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age);
 
 /**
  * get_cached_data: Get the data cached for an addr
@@ -60,7 +60,10 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 
 /**
  * cache_insert: insert the page into the cache. the page cache
- * will dup the data on insert. the previous value will be overwritten
+ * will dup the data on insert. the previous value will be overwritten.
+ * A page that is not cached yet replaces the least recently used page
+ * among those sharing its set, unless that page was used in the last
+ * two bitmap generations.
  *
  * Returns -1 when the page isn't inserted into cache
  *
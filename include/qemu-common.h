@@ -77,6 +77,7 @@ int qemu_openpty_raw(int *aslave, char *pty_name);
 #endif
 
 void tcg_exec_init(unsigned long tb_size);
+void tcg_exec_enable_prefetch(void);
 bool tcg_enabled(void);
 
 void cpu_exec_init_all(void);
@@ -53,6 +53,19 @@ static inline void set_bit_atomic(long nr, unsigned long *addr)
     atomic_or(p, mask);
 }
 
+/**
+ * test_and_set_bit_atomic - Set a bit atomically and return its old value
+ * @nr: Bit to set
+ * @addr: Address to count from
+ */
+static inline int test_and_set_bit_atomic(long nr, unsigned long *addr)
+{
+    unsigned long mask = BIT_MASK(nr);
+    unsigned long *p = addr + BIT_WORD(nr);
+
+    return (atomic_fetch_or(p, mask) & mask) != 0;
+}
+
 /**
  * clear_bit - Clears a bit in memory
  * @nr: Bit to clear
@@ -145,6 +145,89 @@ void hbitmap_reset_all(HBitmap *hb);
  */
 bool hbitmap_get(const HBitmap *hb, uint64_t item);
 
+/**
+ * hbitmap_serialization_granularity:
+ * @hb: HBitmap to operate on.
+ *
+ * Return the granularity, in items, of the chunks a bitmap can be
+ * (de)serialized in: each chunk but the last one must start and end at a
+ * multiple of it.  This is the same on 32-bit and 64-bit hosts, so that
+ * the serialized form can be exchanged between them.
+ */
+uint64_t hbitmap_serialization_granularity(const HBitmap *hb);
+
+/**
+ * hbitmap_serialization_size:
+ * @hb: HBitmap to operate on.
+ * @start: First item to serialize.
+ * @count: Number of items to serialize.
+ *
+ * Return the number of bytes hbitmap_serialize_part needs for the range.
+ */
+uint64_t hbitmap_serialization_size(const HBitmap *hb,
+                                    uint64_t start, uint64_t count);
+
+/**
+ * hbitmap_serialize_part:
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer to store the serialized data in.
+ * @start: First item to serialize.
+ * @count: Number of items to serialize.
+ *
+ * Store the bits of a range of the bitmap in @buf: one bit per group of
+ * 2^granularity items, least significant bit of the first byte first.
+ */
+void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
+                            uint64_t start, uint64_t count);
+
+/**
+ * hbitmap_deserialize_part:
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer with data in the format of hbitmap_serialize_part.
+ * @start: First item to restore.
+ * @count: Number of items to restore.
+ * @finish: Whether to call hbitmap_deserialize_finish automatically.
+ *
+ * Restore a range of the bitmap from @buf.  If @finish is false, the
+ * bitmap must not be used until hbitmap_deserialize_finish is called.
+ */
+void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
+                              uint64_t start, uint64_t count,
+                              bool finish);
+
+/**
+ * hbitmap_deserialize_zeroes:
+ * @hb: HBitmap to operate on.
+ * @start: First item to restore.
+ * @count: Number of items to restore.
+ * @finish: Whether to call hbitmap_deserialize_finish automatically.
+ *
+ * Like hbitmap_deserialize_part, for a range where all bits are clear.
+ */
+void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
+                                bool finish);
+
+/**
+ * hbitmap_deserialize_ones:
+ * @hb: HBitmap to operate on.
+ * @start: First item to restore.
+ * @count: Number of items to restore.
+ * @finish: Whether to call hbitmap_deserialize_finish automatically.
+ *
+ * Like hbitmap_deserialize_part, for a range where all bits are set.
+ */
+void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
+                              bool finish);
+
+/**
+ * hbitmap_deserialize_finish:
+ * @hb: HBitmap to operate on.
+ *
+ * Rebuild the upper levels and the count of set bits after the bottom
+ * level was restored with hbitmap_deserialize_*.
+ */
+void hbitmap_deserialize_finish(HBitmap *hb);
+
 /**
  * hbitmap_free:
  * @hb: HBitmap to operate on.
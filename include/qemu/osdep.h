@@ -383,7 +383,19 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
-void os_mem_prealloc(int fd, char *area, size_t sz, Error **errp);
+/**
+ * os_mem_prealloc:
+ * @fd: file descriptor backing @area, or -1
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory to preallocate
+ * @max_threads: upper bound on the number of threads touching the pages
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Fault in every host page of @area, splitting the work among up to
+ * @max_threads threads (further limited by the number of host CPUs).
+ */
+void os_mem_prealloc(int fd, char *area, size_t sz, int max_threads,
+                     Error **errp);
 
 int qemu_read_password(char *buf, int buf_size);
 
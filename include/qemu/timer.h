@@ -67,7 +67,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* orders timers with the same expire_time */
+    unsigned heap_index;        /* position in the timer list's heap */
     int scale;
 };
 
@@ -28,6 +28,16 @@ typedef struct {
     QemuCond init_done_cond;    /* is thread initialization done? */
     bool stopping;
     int thread_id;
+
+    /* AioContext poll parameters */
+    int64_t poll_max_ns;
+    int64_t poll_grow;
+    int64_t poll_shrink;
+
+    /* Thread pool parameters */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+    int64_t thread_pool_idle_timeout;
 } IOThread;
 
 #define IOTHREAD(obj) \
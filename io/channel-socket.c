@@ -25,6 +25,11 @@
 #include "trace.h"
 #include "qapi/clone-visitor.h"
 
+#if defined(CONFIG_LINUX) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define QEMU_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+
 #define SOCKET_MAX_FDS 16
 
 SocketAddress *
@@ -159,6 +164,18 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
+#ifdef QEMU_MSG_ZEROCOPY
+    {
+        int v = 1;
+
+        /* Only has an effect on the writes that ask for it */
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+            QIO_CHANNEL(ioc)->features |=
+                (1 << QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        }
+    }
+#endif
+
     return 0;
 }
 
@@ -516,12 +533,82 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     return ret;
 }
 
-static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
-                                         const struct iovec *iov,
-                                         size_t niov,
-                                         int *fds,
-                                         size_t nfds,
-                                         Error **errp)
+#ifdef QEMU_MSG_ZEROCOPY
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    struct msghdr msg = { NULL, };
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(*serr))];
+    int ret = 1;
+
+    if (sioc->zero_copy_sent == sioc->zero_copy_queued) {
+        return 0;
+    }
+
+    /*
+     * Each completion on the error queue covers a range of the
+     * sendmsg() calls made with MSG_ZEROCOPY, counted from zero.
+     */
+    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sioc->fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN) {
+                qio_channel_wait(ioc, G_IO_ERR);
+                continue;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno,
+                             "Unable to read socket error queue");
+            return -1;
+        }
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg ||
+            !((cmsg->cmsg_level == SOL_IP &&
+               cmsg->cmsg_type == IP_RECVERR) ||
+              (cmsg->cmsg_level == SOL_IPV6 &&
+               cmsg->cmsg_type == IPV6_RECVERR))) {
+            error_setg_errno(errp, EPROTO,
+                             "Unexpected message in socket error queue");
+            return -1;
+        }
+
+        serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        if (serr->ee_errno != 0) {
+            error_setg_errno(errp, serr->ee_errno, "Error on socket");
+            return -1;
+        }
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            error_setg_errno(errp, EPROTO,
+                             "Unexpected error origin %d in socket error "
+                             "queue", serr->ee_origin);
+            return -1;
+        }
+
+        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+#endif
+
+static ssize_t qio_channel_socket_sendmsg(QIOChannel *ioc,
+                                          const struct iovec *iov,
+                                          size_t niov,
+                                          int *fds,
+                                          size_t nfds,
+                                          int flags,
+                                          Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
     ssize_t ret;
@@ -554,7 +641,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     }
 
  retry:
-    ret = sendmsg(sioc->fd, &msg, 0);
+    ret = sendmsg(sioc->fd, &msg, flags);
     if (ret <= 0) {
         if (errno == EAGAIN) {
             return QIO_CHANNEL_ERR_BLOCK;
@@ -562,12 +649,56 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         if (errno == EINTR) {
             goto retry;
         }
+#ifdef QEMU_MSG_ZEROCOPY
+        if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+            /*
+             * Too many completions are pending, or the pages would
+             * take us over the locked memory limit.  Reaping the
+             * completions helps in the first case only.
+             */
+            if (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+                if (qio_channel_socket_flush(ioc, errp) < 0) {
+                    return -1;
+                }
+                goto retry;
+            }
+            error_setg_errno(errp, errno,
+                             "Unable to lock memory for a zero copy write");
+            return -1;
+        }
+#endif
         error_setg_errno(errp, errno,
                          "Unable to write to socket");
         return -1;
     }
+#ifdef QEMU_MSG_ZEROCOPY
+    if (flags & MSG_ZEROCOPY) {
+        sioc->zero_copy_queued++;
+    }
+#endif
     return ret;
 }
+
+static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
+                                         const struct iovec *iov,
+                                         size_t niov,
+                                         int *fds,
+                                         size_t nfds,
+                                         Error **errp)
+{
+    return qio_channel_socket_sendmsg(ioc, iov, niov, fds, nfds, 0, errp);
+}
+
+#ifdef QEMU_MSG_ZEROCOPY
+static ssize_t qio_channel_socket_writev_zero_copy(QIOChannel *ioc,
+                                                   const struct iovec *iov,
+                                                   size_t niov,
+                                                   Error **errp)
+{
+    return qio_channel_socket_sendmsg(ioc, iov, niov, NULL, 0,
+                                      MSG_ZEROCOPY, errp);
+}
+#endif
 #else /* WIN32 */
 static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
                                         const struct iovec *iov,
@@ -771,6 +902,10 @@ static void qio_channel_socket_class_init(ObjectClass *klass,
     ioc_klass->io_set_cork = qio_channel_socket_set_cork;
     ioc_klass->io_set_delay = qio_channel_socket_set_delay;
     ioc_klass->io_create_watch = qio_channel_socket_create_watch;
+#ifdef QEMU_MSG_ZEROCOPY
+    ioc_klass->io_writev_zero_copy = qio_channel_socket_writev_zero_copy;
+    ioc_klass->io_flush = qio_channel_socket_flush;
+#endif
 }
 
 static const TypeInfo qio_channel_socket_info = {
@@ -16,10 +16,13 @@
 #include "qom/object_interfaces.h"
 #include "qemu/module.h"
 #include "block/aio.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qmp-commands.h"
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
 
 typedef ObjectClass IOThreadClass;
 
@@ -28,6 +31,12 @@ typedef ObjectClass IOThreadClass;
 #define IOTHREAD_CLASS(klass) \
    OBJECT_CLASS_CHECK(IOThreadClass, klass, TYPE_IOTHREAD)
 
+/* Benchmark results from 2016 on NVMe SSD drives show max polling times around
+ * 16-32 microseconds yield IOPS improvements for both iodepth=1 and iodepth=32
+ * workloads.
+ */
+#define IOTHREAD_POLL_MAX_NS_DEFAULT 32768ULL
+
 static void *iothread_run(void *opaque)
 {
     IOThread *iothread = opaque;
@@ -68,6 +77,16 @@ static int iothread_stop(Object *object, void *opaque)
     return 0;
 }
 
+static void iothread_instance_init(Object *obj)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_pool_min = THREAD_POOL_MIN_THREADS_DEFAULT;
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    iothread->thread_pool_idle_timeout = THREAD_POOL_IDLE_TIMEOUT_DEFAULT;
+}
+
 static void iothread_instance_finalize(Object *obj)
 {
     IOThread *iothread = IOTHREAD(obj);
@@ -92,6 +111,25 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_poll_params(iothread->ctx,
+                                iothread->poll_max_ns,
+                                iothread->poll_grow,
+                                iothread->poll_shrink,
+                                &local_error);
+    if (!local_error) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           iothread->thread_pool_idle_timeout,
+                                           &local_error);
+    }
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     qemu_mutex_init(&iothread->init_done_lock);
     qemu_cond_init(&iothread->init_done_cond);
 
@@ -114,10 +152,136 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
     qemu_mutex_unlock(&iothread->init_done_lock);
 }
 
+typedef struct {
+    const char *name;
+    ptrdiff_t offset; /* field's byte offset in IOThread struct */
+} IOThreadParamInfo;
+
+static IOThreadParamInfo poll_max_ns_info = {
+    "poll-max-ns", offsetof(IOThread, poll_max_ns),
+};
+static IOThreadParamInfo poll_grow_info = {
+    "poll-grow", offsetof(IOThread, poll_grow),
+};
+static IOThreadParamInfo poll_shrink_info = {
+    "poll-shrink", offsetof(IOThread, poll_shrink),
+};
+static IOThreadParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static IOThreadParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
+static IOThreadParamInfo thread_pool_idle_timeout_info = {
+    "thread-pool-idle-timeout", offsetof(IOThread, thread_pool_idle_timeout),
+};
+
+static void iothread_get_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+
+    visit_type_int64(v, name, field, errp);
+}
+
+static void iothread_set_poll_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value;
+
+    visit_type_int64(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (value < 0) {
+        error_setg(&local_err, "%s value must be in range [0, %"PRId64"]",
+                   info->name, INT64_MAX);
+        goto out;
+    }
+
+    *field = value;
+
+    if (iothread->ctx) {
+        aio_context_set_poll_params(iothread->ctx,
+                                    iothread->poll_max_ns,
+                                    iothread->poll_grow,
+                                    iothread->poll_shrink,
+                                    &local_err);
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value, old;
+
+    visit_type_int64(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    old = *field;
+    *field = value;
+
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           iothread->thread_pool_idle_timeout,
+                                           &local_err);
+        if (local_err) {
+            *field = old;
+        }
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
     ucc->complete = iothread_complete;
+
+    object_class_property_add(klass, "poll-max-ns", "int",
+                              iothread_get_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_max_ns_info, &error_abort);
+    object_class_property_add(klass, "poll-grow", "int",
+                              iothread_get_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_grow_info, &error_abort);
+    object_class_property_add(klass, "poll-shrink", "int",
+                              iothread_get_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-min", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_min_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-max", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_max_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-idle-timeout", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_idle_timeout_info,
+                              &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -125,6 +289,7 @@ static const TypeInfo iothread_info = {
     .parent = TYPE_OBJECT,
     .class_init = iothread_class_init,
     .instance_size = sizeof(IOThread),
+    .instance_init = iothread_instance_init,
     .instance_finalize = iothread_instance_finalize,
     .interfaces = (InterfaceInfo[]) {
         {TYPE_USER_CREATABLE},
@@ -155,6 +320,7 @@ static int query_one_iothread(Object *object, void *opaque)
     IOThreadInfoList *elem;
     IOThreadInfo *info;
     IOThread *iothread;
+    ThreadPool *pool;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
     if (!iothread) {
@@ -164,6 +330,29 @@ static int query_one_iothread(Object *object, void *opaque)
     info = g_new0(IOThreadInfo, 1);
     info->id = iothread_get_id(iothread);
     info->thread_id = iothread->thread_id;
+    info->poll_max_ns = iothread->poll_max_ns;
+    info->poll_grow = iothread->poll_grow;
+    info->poll_shrink = iothread->poll_shrink;
+    info->thread_pool_min = iothread->thread_pool_min;
+    info->thread_pool_max = iothread->thread_pool_max;
+    info->thread_pool_idle_timeout = iothread->thread_pool_idle_timeout;
+
+    pool = iothread->ctx ? atomic_read(&iothread->ctx->thread_pool) : NULL;
+    if (pool) {
+        ThreadPoolStats stats;
+
+        thread_pool_get_stats(pool, &stats);
+        info->has_thread_pool = true;
+        info->thread_pool = g_new0(ThreadPoolInfo, 1);
+        info->thread_pool->cur_threads = stats.cur_threads;
+        info->thread_pool->idle_threads = stats.idle_threads;
+        info->thread_pool->queue_depth = stats.queue_depth;
+        info->thread_pool->requests = stats.requests;
+        info->thread_pool->stolen = stats.stolen;
+        info->thread_pool->avg_wait_ns =
+            stats.requests ? stats.total_wait_ns / stats.requests : 0;
+        info->thread_pool->max_wait_ns = stats.max_wait_ns;
+    }
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
@@ -714,6 +714,190 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     return view;
 }
 
+/* Parts of the flat views that the current transaction may have changed.
+ * Each entry is an absolute range in the address spaces rooted at @root.
+ * When too many ranges pile up, or for changes that are not tied to one
+ * region, the whole view is rendered again.
+ */
+typedef struct FlatViewDirtyRange {
+    MemoryRegion *root;
+    AddrRange addr;
+} FlatViewDirtyRange;
+
+#define FLATVIEW_DIRTY_MAX      16
+#define FLATVIEW_DIRTY_WALK_MAX 64
+
+static FlatViewDirtyRange flatview_dirty[FLATVIEW_DIRTY_MAX];
+static unsigned flatview_dirty_nb;
+static bool flatview_dirty_all;
+
+static void flatview_dirty_add(MemoryRegion *root, AddrRange addr)
+{
+    FlatViewDirtyRange *d;
+    unsigned i;
+
+    addr = addrrange_intersection(addr, addrrange_make(int128_zero(),
+                                                       int128_2_64()));
+    for (i = 0; i < flatview_dirty_nb; i++) {
+        d = &flatview_dirty[i];
+        if (d->root == root
+            && int128_le(d->addr.start, addrrange_end(addr))
+            && int128_le(addr.start, addrrange_end(d->addr))) {
+            Int128 start = int128_min(d->addr.start, addr.start);
+            Int128 end = int128_max(addrrange_end(d->addr),
+                                    addrrange_end(addr));
+            d->addr = addrrange_make(start, int128_sub(end, start));
+            return;
+        }
+    }
+    if (flatview_dirty_nb == FLATVIEW_DIRTY_MAX) {
+        flatview_dirty_all = true;
+        return;
+    }
+    flatview_dirty[flatview_dirty_nb++] = (FlatViewDirtyRange) {
+        .root = root,
+        .addr = addr,
+    };
+}
+
+static bool memory_region_is_address_space_root(MemoryRegion *mr)
+{
+    AddressSpace *as;
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        if (mr == as->root) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Record every place where @range (relative to the start of @mr) is
+ * visible: through the container chain and through any alias of @mr
+ * or of one of its containers.  Address spaces can be rooted anywhere
+ * in the chain, not just at its top.
+ */
+static void flatview_dirty_walk(MemoryRegion *mr, AddrRange range,
+                                unsigned *budget)
+{
+    AddrRange extent = addrrange_make(int128_zero(), mr->size);
+    MemoryRegion *alias;
+
+    if (flatview_dirty_all || !addrrange_intersects(range, extent)) {
+        return;
+    }
+    if (!*budget) {
+        flatview_dirty_all = true;
+        return;
+    }
+    --*budget;
+
+    range = addrrange_intersection(range, extent);
+    QTAILQ_FOREACH(alias, &mr->aliases, aliases_link) {
+        flatview_dirty_walk(alias,
+                            addrrange_shift(range,
+                                int128_neg(int128_make64(alias->alias_offset))),
+                            budget);
+    }
+    range = addrrange_shift(range, int128_make64(mr->addr));
+    if (!mr->container || memory_region_is_address_space_root(mr)) {
+        flatview_dirty_add(mr, range);
+    }
+    if (mr->container) {
+        flatview_dirty_walk(mr->container, range, budget);
+    }
+}
+
+/* Note that the rendering of @mr is about to change, or just did. */
+static void memory_region_dirty_flatview(MemoryRegion *mr)
+{
+    unsigned budget = FLATVIEW_DIRTY_WALK_MAX;
+
+    flatview_dirty_walk(mr, addrrange_make(int128_zero(), mr->size), &budget);
+}
+
+/* Build the flat view of @root from @old_view, rendering again only the
+ * dirty ranges recorded for @root.  The result is the same as
+ * generate_memory_topology(@root).
+ */
+static FlatView *flatview_update(FlatView *old_view, MemoryRegion *root)
+{
+    AddrRange dirty[FLATVIEW_DIRTY_MAX];
+    AddrRange tmp;
+    unsigned nb = 0;
+    unsigned i, j;
+    FlatView *view;
+    FlatRange *fr, piece;
+    Int128 end;
+
+    /* Sort the ranges for @root and merge the overlapping ones. */
+    for (i = 0; i < flatview_dirty_nb; i++) {
+        if (flatview_dirty[i].root != root) {
+            continue;
+        }
+        tmp = flatview_dirty[i].addr;
+        for (j = nb; j > 0 && int128_lt(tmp.start, dirty[j - 1].start); j--) {
+            dirty[j] = dirty[j - 1];
+        }
+        dirty[j] = tmp;
+        nb++;
+    }
+    for (i = 1, j = 0; i < nb; i++) {
+        if (int128_le(dirty[i].start, addrrange_end(dirty[j]))) {
+            end = int128_max(addrrange_end(dirty[j]), addrrange_end(dirty[i]));
+            dirty[j].size = int128_sub(end, dirty[j].start);
+        } else {
+            dirty[++j] = dirty[i];
+        }
+    }
+    if (nb) {
+        nb = j + 1;
+    }
+
+    view = g_new(FlatView, 1);
+    flatview_init(view);
+
+    /* Keep whatever lies outside the dirty ranges... */
+    i = 0;
+    FOR_EACH_FLAT_RANGE(fr, old_view) {
+        piece = *fr;
+        while (i < nb && int128_le(addrrange_end(dirty[i]), piece.addr.start)) {
+            i++;
+        }
+        for (j = i; j < nb && int128_nz(piece.addr.size); j++) {
+            if (int128_ge(dirty[j].start, addrrange_end(piece.addr))) {
+                break;
+            }
+            if (int128_lt(piece.addr.start, dirty[j].start)) {
+                FlatRange head = piece;
+                head.addr.size = int128_sub(dirty[j].start, piece.addr.start);
+                flatview_insert(view, view->nr, &head);
+            }
+            end = int128_min(addrrange_end(dirty[j]),
+                             addrrange_end(piece.addr));
+            if (int128_gt(end, piece.addr.start)) {
+                piece.offset_in_region +=
+                    int128_get64(int128_sub(end, piece.addr.start));
+                piece.addr = addrrange_make(end,
+                                 int128_sub(addrrange_end(piece.addr), end));
+            }
+        }
+        if (int128_nz(piece.addr.size)) {
+            flatview_insert(view, view->nr, &piece);
+        }
+    }
+
+    /* ... and render the rest again. */
+    if (root) {
+        for (i = 0; i < nb; i++) {
+            render_memory_region(view, root, int128_zero(), dirty[i], false);
+        }
+    }
+    flatview_simplify(view);
+
+    return view;
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -879,7 +1063,13 @@ static void address_space_update_topology_pass(AddressSpace *as,
 static void address_space_update_topology(AddressSpace *as)
 {
     FlatView *old_view = address_space_get_flatview(as);
-    FlatView *new_view = generate_memory_topology(as->root);
+    FlatView *new_view;
+
+    if (flatview_dirty_all) {
+        new_view = generate_memory_topology(as->root);
+    } else {
+        new_view = flatview_update(old_view, as->root);
+    }
 
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
@@ -909,6 +1099,8 @@ static void memory_region_clear_pending(void)
 {
     memory_region_update_pending = false;
     ioeventfd_update_pending = false;
+    flatview_dirty_nb = 0;
+    flatview_dirty_all = false;
 }
 
 void memory_region_transaction_commit(void)
@@ -1070,6 +1262,7 @@ static void memory_region_initfn(Object *obj)
     mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
+    QTAILQ_INIT(&mr->aliases);
     QTAILQ_INIT(&mr->coalesced);
 
     op = object_property_add(OBJECT(mr), "container",
@@ -1369,6 +1562,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QTAILQ_INSERT_TAIL(&orig->aliases, mr, aliases_link);
 }
 
 void memory_region_init_rom(MemoryRegion *mr,
@@ -1436,6 +1630,14 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    if (mr->alias && QTAILQ_IN_USE(mr, aliases_link)) {
+        QTAILQ_REMOVE(&mr->alias->aliases, mr, aliases_link);
+    }
+    while (!QTAILQ_EMPTY(&mr->aliases)) {
+        MemoryRegion *alias = QTAILQ_FIRST(&mr->aliases);
+        QTAILQ_REMOVE(&mr->aliases, alias, aliases_link);
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -1577,6 +1779,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
+    memory_region_dirty_flatview(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -1628,6 +1831,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
+        memory_region_dirty_flatview(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -1638,6 +1842,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
+        memory_region_dirty_flatview(mr);
         memory_region_update_pending |= mr->enabled;
         memory_region_transaction_commit();
     }
@@ -1918,6 +2123,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
+    memory_region_dirty_flatview(subregion);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
@@ -1954,6 +2160,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
 {
     memory_region_transaction_begin();
     assert(subregion->container == mr);
+    memory_region_dirty_flatview(subregion);
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
@@ -1968,6 +2175,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
+    memory_region_dirty_flatview(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -1983,7 +2191,9 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    memory_region_dirty_flatview(mr);
     mr->size = s;
+    memory_region_dirty_flatview(mr);
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2006,8 +2216,11 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        memory_region_transaction_begin();
+        memory_region_dirty_flatview(mr);
         mr->addr = addr;
         memory_region_readd_subregion(mr);
+        memory_region_transaction_commit();
     }
 }
 
@@ -2021,6 +2234,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
+    memory_region_dirty_flatview(mr);
     memory_region_update_pending |= mr->enabled;
     memory_region_transaction_commit();
 }
@@ -2144,6 +2358,7 @@ void memory_global_dirty_log_start(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
+    flatview_dirty_all = true;
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 }
@@ -2154,6 +2369,7 @@ void memory_global_dirty_log_stop(void)
 
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
+    flatview_dirty_all = true;
     memory_region_update_pending = true;
     memory_region_transaction_commit();
 
@@ -2246,6 +2462,7 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_init_dispatch(as);
+    flatview_dirty_all = true;
     memory_region_update_pending |= root->enabled;
     memory_region_transaction_commit();
 }
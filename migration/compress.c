@@ -0,0 +1,189 @@
+/*
+ * Compression methods for live migration
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+#include "qemu/osdep.h"
+#include <zlib.h>
+#ifdef CONFIG_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+#include "qemu-common.h"
+#include "migration/migration.h"
+
+struct MigrationCompressCtx {
+#ifdef CONFIG_ZSTD
+    /* created on first use, reused for every buffer afterwards */
+    ZSTD_CCtx *zstd_cctx;
+    ZSTD_DCtx *zstd_dctx;
+#endif
+};
+
+bool migration_compress_supported(MigrationCompressMethod method)
+{
+    switch (method) {
+    case MIGRATION_COMPRESS_METHOD_ZLIB:
+        return true;
+#ifdef CONFIG_LZ4
+    case MIGRATION_COMPRESS_METHOD_LZ4:
+        return true;
+#endif
+#ifdef CONFIG_ZSTD
+    case MIGRATION_COMPRESS_METHOD_ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* Fixed so that the same levels are accepted whatever the build */
+int migration_compress_level_max(MigrationCompressMethod method)
+{
+    switch (method) {
+    case MIGRATION_COMPRESS_METHOD_LZ4:
+        return 12;
+    case MIGRATION_COMPRESS_METHOD_ZSTD:
+        return 22;
+    default:
+        return 9;
+    }
+}
+
+size_t migration_compress_bound(MigrationCompressMethod method, size_t size)
+{
+    switch (method) {
+#ifdef CONFIG_LZ4
+    case MIGRATION_COMPRESS_METHOD_LZ4:
+        return LZ4_compressBound(size);
+#endif
+#ifdef CONFIG_ZSTD
+    case MIGRATION_COMPRESS_METHOD_ZSTD:
+        return ZSTD_compressBound(size);
+#endif
+    default:
+        return compressBound(size);
+    }
+}
+
+MigrationCompressCtx *migration_compress_ctx_new(void)
+{
+    return g_new0(MigrationCompressCtx, 1);
+}
+
+void migration_compress_ctx_free(MigrationCompressCtx *ctx)
+{
+    if (!ctx) {
+        return;
+    }
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(ctx->zstd_cctx);
+    ZSTD_freeDCtx(ctx->zstd_dctx);
+#endif
+    g_free(ctx);
+}
+
+/*
+ * migration_compress: compress @slen bytes at @src into @dst
+ *
+ * Returns: the compressed size, or -1 if it does not fit in @dlen bytes
+ * or the method is not supported.
+ */
+ssize_t migration_compress(MigrationCompressCtx *ctx,
+                           MigrationCompressMethod method, int level,
+                           uint8_t *dst, size_t dlen,
+                           const uint8_t *src, size_t slen)
+{
+    switch (method) {
+    case MIGRATION_COMPRESS_METHOD_ZLIB: {
+        uLongf blen = dlen;
+
+        if (compress2(dst, &blen, src, slen, level) != Z_OK) {
+            return -1;
+        }
+        return blen;
+    }
+#ifdef CONFIG_LZ4
+    case MIGRATION_COMPRESS_METHOD_LZ4: {
+        int ret;
+
+        if (level == 0) {
+            ret = LZ4_compress_default((const char *)src, (char *)dst,
+                                       slen, dlen);
+        } else {
+            ret = LZ4_compress_HC((const char *)src, (char *)dst,
+                                  slen, dlen, level);
+        }
+        return ret > 0 ? ret : -1;
+    }
+#endif
+#ifdef CONFIG_ZSTD
+    case MIGRATION_COMPRESS_METHOD_ZSTD: {
+        size_t ret;
+
+        if (!ctx->zstd_cctx) {
+            ctx->zstd_cctx = ZSTD_createCCtx();
+            if (!ctx->zstd_cctx) {
+                return -1;
+            }
+        }
+        ret = ZSTD_compressCCtx(ctx->zstd_cctx, dst, dlen, src, slen, level);
+        return ZSTD_isError(ret) ? -1 : ret;
+    }
+#endif
+    default:
+        return -1;
+    }
+}
+
+/*
+ * migration_decompress: decompress @slen bytes at @src into @dst
+ *
+ * Returns: the decompressed size, or -1 on corrupted input, if the
+ * result does not fit in @dlen bytes or the method is not supported.
+ */
+ssize_t migration_decompress(MigrationCompressCtx *ctx,
+                             MigrationCompressMethod method,
+                             uint8_t *dst, size_t dlen,
+                             const uint8_t *src, size_t slen)
+{
+    switch (method) {
+    case MIGRATION_COMPRESS_METHOD_ZLIB: {
+        uLongf blen = dlen;
+
+        if (uncompress(dst, &blen, src, slen) != Z_OK) {
+            return -1;
+        }
+        return blen;
+    }
+#ifdef CONFIG_LZ4
+    case MIGRATION_COMPRESS_METHOD_LZ4: {
+        int ret = LZ4_decompress_safe((const char *)src, (char *)dst,
+                                      slen, dlen);
+        return ret >= 0 ? ret : -1;
+    }
+#endif
+#ifdef CONFIG_ZSTD
+    case MIGRATION_COMPRESS_METHOD_ZSTD: {
+        size_t ret;
+
+        if (!ctx->zstd_dctx) {
+            ctx->zstd_dctx = ZSTD_createDCtx();
+            if (!ctx->zstd_dctx) {
+                return -1;
+            }
+        }
+        ret = ZSTD_decompressDCtx(ctx->zstd_dctx, dst, dlen, src, slen);
+        return ZSTD_isError(ret) ? -1 : ret;
+    }
+#endif
+    default:
+        return -1;
+    }
+}
@@ -54,6 +54,9 @@
 /* Define default autoconverge cpu throttle migration parameters */
 #define DEFAULT_MIGRATE_CPU_THROTTLE_INITIAL 20
 #define DEFAULT_MIGRATE_CPU_THROTTLE_INCREMENT 10
+/* Default multifd connection count and pages sent per packet */
+#define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+#define DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT 64
 
 /* Migration XBZRLE default cache size */
 #define DEFAULT_MIGRATE_CACHE_SIZE (64 * 1024 * 1024)
@@ -63,6 +66,11 @@ static NotifierList migration_state_notifiers =
 
 static bool deferred_incoming;
 
+/* The incoming transport can accept the additional multifd connections */
+static bool incoming_multi_channel;
+/* Migration stream of a multifd migration, until all channels are there */
+static QEMUFile *multifd_main_file;
+
 /*
  * Current state of incoming postcopy; note this is not part of
  * MigrationIncomingState since it's state is used during cleanup
@@ -85,10 +93,13 @@ MigrationState *migrate_get_current(void)
         .mbps = -1,
         .parameters = {
             .compress_level = DEFAULT_MIGRATE_COMPRESS_LEVEL,
+            .compress_method = MIGRATION_COMPRESS_METHOD_ZLIB,
             .compress_threads = DEFAULT_MIGRATE_COMPRESS_THREAD_COUNT,
             .decompress_threads = DEFAULT_MIGRATE_DECOMPRESS_THREAD_COUNT,
             .cpu_throttle_initial = DEFAULT_MIGRATE_CPU_THROTTLE_INITIAL,
             .cpu_throttle_increment = DEFAULT_MIGRATE_CPU_THROTTLE_INCREMENT,
+            .x_multifd_channels = DEFAULT_MIGRATE_MULTIFD_CHANNELS,
+            .x_multifd_page_count = DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT,
         },
     };
 
@@ -298,11 +309,22 @@ void migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
 
 void qemu_start_incoming_migration(const char *uri, Error **errp)
 {
+    MigrationState *s = migrate_get_current();
     const char *p;
 
+    incoming_multi_channel = (strstart(uri, "tcp:", NULL) ||
+                              strstart(uri, "unix:", NULL)) &&
+                             !(s->parameters.tls_creds &&
+                               *s->parameters.tls_creds);
+
     qapi_event_send_migration(MIGRATION_STATUS_SETUP, &error_abort);
     if (!strcmp(uri, "defer")) {
         deferred_incoming_migration(errp);
+    } else if (migrate_use_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "x-mapped-ram requires a file: migration URI");
+    } else if (migrate_use_multifd() && !incoming_multi_channel) {
+        error_setg(errp, "multifd is only supported over tcp: and unix: "
+                   "migration without TLS");
     } else if (strstart(uri, "tcp:", &p)) {
         tcp_start_incoming_migration(p, errp);
 #ifdef CONFIG_RDMA
@@ -315,6 +337,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -379,6 +403,7 @@ static void process_incoming_migration_co(void *opaque)
     migrate_set_state(&mis->state, MIGRATION_STATUS_NONE,
                       MIGRATION_STATUS_ACTIVE);
     ret = qemu_loadvm_state(f);
+    multifd_load_cleanup();
 
     ps = postcopy_state_get();
     trace_process_incoming_migration_co_end(ret, ps);
@@ -440,12 +465,51 @@ void migration_channel_process_incoming(MigrationState *s,
         if (local_err) {
             error_report_err(local_err);
         }
-    } else {
+    } else if (!migrate_use_multifd()) {
         QEMUFile *f = qemu_fopen_channel_input(ioc);
         migration_fd_process_incoming(f);
+    } else if (!incoming_multi_channel) {
+        Error *local_err = NULL;
+
+        error_setg(&local_err, "multifd is only supported over tcp: and "
+                   "unix: migration without TLS");
+        migrate_set_error(s, local_err);
+        error_report_err(local_err);
+    } else if (!multifd_main_file) {
+        /* The first connection carries the migration stream, the
+         * following ones are the multifd channels.  Loading only
+         * starts once all of them are there.
+         */
+        multifd_load_setup();
+        multifd_main_file = qemu_fopen_channel_input(ioc);
+    } else {
+        multifd_recv_new_channel(ioc);
+    }
+}
+
+void migration_multifd_channel_ready(Error *err)
+{
+    if (err) {
+        migrate_set_error(migrate_get_current(), err);
+        error_report_err(err);
+        if (multifd_main_file) {
+            qemu_fclose(multifd_main_file);
+            multifd_main_file = NULL;
+        }
+        multifd_load_cleanup();
+    } else if (multifd_recv_all_channels_created()) {
+        QEMUFile *f = multifd_main_file;
+
+        multifd_main_file = NULL;
+        migration_fd_process_incoming(f);
     }
 }
 
+bool migration_has_all_channels(void)
+{
+    return !migrate_use_multifd() || multifd_recv_all_channels_accepted();
+}
+
 
 void migration_channel_connect(MigrationState *s,
                                QIOChannel *ioc,
@@ -464,7 +528,16 @@ void migration_channel_connect(MigrationState *s,
             error_free(local_err);
         }
     } else {
-        QEMUFile *f = qemu_fopen_channel_output(ioc);
+        QEMUFile *f;
+        Error *local_err = NULL;
+
+        if (migrate_use_multifd() &&
+            multifd_save_setup(ioc, &local_err) < 0) {
+            migrate_fd_error(s, local_err);
+            error_free(local_err);
+            return;
+        }
+        f = qemu_fopen_channel_output(ioc);
 
         s->to_dst_file = f;
 
@@ -560,12 +633,15 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
 
     params = g_malloc0(sizeof(*params));
     params->compress_level = s->parameters.compress_level;
+    params->compress_method = s->parameters.compress_method;
     params->compress_threads = s->parameters.compress_threads;
     params->decompress_threads = s->parameters.decompress_threads;
     params->cpu_throttle_initial = s->parameters.cpu_throttle_initial;
     params->cpu_throttle_increment = s->parameters.cpu_throttle_increment;
     params->tls_creds = g_strdup(s->parameters.tls_creds);
     params->tls_hostname = g_strdup(s->parameters.tls_hostname);
+    params->x_multifd_channels = s->parameters.x_multifd_channels;
+    params->x_multifd_page_count = s->parameters.x_multifd_page_count;
 
     return params;
 }
@@ -598,6 +674,8 @@ static void get_xbzrle_cache_stats(MigrationInfo *info)
         info->xbzrle_cache->pages = xbzrle_mig_pages_transferred();
         info->xbzrle_cache->cache_miss = xbzrle_mig_pages_cache_miss();
         info->xbzrle_cache->cache_miss_rate = xbzrle_mig_cache_miss_rate();
+        info->xbzrle_cache->cache_hit = xbzrle_mig_pages_cache_hit();
+        info->xbzrle_cache->cache_hit_rate = xbzrle_mig_cache_hit_rate();
         info->xbzrle_cache->overflow = xbzrle_mig_pages_overflow();
     }
 }
@@ -614,6 +692,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->normal_bytes = norm_mig_bytes_transferred();
     info->ram->mbps = s->mbps;
     info->ram->dirty_sync_count = s->dirty_sync_count;
+    info->ram->dirty_sync_time = s->dirty_sync_time;
+    info->ram->dirty_sync_time_total = s->dirty_sync_time_total;
     info->ram->postcopy_requests = s->postcopy_requests;
 
     if (s->state != MIGRATION_STATUS_COMPLETED) {
@@ -756,6 +836,43 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
             s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM] =
                 false;
         }
+        if (migrate_use_multifd()) {
+            /* Pages arriving on the multifd channels are written straight
+             * into guest RAM, which is not possible once the destination
+             * has started running.
+             */
+            error_report("Postcopy is not currently compatible with "
+                         "multifd");
+            s->enabled_capabilities[MIGRATION_CAPABILITY_X_MULTIFD] = false;
+        }
+    }
+
+    if (migrate_use_mapped_ram()) {
+        const char *conflict = NULL;
+
+        /* Each page has a single place in the file, so only whole pages
+         * can be written, and the destination does not run until the
+         * whole file has been read.
+         */
+        if (migrate_postcopy_ram()) {
+            conflict = "postcopy-ram";
+        } else if (migrate_use_xbzrle()) {
+            conflict = "xbzrle";
+        } else if (migrate_use_compression()) {
+            conflict = "compress";
+        } else if (migrate_use_multifd()) {
+            conflict = "x-multifd";
+        }
+        if (conflict) {
+            error_report("x-mapped-ram is not compatible with %s", conflict);
+            s->enabled_capabilities[MIGRATION_CAPABILITY_X_MAPPED_RAM] = false;
+        }
+    }
+
+    if (migrate_use_zero_copy_send() && !migrate_use_multifd()) {
+        /* Only the multifd channels send pages straight from guest RAM */
+        error_report("x-zero-copy-send requires x-multifd");
+        s->enabled_capabilities[MIGRATION_CAPABILITY_X_ZERO_COPY_SEND] = false;
     }
 }
 
@@ -773,13 +890,31 @@ void qmp_migrate_set_parameters(bool has_compress_level,
                                 const char *tls_creds,
                                 bool has_tls_hostname,
                                 const char *tls_hostname,
+                                bool has_x_multifd_channels,
+                                int64_t x_multifd_channels,
+                                bool has_x_multifd_page_count,
+                                int64_t x_multifd_page_count,
+                                bool has_compress_method,
+                                MigrationCompressMethod compress_method,
                                 Error **errp)
 {
     MigrationState *s = migrate_get_current();
-
-    if (has_compress_level && (compress_level < 0 || compress_level > 9)) {
-        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "compress_level",
-                   "is invalid, it should be in the range of 0 to 9");
+    MigrationCompressMethod method = has_compress_method ?
+        compress_method : s->parameters.compress_method;
+    int64_t level = has_compress_level ?
+        compress_level : s->parameters.compress_level;
+
+    if (has_compress_method && !migration_compress_supported(method)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "compress_method",
+                   "a compression method supported by this binary");
+        return;
+    }
+    if ((has_compress_level || has_compress_method) &&
+        (level < 0 || level > migration_compress_level_max(method))) {
+        error_setg(errp, "Parameter 'compress_level' is invalid, it should "
+                   "be in the range of 0 to %d for %s",
+                   migration_compress_level_max(method),
+                   MigrationCompressMethod_lookup[method]);
         return;
     }
     if (has_compress_threads &&
@@ -808,10 +943,28 @@ void qmp_migrate_set_parameters(bool has_compress_level,
                    "cpu_throttle_increment",
                    "an integer in the range of 1 to 99");
     }
+    if (has_x_multifd_channels &&
+            (x_multifd_channels < 1 || x_multifd_channels > 255)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "x_multifd_channels",
+                   "is invalid, it should be in the range of 1 to 255");
+        return;
+    }
+    if (has_x_multifd_page_count &&
+            (x_multifd_page_count < 1 ||
+             x_multifd_page_count > MULTIFD_PAGE_COUNT_MAX)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "x_multifd_page_count",
+                   "is invalid, it should be in the range of 1 to 1024");
+        return;
+    }
 
     if (has_compress_level) {
         s->parameters.compress_level = compress_level;
     }
+    if (has_compress_method) {
+        s->parameters.compress_method = compress_method;
+    }
     if (has_compress_threads) {
         s->parameters.compress_threads = compress_threads;
     }
@@ -832,6 +985,12 @@ void qmp_migrate_set_parameters(bool has_compress_level,
         g_free(s->parameters.tls_hostname);
         s->parameters.tls_hostname = g_strdup(tls_hostname);
     }
+    if (has_x_multifd_channels) {
+        s->parameters.x_multifd_channels = x_multifd_channels;
+    }
+    if (has_x_multifd_page_count) {
+        s->parameters.x_multifd_page_count = x_multifd_page_count;
+    }
 }
 
 
@@ -886,6 +1045,7 @@ static void migrate_fd_cleanup(void *opaque)
         qemu_mutex_lock_iothread();
 
         migrate_compress_threads_join();
+        multifd_save_cleanup();
         qemu_fclose(s->to_dst_file);
         s->to_dst_file = NULL;
     }
@@ -901,15 +1061,21 @@ static void migrate_fd_cleanup(void *opaque)
     notifier_list_notify(&migration_state_notifiers, s);
 }
 
+/* Remember @error as the reason of the failure, unless there is one */
+void migrate_set_error(MigrationState *s, const Error *error)
+{
+    if (!s->error) {
+        s->error = error_copy(error);
+    }
+}
+
 void migrate_fd_error(MigrationState *s, const Error *error)
 {
     trace_migrate_fd_error(error ? error_get_pretty(error) : "");
     assert(s->to_dst_file == NULL);
     migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
                       MIGRATION_STATUS_FAILED);
-    if (!s->error) {
-        s->error = error_copy(error);
-    }
+    migrate_set_error(s, error);
     notifier_list_notify(&migration_state_notifiers, s);
 }
 
@@ -941,6 +1107,7 @@ static void migrate_fd_cancel(MigrationState *s)
      */
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
+        multifd_save_shutdown();
     }
 }
 
@@ -1004,6 +1171,8 @@ MigrationState *migrate_init(const MigrationParams *params)
     s->dirty_bytes_rate = 0;
     s->setup_time = 0;
     s->dirty_sync_count = 0;
+    s->dirty_sync_time = 0;
+    s->dirty_sync_time_total = 0;
     s->start_postcopy = false;
     s->postcopy_after_devices = false;
     s->postcopy_requests = 0;
@@ -1095,6 +1264,11 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         return;
     }
 
+    if (migrate_use_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "x-mapped-ram requires a file: migration URI");
+        return;
+    }
+
     s = migrate_init(&params);
 
     if (strstart(uri, "tcp:", &p)) {
@@ -1109,6 +1283,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -1234,6 +1410,15 @@ int migrate_compress_level(void)
     return s->parameters.compress_level;
 }
 
+MigrationCompressMethod migrate_compress_method(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.compress_method;
+}
+
 int migrate_compress_threads(void)
 {
     MigrationState *s;
@@ -1261,6 +1446,51 @@ bool migrate_use_events(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_EVENTS];
 }
 
+bool migrate_use_multifd(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_MULTIFD];
+}
+
+bool migrate_use_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_MAPPED_RAM];
+}
+
+bool migrate_use_zero_copy_send(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_ZERO_COPY_SEND];
+}
+
+int migrate_multifd_channels(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_channels;
+}
+
+int migrate_multifd_page_count(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_page_count;
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -1789,8 +2019,8 @@ static void *migration_thread(void *opaque)
         }
         current_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
         if (current_time >= initial_time + BUFFER_DELAY) {
-            uint64_t transferred_bytes = qemu_ftell(s->to_dst_file) -
-                                         initial_bytes;
+            uint64_t transferred_bytes =
+                qemu_file_transferred(s->to_dst_file) - initial_bytes;
             uint64_t time_spent = current_time - initial_time;
             double bandwidth = (double)transferred_bytes / time_spent;
             max_size = bandwidth * migrate_max_downtime() / 1000000;
@@ -1808,7 +2038,7 @@ static void *migration_thread(void *opaque)
 
             qemu_file_reset_rate_limit(s->to_dst_file);
             initial_time = current_time;
-            initial_bytes = qemu_ftell(s->to_dst_file);
+            initial_bytes = qemu_file_transferred(s->to_dst_file);
         }
         if (qemu_file_rate_limit(s->to_dst_file)) {
             /* usleep expects microseconds */
@@ -1824,7 +2054,7 @@ static void *migration_thread(void *opaque)
     qemu_mutex_lock_iothread();
     qemu_savevm_state_cleanup();
     if (s->state == MIGRATION_STATUS_COMPLETED) {
-        uint64_t transferred_bytes = qemu_ftell(s->to_dst_file);
+        uint64_t transferred_bytes = qemu_file_transferred(s->to_dst_file);
         s->total_time = end_time - s->total_time;
         if (!entered_postcopy) {
             s->downtime = end_time - start_time;
@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "migration/qemu-file.h"
 #include "io/channel-socket.h"
+#include "io/channel-file.h"
 #include "qemu/iov.h"
 
 
@@ -135,6 +136,27 @@ static int channel_set_blocking(void *opaque,
     return 0;
 }
 
+static int channel_get_fd(void *opaque)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return -1;
+    }
+    return QIO_CHANNEL_FILE(ioc)->fd;
+}
+
+static int channel_seek(void *opaque, int64_t pos)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+
+    if (qio_channel_io_seek(ioc, pos, SEEK_SET, NULL) < 0) {
+        /* XXX handle Error * object */
+        return -EIO;
+    }
+    return 0;
+}
+
 static QEMUFile *channel_get_input_return_path(void *opaque)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
@@ -155,6 +177,8 @@ static const QEMUFileOps channel_input_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
+    .get_fd = channel_get_fd,
+    .seek = channel_seek,
 };
 
 
@@ -164,6 +188,8 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .get_fd = channel_get_fd,
+    .seek = channel_seek,
 };
 
 
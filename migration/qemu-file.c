@@ -42,6 +42,8 @@ struct QEMUFile {
 
     int64_t bytes_xfer;
     int64_t xfer_limit;
+    /* written by us or on our behalf, unlike pos not moved by seeks */
+    int64_t total_transferred;
 
     int64_t pos; /* start of buffer when writing, end of buffer
                     when reading */
@@ -155,6 +157,7 @@ void qemu_fflush(QEMUFile *f)
 
     if (ret >= 0) {
         f->pos += ret;
+        f->total_transferred += ret;
     }
     /* We expect the QEMUFile write impl to send the full
      * data set we requested, so sanity check that.
@@ -543,6 +546,53 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Move the position of @f to @pos, for backends that support random
+ * access.  Pending output is written first; buffered input is dropped.
+ *
+ * Returns 0 on success, or a negative errno that is also set as the
+ * error of @f.
+ */
+int qemu_file_seek(QEMUFile *f, int64_t pos)
+{
+    int ret;
+
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOSYS);
+        return -ENOSYS;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        ret = qemu_file_get_error(f);
+        if (ret < 0) {
+            return ret;
+        }
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = f->ops->seek(f->opaque, pos);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+    f->pos = pos;
+    return 0;
+}
+
+/*
+ * Returns the OS file descriptor under @f, or -1 if there is none.
+ * It may be used for positioned I/O, which does not disturb the stream.
+ */
+int qemu_get_fd(QEMUFile *f)
+{
+    if (!f->ops->get_fd) {
+        return -1;
+    }
+    return f->ops->get_fd(f->opaque);
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (qemu_file_get_error(f)) {
@@ -569,6 +619,27 @@ void qemu_file_reset_rate_limit(QEMUFile *f)
     f->bytes_xfer = 0;
 }
 
+/*
+ * Account for data sent on behalf of @f over another channel, so that
+ * it counts against the rate limit.
+ */
+void qemu_file_update_transfer(QEMUFile *f, int64_t len)
+{
+    f->bytes_xfer += len;
+    f->total_transferred += len;
+}
+
+/*
+ * Returns the number of bytes sent so far, including those accounted
+ * with qemu_file_update_transfer().  Unlike qemu_ftell(), this is what
+ * to use for bandwidth computations.
+ */
+int64_t qemu_file_transferred(QEMUFile *f)
+{
+    qemu_fflush(f);
+    return f->total_transferred;
+}
+
 void qemu_put_be16(QEMUFile *f, unsigned int v)
 {
     qemu_put_byte(f, v >> 8);
@@ -43,6 +43,7 @@
 #include "trace.h"
 #include "exec/ram_addr.h"
 #include "qemu/rcu_queue.h"
+#include "io/channel-socket.h"
 
 #ifdef DEBUG_MIGRATION_RAM
 #define DPRINTF(fmt, ...) \
@@ -68,6 +69,16 @@ static uint64_t bitmap_sync_count;
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+#define RAM_SAVE_FLAG_MULTIFD_SYNC     0x200
+/* There are no free flags left for targets with 1 KiB pages, so batches
+ * of pages compressed with lz4 or zstd combine COMPRESS_PAGE with the
+ * obsolete FULL flag.  Older versions reject the combination.
+ */
+#define RAM_SAVE_FLAG_COMPRESS_BATCH \
+    (RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_FULL)
+
+/* Number of pages compressed together by lz4 and zstd */
+#define COMPRESS_BATCH_PAGES 16
 
 static const uint8_t ZERO_TARGET_PAGE[TARGET_PAGE_SIZE];
 
@@ -151,6 +162,7 @@ typedef struct AccountingInfo {
     uint64_t iterations;
     uint64_t xbzrle_bytes;
     uint64_t xbzrle_pages;
+    uint64_t xbzrle_cache_hit;
     uint64_t xbzrle_cache_miss;
     double xbzrle_cache_miss_rate;
     uint64_t xbzrle_overflows;
@@ -203,6 +215,20 @@ uint64_t xbzrle_mig_pages_transferred(void)
     return acct_info.xbzrle_pages;
 }
 
+uint64_t xbzrle_mig_pages_cache_hit(void)
+{
+    return acct_info.xbzrle_cache_hit;
+}
+
+/* Share of the cache lookups that hit, since the migration started */
+double xbzrle_mig_cache_hit_rate(void)
+{
+    uint64_t lookups = acct_info.xbzrle_cache_hit +
+                       acct_info.xbzrle_cache_miss;
+
+    return lookups ? (double)acct_info.xbzrle_cache_hit / lookups : 0;
+}
+
 uint64_t xbzrle_mig_pages_cache_miss(void)
 {
     return acct_info.xbzrle_cache_miss;
@@ -259,7 +285,17 @@ struct CompressParam {
     QemuMutex mutex;
     QemuCond cond;
     RAMBlock *block;
-    ram_addr_t offset;
+    /* pages of block to compress, always a single one with zlib */
+    ram_addr_t offset[COMPRESS_BATCH_PAGES];
+    int nr_pages;
+    /* With lz4 and zstd, the pages are copied to buf and compressed as a
+     * whole into out, which would not fit in the buffer of file.
+     */
+    MigrationCompressCtx *ctx;
+    uint8_t *buf;
+    uint8_t *out;
+    size_t out_len;
+    RAMBlock *out_block;
 };
 typedef struct CompressParam CompressParam;
 
@@ -271,6 +307,12 @@ struct DecompressParam {
     void *des;
     uint8_t *compbuf;
     int len;
+    /* 0 for a single zlib page at des, else the pages of a batch */
+    int nr_pages;
+    MigrationCompressMethod method;
+    void *hosts[COMPRESS_BATCH_PAGES];
+    MigrationCompressCtx *ctx;
+    uint8_t *buf;
 };
 typedef struct DecompressParam DecompressParam;
 
@@ -286,29 +328,53 @@ static QemuCond comp_done_cond;
 static const QEMUFileOps empty_ops = { };
 
 static bool compression_switch;
+/* Fixed for the whole migration when the threads are created */
+static MigrationCompressMethod compress_method;
+/* lz4/zstd: pages waiting to be handed to a compression thread */
+static struct {
+    RAMBlock *block;
+    ram_addr_t offset[COMPRESS_BATCH_PAGES];
+    int nr_pages;
+} compress_batch;
 static DecompressParam *decomp_param;
 static QemuThread *decompress_threads;
+/* number of decompression threads started, 0 when they are not running */
+static int decompress_thread_count;
 static QemuMutex decomp_done_lock;
 static QemuCond decomp_done_cond;
+/* set when a batch could not be decompressed, protected by decomp_done_lock */
+static bool decomp_error;
 
 static int do_compress_ram_page(QEMUFile *f, RAMBlock *block,
                                 ram_addr_t offset);
+static ssize_t do_compress_ram_batch(QEMUFile *f, MigrationCompressCtx *ctx,
+                                     RAMBlock *block,
+                                     const ram_addr_t *offset, int nr_pages,
+                                     uint8_t *buf, uint8_t *out);
 
 static void *do_data_compress(void *opaque)
 {
     CompressParam *param = opaque;
     RAMBlock *block;
-    ram_addr_t offset;
+    ssize_t len;
 
     qemu_mutex_lock(&param->mutex);
     while (!param->quit) {
         if (param->block) {
+            /* offset[] is left alone until we set done again */
             block = param->block;
-            offset = param->offset;
             param->block = NULL;
             qemu_mutex_unlock(&param->mutex);
 
-            do_compress_ram_page(param->file, block, offset);
+            if (compress_method == MIGRATION_COMPRESS_METHOD_ZLIB) {
+                do_compress_ram_page(param->file, block, param->offset[0]);
+            } else {
+                len = do_compress_ram_batch(param->file, param->ctx, block,
+                                            param->offset, param->nr_pages,
+                                            param->buf, param->out);
+                param->out_len = MAX(len, 0);
+                param->out_block = block;
+            }
 
             qemu_mutex_lock(&comp_done_lock);
             param->done = true;
@@ -352,41 +418,1201 @@ void migrate_compress_threads_join(void)
         qemu_fclose(comp_param[i].file);
         qemu_mutex_destroy(&comp_param[i].mutex);
         qemu_cond_destroy(&comp_param[i].cond);
+        migration_compress_ctx_free(comp_param[i].ctx);
+        g_free(comp_param[i].buf);
+        g_free(comp_param[i].out);
+    }
+    qemu_mutex_destroy(&comp_done_lock);
+    qemu_cond_destroy(&comp_done_cond);
+    g_free(compress_threads);
+    g_free(comp_param);
+    compress_threads = NULL;
+    comp_param = NULL;
+}
+
+void migrate_compress_threads_create(void)
+{
+    int i, thread_count;
+
+    if (!migrate_use_compression()) {
+        return;
+    }
+    compression_switch = true;
+    compress_method = migrate_compress_method();
+    compress_batch.nr_pages = 0;
+    thread_count = migrate_compress_threads();
+    compress_threads = g_new0(QemuThread, thread_count);
+    comp_param = g_new0(CompressParam, thread_count);
+    qemu_cond_init(&comp_done_cond);
+    qemu_mutex_init(&comp_done_lock);
+    for (i = 0; i < thread_count; i++) {
+        /* comp_param[i].file is just used as a dummy buffer to save data,
+         * set its ops to empty.
+         */
+        comp_param[i].file = qemu_fopen_ops(NULL, &empty_ops);
+        comp_param[i].done = true;
+        comp_param[i].quit = false;
+        if (compress_method != MIGRATION_COMPRESS_METHOD_ZLIB) {
+            size_t size = COMPRESS_BATCH_PAGES * TARGET_PAGE_SIZE;
+
+            comp_param[i].ctx = migration_compress_ctx_new();
+            comp_param[i].buf = g_malloc(size);
+            comp_param[i].out =
+                g_malloc(migration_compress_bound(compress_method, size));
+        }
+        qemu_mutex_init(&comp_param[i].mutex);
+        qemu_cond_init(&comp_param[i].cond);
+        qemu_thread_create(compress_threads + i, "compress",
+                           do_data_compress, comp_param + i,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+/* Multiple fd's */
+
+#define MULTIFD_MAGIC 0x11223344U
+#define MULTIFD_VERSION 1
+
+#define MULTIFD_FLAG_SYNC (1 << 0)
+
+/* Sent once by each channel right after it is connected */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id;
+    uint32_t page_count;
+} QEMU_PACKED MultiFDInit_t;
+
+/* Header of each batch of pages; followed by pages_used big endian
+ * offsets inside @ramblock and then by the contents of the pages.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t pages_used;
+    uint64_t packet_num;
+    char ramblock[256];
+} QEMU_PACKED MultiFDPacket_t;
+
+typedef struct {
+    /* number of used entries in offset */
+    uint32_t used;
+    /* number of allocated entries in offset */
+    uint32_t allocated;
+    /* all pages of a batch belong to the same block */
+    RAMBlock *block;
+    uint64_t *offset;
+    struct iovec *iov;
+} MultiFDPages;
+
+typedef struct {
+    uint8_t id;
+    char *name;
+    QemuThread thread;
+    QIOChannel *c;
+    /* send the pages with MSG_ZEROCOPY, reaped at each sync */
+    bool zero_copy;
+    /* wakes up the thread when there is work to do */
+    QemuSemaphore sem;
+    /* posted each time the thread has sent a sync packet */
+    QemuSemaphore sem_sync;
+    /* protects the fields below */
+    QemuMutex mutex;
+    bool running;
+    bool quit;
+    /* pages waiting to be sent, owned by the thread while used != 0 */
+    MultiFDPages *pages;
+    uint64_t packet_num;
+    bool pending_sync;
+    /* statistics */
+    uint64_t num_packets;
+    uint64_t num_pages;
+} MultiFDSendParams;
+
+static struct {
+    MultiFDSendParams *params;
+    int count;
+    /* where the additional connections go */
+    SocketAddress *addr;
+    /* batch being filled by the migration thread */
+    MultiFDPages *pages;
+    /* one token per channel that can take a new batch */
+    QemuSemaphore channels_ready;
+    uint64_t packet_num;
+    int next_channel;
+    /* set by a channel thread that failed */
+    bool error;
+} *multifd_send_state;
+
+static MultiFDPages *multifd_pages_new(uint32_t page_count)
+{
+    MultiFDPages *pages = g_new0(MultiFDPages, 1);
+
+    pages->allocated = page_count;
+    pages->offset = g_new0(uint64_t, page_count);
+    pages->iov = g_new0(struct iovec, page_count);
+    return pages;
+}
+
+static void multifd_pages_free(MultiFDPages *pages)
+{
+    g_free(pages->offset);
+    g_free(pages->iov);
+    g_free(pages);
+}
+
+static void multifd_send_fail(MultiFDSendParams *p, Error *err)
+{
+    qemu_mutex_lock(&p->mutex);
+    if (!p->quit) {
+        error_report_err(err);
+    } else {
+        error_free(err);
+    }
+    p->quit = true;
+    qemu_mutex_unlock(&p->mutex);
+    atomic_set(&multifd_send_state->error, true);
+    /* unblock the migration thread, whatever it is waiting for */
+    qemu_sem_post(&multifd_send_state->channels_ready);
+    qemu_sem_post(&p->sem_sync);
+}
+
+static int multifd_send_packet(MultiFDSendParams *p, uint32_t flags,
+                               Error **errp)
+{
+    MultiFDPages *pages = p->pages;
+    MultiFDPacket_t packet;
+    uint32_t i;
+    int ret;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.magic = cpu_to_be32(MULTIFD_MAGIC);
+    packet.version = cpu_to_be32(MULTIFD_VERSION);
+    packet.flags = cpu_to_be32(flags);
+    packet.packet_num = cpu_to_be64(p->packet_num);
+    if (flags & MULTIFD_FLAG_SYNC) {
+        return qio_channel_write_all(p->c, (char *)&packet, sizeof(packet),
+                                     errp);
+    }
+
+    packet.pages_used = cpu_to_be32(pages->used);
+    pstrcpy(packet.ramblock, sizeof(packet.ramblock), pages->block->idstr);
+    for (i = 0; i < pages->used; i++) {
+        pages->iov[i].iov_base = pages->block->host + pages->offset[i];
+        pages->iov[i].iov_len = TARGET_PAGE_SIZE;
+        pages->offset[i] = cpu_to_be64(pages->offset[i]);
+    }
+
+    ret = qio_channel_write_all(p->c, (char *)&packet, sizeof(packet), errp);
+    if (!ret) {
+        ret = qio_channel_write_all(p->c, (char *)pages->offset,
+                                    pages->used * sizeof(uint64_t), errp);
+    }
+    if (!ret && p->zero_copy) {
+        ret = qio_channel_writev_zero_copy_all(p->c, pages->iov, pages->used,
+                                               errp);
+    } else if (!ret) {
+        ret = qio_channel_writev_all(p->c, pages->iov, pages->used, errp);
+    }
+    return ret;
+}
+
+static void *multifd_send_thread(void *opaque)
+{
+    MultiFDSendParams *p = opaque;
+    MultiFDInit_t msg;
+    Error *local_err = NULL;
+
+    rcu_register_thread();
+    trace_multifd_send_thread_start(p->id);
+
+    if (qio_channel_socket_connect_sync(QIO_CHANNEL_SOCKET(p->c),
+                                        multifd_send_state->addr,
+                                        &local_err) < 0) {
+        goto out;
+    }
+    if (p->zero_copy &&
+        !qio_channel_has_feature(p->c, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg(&local_err, "x-zero-copy-send is not supported by this "
+                   "host");
+        goto out;
+    }
+
+    msg.magic = cpu_to_be32(MULTIFD_MAGIC);
+    msg.version = cpu_to_be32(MULTIFD_VERSION);
+    msg.id = cpu_to_be32(p->id);
+    msg.page_count = cpu_to_be32(p->pages->allocated);
+    if (qio_channel_write_all(p->c, (char *)&msg, sizeof(msg),
+                              &local_err) < 0) {
+        goto out;
+    }
+    qemu_sem_post(&multifd_send_state->channels_ready);
+
+    while (true) {
+        qemu_sem_wait(&p->sem);
+        qemu_mutex_lock(&p->mutex);
+        if (p->pages->used) {
+            uint32_t used = p->pages->used;
+            int ret;
+
+            qemu_mutex_unlock(&p->mutex);
+
+            /* The pages point into guest RAM; keep the block alive */
+            rcu_read_lock();
+            ret = multifd_send_packet(p, 0, &local_err);
+            rcu_read_unlock();
+            if (ret < 0) {
+                goto out;
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            p->num_packets++;
+            p->num_pages += used;
+            p->pages->used = 0;
+            p->pages->block = NULL;
+            qemu_mutex_unlock(&p->mutex);
+            qemu_sem_post(&multifd_send_state->channels_ready);
+        } else if (p->pending_sync) {
+            p->pending_sync = false;
+            qemu_mutex_unlock(&p->mutex);
+
+            /* The kernel may still be reading pages queued before the
+             * sync; wait for it so that the sync really covers them.
+             */
+            if (p->zero_copy) {
+                int ret = qio_channel_flush(p->c, &local_err);
+
+                if (ret < 0) {
+                    goto out;
+                }
+                if (ret == 1) {
+                    trace_multifd_send_zero_copy_copied(p->id);
+                }
+            }
+            if (multifd_send_packet(p, MULTIFD_FLAG_SYNC, &local_err) < 0) {
+                goto out;
+            }
+            qemu_sem_post(&p->sem_sync);
+        } else if (p->quit) {
+            qemu_mutex_unlock(&p->mutex);
+            break;
+        } else {
+            qemu_mutex_unlock(&p->mutex);
+        }
+    }
+
+out:
+    if (local_err) {
+        multifd_send_fail(p, local_err);
+    }
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * multifd_save_setup: create the additional connections next to the
+ * main migration channel @ioc; they are opened to the same address.
+ */
+int multifd_save_setup(QIOChannel *ioc, Error **errp)
+{
+    int thread_count, page_count;
+    SocketAddress *addr;
+    int i;
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_SOCKET)) {
+        error_setg(errp, "multifd is only supported over tcp: and unix: "
+                   "migration without TLS");
+        return -1;
+    }
+    addr = qio_channel_socket_get_remote_address(QIO_CHANNEL_SOCKET(ioc),
+                                                 errp);
+    if (!addr) {
+        return -1;
+    }
+
+    thread_count = migrate_multifd_channels();
+    page_count = migrate_multifd_page_count();
+    multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
+    multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
+    multifd_send_state->count = 0;
+    multifd_send_state->addr = addr;
+    multifd_send_state->pages = multifd_pages_new(page_count);
+    qemu_sem_init(&multifd_send_state->channels_ready, 0);
+
+    for (i = 0; i < thread_count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_init(&p->mutex);
+        qemu_sem_init(&p->sem, 0);
+        qemu_sem_init(&p->sem_sync, 0);
+        p->quit = false;
+        p->id = i;
+        p->zero_copy = migrate_use_zero_copy_send();
+        p->pages = multifd_pages_new(page_count);
+        p->c = QIO_CHANNEL(qio_channel_socket_new());
+        p->name = g_strdup_printf("multifdsend_%d", i);
+        p->running = true;
+        qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
+                           QEMU_THREAD_JOINABLE);
+        multifd_send_state->count++;
+    }
+    return 0;
+}
+
+/* Called on cancel: unblock the channel threads stuck in a write */
+void multifd_save_shutdown(void)
+{
+    int i;
+
+    if (!multifd_send_state) {
+        return;
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        p->quit = true;
+        qemu_mutex_unlock(&p->mutex);
+        qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    }
+}
+
+void multifd_save_cleanup(void)
+{
+    int i;
+
+    if (!multifd_send_state) {
+        return;
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        p->quit = true;
+        qemu_mutex_unlock(&p->mutex);
+        qemu_sem_post(&p->sem);
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        if (p->running) {
+            qemu_thread_join(&p->thread);
+        }
+        object_unref(OBJECT(p->c));
+        qemu_mutex_destroy(&p->mutex);
+        qemu_sem_destroy(&p->sem);
+        qemu_sem_destroy(&p->sem_sync);
+        multifd_pages_free(p->pages);
+        g_free(p->name);
+    }
+    qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qapi_free_SocketAddress(multifd_send_state->addr);
+    multifd_pages_free(multifd_send_state->pages);
+    g_free(multifd_send_state->params);
+    g_free(multifd_send_state);
+    multifd_send_state = NULL;
+}
+
+/*
+ * Hand the batch being filled to an idle channel.
+ *
+ * Returns: 0 on success, -1 if a channel has failed
+ */
+static int multifd_send_pages(void)
+{
+    MultiFDSendParams *p;
+    MultiFDPages *pages;
+    int i;
+
+    if (atomic_read(&multifd_send_state->error)) {
+        return -1;
+    }
+    qemu_sem_wait(&multifd_send_state->channels_ready);
+    if (atomic_read(&multifd_send_state->error)) {
+        return -1;
+    }
+    /* A token means at least one of the channels is idle */
+    for (i = multifd_send_state->next_channel;; i = (i + 1) %
+         multifd_send_state->count) {
+        p = &multifd_send_state->params[i];
+        qemu_mutex_lock(&p->mutex);
+        if (!p->pages->used) {
+            break;
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+    multifd_send_state->next_channel = (i + 1) % multifd_send_state->count;
+
+    pages = p->pages;
+    p->pages = multifd_send_state->pages;
+    p->packet_num = multifd_send_state->packet_num++;
+    multifd_send_state->pages = pages;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    return 0;
+}
+
+static int multifd_queue_page(RAMBlock *block, ram_addr_t offset)
+{
+    MultiFDPages *pages = multifd_send_state->pages;
+
+    if (pages->used && pages->block != block) {
+        if (multifd_send_pages() < 0) {
+            return -1;
+        }
+        pages = multifd_send_state->pages;
+    }
+
+    pages->block = block;
+    pages->offset[pages->used++] = offset;
+    if (pages->used == pages->allocated) {
+        return multifd_send_pages();
+    }
+    return 0;
+}
+
+/*
+ * multifd_send_sync_main: wait until every page queued so far has been
+ * written to its channel, and mark that point in each channel.
+ *
+ * Returns: 0 on success, -1 if a channel has failed
+ */
+static int multifd_send_sync_main(void)
+{
+    int i;
+
+    if (atomic_read(&multifd_send_state->error)) {
+        return -1;
+    }
+    if (multifd_send_state->pages->used && multifd_send_pages() < 0) {
+        return -1;
+    }
+    trace_multifd_send_sync_main(multifd_send_state->packet_num);
+    for (i = 0; i < multifd_send_state->count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        p->pending_sync = true;
+        qemu_mutex_unlock(&p->mutex);
+        qemu_sem_post(&p->sem);
+    }
+    for (i = 0; i < multifd_send_state->count; i++) {
+        qemu_sem_wait(&multifd_send_state->params[i].sem_sync);
+    }
+    return atomic_read(&multifd_send_state->error) ? -1 : 0;
+}
+
+typedef struct {
+    uint8_t id;
+    char *name;
+    QemuThread thread;
+    QIOChannel *c;
+    /* released by the main thread once every channel is synced */
+    QemuSemaphore sem_sync;
+    bool running;
+    bool quit;
+    /* page_count announced by the source for this channel */
+    uint32_t page_count;
+    uint64_t *offset;
+    struct iovec *iov;
+    /* statistics */
+    uint64_t num_packets;
+    uint64_t num_pages;
+} MultiFDRecvParams;
+
+/* An additional connection whose header has not been read yet */
+typedef struct {
+    QIOChannel *c;
+    guint watch;
+    MultiFDInit_t msg;
+    size_t done;
+} MultiFDHandshake;
+
+static struct {
+    MultiFDRecvParams *params;
+    /* number of channels expected */
+    int nr_channels;
+    /* number of connections accepted so far */
+    int accepted;
+    /* number of channels created so far */
+    int count;
+    /* connections still sending their header */
+    GSList *handshakes;
+    /* one post per channel that has reached a sync point */
+    QemuSemaphore sem_sync;
+    /* protects error */
+    QemuMutex mutex;
+    /* first error of a channel thread, reported at the next sync */
+    Error *error;
+} *multifd_recv_state;
+
+static int multifd_recv_packet(MultiFDRecvParams *p, uint32_t *flags,
+                               Error **errp)
+{
+    MultiFDPacket_t packet;
+    RAMBlock *block;
+    uint32_t used, i;
+    int ret = -1;
+
+    if (qio_channel_read_all(p->c, (char *)&packet, sizeof(packet),
+                             errp) < 0) {
+        return -1;
+    }
+    if (be32_to_cpu(packet.magic) != MULTIFD_MAGIC ||
+        be32_to_cpu(packet.version) != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: invalid packet on channel %d", p->id);
+        return -1;
+    }
+    *flags = be32_to_cpu(packet.flags);
+    if (*flags & MULTIFD_FLAG_SYNC) {
+        return 0;
+    }
+
+    used = be32_to_cpu(packet.pages_used);
+    if (used == 0 || used > p->page_count) {
+        error_setg(errp, "multifd: packet with %u pages, expected at most %u",
+                   used, p->page_count);
+        return -1;
+    }
+    if (qio_channel_read_all(p->c, (char *)p->offset, used * sizeof(uint64_t),
+                             errp) < 0) {
+        return -1;
+    }
+
+    rcu_read_lock();
+    packet.ramblock[sizeof(packet.ramblock) - 1] = 0;
+    block = qemu_ram_block_by_name(packet.ramblock);
+    if (!block) {
+        error_setg(errp, "multifd: unknown ramblock \"%s\"", packet.ramblock);
+        goto out;
+    }
+    for (i = 0; i < used; i++) {
+        ram_addr_t offset = be64_to_cpu(p->offset[i]);
+
+        if ((offset & ~TARGET_PAGE_MASK) ||
+            !offset_in_ramblock(block, offset)) {
+            error_setg(errp, "multifd: illegal RAM offset " RAM_ADDR_FMT
+                       " in ramblock \"%s\"", offset, block->idstr);
+            goto out;
+        }
+        p->iov[i].iov_base = block->host + offset;
+        p->iov[i].iov_len = TARGET_PAGE_SIZE;
+    }
+    ret = qio_channel_readv_all(p->c, p->iov, used, errp);
+    if (!ret) {
+        p->num_packets++;
+        p->num_pages += used;
+    }
+out:
+    rcu_read_unlock();
+    return ret;
+}
+
+static void *multifd_recv_thread(void *opaque)
+{
+    MultiFDRecvParams *p = opaque;
+    Error *local_err = NULL;
+    uint32_t flags;
+
+    rcu_register_thread();
+    trace_multifd_recv_thread_start(p->id);
+
+    while (true) {
+        if (multifd_recv_packet(p, &flags, &local_err) < 0) {
+            break;
+        }
+        if (flags & MULTIFD_FLAG_SYNC) {
+            qemu_sem_post(&multifd_recv_state->sem_sync);
+            qemu_sem_wait(&p->sem_sync);
+        }
+        if (atomic_read(&p->quit)) {
+            break;
+        }
+    }
+
+    if (!atomic_read(&p->quit)) {
+        /* The source closes the channels once the migration has completed,
+         * so only complain if the main thread is still waiting for us.
+         */
+        qemu_mutex_lock(&multifd_recv_state->mutex);
+        if (!multifd_recv_state->error) {
+            multifd_recv_state->error = local_err;
+            local_err = NULL;
+        }
+        qemu_mutex_unlock(&multifd_recv_state->mutex);
+        qemu_sem_post(&multifd_recv_state->sem_sync);
+    }
+    error_free(local_err);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void multifd_load_setup(void)
+{
+    int thread_count = migrate_multifd_channels();
+
+    multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
+    multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
+    multifd_recv_state->nr_channels = thread_count;
+    multifd_recv_state->count = 0;
+    qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    qemu_mutex_init(&multifd_recv_state->mutex);
+}
+
+void multifd_load_cleanup(void)
+{
+    GSList *l;
+    int i;
+
+    if (!multifd_recv_state) {
+        return;
+    }
+    for (l = multifd_recv_state->handshakes; l; l = l->next) {
+        MultiFDHandshake *hs = l->data;
+
+        g_source_remove(hs->watch);
+        object_unref(OBJECT(hs->c));
+        g_free(hs);
+    }
+    g_slist_free(multifd_recv_state->handshakes);
+    for (i = 0; i < multifd_recv_state->nr_channels; i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        if (!p->running) {
+            continue;
+        }
+        atomic_set(&p->quit, true);
+        qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        qemu_sem_post(&p->sem_sync);
+        qemu_thread_join(&p->thread);
+        object_unref(OBJECT(p->c));
+        qemu_sem_destroy(&p->sem_sync);
+        g_free(p->offset);
+        g_free(p->iov);
+        g_free(p->name);
+    }
+    qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_mutex_destroy(&multifd_recv_state->mutex);
+    error_free(multifd_recv_state->error);
+    g_free(multifd_recv_state->params);
+    g_free(multifd_recv_state);
+    multifd_recv_state = NULL;
+}
+
+bool multifd_recv_all_channels_accepted(void)
+{
+    return multifd_recv_state &&
+           multifd_recv_state->accepted == multifd_recv_state->nr_channels;
+}
+
+bool multifd_recv_all_channels_created(void)
+{
+    return multifd_recv_state &&
+           atomic_read(&multifd_recv_state->count) ==
+           multifd_recv_state->nr_channels;
+}
+
+/* Start the receiving thread for @ioc, whose header is @msg */
+static int multifd_recv_start_channel(QIOChannel *ioc, MultiFDInit_t *msg,
+                                      Error **errp)
+{
+    MultiFDRecvParams *p;
+    uint32_t id, page_count;
+
+    if (be32_to_cpu(msg->magic) != MULTIFD_MAGIC ||
+        be32_to_cpu(msg->version) != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: invalid channel header");
+        return -1;
+    }
+    id = be32_to_cpu(msg->id);
+    if (id >= multifd_recv_state->nr_channels) {
+        error_setg(errp, "multifd: channel %u, only %d channels expected",
+                   id, multifd_recv_state->nr_channels);
+        return -1;
+    }
+    p = &multifd_recv_state->params[id];
+    if (p->running) {
+        error_setg(errp, "multifd: channel %u received twice", id);
+        return -1;
+    }
+    page_count = be32_to_cpu(msg->page_count);
+    if (page_count == 0 || page_count > MULTIFD_PAGE_COUNT_MAX) {
+        error_setg(errp, "multifd: invalid page count %u", page_count);
+        return -1;
+    }
+
+    qio_channel_set_blocking(ioc, true, NULL);
+    object_ref(OBJECT(ioc));
+    p->c = ioc;
+    p->id = id;
+    p->quit = false;
+    p->page_count = page_count;
+    p->offset = g_new0(uint64_t, page_count);
+    p->iov = g_new0(struct iovec, page_count);
+    qemu_sem_init(&p->sem_sync, 0);
+    p->name = g_strdup_printf("multifdrecv_%u", id);
+    p->running = true;
+    qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
+                       QEMU_THREAD_JOINABLE);
+    atomic_inc(&multifd_recv_state->count);
+    return 0;
+}
+
+static gboolean multifd_recv_handshake_ready(QIOChannel *ioc,
+                                             GIOCondition condition,
+                                             gpointer opaque)
+{
+    MultiFDHandshake *hs = opaque;
+    Error *local_err = NULL;
+    ssize_t len;
+
+    len = qio_channel_read(ioc, (char *)&hs->msg + hs->done,
+                           sizeof(hs->msg) - hs->done, &local_err);
+    if (len == QIO_CHANNEL_ERR_BLOCK) {
+        return TRUE;
+    }
+    if (len > 0) {
+        hs->done += len;
+        if (hs->done < sizeof(hs->msg)) {
+            return TRUE;
+        }
+        multifd_recv_start_channel(ioc, &hs->msg, &local_err);
+    } else if (len == 0) {
+        error_setg(&local_err, "multifd: connection closed before its header");
+    }
+
+    multifd_recv_state->handshakes =
+        g_slist_remove(multifd_recv_state->handshakes, hs);
+    object_unref(OBJECT(hs->c));
+    g_free(hs);
+    migration_multifd_channel_ready(local_err);
+    return FALSE;
+}
+
+/*
+ * multifd_recv_new_channel: start receiving pages on @ioc, an incoming
+ * connection other than the main migration stream.  The channel header
+ * is read from the main loop as it arrives; migration_multifd_channel_ready()
+ * is called once the channel is running or has failed.
+ */
+void multifd_recv_new_channel(QIOChannel *ioc)
+{
+    MultiFDHandshake *hs = g_new0(MultiFDHandshake, 1);
+
+    object_ref(OBJECT(ioc));
+    hs->c = ioc;
+    qio_channel_set_blocking(ioc, false, NULL);
+    hs->watch = qio_channel_add_watch(ioc, G_IO_IN,
+                                      multifd_recv_handshake_ready, hs, NULL);
+    multifd_recv_state->handshakes =
+        g_slist_prepend(multifd_recv_state->handshakes, hs);
+    multifd_recv_state->accepted++;
+}
+
+/*
+ * multifd_recv_sync_main: wait until every channel has loaded the pages
+ * sent before the sync point, then let them continue.
+ *
+ * Returns: 0 on success, -EIO if a channel has failed
+ */
+static int multifd_recv_sync_main(void)
+{
+    int i;
+
+    if (!multifd_recv_state) {
+        error_report("multifd sync received without multifd enabled");
+        return -EINVAL;
+    }
+    for (i = 0; i < multifd_recv_state->nr_channels; i++) {
+        qemu_sem_wait(&multifd_recv_state->sem_sync);
+    }
+    qemu_mutex_lock(&multifd_recv_state->mutex);
+    if (multifd_recv_state->error) {
+        error_report_err(multifd_recv_state->error);
+        multifd_recv_state->error = NULL;
+        qemu_mutex_unlock(&multifd_recv_state->mutex);
+        return -EIO;
+    }
+    qemu_mutex_unlock(&multifd_recv_state->mutex);
+    trace_multifd_recv_sync_main();
+    for (i = 0; i < multifd_recv_state->nr_channels; i++) {
+        qemu_sem_post(&multifd_recv_state->params[i].sem_sync);
+    }
+    return 0;
+}
+
+/*
+ * x-mapped-ram: each RAMBlock has a fixed region in the migration file,
+ * made of a bitmap of the pages present followed by the pages at their
+ * offset in the block.  The stream only carries where the regions are;
+ * the pages are written and read with pwrite/pread by a pool of threads.
+ */
+
+/* Pages of a block start at a multiple of this in the file */
+#define MAPPED_RAM_ALIGN (1 * 1024 * 1024)
+/* Largest run of contiguous pages written or read at once */
+#define MAPPED_RAM_JOB_SIZE (1 * 1024 * 1024)
+/* Jobs queued per thread before the producer waits */
+#define MAPPED_RAM_QUEUE_DEPTH 4
+
+typedef struct MappedRamJob {
+    uint8_t *host;
+    size_t len;
+    uint64_t offset;
+    QSIMPLEQ_ENTRY(MappedRamJob) next;
+} MappedRamJob;
+
+typedef struct {
+    int fd;
+    bool write;
+    int count;
+    QemuThread *threads;
+    QemuMutex mutex;
+    /* signalled when a job is queued or on quit */
+    QemuCond job_cond;
+    /* signalled when a job is done */
+    QemuCond done_cond;
+    QSIMPLEQ_HEAD(, MappedRamJob) jobs;
+    /* jobs queued or running */
+    unsigned int pending;
+    bool quit;
+    int error;
+    /* run of dirty pages being gathered by the migration thread */
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t len;
+} MappedRamState;
+
+/* Only used on the source; the destination has one during ram_load */
+static MappedRamState *mapped_ram_state;
+
+/* Returns: 0 on success, negative errno on error */
+static int mapped_ram_io(int fd, bool write, uint8_t *buf, size_t len,
+                         uint64_t offset)
+{
+    while (len) {
+        ssize_t ret;
+
+        if (write) {
+            ret = pwrite(fd, buf, len, offset);
+        } else {
+            ret = pread(fd, buf, len, offset);
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            /* the file is shorter than the layout says */
+            return -EIO;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static void *mapped_ram_thread(void *opaque)
+{
+    MappedRamState *s = opaque;
+
+    rcu_register_thread();
+    qemu_mutex_lock(&s->mutex);
+    while (true) {
+        MappedRamJob *job;
+        int ret = 0;
+
+        while (!s->quit && QSIMPLEQ_EMPTY(&s->jobs)) {
+            qemu_cond_wait(&s->job_cond, &s->mutex);
+        }
+        job = QSIMPLEQ_FIRST(&s->jobs);
+        if (!job) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&s->jobs, next);
+        if (!s->error) {
+            qemu_mutex_unlock(&s->mutex);
+            /* The job points into guest RAM; keep the block alive */
+            rcu_read_lock();
+            ret = mapped_ram_io(s->fd, s->write, job->host, job->len,
+                                job->offset);
+            rcu_read_unlock();
+            qemu_mutex_lock(&s->mutex);
+        }
+        g_free(job);
+        if (ret < 0 && !s->error) {
+            s->error = ret;
+        }
+        s->pending--;
+        qemu_cond_broadcast(&s->done_cond);
+    }
+    qemu_mutex_unlock(&s->mutex);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static MappedRamState *mapped_ram_new(int fd, bool write)
+{
+    MappedRamState *s = g_new0(MappedRamState, 1);
+    int i;
+
+    s->fd = fd;
+    s->write = write;
+    s->count = migrate_multifd_channels();
+    s->threads = g_new0(QemuThread, s->count);
+    qemu_mutex_init(&s->mutex);
+    qemu_cond_init(&s->job_cond);
+    qemu_cond_init(&s->done_cond);
+    QSIMPLEQ_INIT(&s->jobs);
+    for (i = 0; i < s->count; i++) {
+        qemu_thread_create(&s->threads[i], "mapped_ram", mapped_ram_thread,
+                           s, QEMU_THREAD_JOINABLE);
+    }
+    return s;
+}
+
+/* Queued jobs are still run, unless one of them has failed */
+static void mapped_ram_free(MappedRamState *s)
+{
+    int i;
+
+    qemu_mutex_lock(&s->mutex);
+    s->quit = true;
+    qemu_cond_broadcast(&s->job_cond);
+    qemu_mutex_unlock(&s->mutex);
+    for (i = 0; i < s->count; i++) {
+        qemu_thread_join(&s->threads[i]);
+    }
+    qemu_cond_destroy(&s->done_cond);
+    qemu_cond_destroy(&s->job_cond);
+    qemu_mutex_destroy(&s->mutex);
+    g_free(s->threads);
+    g_free(s);
+}
+
+/*
+ * Queue @len bytes at @host to be written to, or read from, @offset in
+ * the file.  Waits while the threads already have enough work.
+ *
+ * Returns: 0 on success, the error of an earlier job otherwise
+ */
+static int mapped_ram_queue(MappedRamState *s, uint8_t *host, size_t len,
+                            uint64_t offset)
+{
+    MappedRamJob *job;
+    int ret;
+
+    qemu_mutex_lock(&s->mutex);
+    while (!s->error && s->pending >= s->count * MAPPED_RAM_QUEUE_DEPTH) {
+        qemu_cond_wait(&s->done_cond, &s->mutex);
+    }
+    ret = s->error;
+    if (!ret) {
+        job = g_new(MappedRamJob, 1);
+        job->host = host;
+        job->len = len;
+        job->offset = offset;
+        QSIMPLEQ_INSERT_TAIL(&s->jobs, job, next);
+        s->pending++;
+        qemu_cond_signal(&s->job_cond);
+    }
+    qemu_mutex_unlock(&s->mutex);
+    return ret;
+}
+
+/*
+ * Wait until all the jobs queued so far are done.
+ *
+ * Returns: 0 on success, negative errno if any of them failed
+ */
+static int mapped_ram_wait(MappedRamState *s)
+{
+    int ret;
+
+    qemu_mutex_lock(&s->mutex);
+    while (s->pending) {
+        qemu_cond_wait(&s->done_cond, &s->mutex);
+    }
+    ret = s->error;
+    qemu_mutex_unlock(&s->mutex);
+    return ret;
+}
+
+/* Hand the run of pages gathered so far to the threads */
+static void mapped_ram_flush(QEMUFile *f)
+{
+    MappedRamState *s = mapped_ram_state;
+    int ret;
+
+    if (!s || !s->len) {
+        return;
+    }
+    ret = mapped_ram_queue(s, s->block->host + s->start, s->len,
+                           s->block->pages_offset + s->start);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+    }
+    s->len = 0;
+}
+
+/*
+ * mapped_ram_sync: make sure the pages sent so far are in the file
+ * before they can be sent again, i.e. whenever we go around RAM, and
+ * before the bitmaps are written.
+ */
+static void mapped_ram_sync(QEMUFile *f)
+{
+    int ret;
+
+    if (!mapped_ram_state) {
+        return;
+    }
+    mapped_ram_flush(f);
+    ret = mapped_ram_wait(mapped_ram_state);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+    }
+}
+
+/*
+ * Reserve the region of @block in the file, right after the current
+ * position of the stream, and tell the destination where it is.  The
+ * stream goes on after the region.
+ */
+static void mapped_ram_save_block_header(QEMUFile *f, RAMBlock *block)
+{
+    long pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = DIV_ROUND_UP(pages, BITS_PER_BYTE);
+
+    /* the two offsets themselves come first */
+    block->bitmap_offset = qemu_ftell(f) + 2 * sizeof(uint64_t);
+    block->pages_offset = QEMU_ALIGN_UP(block->bitmap_offset + bitmap_size,
+                                        MAPPED_RAM_ALIGN);
+    block->file_bmap = bitmap_new(pages);
+
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+    qemu_file_seek(f, block->pages_offset + block->used_length);
+}
+
+/*
+ * Write the bitmap of the pages present for each block, one bit per page
+ * in little endian bit order.  Zero pages are not present: the
+ * destination RAM is zero already.
+ */
+static int mapped_ram_save_bitmaps(void)
+{
+    RAMBlock *block;
+
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        long pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t bitmap_size = DIV_ROUND_UP(pages, BITS_PER_BYTE);
+        uint8_t *buf;
+        long i;
+        int ret;
+
+        if (!block->file_bmap) {
+            error_report("RAM block %s was added during the migration",
+                         block->idstr);
+            return -EINVAL;
+        }
+        buf = g_malloc0(bitmap_size);
+        for (i = find_first_bit(block->file_bmap, pages); i < pages;
+             i = find_next_bit(block->file_bmap, pages, i + 1)) {
+            buf[i / BITS_PER_BYTE] |= 1 << (i % BITS_PER_BYTE);
+        }
+        ret = mapped_ram_io(mapped_ram_state->fd, true, buf, bitmap_size,
+                            block->bitmap_offset);
+        g_free(buf);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static void mapped_ram_save_cleanup(void)
+{
+    RAMBlock *block;
+
+    if (!mapped_ram_state) {
+        return;
+    }
+    mapped_ram_free(mapped_ram_state);
+    mapped_ram_state = NULL;
+
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+    }
+    rcu_read_unlock();
+}
+
+/*
+ * Read the region of @block described in the stream and queue the
+ * present pages on @s, zero the others, then move the stream past the
+ * region.
+ *
+ * Returns: 0 on success, negative errno on error
+ */
+static int mapped_ram_load_block(QEMUFile *f, MappedRamState *s,
+                                 RAMBlock *block)
+{
+    long pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = DIV_ROUND_UP(pages, BITS_PER_BYTE);
+    uint64_t bitmap_offset, pages_offset;
+    long i, start = -1;
+    uint8_t *bitmap;
+    int ret;
+
+    bitmap_offset = qemu_get_be64(f);
+    pages_offset = qemu_get_be64(f);
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        return ret;
     }
-    qemu_mutex_destroy(&comp_done_lock);
-    qemu_cond_destroy(&comp_done_cond);
-    g_free(compress_threads);
-    g_free(comp_param);
-    compress_threads = NULL;
-    comp_param = NULL;
-}
 
-void migrate_compress_threads_create(void)
-{
-    int i, thread_count;
+    bitmap = g_malloc(bitmap_size);
+    ret = mapped_ram_io(s->fd, false, bitmap, bitmap_size, bitmap_offset);
+    for (i = 0; !ret && i <= pages; i++) {
+        bool present = i < pages &&
+                       (bitmap[i / BITS_PER_BYTE] & (1 << (i % BITS_PER_BYTE)));
+
+        if (start >= 0 &&
+            (!present ||
+             ((i - start) << TARGET_PAGE_BITS) >= MAPPED_RAM_JOB_SIZE)) {
+            ram_addr_t offset = (ram_addr_t)start << TARGET_PAGE_BITS;
+
+            ret = mapped_ram_queue(s, block->host + offset,
+                                   (i - start) << TARGET_PAGE_BITS,
+                                   pages_offset + offset);
+            start = -1;
+        }
+        if (present && start < 0) {
+            start = i;
+        } else if (!present && i < pages) {
+            ram_addr_t offset = (ram_addr_t)i << TARGET_PAGE_BITS;
 
-    if (!migrate_use_compression()) {
-        return;
+            /* Zero pages are not in the file, and RAM here need not be zero */
+            ram_handle_compressed(block->host + offset, 0, TARGET_PAGE_SIZE);
+        }
     }
-    compression_switch = true;
-    thread_count = migrate_compress_threads();
-    compress_threads = g_new0(QemuThread, thread_count);
-    comp_param = g_new0(CompressParam, thread_count);
-    qemu_cond_init(&comp_done_cond);
-    qemu_mutex_init(&comp_done_lock);
-    for (i = 0; i < thread_count; i++) {
-        /* comp_param[i].file is just used as a dummy buffer to save data,
-         * set its ops to empty.
-         */
-        comp_param[i].file = qemu_fopen_ops(NULL, &empty_ops);
-        comp_param[i].done = true;
-        comp_param[i].quit = false;
-        qemu_mutex_init(&comp_param[i].mutex);
-        qemu_cond_init(&comp_param[i].cond);
-        qemu_thread_create(compress_threads + i, "compress",
-                           do_data_compress, comp_param + i,
-                           QEMU_THREAD_JOINABLE);
+    g_free(bitmap);
+    if (ret < 0) {
+        error_report("Failed to read RAM block %s from the file: %s",
+                     block->idstr, strerror(-ret));
+        return ret;
     }
+
+    return qemu_file_seek(f, pages_offset + block->used_length);
 }
 
 /**
@@ -495,6 +1721,7 @@ static int save_xbzrle_page(QEMUFile *f, uint8_t **current_data,
         }
         return -1;
     }
+    acct_info.xbzrle_cache_hit++;
 
     prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
 
@@ -583,12 +1810,159 @@ static inline bool migration_bitmap_clear_dirty(ram_addr_t addr)
     return ret;
 }
 
-static void migration_bitmap_sync_range(ram_addr_t start, ram_addr_t length)
-{
+/*
+ * The dirty log is copied into the migration bitmap in chunks of guest
+ * RAM, shared between the migration thread and a few helper threads.
+ * Chunk boundaries are aligned so that only the ends of a RAMBlock can
+ * share a bitmap word with another chunk.
+ */
+#define BITMAP_SYNC_CHUNK_SIZE (1ULL << 30)
+#define BITMAP_SYNC_THREADS_MAX 8
+
+typedef struct {
+    ram_addr_t start;
+    ram_addr_t length;
+} BitmapSyncChunk;
+
+typedef struct {
+    /* helper threads, not counting the migration thread */
+    int count;
+    QemuThread *threads;
+    /* posted once per helper needed by a sync, and on quit */
+    QemuSemaphore sem;
+    /* posted by each helper once it is out of chunks */
+    QemuSemaphore done_sem;
+    bool quit;
+    /* the sync in progress */
     unsigned long *bitmap;
-    bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
-    migration_dirty_pages +=
-        cpu_physical_memory_sync_dirty_bitmap(bitmap, start, length);
+    BitmapSyncChunk *chunks;
+    int nr_chunks;
+    int max_chunks;
+    int next_chunk;
+    uint64_t num_dirty;
+} BitmapSyncState;
+
+static BitmapSyncState *bitmap_sync_state;
+
+static void bitmap_sync_run(BitmapSyncState *s)
+{
+    uint64_t num_dirty = 0;
+    int i;
+
+    while ((i = atomic_fetch_inc(&s->next_chunk)) < s->nr_chunks) {
+        num_dirty += cpu_physical_memory_sync_dirty_bitmap(s->bitmap,
+                                                           s->chunks[i].start,
+                                                           s->chunks[i].length);
+    }
+    atomic_add(&s->num_dirty, num_dirty);
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    BitmapSyncState *s = opaque;
+
+    rcu_register_thread();
+    while (true) {
+        qemu_sem_wait(&s->sem);
+        if (atomic_read(&s->quit)) {
+            break;
+        }
+        rcu_read_lock();
+        bitmap_sync_run(s);
+        rcu_read_unlock();
+        qemu_sem_post(&s->done_sem);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static BitmapSyncState *bitmap_sync_new(void)
+{
+    BitmapSyncState *s = g_new0(BitmapSyncState, 1);
+    int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    s->count = MIN(sysconf(_SC_NPROCESSORS_ONLN), BITMAP_SYNC_THREADS_MAX) - 1;
+    s->count = MAX(s->count, 0);
+#endif
+    s->threads = g_new0(QemuThread, s->count);
+    qemu_sem_init(&s->sem, 0);
+    qemu_sem_init(&s->done_sem, 0);
+    for (i = 0; i < s->count; i++) {
+        qemu_thread_create(&s->threads[i], "bitmap_sync", bitmap_sync_thread,
+                           s, QEMU_THREAD_JOINABLE);
+    }
+    return s;
+}
+
+static void bitmap_sync_cleanup(void)
+{
+    BitmapSyncState *s = bitmap_sync_state;
+    int i;
+
+    if (!s) {
+        return;
+    }
+    atomic_set(&s->quit, true);
+    for (i = 0; i < s->count; i++) {
+        qemu_sem_post(&s->sem);
+    }
+    for (i = 0; i < s->count; i++) {
+        qemu_thread_join(&s->threads[i]);
+    }
+    qemu_sem_destroy(&s->done_sem);
+    qemu_sem_destroy(&s->sem);
+    g_free(s->chunks);
+    g_free(s->threads);
+    g_free(s);
+    bitmap_sync_state = NULL;
+}
+
+/* Called with migration_bitmap_mutex and the rcu read lock held */
+static void migration_bitmap_sync_blocks(void)
+{
+    BitmapSyncState *s = bitmap_sync_state;
+    RAMBlock *block;
+    int i, helpers;
+
+    if (!s) {
+        s = bitmap_sync_state = bitmap_sync_new();
+    }
+
+    s->nr_chunks = 0;
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        ram_addr_t start = block->offset;
+        ram_addr_t end = block->offset + block->used_length;
+
+        while (start < end) {
+            ram_addr_t next = MIN(end, QEMU_ALIGN_DOWN(start,
+                                                       BITMAP_SYNC_CHUNK_SIZE)
+                                       + BITMAP_SYNC_CHUNK_SIZE);
+
+            if (s->nr_chunks == s->max_chunks) {
+                s->max_chunks = MAX(s->max_chunks * 2, 16);
+                s->chunks = g_renew(BitmapSyncChunk, s->chunks,
+                                    s->max_chunks);
+            }
+            s->chunks[s->nr_chunks].start = start;
+            s->chunks[s->nr_chunks].length = next - start;
+            s->nr_chunks++;
+            start = next;
+        }
+    }
+
+    s->bitmap = atomic_rcu_read(&migration_bitmap_rcu)->bmap;
+    s->next_chunk = 0;
+    s->num_dirty = 0;
+    helpers = MIN(s->count, s->nr_chunks - 1);
+    for (i = 0; i < helpers; i++) {
+        qemu_sem_post(&s->sem);
+    }
+    bitmap_sync_run(s);
+    for (i = 0; i < helpers; i++) {
+        qemu_sem_wait(&s->done_sem);
+    }
+    migration_dirty_pages += s->num_dirty;
 }
 
 /* Fix me: there are too many global variables used in migration process. */
@@ -607,11 +1981,16 @@ static void migration_bitmap_sync_init(void)
     iterations_prev = 0;
 }
 
-static void migration_bitmap_sync(void)
+/*
+ * Called with the iothread lock held.  With @unlock_iothread the lock is
+ * dropped once the dirty log has been fetched from the accelerator, while
+ * it is merged into the migration bitmap.
+ */
+static void migration_bitmap_sync(bool unlock_iothread)
 {
-    RAMBlock *block;
     uint64_t num_dirty_pages_init = migration_dirty_pages;
     MigrationState *s = migrate_get_current();
+    int64_t sync_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int64_t end_time;
     int64_t bytes_xfer_now;
 
@@ -627,17 +2006,24 @@ static void migration_bitmap_sync(void)
 
     trace_migration_bitmap_sync_start();
     address_space_sync_dirty_bitmap(&address_space_memory);
+    if (unlock_iothread) {
+        qemu_mutex_unlock_iothread();
+    }
 
     qemu_mutex_lock(&migration_bitmap_mutex);
     rcu_read_lock();
-    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
-        migration_bitmap_sync_range(block->offset, block->used_length);
-    }
+    migration_bitmap_sync_blocks();
     rcu_read_unlock();
     qemu_mutex_unlock(&migration_bitmap_mutex);
 
+    if (unlock_iothread) {
+        qemu_mutex_lock_iothread();
+    }
+    s->dirty_sync_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - sync_start;
+    s->dirty_sync_time_total += s->dirty_sync_time;
     trace_migration_bitmap_sync_end(migration_dirty_pages
-                                    - num_dirty_pages_init);
+                                    - num_dirty_pages_init,
+                                    s->dirty_sync_time);
     num_dirty_pages_period += migration_dirty_pages - num_dirty_pages_init;
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -712,6 +2098,57 @@ static int save_zero_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
     return pages;
 }
 
+/**
+ * mapped_ram_save_page: queue the page to be written at its place in
+ *                       the file, gathering runs of contiguous pages
+ *
+ * Returns: 1, the number of pages written
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ * @bytes_transferred: increase it with the number of transferred bytes
+ */
+static int mapped_ram_save_page(QEMUFile *f, RAMBlock *block,
+                                ram_addr_t offset,
+                                uint64_t *bytes_transferred)
+{
+    MappedRamState *s = mapped_ram_state;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+
+    if (!block->file_bmap) {
+        error_report("RAM block %s was added during the migration",
+                     block->idstr);
+        qemu_file_set_error(f, -EINVAL);
+        return 1;
+    }
+
+    if (is_zero_range(block->host + offset, TARGET_PAGE_SIZE)) {
+        /* Nothing to write, the destination zeroes the pages missing
+         * from the bitmap
+         */
+        clear_bit(page, block->file_bmap);
+        acct_info.dup_pages++;
+        return 1;
+    }
+    set_bit(page, block->file_bmap);
+
+    if (s->len && (s->block != block || s->start + s->len != offset ||
+                   s->len >= MAPPED_RAM_JOB_SIZE)) {
+        mapped_ram_flush(f);
+    }
+    if (!s->len) {
+        s->block = block;
+        s->start = offset;
+    }
+    s->len += TARGET_PAGE_SIZE;
+
+    *bytes_transferred += TARGET_PAGE_SIZE;
+    qemu_file_update_transfer(f, TARGET_PAGE_SIZE);
+    acct_info.norm_pages++;
+    return 1;
+}
+
 /**
  * ram_save_page: Send the given page to the stream
  *
@@ -783,6 +2220,22 @@ static int ram_save_page(QEMUFile *f, PageSearchStatus *pss,
         }
     }
 
+    /* Pages that can be sent asynchronously go to the multifd channels;
+     * these do not go through the main stream, so last_sent_block
+     * stays as it is.
+     */
+    if (pages == -1 && send_async && multifd_send_state) {
+        if (multifd_queue_page(block, pss->offset) < 0) {
+            qemu_file_set_error(f, -EIO);
+        } else {
+            *bytes_transferred += TARGET_PAGE_SIZE;
+            qemu_file_update_transfer(f, TARGET_PAGE_SIZE);
+            acct_info.norm_pages++;
+        }
+        XBZRLE_cache_unlock();
+        return 1;
+    }
+
     /* XBZRLE overflow or normal page */
     if (pages == -1) {
         *bytes_transferred += save_page_header(f, block,
@@ -799,6 +2252,14 @@ static int ram_save_page(QEMUFile *f, PageSearchStatus *pss,
 
     XBZRLE_cache_unlock();
 
+    /* Only update last_sent_block if a block was actually sent; xbzrle
+     * might have decided the page was identical so didn't bother writing
+     * to the stream.
+     */
+    if (pages > 0) {
+        last_sent_block = block;
+    }
+
     return pages;
 }
 
@@ -823,8 +2284,68 @@ static int do_compress_ram_page(QEMUFile *f, RAMBlock *block,
     return bytes_sent;
 }
 
+/*
+ * do_compress_ram_batch: compress @nr_pages pages of @block as a whole
+ *
+ * The record header, which always carries the block name, goes to @f
+ * while the compressed data is left in @out.  @buf is scratch space for
+ * a copy of the pages.
+ *
+ * Returns: the size of the compressed data, or -1 on error
+ */
+static ssize_t do_compress_ram_batch(QEMUFile *f, MigrationCompressCtx *ctx,
+                                     RAMBlock *block,
+                                     const ram_addr_t *offset, int nr_pages,
+                                     uint8_t *buf, uint8_t *out)
+{
+    size_t size = nr_pages * TARGET_PAGE_SIZE;
+    ssize_t len;
+    int i;
+
+    /* the guest keeps running, compress a stable copy */
+    for (i = 0; i < nr_pages; i++) {
+        memcpy(buf + i * TARGET_PAGE_SIZE, block->host + offset[i],
+               TARGET_PAGE_SIZE);
+    }
+    len = migration_compress(ctx, compress_method, migrate_compress_level(),
+                             out, migration_compress_bound(compress_method,
+                                                           size),
+                             buf, size);
+    if (len < 0) {
+        qemu_file_set_error(migrate_get_current()->to_dst_file, -EIO);
+        error_report("compressed data failed!");
+        return -1;
+    }
+
+    save_page_header(f, block, offset[0] | RAM_SAVE_FLAG_COMPRESS_BATCH);
+    qemu_put_byte(f, compress_method);
+    qemu_put_byte(f, nr_pages);
+    for (i = 1; i < nr_pages; i++) {
+        qemu_put_be64(f, offset[i]);
+    }
+    qemu_put_be32(f, len);
+    return len;
+}
+
+/* Move the output of a compression thread to the migration stream */
+static int compress_collect(QEMUFile *f, CompressParam *param)
+{
+    int len = qemu_put_qemu_file(f, param->file);
+
+    if (param->out_len) {
+        qemu_put_buffer(f, param->out, param->out_len);
+        len += param->out_len;
+        param->out_len = 0;
+        /* batches carry the block name, following pages can refer to it */
+        last_sent_block = param->out_block;
+    }
+    return len;
+}
+
 static uint64_t bytes_transferred;
 
+static void compress_batch_flush(QEMUFile *f, uint64_t *bytes_transferred);
+
 static void flush_compressed_data(QEMUFile *f)
 {
     int idx, len, thread_count;
@@ -832,6 +2353,7 @@ static void flush_compressed_data(QEMUFile *f)
     if (!migrate_use_compression()) {
         return;
     }
+    compress_batch_flush(f, &bytes_transferred);
     thread_count = migrate_compress_threads();
 
     qemu_mutex_lock(&comp_done_lock);
@@ -845,7 +2367,7 @@ static void flush_compressed_data(QEMUFile *f)
     for (idx = 0; idx < thread_count; idx++) {
         qemu_mutex_lock(&comp_param[idx].mutex);
         if (!comp_param[idx].quit) {
-            len = qemu_put_qemu_file(f, comp_param[idx].file);
+            len = compress_collect(f, &comp_param[idx]);
             bytes_transferred += len;
         }
         qemu_mutex_unlock(&comp_param[idx].mutex);
@@ -853,14 +2375,16 @@ static void flush_compressed_data(QEMUFile *f)
 }
 
 static inline void set_compress_params(CompressParam *param, RAMBlock *block,
-                                       ram_addr_t offset)
+                                       const ram_addr_t *offset, int nr_pages)
 {
     param->block = block;
-    param->offset = offset;
+    memcpy(param->offset, offset, nr_pages * sizeof(offset[0]));
+    param->nr_pages = nr_pages;
 }
 
 static int compress_page_with_multi_thread(QEMUFile *f, RAMBlock *block,
-                                           ram_addr_t offset,
+                                           const ram_addr_t *offset,
+                                           int nr_pages,
                                            uint64_t *bytes_transferred)
 {
     int idx, thread_count, bytes_xmit = -1, pages = -1;
@@ -871,13 +2395,14 @@ static int compress_page_with_multi_thread(QEMUFile *f, RAMBlock *block,
         for (idx = 0; idx < thread_count; idx++) {
             if (comp_param[idx].done) {
                 comp_param[idx].done = false;
-                bytes_xmit = qemu_put_qemu_file(f, comp_param[idx].file);
+                bytes_xmit = compress_collect(f, &comp_param[idx]);
                 qemu_mutex_lock(&comp_param[idx].mutex);
-                set_compress_params(&comp_param[idx], block, offset);
+                set_compress_params(&comp_param[idx], block, offset,
+                                    nr_pages);
                 qemu_cond_signal(&comp_param[idx].cond);
                 qemu_mutex_unlock(&comp_param[idx].mutex);
-                pages = 1;
-                acct_info.norm_pages++;
+                pages = nr_pages;
+                acct_info.norm_pages += nr_pages;
                 *bytes_transferred += bytes_xmit;
                 break;
             }
@@ -893,6 +2418,54 @@ static int compress_page_with_multi_thread(QEMUFile *f, RAMBlock *block,
     return pages;
 }
 
+/* Hand the pending lz4/zstd batch to a compression thread */
+static void compress_batch_flush(QEMUFile *f, uint64_t *bytes_transferred)
+{
+    if (!compress_batch.nr_pages) {
+        return;
+    }
+    compress_page_with_multi_thread(f, compress_batch.block,
+                                    compress_batch.offset,
+                                    compress_batch.nr_pages,
+                                    bytes_transferred);
+    compress_batch.nr_pages = 0;
+}
+
+/*
+ * ram_save_compressed_batch: queue a page for lz4/zstd compression
+ *
+ * Batches carry the name of their block, so unlike zlib there is no need
+ * to flush the threads when moving to another block.
+ *
+ * Returns: Number of pages written.
+ */
+static int ram_save_compressed_batch(QEMUFile *f, PageSearchStatus *pss,
+                                     uint64_t *bytes_transferred)
+{
+    RAMBlock *block = pss->block;
+    ram_addr_t offset = pss->offset;
+    int pages;
+
+    pages = save_zero_page(f, block,
+                           block == last_sent_block ?
+                           offset | RAM_SAVE_FLAG_CONTINUE : offset,
+                           block->host + offset, bytes_transferred);
+    if (pages > 0) {
+        last_sent_block = block;
+        return pages;
+    }
+
+    if (compress_batch.nr_pages && compress_batch.block != block) {
+        compress_batch_flush(f, bytes_transferred);
+    }
+    compress_batch.block = block;
+    compress_batch.offset[compress_batch.nr_pages++] = offset;
+    if (compress_batch.nr_pages == COMPRESS_BATCH_PAGES) {
+        compress_batch_flush(f, bytes_transferred);
+    }
+    return 1;
+}
+
 /**
  * ram_save_compressed_page: compress the given page and send it to the stream
  *
@@ -931,6 +2504,8 @@ static int ram_save_compressed_page(QEMUFile *f, PageSearchStatus *pss,
                 acct_info.dup_pages++;
             }
         }
+    } else if (compress_method != MIGRATION_COMPRESS_METHOD_ZLIB) {
+        return ram_save_compressed_batch(f, pss, bytes_transferred);
     } else {
         /* When starting the process of a new block, the first page of
          * the block should be sent out before other pages in the same
@@ -960,15 +2535,37 @@ static int ram_save_compressed_page(QEMUFile *f, PageSearchStatus *pss,
             offset |= RAM_SAVE_FLAG_CONTINUE;
             pages = save_zero_page(f, block, offset, p, bytes_transferred);
             if (pages == -1) {
-                pages = compress_page_with_multi_thread(f, block, offset,
+                pages = compress_page_with_multi_thread(f, block, &offset, 1,
                                                         bytes_transferred);
             }
         }
     }
 
+    if (pages > 0) {
+        last_sent_block = block;
+    }
+
     return pages;
 }
 
+/*
+ * multifd_send_sync: make sure the pages sent over the multifd channels
+ * so far are loaded before anything that follows in @f.  Needed each
+ * time a page may be sent again, i.e. whenever we go around RAM.
+ */
+static void multifd_send_sync(QEMUFile *f)
+{
+    if (!multifd_send_state || qemu_file_get_error(f)) {
+        return;
+    }
+    if (multifd_send_sync_main() < 0) {
+        qemu_file_set_error(f, -EIO);
+        return;
+    }
+    qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_SYNC);
+    bytes_transferred += 8;
+}
+
 /*
  * Find the next dirty page and update any state associated with
  * the search process.
@@ -1005,11 +2602,16 @@ static bool find_dirty_block(QEMUFile *f, PageSearchStatus *pss,
             /* Flag that we've looped */
             pss->complete_round = true;
             ram_bulk_stage = false;
+            multifd_send_sync(f);
+            mapped_ram_sync(f);
+            /* Pages still in the compression threads must reach the
+             * stream before they are sent again in the next round.
+             */
+            flush_compressed_data(f);
             if (migrate_use_xbzrle()) {
                 /* If xbzrle is on, stop using the data compression at this
                  * point. In theory, xbzrle can do better than compression.
                  */
-                flush_compressed_data(f);
                 compression_switch = false;
             }
         }
@@ -1235,7 +2837,10 @@ static int ram_save_target_page(MigrationState *ms, QEMUFile *f,
     /* Check the pages is dirty and if it is send it */
     if (migration_bitmap_clear_dirty(dirty_ram_abs)) {
         unsigned long *unsentmap;
-        if (compression_switch && migrate_use_compression()) {
+        if (mapped_ram_state) {
+            res = mapped_ram_save_page(f, pss->block, pss->offset,
+                                       bytes_transferred);
+        } else if (compression_switch && migrate_use_compression()) {
             res = ram_save_compressed_page(f, pss,
                                            last_stage,
                                            bytes_transferred);
@@ -1251,13 +2856,6 @@ static int ram_save_target_page(MigrationState *ms, QEMUFile *f,
         if (unsentmap) {
             clear_bit(dirty_ram_abs >> TARGET_PAGE_BITS, unsentmap);
         }
-        /* Only update last_sent_block if a block was actually sent; xbzrle
-         * might have decided the page was identical so didn't bother writing
-         * to the stream.
-         */
-        if (res > 0) {
-            last_sent_block = pss->block;
-        }
     }
 
     return res;
@@ -1434,6 +3032,9 @@ static void ram_migration_cleanup(void *opaque)
         XBZRLE.current_buf = NULL;
     }
     XBZRLE_cache_unlock();
+
+    mapped_ram_save_cleanup();
+    bitmap_sync_cleanup();
 }
 
 static void reset_ram_globals(void)
@@ -1458,7 +3059,7 @@ void migration_bitmap_extend(ram_addr_t old, ram_addr_t new)
         bitmap->bmap = bitmap_new(new);
 
         /* prevent migration_bitmap content from being set bit
-         * by migration_bitmap_sync_range() at the same time.
+         * by migration_bitmap_sync() at the same time.
          * it is safe to migration if migration_bitmap is cleared bit
          * at the same time.
          */
@@ -1778,7 +3379,7 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms)
     rcu_read_lock();
 
     /* This should be our last sync, the src is now paused */
-    migration_bitmap_sync();
+    migration_bitmap_sync(false);
 
     unsentmap = atomic_rcu_read(&migration_bitmap_rcu)->unsentmap;
     if (!unsentmap) {
@@ -1885,6 +3486,16 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     migration_bitmap_sync_init();
     qemu_mutex_init(&migration_bitmap_mutex);
 
+    if (migrate_use_mapped_ram()) {
+        int fd = qemu_get_fd(f);
+
+        if (fd < 0) {
+            error_report("x-mapped-ram needs a file: migration");
+            return -1;
+        }
+        mapped_ram_state = mapped_ram_new(fd, true);
+    }
+
     if (migrate_use_xbzrle()) {
         XBZRLE_cache_lock();
         XBZRLE.cache = cache_init(migrate_xbzrle_cache_size() /
@@ -1940,7 +3551,7 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     migration_dirty_pages = ram_bytes_total() >> TARGET_PAGE_BITS;
 
     memory_global_dirty_log_start();
-    migration_bitmap_sync();
+    migration_bitmap_sync(false);
     qemu_mutex_unlock_ramlist();
     qemu_mutex_unlock_iothread();
 
@@ -1950,6 +3561,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         qemu_put_byte(f, strlen(block->idstr));
         qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
         qemu_put_be64(f, block->used_length);
+        if (mapped_ram_state) {
+            mapped_ram_save_block_header(f, block);
+        }
     }
 
     rcu_read_unlock();
@@ -1972,6 +3586,9 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     rcu_read_lock();
     if (ram_list.version != last_version) {
         reset_ram_globals();
+        /* the scan starts over, pages may be sent again */
+        multifd_send_sync(f);
+        mapped_ram_sync(f);
     }
 
     /* Read version before ram_list.blocks */
@@ -2008,6 +3625,11 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         i++;
     }
     flush_compressed_data(f);
+    if (multifd_send_state && multifd_send_state->pages->used &&
+        multifd_send_pages() < 0) {
+        qemu_file_set_error(f, -EIO);
+    }
+    mapped_ram_flush(f);
     rcu_read_unlock();
 
     /*
@@ -2033,7 +3655,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     rcu_read_lock();
 
     if (!migration_in_postcopy(migrate_get_current())) {
-        migration_bitmap_sync();
+        migration_bitmap_sync(false);
     }
 
     ram_control_before_iterate(f, RAM_CONTROL_FINISH);
@@ -2052,6 +3674,15 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     }
 
     flush_compressed_data(f);
+    multifd_send_sync(f);
+    mapped_ram_sync(f);
+    if (mapped_ram_state && !qemu_file_get_error(f)) {
+        int ret = mapped_ram_save_bitmaps();
+
+        if (ret < 0) {
+            qemu_file_set_error(f, ret);
+        }
+    }
     ram_control_after_iterate(f, RAM_CONTROL_FINISH);
 
     rcu_read_unlock();
@@ -2073,7 +3704,7 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
         remaining_size < max_size) {
         qemu_mutex_lock_iothread();
         rcu_read_lock();
-        migration_bitmap_sync();
+        migration_bitmap_sync(true);
         rcu_read_unlock();
         qemu_mutex_unlock_iothread();
         remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
@@ -2178,12 +3809,30 @@ void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
     }
 }
 
+/* Decompress a batch of pages and copy them to their place in RAM */
+static bool do_decompress_ram_batch(DecompressParam *param, int len)
+{
+    size_t size = param->nr_pages * TARGET_PAGE_SIZE;
+    int i;
+
+    if (migration_decompress(param->ctx, param->method, param->buf, size,
+                             param->compbuf, len) != size) {
+        return false;
+    }
+    for (i = 0; i < param->nr_pages; i++) {
+        memcpy(param->hosts[i], param->buf + i * TARGET_PAGE_SIZE,
+               TARGET_PAGE_SIZE);
+    }
+    return true;
+}
+
 static void *do_data_decompress(void *opaque)
 {
     DecompressParam *param = opaque;
     unsigned long pagesize;
     uint8_t *des;
     int len;
+    bool ok;
 
     qemu_mutex_lock(&param->mutex);
     while (!param->quit) {
@@ -2193,16 +3842,24 @@ static void *do_data_decompress(void *opaque)
             param->des = 0;
             qemu_mutex_unlock(&param->mutex);
 
-            pagesize = TARGET_PAGE_SIZE;
-            /* uncompress() will return failed in some case, especially
-             * when the page is dirted when doing the compression, it's
-             * not a problem because the dirty page will be retransferred
-             * and uncompress() won't break the data in other pages.
-             */
-            uncompress((Bytef *)des, &pagesize,
-                       (const Bytef *)param->compbuf, len);
+            ok = true;
+            if (param->nr_pages) {
+                ok = do_decompress_ram_batch(param, len);
+            } else {
+                pagesize = TARGET_PAGE_SIZE;
+                /* uncompress() will return failed in some case, especially
+                 * when the page is dirted when doing the compression, it's
+                 * not a problem because the dirty page will be retransferred
+                 * and uncompress() won't break the data in other pages.
+                 */
+                uncompress((Bytef *)des, &pagesize,
+                           (const Bytef *)param->compbuf, len);
+            }
 
             qemu_mutex_lock(&decomp_done_lock);
+            if (!ok) {
+                decomp_error = true;
+            }
             param->done = true;
             qemu_cond_signal(&decomp_done_cond);
             qemu_mutex_unlock(&decomp_done_lock);
@@ -2217,22 +3874,45 @@ static void *do_data_decompress(void *opaque)
     return NULL;
 }
 
-static void wait_for_decompress_done(void)
+/*
+ * Returns: 0 on success, -EIO if a batch of pages could not be
+ * decompressed
+ */
+static int wait_for_decompress_done(void)
 {
-    int idx, thread_count;
+    int idx, ret;
 
-    if (!migrate_use_compression()) {
-        return;
+    /* Compressed pages are sent whenever the source enables compression,
+     * whatever the capability says on this side.
+     */
+    if (!decompress_thread_count) {
+        return 0;
     }
 
-    thread_count = migrate_decompress_threads();
     qemu_mutex_lock(&decomp_done_lock);
-    for (idx = 0; idx < thread_count; idx++) {
+    for (idx = 0; idx < decompress_thread_count; idx++) {
         while (!decomp_param[idx].done) {
             qemu_cond_wait(&decomp_done_cond, &decomp_done_lock);
         }
     }
+    ret = decomp_error ? -EIO : 0;
     qemu_mutex_unlock(&decomp_done_lock);
+    return ret;
+}
+
+/* Large enough for a zlib page or a batch with any supported method */
+static size_t decompress_buf_size(void)
+{
+    size_t size = compressBound(TARGET_PAGE_SIZE);
+    int i;
+
+    for (i = 0; i < MIGRATION_COMPRESS_METHOD__MAX; i++) {
+        if (migration_compress_supported(i)) {
+            size = MAX(size, migration_compress_bound(i,
+                               COMPRESS_BATCH_PAGES * TARGET_PAGE_SIZE));
+        }
+    }
+    return size;
 }
 
 void migrate_decompress_threads_create(void)
@@ -2244,23 +3924,29 @@ void migrate_decompress_threads_create(void)
     decomp_param = g_new0(DecompressParam, thread_count);
     qemu_mutex_init(&decomp_done_lock);
     qemu_cond_init(&decomp_done_cond);
+    decomp_error = false;
     for (i = 0; i < thread_count; i++) {
         qemu_mutex_init(&decomp_param[i].mutex);
         qemu_cond_init(&decomp_param[i].cond);
-        decomp_param[i].compbuf = g_malloc0(compressBound(TARGET_PAGE_SIZE));
+        decomp_param[i].compbuf = g_malloc0(decompress_buf_size());
+        decomp_param[i].ctx = migration_compress_ctx_new();
+        decomp_param[i].buf = g_malloc(COMPRESS_BATCH_PAGES *
+                                       TARGET_PAGE_SIZE);
         decomp_param[i].done = true;
         decomp_param[i].quit = false;
         qemu_thread_create(decompress_threads + i, "decompress",
                            do_data_decompress, decomp_param + i,
                            QEMU_THREAD_JOINABLE);
     }
+    decompress_thread_count = thread_count;
 }
 
 void migrate_decompress_threads_join(void)
 {
     int i, thread_count;
 
-    thread_count = migrate_decompress_threads();
+    thread_count = decompress_thread_count;
+    decompress_thread_count = 0;
     for (i = 0; i < thread_count; i++) {
         qemu_mutex_lock(&decomp_param[i].mutex);
         decomp_param[i].quit = true;
@@ -2272,6 +3958,8 @@ void migrate_decompress_threads_join(void)
         qemu_mutex_destroy(&decomp_param[i].mutex);
         qemu_cond_destroy(&decomp_param[i].cond);
         g_free(decomp_param[i].compbuf);
+        migration_compress_ctx_free(decomp_param[i].ctx);
+        g_free(decomp_param[i].buf);
     }
     g_free(decompress_threads);
     g_free(decomp_param);
@@ -2279,12 +3967,18 @@ void migrate_decompress_threads_join(void)
     decomp_param = NULL;
 }
 
+/*
+ * With @nr_pages == 0, @hosts points to a single zlib page as sent by
+ * RAM_SAVE_FLAG_COMPRESS_PAGE; otherwise it is a batch of @nr_pages
+ * pages compressed with @method.
+ */
 static void decompress_data_with_multi_threads(QEMUFile *f,
-                                               void *host, int len)
+                                               MigrationCompressMethod method,
+                                               void **hosts, int nr_pages,
+                                               int len)
 {
-    int idx, thread_count;
+    int idx, thread_count = decompress_thread_count;
 
-    thread_count = migrate_decompress_threads();
     qemu_mutex_lock(&decomp_done_lock);
     while (true) {
         for (idx = 0; idx < thread_count; idx++) {
@@ -2292,7 +3986,11 @@ static void decompress_data_with_multi_threads(QEMUFile *f,
                 decomp_param[idx].done = false;
                 qemu_mutex_lock(&decomp_param[idx].mutex);
                 qemu_get_buffer(f, decomp_param[idx].compbuf, len);
-                decomp_param[idx].des = host;
+                decomp_param[idx].des = hosts[0];
+                decomp_param[idx].method = method;
+                decomp_param[idx].nr_pages = nr_pages;
+                memcpy(decomp_param[idx].hosts, hosts,
+                       MAX(nr_pages, 1) * sizeof(hosts[0]));
                 decomp_param[idx].len = len;
                 qemu_cond_signal(&decomp_param[idx].cond);
                 qemu_mutex_unlock(&decomp_param[idx].mutex);
@@ -2308,6 +4006,49 @@ static void decompress_data_with_multi_threads(QEMUFile *f,
     qemu_mutex_unlock(&decomp_done_lock);
 }
 
+/* Load a RAM_SAVE_FLAG_COMPRESS_BATCH record whose first page is @host */
+static int load_compressed_batch(QEMUFile *f, RAMBlock *block, void *host)
+{
+    void *hosts[COMPRESS_BATCH_PAGES];
+    int method, nr_pages, len, i;
+
+    method = qemu_get_byte(f);
+    nr_pages = qemu_get_byte(f);
+    if (method >= MIGRATION_COMPRESS_METHOD__MAX ||
+        !migration_compress_supported(method)) {
+        error_report("Compression method %s is not supported",
+                     method < MIGRATION_COMPRESS_METHOD__MAX ?
+                     MigrationCompressMethod_lookup[method] : "(unknown)");
+        return -EINVAL;
+    }
+    if (nr_pages < 1 || nr_pages > COMPRESS_BATCH_PAGES) {
+        error_report("Invalid compressed batch of %d pages", nr_pages);
+        return -EINVAL;
+    }
+
+    hosts[0] = host;
+    for (i = 1; i < nr_pages; i++) {
+        ram_addr_t addr = qemu_get_be64(f);
+
+        hosts[i] = (addr & ~TARGET_PAGE_MASK) ?
+                   NULL : host_from_ram_block_offset(block, addr);
+        if (!hosts[i]) {
+            error_report("Illegal RAM offset " RAM_ADDR_FMT, addr);
+            return -EINVAL;
+        }
+    }
+
+    len = qemu_get_be32(f);
+    if (len < 0 ||
+        len > migration_compress_bound(method,
+                                       nr_pages * TARGET_PAGE_SIZE)) {
+        error_report("Invalid compressed data length: %d", len);
+        return -EINVAL;
+    }
+    decompress_data_with_multi_threads(f, method, hosts, nr_pages, len);
+    return 0;
+}
+
 /*
  * Allocate data structures etc needed by incoming migration with postcopy-ram
  * postcopy-ram's similarly names postcopy_ram_incoming_init does the work
@@ -2471,6 +4212,8 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
     while (!postcopy_running && !ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
+        MappedRamState *mapped_ram = NULL;
+        RAMBlock *block = NULL;
         void *host = NULL;
         uint8_t ch;
 
@@ -2480,7 +4223,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
         if (flags & (RAM_SAVE_FLAG_COMPRESS | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(f, flags);
 
             host = host_from_ram_block_offset(block, addr);
             if (!host) {
@@ -2517,6 +4260,20 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                     }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
+                    if (!ret && migrate_use_mapped_ram()) {
+                        if (!mapped_ram) {
+                            int fd = qemu_get_fd(f);
+
+                            if (fd < 0) {
+                                error_report("x-mapped-ram needs a file: "
+                                             "migration");
+                                ret = -EINVAL;
+                                break;
+                            }
+                            mapped_ram = mapped_ram_new(fd, false);
+                        }
+                        ret = mapped_ram_load_block(f, mapped_ram, block);
+                    }
                 } else {
                     error_report("Unknown ramblock \"%s\", cannot "
                                  "accept migration", id);
@@ -2525,6 +4282,17 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
                 total_ram_bytes -= length;
             }
+            if (mapped_ram) {
+                int wait_ret = mapped_ram_wait(mapped_ram);
+
+                if (wait_ret < 0) {
+                    error_report("Failed to read RAM from the file: %s",
+                                 strerror(-wait_ret));
+                    ret = ret ? ret : wait_ret;
+                }
+                mapped_ram_free(mapped_ram);
+                mapped_ram = NULL;
+            }
             break;
 
         case RAM_SAVE_FLAG_COMPRESS:
@@ -2543,7 +4311,13 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 ret = -EINVAL;
                 break;
             }
-            decompress_data_with_multi_threads(f, host, len);
+            decompress_data_with_multi_threads(f,
+                                               MIGRATION_COMPRESS_METHOD_ZLIB,
+                                               &host, 0, len);
+            break;
+
+        case RAM_SAVE_FLAG_COMPRESS_BATCH:
+            ret = load_compressed_batch(f, block, host);
             break;
 
         case RAM_SAVE_FLAG_XBZRLE:
@@ -2554,6 +4328,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 break;
             }
             break;
+        case RAM_SAVE_FLAG_MULTIFD_SYNC:
+            ret = multifd_recv_sync_main();
+            break;
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
             break;
@@ -2571,7 +4348,10 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
         }
     }
 
-    wait_for_decompress_done();
+    if (wait_for_decompress_done() < 0 && !ret) {
+        error_report("Failed to decompress pages");
+        ret = -EIO;
+    }
     rcu_read_unlock();
     DPRINTF("Completed load of VM with exit code %d seq iteration "
             "%" PRIu64 "\n", ret, seq_iter);
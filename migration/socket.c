@@ -146,6 +146,11 @@ static gboolean socket_accept_incoming_migration(QIOChannel *ioc,
                                        QIO_CHANNEL(sioc));
     object_unref(OBJECT(sioc));
 
+    if (!migration_has_all_channels()) {
+        /* multifd connections are still to come */
+        return TRUE;
+    }
+
 out:
     /* Close listening socket as its no longer needed */
     qio_channel_close(ioc, NULL);
@@ -12,8 +12,278 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
+#include "qemu/bswap.h"
 #include "include/migration/migration.h"
 
+/*
+ * Run detection.  xbzrle_find_diff returns the index of the first byte
+ * at or after @i where the two buffers differ, xbzrle_find_equal the
+ * index of the first byte where they are equal; both return @len if
+ * there is none.  The vectorized versions below only differ from these
+ * in how many bytes they compare at a time.
+ */
+static size_t xbzrle_find_diff_int(const uint8_t *old_buf,
+                                   const uint8_t *new_buf,
+                                   size_t i, size_t len)
+{
+    /* word at a time for speed */
+    while (i + 8 <= len && ldq_he_p(old_buf + i) == ldq_he_p(new_buf + i)) {
+        i += 8;
+    }
+    while (i < len && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static size_t xbzrle_find_equal_int(const uint8_t *old_buf,
+                                    const uint8_t *new_buf,
+                                    size_t i, size_t len)
+{
+    const uint64_t mask = 0x0101010101010101ULL;
+
+    while (i + 8 <= len) {
+        uint64_t xor = ldq_he_p(old_buf + i) ^ ldq_he_p(new_buf + i);
+
+        if ((xor - mask) & ~xor & (mask << 7)) {
+            /* found the end of an nzrun within the current word */
+            break;
+        }
+        i += 8;
+    }
+    while (i < len && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* See util/bufferiszero.c for why the pragmas and includes are
+ * arranged this way.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static size_t xbzrle_find_diff_sse2(const uint8_t *old_buf,
+                                    const uint8_t *new_buf,
+                                    size_t i, size_t len)
+{
+    while (i + 16 <= len) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(old_buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(new_buf + i));
+        unsigned ne = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+
+        if (ne) {
+            return i + ctz32(ne);
+        }
+        i += 16;
+    }
+    return xbzrle_find_diff_int(old_buf, new_buf, i, len);
+}
+
+static size_t xbzrle_find_equal_sse2(const uint8_t *old_buf,
+                                     const uint8_t *new_buf,
+                                     size_t i, size_t len)
+{
+    while (i + 16 <= len) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(old_buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(new_buf + i));
+        unsigned eq = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+        i += 16;
+    }
+    return xbzrle_find_equal_int(old_buf, new_buf, i, len);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static size_t xbzrle_find_diff_avx2(const uint8_t *old_buf,
+                                    const uint8_t *new_buf,
+                                    size_t i, size_t len)
+{
+    while (i + 32 <= len) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t ne = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if (ne) {
+            return i + ctz32(ne);
+        }
+        i += 32;
+    }
+    return xbzrle_find_diff_sse2(old_buf, new_buf, i, len);
+}
+
+static size_t xbzrle_find_equal_avx2(const uint8_t *old_buf,
+                                     const uint8_t *new_buf,
+                                     size_t i, size_t len)
+{
+    while (i + 32 <= len) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+        i += 32;
+    }
+    return xbzrle_find_equal_sse2(old_buf, new_buf, i, len);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+/* As in util/bufferiszero.c, the most preferred ISA must have the
+ * least significant bit for test_xbzrle_next_accel.
+ */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_DIFF  xbzrle_find_diff_int
+# define INIT_EQUAL xbzrle_find_equal_int
+#else
+# define INIT_CACHE CACHE_SSE2
+# define INIT_DIFF  xbzrle_find_diff_sse2
+# define INIT_EQUAL xbzrle_find_equal_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static size_t (*xbzrle_find_diff)(const uint8_t *, const uint8_t *,
+                                  size_t, size_t) = INIT_DIFF;
+static size_t (*xbzrle_find_equal)(const uint8_t *, const uint8_t *,
+                                   size_t, size_t) = INIT_EQUAL;
+
+static void init_accel(unsigned cache)
+{
+    xbzrle_find_diff = xbzrle_find_diff_int;
+    xbzrle_find_equal = xbzrle_find_equal_int;
+    if (cache & CACHE_SSE2) {
+        xbzrle_find_diff = xbzrle_find_diff_sse2;
+        xbzrle_find_equal = xbzrle_find_equal_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        xbzrle_find_diff = xbzrle_find_diff_avx2;
+        xbzrle_find_equal = xbzrle_find_equal_avx2;
+    }
+#endif
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include <cpuid.h>
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_xbzrle_next_accel(void)
+{
+    /* If no bits set, we just tested the integer version, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#elif defined(__aarch64__)
+/* Advanced SIMD is part of the base ARMv8 ISA, so no detection is needed. */
+#include <arm_neon.h>
+
+static size_t xbzrle_find_diff_neon(const uint8_t *old_buf,
+                                    const uint8_t *new_buf,
+                                    size_t i, size_t len)
+{
+    while (i + 16 <= len) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(old_buf + i), vld1q_u8(new_buf + i));
+
+        if (vminvq_u8(eq) != 0xff) {
+            break;
+        }
+        i += 16;
+    }
+    return xbzrle_find_diff_int(old_buf, new_buf, i, len);
+}
+
+static size_t xbzrle_find_equal_neon(const uint8_t *old_buf,
+                                     const uint8_t *new_buf,
+                                     size_t i, size_t len)
+{
+    while (i + 16 <= len) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(old_buf + i), vld1q_u8(new_buf + i));
+
+        if (vmaxvq_u8(eq)) {
+            break;
+        }
+        i += 16;
+    }
+    return xbzrle_find_equal_int(old_buf, new_buf, i, len);
+}
+
+static size_t (*xbzrle_find_diff)(const uint8_t *, const uint8_t *,
+                                  size_t, size_t) = xbzrle_find_diff_neon;
+static size_t (*xbzrle_find_equal)(const uint8_t *, const uint8_t *,
+                                   size_t, size_t) = xbzrle_find_equal_neon;
+
+bool test_xbzrle_next_accel(void)
+{
+    if (xbzrle_find_diff == xbzrle_find_diff_int) {
+        return false;
+    }
+    xbzrle_find_diff = xbzrle_find_diff_int;
+    xbzrle_find_equal = xbzrle_find_equal_int;
+    return true;
+}
+
+#else
+#define xbzrle_find_diff  xbzrle_find_diff_int
+#define xbzrle_find_equal xbzrle_find_equal_int
+bool test_xbzrle_next_accel(void)
+{
+    return false;
+}
+#endif
+
 /*
   page = zrun nzrun
        | zrun nzrun page
@@ -27,10 +297,8 @@
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen)
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, j;
 
     g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
                sizeof(long)));
@@ -41,28 +309,9 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
             return -1;
         }
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
-
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
-
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
-            }
-        }
+        j = xbzrle_find_diff(old_buf, new_buf, i, slen);
+        zrun_len = j - i;
+        i = j;
 
         /* buffer unchanged */
         if (zrun_len == slen) {
@@ -76,51 +325,22 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
         d += uleb128_encode_small(dst + d, zrun_len);
 
-        zrun_len = 0;
-        nzrun_start = new_buf + i;
-
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+
+        j = xbzrle_find_equal(old_buf, new_buf, i, slen);
+        nzrun_len = j - i;
 
         d += uleb128_encode_small(dst + d, nzrun_len);
         /* overflow */
         if (d + nzrun_len > dlen) {
             return -1;
         }
-        memcpy(dst + d, nzrun_start, nzrun_len);
+        memcpy(dst + d, new_buf + i, nzrun_len);
         d += nzrun_len;
-        nzrun_len = 0;
+        i = j;
     }
 
     return d;
@@ -20,7 +20,7 @@
 #include "qapi/error.h"
 #include "nbd-internal.h"
 
-static int nbd_errno_to_system_errno(int err)
+int nbd_errno_to_system_errno(int err)
 {
     switch (err) {
     case NBD_SUCCESS:
@@ -129,6 +129,11 @@ static int nbd_handle_reply_err(QIOChannel *ioc, uint32_t opt, uint32_t type,
                    opt);
         break;
 
+    case NBD_REP_ERR_UNKNOWN:
+        error_setg(errp, "Requested export not available for option %" PRIx32,
+                   opt);
+        break;
+
     default:
         error_setg(errp, "Unknown error code when asking for option %" PRIx32,
                    opt);
@@ -309,6 +314,209 @@ static int nbd_receive_query_exports(QIOChannel *ioc,
     return 0;
 }
 
+static int nbd_send_option_request(QIOChannel *ioc, uint32_t opt,
+                                   uint32_t len, const char *data,
+                                   Error **errp)
+{
+    uint64_t magic = cpu_to_be64(NBD_OPTS_MAGIC);
+    uint32_t be_opt = cpu_to_be32(opt);
+    uint32_t be_len = cpu_to_be32(len);
+
+    TRACE("Sending option request %" PRIu32 ", len %" PRIu32, opt, len);
+    if (write_sync(ioc, &magic, sizeof(magic)) != sizeof(magic)) {
+        error_setg(errp, "Failed to send option magic");
+        return -1;
+    }
+    if (write_sync(ioc, &be_opt, sizeof(be_opt)) != sizeof(be_opt)) {
+        error_setg(errp, "Failed to send option number");
+        return -1;
+    }
+    if (write_sync(ioc, &be_len, sizeof(be_len)) != sizeof(be_len)) {
+        error_setg(errp, "Failed to send option length");
+        return -1;
+    }
+    if (len && write_sync(ioc, (char *)data, len) != len) {
+        error_setg(errp, "Failed to send option payload");
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the magic, option and type of a reply to @opt.  The caller goes on
+ * with nbd_handle_reply_err() and then reads the length.
+ */
+static int nbd_receive_option_reply(QIOChannel *ioc, uint32_t opt,
+                                    uint32_t *type, Error **errp)
+{
+    uint64_t magic;
+    uint32_t reply_opt;
+
+    if (read_sync(ioc, &magic, sizeof(magic)) != sizeof(magic)) {
+        error_setg(errp, "failed to read option magic");
+        return -1;
+    }
+    magic = be64_to_cpu(magic);
+    if (magic != NBD_REP_MAGIC) {
+        error_setg(errp, "Unexpected option magic");
+        return -1;
+    }
+    if (read_sync(ioc, &reply_opt, sizeof(reply_opt)) != sizeof(reply_opt)) {
+        error_setg(errp, "failed to read option");
+        return -1;
+    }
+    reply_opt = be32_to_cpu(reply_opt);
+    if (reply_opt != opt) {
+        error_setg(errp, "Unexpected option type %" PRIx32 " expected %"
+                   PRIx32, reply_opt, opt);
+        return -1;
+    }
+    if (read_sync(ioc, type, sizeof(*type)) != sizeof(*type)) {
+        error_setg(errp, "failed to read option type");
+        return -1;
+    }
+    *type = be32_to_cpu(*type);
+    return 0;
+}
+
+/* Send an option without payload that the server acknowledges with a plain
+ * NBD_REP_ACK.  Returns 1 if the server accepted it, 0 if the server does
+ * not support it, -1 with errp set on other errors.
+ */
+static int nbd_request_simple_option(QIOChannel *ioc, uint32_t opt,
+                                     Error **errp)
+{
+    uint32_t type;
+    uint32_t len;
+    int error;
+
+    if (nbd_send_option_request(ioc, opt, 0, NULL, errp) < 0 ||
+        nbd_receive_option_reply(ioc, opt, &type, errp) < 0) {
+        return -1;
+    }
+    error = nbd_handle_reply_err(ioc, opt, type, errp);
+    if (error <= 0) {
+        return error;
+    }
+
+    if (read_sync(ioc, &len, sizeof(len)) != sizeof(len)) {
+        error_setg(errp, "failed to read option length");
+        return -1;
+    }
+    len = be32_to_cpu(len);
+    if (type != NBD_REP_ACK) {
+        error_setg(errp, "Server answered option %" PRIx32 " with unexpected "
+                   "reply type %" PRIx32, opt, type);
+        return -1;
+    }
+    if (len != 0) {
+        error_setg(errp, "Option %" PRIx32 " reply length was not zero %"
+                   PRIu32, opt, len);
+        return -1;
+    }
+    return 1;
+}
+
+/* Select the "base:allocation" meta context of export @name, which makes
+ * NBD_CMD_BLOCK_STATUS available.  Returns 1 and the context ID in
+ * @context_id if the server supports it, 0 if it does not, -1 with errp
+ * set on errors.
+ */
+static int nbd_receive_base_allocation(QIOChannel *ioc, const char *name,
+                                       uint32_t *context_id, Error **errp)
+{
+    const char *query = NBD_META_BASE_ALLOCATION;
+    uint32_t name_len = strlen(name);
+    uint32_t query_len = strlen(query);
+    uint32_t data_len = 4 + name_len + 4 + 4 + query_len;
+    char *data = g_malloc(data_len);
+    char *p = data;
+    bool found = false;
+    int ret;
+
+    /* Option payload
+       [ 0 ..  3]    export name length
+       [ 4 ..  xx]   export name
+       [ . .. .+3]   number of queries (1)
+       [ . .. .+3]   query length
+       [ . .. xx]    query
+     */
+    stl_be_p(p, name_len);
+    p += 4;
+    memcpy(p, name, name_len);
+    p += name_len;
+    stl_be_p(p, 1);
+    p += 4;
+    stl_be_p(p, query_len);
+    p += 4;
+    memcpy(p, query, query_len);
+
+    ret = nbd_send_option_request(ioc, NBD_OPT_SET_META_CONTEXT, data_len,
+                                  data, errp);
+    g_free(data);
+    if (ret < 0) {
+        return -1;
+    }
+
+    while (1) {
+        char context[NBD_MAX_NAME_SIZE + 1];
+        uint32_t type;
+        uint32_t len;
+        uint32_t id;
+
+        if (nbd_receive_option_reply(ioc, NBD_OPT_SET_META_CONTEXT, &type,
+                                     errp) < 0) {
+            return -1;
+        }
+        ret = nbd_handle_reply_err(ioc, NBD_OPT_SET_META_CONTEXT, type, errp);
+        if (ret <= 0) {
+            return ret;
+        }
+
+        if (read_sync(ioc, &len, sizeof(len)) != sizeof(len)) {
+            error_setg(errp, "failed to read option length");
+            return -1;
+        }
+        len = be32_to_cpu(len);
+
+        if (type == NBD_REP_ACK) {
+            if (len != 0) {
+                error_setg(errp, "length too long for option end");
+                return -1;
+            }
+            break;
+        }
+        if (type != NBD_REP_META_CONTEXT) {
+            error_setg(errp, "Unexpected reply type %" PRIx32 " expected %x",
+                       type, NBD_REP_META_CONTEXT);
+            return -1;
+        }
+        if (len < sizeof(id) || len - sizeof(id) > NBD_MAX_NAME_SIZE) {
+            error_setg(errp, "incorrect option length");
+            return -1;
+        }
+        if (read_sync(ioc, &id, sizeof(id)) != sizeof(id)) {
+            error_setg(errp, "failed to read meta context ID");
+            return -1;
+        }
+        len -= sizeof(id);
+        if (read_sync(ioc, context, len) != len) {
+            error_setg(errp, "failed to read meta context name");
+            return -1;
+        }
+        context[len] = '\0';
+        if (strcmp(context, query)) {
+            error_setg(errp, "Server selected meta context '%s' that was "
+                       "not requested", context);
+            return -1;
+        }
+        *context_id = be32_to_cpu(id);
+        found = true;
+        TRACE("Meta context '%s' has ID %" PRIu32, context, *context_id);
+    }
+
+    return found;
+}
+
 static QIOChannel *nbd_receive_starttls(QIOChannel *ioc,
                                         QCryptoTLSCreds *tlscreds,
                                         const char *hostname, Error **errp)
@@ -408,19 +616,23 @@ static QIOChannel *nbd_receive_starttls(QIOChannel *ioc,
 }
 
 
-int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
+int nbd_receive_negotiate(QIOChannel *ioc, const char *name,
                           QCryptoTLSCreds *tlscreds, const char *hostname,
                           QIOChannel **outioc,
-                          off_t *size, Error **errp)
+                          NBDExportInfo *info, Error **errp)
 {
     char buf[256];
     uint64_t magic, s;
+    bool want_structured_reply = info->structured_reply;
+    bool want_base_allocation = info->base_allocation;
     int rc;
 
     TRACE("Receiving negotiation tlscreds=%p hostname=%s.",
           tlscreds, hostname ? hostname : "<null>");
 
     rc = -EINVAL;
+    info->structured_reply = false;
+    info->base_allocation = false;
 
     if (outioc) {
         *outioc = NULL;
@@ -515,6 +727,24 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             if (nbd_receive_query_exports(ioc, name, errp) < 0) {
                 goto fail;
             }
+
+            if (want_structured_reply) {
+                int ret = nbd_request_simple_option(ioc,
+                                                    NBD_OPT_STRUCTURED_REPLY,
+                                                    errp);
+                if (ret < 0) {
+                    goto fail;
+                }
+                info->structured_reply = ret;
+            }
+            if (info->structured_reply && want_base_allocation) {
+                int ret = nbd_receive_base_allocation(
+                    ioc, name, &info->meta_base_allocation_id, errp);
+                if (ret < 0) {
+                    goto fail;
+                }
+                info->base_allocation = ret;
+            }
         }
         /* write the export name */
         magic = cpu_to_be64(magic);
@@ -542,13 +772,14 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             error_setg(errp, "Failed to read export length");
             goto fail;
         }
-        *size = be64_to_cpu(s);
+        info->size = be64_to_cpu(s);
 
-        if (read_sync(ioc, flags, sizeof(*flags)) != sizeof(*flags)) {
+        if (read_sync(ioc, &info->flags, sizeof(info->flags)) !=
+            sizeof(info->flags)) {
             error_setg(errp, "Failed to read export flags");
             goto fail;
         }
-        be16_to_cpus(flags);
+        be16_to_cpus(&info->flags);
     } else if (magic == NBD_CLIENT_MAGIC) {
         uint32_t oldflags;
 
@@ -565,8 +796,8 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             error_setg(errp, "Failed to read export length");
             goto fail;
         }
-        *size = be64_to_cpu(s);
-        TRACE("Size is %" PRIu64, *size);
+        info->size = be64_to_cpu(s);
+        TRACE("Size is %" PRIu64, info->size);
 
         if (read_sync(ioc, &oldflags, sizeof(oldflags)) != sizeof(oldflags)) {
             error_setg(errp, "Failed to read export flags");
@@ -577,13 +808,14 @@ int nbd_receive_negotiate(QIOChannel *ioc, const char *name, uint16_t *flags,
             error_setg(errp, "Unexpected export flags %0x" PRIx32, oldflags);
             goto fail;
         }
-        *flags = oldflags;
+        info->flags = oldflags;
     } else {
         error_setg(errp, "Bad magic received");
         goto fail;
     }
 
-    TRACE("Size is %" PRIu64 ", export flags %" PRIx16, *size, *flags);
+    TRACE("Size is %" PRIu64 ", export flags %" PRIx16, info->size,
+          info->flags);
     if (read_sync(ioc, &buf, 124) != 124) {
         error_setg(errp, "Failed to read reserved block");
         goto fail;
@@ -736,27 +968,66 @@ ssize_t nbd_send_request(QIOChannel *ioc, struct nbd_request *request)
 
 ssize_t nbd_receive_reply(QIOChannel *ioc, struct nbd_reply *reply)
 {
-    uint8_t buf[NBD_REPLY_SIZE];
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE];
     uint32_t magic;
     ssize_t ret;
 
-    ret = read_sync(ioc, buf, sizeof(buf));
+    ret = read_sync(ioc, buf, NBD_REPLY_SIZE);
     if (ret < 0) {
         return ret;
     }
 
-    if (ret != sizeof(buf)) {
+    if (ret != NBD_REPLY_SIZE) {
         LOG("read failed");
         return -EINVAL;
     }
 
+    magic = ldl_be_p(buf);
+    if (magic == NBD_STRUCTURED_REPLY_MAGIC) {
+        size_t rest = NBD_STRUCTURED_REPLY_SIZE - NBD_REPLY_SIZE;
+
+        /* The header is longer than a simple reply; the first part has
+         * been read already, so wait for the rest instead of failing with
+         * -EAGAIN.
+         */
+        do {
+            ret = read_sync(ioc, buf + NBD_REPLY_SIZE, rest);
+            if (ret == -EAGAIN) {
+                qio_channel_wait(ioc, G_IO_IN);
+            }
+        } while (ret == -EAGAIN);
+        if (ret != rest) {
+            LOG("read failed");
+            return ret < 0 ? ret : -EINVAL;
+        }
+
+        /* Structured reply chunk
+           [ 0 ..  3]    magic   (NBD_STRUCTURED_REPLY_MAGIC)
+           [ 4 ..  5]    flags
+           [ 6 ..  7]    type
+           [ 8 .. 15]    handle
+           [16 .. 19]    length of the payload
+         */
+        reply->structured = true;
+        reply->error  = 0;
+        reply->flags  = lduw_be_p(buf + 4);
+        reply->type   = lduw_be_p(buf + 6);
+        reply->handle = ldq_be_p(buf + 8);
+        reply->length = ldl_be_p(buf + 16);
+
+        TRACE("Got structured reply: { .flags = 0x%" PRIx16 ", .type = %"
+              PRIu16 ", handle = %" PRIu64 ", .length = %" PRIu32 " }",
+              reply->flags, reply->type, reply->handle, reply->length);
+        return 0;
+    }
+
     /* Reply
        [ 0 ..  3]    magic   (NBD_REPLY_MAGIC)
        [ 4 ..  7]    error   (0 == no error)
        [ 7 .. 15]    handle
      */
 
-    magic = ldl_be_p(buf);
+    reply->structured = false;
     reply->error  = ldl_be_p(buf + 4);
     reply->handle = ldq_be_p(buf + 8);
 
@@ -44,6 +44,13 @@ static int system_errno_to_nbd_errno(int err)
     }
 }
 
+/* The only meta context we know */
+#define NBD_META_ID_BASE_ALLOCATION 0
+
+/* Upper bound for the extents in one NBD_CMD_BLOCK_STATUS reply; the client
+ * asks again for the rest of the range */
+#define NBD_MAX_BLOCK_STATUS_EXTENTS 8192
+
 /* Definitions for opaque data types */
 
 typedef struct NBDRequest NBDRequest;
@@ -92,6 +99,9 @@ struct NBDClient {
 
     bool can_read;
 
+    bool structured_reply;
+    bool base_allocation; /* "base:allocation" meta context selected */
+
     QTAILQ_ENTRY(NBDClient) next;
     int nb_requests;
     bool closing;
@@ -193,12 +203,13 @@ static ssize_t nbd_negotiate_drop_sync(QIOChannel *ioc, size_t size)
 
 */
 
-static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
+static int nbd_negotiate_send_rep_len(QIOChannel *ioc, uint32_t type,
+                                      uint32_t opt, uint32_t len)
 {
     uint64_t magic;
-    uint32_t len;
 
-    TRACE("Reply opt=%" PRIx32 " type=%" PRIx32, type, opt);
+    TRACE("Reply opt=%" PRIx32 " type=%" PRIx32 " len=%" PRIu32,
+          type, opt, len);
 
     magic = cpu_to_be64(NBD_REP_MAGIC);
     if (nbd_negotiate_write(ioc, &magic, sizeof(magic)) != sizeof(magic)) {
@@ -215,7 +226,7 @@ static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
         LOG("write failed (rep type)");
         return -EINVAL;
     }
-    len = cpu_to_be32(0);
+    len = cpu_to_be32(len);
     if (nbd_negotiate_write(ioc, &len, sizeof(len)) != sizeof(len)) {
         LOG("write failed (rep data length)");
         return -EINVAL;
@@ -223,6 +234,11 @@ static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
     return 0;
 }
 
+static int nbd_negotiate_send_rep(QIOChannel *ioc, uint32_t type, uint32_t opt)
+{
+    return nbd_negotiate_send_rep_len(ioc, type, opt, 0);
+}
+
 static int nbd_negotiate_send_rep_list(QIOChannel *ioc, NBDExport *exp)
 {
     uint64_t magic, name_len;
@@ -319,6 +335,166 @@ fail:
 }
 
 
+static int nbd_negotiate_handle_structured_reply(NBDClient *client,
+                                                uint32_t length)
+{
+    if (length) {
+        if (nbd_negotiate_drop_sync(client->ioc, length) != length) {
+            return -EIO;
+        }
+        return nbd_negotiate_send_rep(client->ioc, NBD_REP_ERR_INVALID,
+                                      NBD_OPT_STRUCTURED_REPLY);
+    }
+
+    TRACE("Client requested structured replies");
+    client->structured_reply = true;
+    return nbd_negotiate_send_rep(client->ioc, NBD_REP_ACK,
+                                  NBD_OPT_STRUCTURED_REPLY);
+}
+
+/* Read @size bytes of an option payload of which @length bytes are left.
+ * Returns -EINVAL if the payload is too short. */
+static int nbd_negotiate_read_payload(QIOChannel *ioc, void *buf,
+                                      uint32_t size, uint32_t *length)
+{
+    if (size > *length) {
+        return -EINVAL;
+    }
+    if (nbd_negotiate_read(ioc, buf, size) != size) {
+        LOG("read failed");
+        return -EIO;
+    }
+    *length -= size;
+    return 0;
+}
+
+static int nbd_negotiate_send_meta_context(QIOChannel *ioc, uint32_t opt,
+                                           uint32_t id, const char *name)
+{
+    uint32_t len = strlen(name);
+
+    if (nbd_negotiate_send_rep_len(ioc, NBD_REP_META_CONTEXT, opt,
+                                   sizeof(id) + len) < 0) {
+        return -EINVAL;
+    }
+    id = cpu_to_be32(id);
+    if (nbd_negotiate_write(ioc, &id, sizeof(id)) != sizeof(id)) {
+        LOG("write failed (meta context id)");
+        return -EINVAL;
+    }
+    if (nbd_negotiate_write(ioc, (char *)name, len) != len) {
+        LOG("write failed (meta context name)");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Handle NBD_OPT_LIST_META_CONTEXT and NBD_OPT_SET_META_CONTEXT.  The only
+ * context is "base:allocation", which reports holes and zeroes. */
+static int nbd_negotiate_handle_meta_context(NBDClient *client, uint32_t opt,
+                                             uint32_t length)
+{
+    char buf[NBD_MAX_NAME_SIZE + 1];
+    uint32_t err_type = NBD_REP_ERR_INVALID;
+    uint32_t name_len, nb_queries, query_len, i;
+    bool base_allocation = false;
+    int ret;
+
+    /* Client sends:
+        [ 0 ..   3]   export name length
+        [ 4 ..  xx]   export name
+        [ . .. .+3]   number of queries
+        ...           for each query: length, then query
+     */
+    if (opt == NBD_OPT_SET_META_CONTEXT && !client->structured_reply) {
+        ret = -EINVAL;
+        goto invalid;
+    }
+
+    ret = nbd_negotiate_read_payload(client->ioc, &name_len, sizeof(name_len),
+                                     &length);
+    if (ret < 0) {
+        goto invalid;
+    }
+    name_len = be32_to_cpu(name_len);
+    if (name_len > NBD_MAX_NAME_SIZE) {
+        ret = -EINVAL;
+        goto invalid;
+    }
+    ret = nbd_negotiate_read_payload(client->ioc, buf, name_len, &length);
+    if (ret < 0) {
+        goto invalid;
+    }
+    buf[name_len] = '\0';
+    if (!nbd_export_find(buf)) {
+        TRACE("Meta context requested for unknown export '%s'", buf);
+        err_type = NBD_REP_ERR_UNKNOWN;
+        ret = -EINVAL;
+        goto invalid;
+    }
+
+    ret = nbd_negotiate_read_payload(client->ioc, &nb_queries,
+                                     sizeof(nb_queries), &length);
+    if (ret < 0) {
+        goto invalid;
+    }
+    nb_queries = be32_to_cpu(nb_queries);
+    if (opt == NBD_OPT_LIST_META_CONTEXT && !nb_queries) {
+        /* No query lists all contexts */
+        base_allocation = true;
+    }
+
+    for (i = 0; i < nb_queries; i++) {
+        ret = nbd_negotiate_read_payload(client->ioc, &query_len,
+                                         sizeof(query_len), &length);
+        if (ret < 0) {
+            goto invalid;
+        }
+        query_len = be32_to_cpu(query_len);
+        if (query_len > NBD_MAX_NAME_SIZE) {
+            ret = -EINVAL;
+            goto invalid;
+        }
+        ret = nbd_negotiate_read_payload(client->ioc, buf, query_len, &length);
+        if (ret < 0) {
+            goto invalid;
+        }
+        buf[query_len] = '\0';
+        TRACE("Client queried meta context '%s'", buf);
+
+        if (!strcmp(buf, NBD_META_BASE_ALLOCATION) ||
+            (opt == NBD_OPT_LIST_META_CONTEXT && !strcmp(buf, "base:"))) {
+            base_allocation = true;
+        }
+    }
+    if (length) {
+        ret = -EINVAL;
+        goto invalid;
+    }
+
+    if (base_allocation) {
+        ret = nbd_negotiate_send_meta_context(client->ioc, opt,
+                                              NBD_META_ID_BASE_ALLOCATION,
+                                              NBD_META_BASE_ALLOCATION);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    if (opt == NBD_OPT_SET_META_CONTEXT) {
+        client->base_allocation = base_allocation;
+    }
+    return nbd_negotiate_send_rep(client->ioc, NBD_REP_ACK, opt);
+
+invalid:
+    if (ret == -EIO) {
+        return ret;
+    }
+    if (nbd_negotiate_drop_sync(client->ioc, length) != length) {
+        return -EIO;
+    }
+    return nbd_negotiate_send_rep(client->ioc, err_type, opt);
+}
+
 static QIOChannel *nbd_negotiate_handle_starttls(NBDClient *client,
                                                  uint32_t length)
 {
@@ -487,6 +663,22 @@ static int nbd_negotiate_options(NBDClient *client)
             case NBD_OPT_EXPORT_NAME:
                 return nbd_negotiate_handle_export_name(client, length);
 
+            case NBD_OPT_STRUCTURED_REPLY:
+                ret = nbd_negotiate_handle_structured_reply(client, length);
+                if (ret < 0) {
+                    return ret;
+                }
+                break;
+
+            case NBD_OPT_LIST_META_CONTEXT:
+            case NBD_OPT_SET_META_CONTEXT:
+                ret = nbd_negotiate_handle_meta_context(client, clientflags,
+                                                        length);
+                if (ret < 0) {
+                    return ret;
+                }
+                break;
+
             case NBD_OPT_STARTTLS:
                 if (nbd_negotiate_drop_sync(client->ioc, length) != length) {
                     return -EIO;
@@ -664,11 +856,8 @@ static ssize_t nbd_receive_request(QIOChannel *ioc, struct nbd_request *request)
     return 0;
 }
 
-static ssize_t nbd_send_reply(QIOChannel *ioc, struct nbd_reply *reply)
+static void nbd_set_reply(uint8_t *buf, struct nbd_reply *reply)
 {
-    uint8_t buf[NBD_REPLY_SIZE];
-    ssize_t ret;
-
     reply->error = system_errno_to_nbd_errno(reply->error);
 
     TRACE("Sending response to client: { .error = %" PRId32
@@ -683,17 +872,28 @@ static ssize_t nbd_send_reply(QIOChannel *ioc, struct nbd_reply *reply)
     stl_be_p(buf, NBD_REPLY_MAGIC);
     stl_be_p(buf + 4, reply->error);
     stq_be_p(buf + 8, reply->handle);
+}
 
-    ret = write_sync(ioc, buf, sizeof(buf));
-    if (ret < 0) {
-        return ret;
-    }
-
-    if (ret != sizeof(buf)) {
-        LOG("writing to socket failed");
-        return -EINVAL;
-    }
-    return 0;
+static void nbd_set_structured_reply(uint8_t *buf, uint16_t flags,
+                                     uint16_t type, uint64_t handle,
+                                     uint32_t length)
+{
+    TRACE("Sending structured reply to client: { .flags = 0x%" PRIx16
+          ", .type = %" PRIu16 ", handle = %" PRIu64 ", .length = %" PRIu32
+          " }", flags, type, handle, length);
+
+    /* Structured reply chunk
+       [ 0 ..  3]    magic   (NBD_STRUCTURED_REPLY_MAGIC)
+       [ 4 ..  5]    flags
+       [ 6 ..  7]    type
+       [ 8 .. 15]    handle
+       [16 .. 19]    length of the payload
+     */
+    stl_be_p(buf, NBD_STRUCTURED_REPLY_MAGIC);
+    stw_be_p(buf + 4, flags);
+    stw_be_p(buf + 6, type);
+    stq_be_p(buf + 8, handle);
+    stl_be_p(buf + 16, length);
 }
 
 #define MAX_NBD_REQUESTS 16
@@ -954,10 +1154,11 @@ void nbd_export_close_all(void)
     }
 }
 
-static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
-                                 int len)
+/* Send a reply header and its payload as one unit */
+static ssize_t nbd_co_send_iov(NBDClient *client, struct iovec *iov,
+                               unsigned niov)
 {
-    NBDClient *client = req->client;
+    size_t len = iov_size(iov, niov);
     ssize_t rc, ret;
 
     g_assert(qemu_in_coroutine());
@@ -965,17 +1166,19 @@ static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
     client->send_coroutine = qemu_coroutine_self();
     nbd_set_handlers(client);
 
-    if (!len) {
-        rc = nbd_send_reply(client->ioc, reply);
-    } else {
+    if (niov > 1) {
         qio_channel_set_cork(client->ioc, true);
-        rc = nbd_send_reply(client->ioc, reply);
-        if (rc >= 0) {
-            ret = write_sync(client->ioc, req->data, len);
-            if (ret != len) {
-                rc = -EIO;
-            }
-        }
+    }
+    ret = nbd_wr_syncv(client->ioc, iov, niov, len, false);
+    if (ret < 0) {
+        rc = ret;
+    } else if (ret != len) {
+        LOG("writing to socket failed");
+        rc = -EIO;
+    } else {
+        rc = 0;
+    }
+    if (niov > 1) {
         qio_channel_set_cork(client->ioc, false);
     }
 
@@ -985,6 +1188,217 @@ static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
     return rc;
 }
 
+static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
+                                 int len)
+{
+    uint8_t buf[NBD_REPLY_SIZE];
+    struct iovec iov[] = {
+        { .iov_base = buf, .iov_len = sizeof(buf) },
+        { .iov_base = req->data, .iov_len = len },
+    };
+
+    nbd_set_reply(buf, reply);
+    return nbd_co_send_iov(req->client, iov, len ? 2 : 1);
+}
+
+static ssize_t nbd_co_send_structured_done(NBDClient *client, uint64_t handle)
+{
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE];
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+    nbd_set_structured_reply(buf, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_NONE,
+                             handle, 0);
+    return nbd_co_send_iov(client, &iov, 1);
+}
+
+static ssize_t nbd_co_send_structured_error(NBDClient *client,
+                                            uint64_t handle, int error)
+{
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE + 4 + 2];
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+    /* No message, just the error and a zero message length */
+    nbd_set_structured_reply(buf, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_ERROR,
+                             handle, 4 + 2);
+    stl_be_p(buf + NBD_STRUCTURED_REPLY_SIZE,
+             system_errno_to_nbd_errno(error));
+    stw_be_p(buf + NBD_STRUCTURED_REPLY_SIZE + 4, 0);
+    return nbd_co_send_iov(client, &iov, 1);
+}
+
+static ssize_t nbd_co_send_structured_data(NBDClient *client, uint64_t handle,
+                                           uint64_t offset, void *data,
+                                           uint32_t size, bool final)
+{
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE + 8];
+    struct iovec iov[] = {
+        { .iov_base = buf, .iov_len = sizeof(buf) },
+        { .iov_base = data, .iov_len = size },
+    };
+
+    nbd_set_structured_reply(buf, final ? NBD_REPLY_FLAG_DONE : 0,
+                             NBD_REPLY_TYPE_OFFSET_DATA, handle, 8 + size);
+    stq_be_p(buf + NBD_STRUCTURED_REPLY_SIZE, offset);
+    return nbd_co_send_iov(client, iov, 2);
+}
+
+static ssize_t nbd_co_send_structured_hole(NBDClient *client, uint64_t handle,
+                                           uint64_t offset, uint32_t size,
+                                           bool final)
+{
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE + 8 + 4];
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+    nbd_set_structured_reply(buf, final ? NBD_REPLY_FLAG_DONE : 0,
+                             NBD_REPLY_TYPE_OFFSET_HOLE, handle, 8 + 4);
+    stq_be_p(buf + NBD_STRUCTURED_REPLY_SIZE, offset);
+    stl_be_p(buf + NBD_STRUCTURED_REPLY_SIZE + 8, size);
+    return nbd_co_send_iov(client, &iov, 1);
+}
+
+/* Answer NBD_CMD_READ with structured replies.  Ranges that read as zeroes
+ * are sent as holes instead of data.  Read errors are reported to the
+ * client; the return value is negative only if sending failed. */
+static ssize_t coroutine_fn nbd_co_send_sparse_read(NBDRequest *req,
+                                                    uint64_t handle,
+                                                    uint64_t offset,
+                                                    uint32_t size)
+{
+    NBDClient *client = req->client;
+    NBDExport *exp = client->exp;
+    BlockDriverState *bs = blk_bs(exp->blk);
+    int64_t start = offset + exp->dev_offset;
+    bool aligned = !(start % BDRV_SECTOR_SIZE) && !(size % BDRV_SECTOR_SIZE);
+    uint32_t progress = 0;
+    ssize_t ret;
+
+    if (!size) {
+        return nbd_co_send_structured_done(client, handle);
+    }
+
+    while (progress < size) {
+        uint32_t chunk = size - progress;
+        bool zero = false;
+        bool final;
+
+        if (aligned) {
+            BlockDriverState *file;
+            int64_t status;
+            int pnum;
+
+            status = bdrv_get_block_status_above(
+                bs, NULL, (start + progress) >> BDRV_SECTOR_BITS,
+                chunk >> BDRV_SECTOR_BITS, &pnum, &file);
+            /* On errors, fall back to reading everything that is left */
+            if (status >= 0 && pnum > 0) {
+                chunk = MIN(chunk, (uint32_t)pnum << BDRV_SECTOR_BITS);
+                zero = status & BDRV_BLOCK_ZERO;
+            }
+        }
+        final = progress + chunk == size;
+
+        if (zero) {
+            ret = nbd_co_send_structured_hole(client, handle,
+                                              offset + progress, chunk, final);
+        } else {
+            ret = blk_pread(exp->blk, start + progress, req->data + progress,
+                            chunk);
+            if (ret < 0) {
+                LOG("reading from file failed");
+                return nbd_co_send_structured_error(client, handle, -ret);
+            }
+            ret = nbd_co_send_structured_data(client, handle,
+                                              offset + progress,
+                                              req->data + progress, chunk,
+                                              final);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        progress += chunk;
+    }
+    return 0;
+}
+
+/* Answer NBD_CMD_BLOCK_STATUS for the "base:allocation" context.  Errors
+ * are reported to the client; the return value is negative only if sending
+ * failed. */
+static ssize_t coroutine_fn nbd_co_send_block_status(NBDClient *client,
+                                                     uint64_t handle,
+                                                     uint64_t offset,
+                                                     uint32_t length,
+                                                     bool req_one)
+{
+    NBDExport *exp = client->exp;
+    BlockDriverState *bs = blk_bs(exp->blk);
+    uint32_t max_extents = req_one ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
+    uint32_t nb_extents = 0;
+    uint32_t *extents = g_new(uint32_t, 2 * max_extents);
+    uint64_t pos = offset + exp->dev_offset;
+    uint64_t end = pos + length;
+    uint8_t buf[NBD_STRUCTURED_REPLY_SIZE + 4];
+    struct iovec iov[2];
+    ssize_t ret;
+    uint32_t i;
+
+    while (pos < end) {
+        int64_t sector_num = pos >> BDRV_SECTOR_BITS;
+        int nb_sectors = MIN(DIV_ROUND_UP(end, BDRV_SECTOR_SIZE) - sector_num,
+                             INT_MAX >> BDRV_SECTOR_BITS);
+        BlockDriverState *file;
+        int64_t status;
+        uint32_t len, flags;
+        int pnum;
+
+        status = bdrv_get_block_status_above(bs, NULL, sector_num, nb_sectors,
+                                             &pnum, &file);
+        if (status < 0 || pnum == 0) {
+            LOG("block status failed");
+            g_free(extents);
+            return nbd_co_send_structured_error(client, handle,
+                                                status < 0 ? -status : EIO);
+        }
+
+        len = MIN((uint64_t)(sector_num + pnum) << BDRV_SECTOR_BITS, end) -
+              pos;
+        flags = (status & BDRV_BLOCK_DATA ? 0 : NBD_STATE_HOLE) |
+                (status & BDRV_BLOCK_ZERO ? NBD_STATE_ZERO : 0);
+
+        if (nb_extents && extents[2 * nb_extents - 1] == flags) {
+            extents[2 * nb_extents - 2] += len;
+        } else if (nb_extents < max_extents) {
+            extents[2 * nb_extents] = len;
+            extents[2 * nb_extents + 1] = flags;
+            nb_extents++;
+        } else {
+            break;
+        }
+        pos += len;
+    }
+
+    /* Block status payload
+       [ 0 ..  3]    meta context ID
+       then for each extent:
+       [ 0 ..  3]    length
+       [ 4 ..  7]    status flags
+     */
+    for (i = 0; i < 2 * nb_extents; i++) {
+        extents[i] = cpu_to_be32(extents[i]);
+    }
+    nbd_set_structured_reply(buf, NBD_REPLY_FLAG_DONE,
+                             NBD_REPLY_TYPE_BLOCK_STATUS, handle,
+                             4 + nb_extents * 8);
+    stl_be_p(buf + NBD_STRUCTURED_REPLY_SIZE, NBD_META_ID_BASE_ALLOCATION);
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(buf);
+    iov[1].iov_base = extents;
+    iov[1].iov_len = nb_extents * 8;
+
+    ret = nbd_co_send_iov(client, iov, 2);
+    g_free(extents);
+    return ret;
+}
+
 /* Collect a client request.  Return 0 if request looks valid, -EAGAIN
  * to keep trying the collection, -EIO to drop connection right away,
  * and any other negative value to report an error to the client
@@ -994,7 +1408,7 @@ static ssize_t nbd_co_receive_request(NBDRequest *req,
                                       struct nbd_request *request)
 {
     NBDClient *client = req->client;
-    uint32_t command;
+    uint32_t command, valid_flags;
     ssize_t rc;
 
     g_assert(qemu_in_coroutine());
@@ -1067,7 +1481,11 @@ static ssize_t nbd_co_receive_request(NBDRequest *req,
         rc = command == NBD_CMD_WRITE ? -ENOSPC : -EINVAL;
         goto out;
     }
-    if (request->type & ~NBD_CMD_MASK_COMMAND & ~NBD_CMD_FLAG_FUA) {
+    valid_flags = NBD_CMD_FLAG_FUA;
+    if (command == NBD_CMD_BLOCK_STATUS) {
+        valid_flags |= NBD_CMD_FLAG_REQ_ONE;
+    }
+    if (request->type & ~NBD_CMD_MASK_COMMAND & ~valid_flags) {
         LOG("unsupported flags (got 0x%x)",
             request->type & ~NBD_CMD_MASK_COMMAND);
         rc = -EINVAL;
@@ -1138,6 +1556,14 @@ static void nbd_trip(void *opaque)
             }
         }
 
+        if (client->structured_reply) {
+            if (nbd_co_send_sparse_read(req, request.handle, request.from,
+                                        request.len) < 0) {
+                goto out;
+            }
+            break;
+        }
+
         ret = blk_pread(exp->blk, request.from + exp->dev_offset,
                         req->data, request.len);
         if (ret < 0) {
@@ -1206,14 +1632,32 @@ static void nbd_trip(void *opaque)
             goto out;
         }
         break;
+    case NBD_CMD_BLOCK_STATUS:
+        TRACE("Request type is BLOCK_STATUS");
+        if (!client->base_allocation || !request.len) {
+            reply.error = EINVAL;
+            goto error_reply;
+        }
+        if (nbd_co_send_block_status(client, request.handle, request.from,
+                                     request.len,
+                                     request.type & NBD_CMD_FLAG_REQ_ONE) < 0) {
+            goto out;
+        }
+        break;
     default:
         LOG("invalid request type (%" PRIu32 ") received", request.type);
         reply.error = EINVAL;
     error_reply:
+        if (client->structured_reply) {
+            ret = nbd_co_send_structured_error(client, reply.handle,
+                                               reply.error);
+        } else {
+            ret = nbd_co_send_reply(req, &reply, 0);
+        }
         /* We must disconnect after NBD_CMD_WRITE if we did not
          * read the payload.
          */
-        if (nbd_co_send_reply(req, &reply, 0) < 0 || !req->complete) {
+        if (ret < 0 || !req->complete) {
             goto out;
         }
         break;
@@ -1255,7 +1699,7 @@ static void nbd_set_handlers(NBDClient *client)
                            true,
                            client->can_read ? nbd_read : NULL,
                            client->send_coroutine ? nbd_restart_write : NULL,
-                           client);
+                           NULL, client);
     }
 }
 
@@ -1263,7 +1707,7 @@ static void nbd_unset_handlers(NBDClient *client)
 {
     if (client->exp && client->exp->ctx) {
         aio_set_fd_handler(client->exp->ctx, client->sioc->fd,
-                           true, NULL, NULL, NULL);
+                           true, NULL, NULL, NULL, NULL);
     }
 }
 
@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is set associative, indexed by the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -29,11 +29,15 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* number of pages a given address can be cached in */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
     uint64_t it_addr;
     uint64_t it_age;
+    uint64_t it_lru;
     uint8_t *it_data;
 };
 
@@ -41,7 +45,9 @@ struct PageCache {
     CacheItem *page_cache;
     unsigned int page_size;
     int64_t max_num_items;
-    uint64_t max_item_age;
+    int64_t num_sets;
+    unsigned int num_ways;
+    uint64_t lru_clock;
     int64_t num_items;
 };
 
@@ -69,10 +75,13 @@ PageCache *cache_init(int64_t num_pages, unsigned int page_size)
     }
     cache->page_size = page_size;
     cache->num_items = 0;
-    cache->max_item_age = 0;
+    cache->lru_clock = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %" PRId64 " sets of %u\n",
+            cache->num_sets, cache->num_ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -86,6 +95,7 @@ PageCache *cache_init(int64_t num_pages, unsigned int page_size)
     for (i = 0; i < cache->max_num_items; i++) {
         cache->page_cache[i].it_data = NULL;
         cache->page_cache[i].it_age = 0;
+        cache->page_cache[i].it_lru = 0;
         cache->page_cache[i].it_addr = -1;
     }
 
@@ -108,40 +118,68 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+/* Returns the first of the num_ways items @address can be cached in */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    size_t set;
+
+    g_assert(cache);
+    g_assert(cache->page_cache);
+
+    set = (address / cache->page_size) & (cache->num_sets - 1);
+    return &cache->page_cache[set * cache->num_ways];
 }
 
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
+    CacheItem *set = cache_get_set(cache, addr);
+    unsigned int i;
 
-    g_assert(cache);
-    g_assert(cache->page_cache);
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
 
-    pos = cache_get_cache_pos(cache, addr);
+/*
+ * Pick the item of @set to store a new page in: a free one if any,
+ * otherwise the least recently used one.
+ */
+static CacheItem *cache_get_victim(const PageCache *cache, CacheItem *set)
+{
+    CacheItem *victim = &set[0];
+    unsigned int i;
 
-    return &cache->page_cache[pos];
+    for (i = 0; i < cache->num_ways; i++) {
+        if (!set[i].it_data) {
+            return &set[i];
+        }
+        if (set[i].it_lru < victim->it_lru) {
+            victim = &set[i];
+        }
+    }
+    return victim;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age)
 {
     CacheItem *it;
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
+        it->it_lru = ++cache->lru_clock;
         return true;
     }
     return false;
@@ -155,11 +193,12 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
 
     /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
-
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+    if (!it) {
+        it = cache_get_victim(cache, cache_get_set(cache, addr));
+        if (it->it_data && it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+            /* even the oldest page of the set is fresh, don't replace it */
+            return -1;
+        }
     }
     /* allocate page */
     if (!it->it_data) {
@@ -174,6 +213,7 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
     memcpy(it->it_data, pdata, cache->page_size);
 
     it->it_age = current_age;
+    it->it_lru = ++cache->lru_clock;
     it->it_addr = addr;
 
     return 0;
@@ -209,8 +249,10 @@ int64_t cache_resize(PageCache *cache, int64_t new_num_pages)
         old_it = &cache->page_cache[i];
         if (old_it->it_addr != -1) {
             /* check for collision, if there is, keep MRU page */
-            new_it = cache_get_by_addr(new_cache, old_it->it_addr);
-            if (new_it->it_data && new_it->it_age >= old_it->it_age) {
+            new_it = cache_get_victim(new_cache,
+                                      cache_get_set(new_cache,
+                                                    old_it->it_addr));
+            if (new_it->it_data && new_it->it_lru >= old_it->it_lru) {
                 /* keep the MRU page */
                 g_free(old_it->it_data);
             } else {
@@ -220,6 +262,7 @@ int64_t cache_resize(PageCache *cache, int64_t new_num_pages)
                 g_free(new_it->it_data);
                 new_it->it_data = old_it->it_data;
                 new_it->it_age = old_it->it_age;
+                new_it->it_lru = old_it->it_lru;
                 new_it->it_addr = old_it->it_addr;
             }
         }
@@ -228,6 +271,8 @@ int64_t cache_resize(PageCache *cache, int64_t new_num_pages)
     g_free(cache->page_cache);
     cache->page_cache = new_cache->page_cache;
     cache->max_num_items = new_cache->max_num_items;
+    cache->num_sets = new_cache->num_sets;
+    cache->num_ways = new_cache->num_ways;
     cache->num_items = new_cache->num_items;
 
     g_free(new_cache);
@@ -150,6 +150,14 @@ static void QEMU_NORETURN help(void)
            "  '-n' skips the target volume creation (useful if the volume is created\n"
            "       prior to running qemu-img)\n"
            "\n"
+           "Parameters to convert subcommand:\n"
+           "  '-m' specifies how many coroutines work in parallel during the convert\n"
+           "       process (defaults to 8)\n"
+           "  '-W' allows writes to the target to complete out of order rather than\n"
+           "       sequentially\n"
+           "  '-C' tries to let the host copy the data without passing it through\n"
+           "       qemu-img (for example with copy_file_range)\n"
+           "\n"
            "Parameters to check subcommand:\n"
            "  '-r' tries to repair any inconsistencies that are found during the check.\n"
            "       '-r leaks' repairs only cluster leaks, whereas '-r all' fixes all\n"
@@ -1439,83 +1447,141 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
+#define MAX_COROUTINES 16
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
-    int src_cur, src_num;
-    int64_t src_cur_offset;
+    int src_num;
     int64_t total_sectors;
     int64_t allocated_sectors;
+    int64_t allocated_done;
+    int64_t sector_num;
+    int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
+    bool compress_multiple_clusters;
     bool target_has_backing;
+    bool wr_in_order;
+    bool copy_range;
     int min_sparse;
     size_t cluster_sectors;
     size_t buf_sectors;
+    int num_coroutines;
+    int running_coroutines;
+    Coroutine *co[MAX_COROUTINES];
+    int64_t wait_sector_num[MAX_COROUTINES];
+    CoMutex lock;
+    int ret;
 } ImgConvertState;
 
-static void convert_select_part(ImgConvertState *s, int64_t sector_num)
+static void convert_select_part(ImgConvertState *s, int64_t sector_num,
+                                int *src_cur, int64_t *src_cur_offset)
 {
-    assert(sector_num >= s->src_cur_offset);
-    while (sector_num - s->src_cur_offset >= s->src_sectors[s->src_cur]) {
-        s->src_cur_offset += s->src_sectors[s->src_cur];
-        s->src_cur++;
-        assert(s->src_cur < s->src_num);
+    *src_cur = 0;
+    *src_cur_offset = 0;
+    while (sector_num - *src_cur_offset >= s->src_sectors[*src_cur]) {
+        *src_cur_offset += s->src_sectors[*src_cur];
+        (*src_cur)++;
+        assert(*src_cur < s->src_num);
     }
 }
 
-static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+/*
+ * Returns the status of the @nb_sectors sectors at @sector_num of source
+ * part @src_cur (relative to that part), with the number of sectors that
+ * share it in *pnum, or a negative errno.
+ */
+static int convert_block_status(ImgConvertState *s, int src_cur,
+                                int64_t sector_num, int nb_sectors, int *pnum)
 {
+    BlockDriverState *bs = blk_bs(s->src[src_cur]);
+    BlockDriverState *file;
     int64_t ret;
+
+    ret = bdrv_get_block_status(bs, sector_num, nb_sectors, pnum, &file);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (ret & BDRV_BLOCK_ZERO) {
+        return BLK_ZERO;
+    } else if (ret & BDRV_BLOCK_DATA) {
+        return BLK_DATA;
+    } else if (!s->target_has_backing) {
+        /* Without a target backing file we must copy over the contents of
+         * the backing file as well. */
+        /* Check block status of the backing file chain to avoid
+         * needlessly reading zeroes and limiting the iteration to the
+         * buffer size */
+        ret = bdrv_get_block_status_above(bs, NULL, sector_num, *pnum, pnum,
+                                          &file);
+        if (ret < 0) {
+            return ret;
+        }
+
+        return (ret & BDRV_BLOCK_ZERO) ? BLK_ZERO : BLK_DATA;
+    } else {
+        return BLK_BACKING_FILE;
+    }
+}
+
+/* Called with s->lock held once the copy coroutines are running */
+static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+{
+    int64_t src_cur_offset, part_end;
+    int src_cur;
+    int ret;
     int n;
 
-    convert_select_part(s, sector_num);
+    convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
 
     assert(s->total_sectors > sector_num);
     n = MIN(s->total_sectors - sector_num, BDRV_REQUEST_MAX_SECTORS);
 
     if (s->sector_next_status <= sector_num) {
-        BlockDriverState *file;
-        ret = bdrv_get_block_status(blk_bs(s->src[s->src_cur]),
-                                    sector_num - s->src_cur_offset,
-                                    n, &n, &file);
+        ret = convert_block_status(s, src_cur, sector_num - src_cur_offset,
+                                   n, &n);
         if (ret < 0) {
             return ret;
         }
+        s->status = ret;
+        s->sector_next_status = sector_num + n;
 
-        if (ret & BDRV_BLOCK_ZERO) {
-            s->status = BLK_ZERO;
-        } else if (ret & BDRV_BLOCK_DATA) {
-            s->status = BLK_DATA;
-        } else if (!s->target_has_backing) {
-            /* Without a target backing file we must copy over the contents of
-             * the backing file as well. */
-            /* Check block status of the backing file chain to avoid
-             * needlessly reading zeroes and limiting the iteration to the
-             * buffer size */
-            ret = bdrv_get_block_status_above(blk_bs(s->src[s->src_cur]), NULL,
-                                              sector_num - s->src_cur_offset,
-                                              n, &n, &file);
+        /* Drivers report status at most one metadata table at a time; merge
+         * the following extents with the same status, so that zeroes and
+         * unallocated areas are handled in a few large requests. Data is
+         * only ever read a buffer at a time. */
+        part_end = src_cur_offset + s->src_sectors[src_cur];
+        while (s->sector_next_status < part_end) {
+            int64_t limit = s->status == BLK_DATA ? s->buf_sectors
+                                                  : BDRV_REQUEST_MAX_SECTORS;
+            int64_t done = s->sector_next_status - sector_num;
+            int pnum;
+
+            if (done >= limit) {
+                break;
+            }
+            ret = convert_block_status(s, src_cur,
+                                       s->sector_next_status - src_cur_offset,
+                                       MIN(limit - done,
+                                           part_end - s->sector_next_status),
+                                       &pnum);
             if (ret < 0) {
                 return ret;
             }
-
-            if (ret & BDRV_BLOCK_ZERO) {
-                s->status = BLK_ZERO;
-            } else {
-                s->status = BLK_DATA;
+            if (ret != s->status || pnum == 0) {
+                break;
             }
-        } else {
-            s->status = BLK_BACKING_FILE;
+            s->sector_next_status += pnum;
         }
-
-        s->sector_next_status = sector_num + n;
     }
 
-    n = MIN(n, s->sector_next_status - sector_num);
+    n = MIN(MIN(s->total_sectors - sector_num, BDRV_REQUEST_MAX_SECTORS),
+            s->sector_next_status - sector_num);
     if (s->status == BLK_DATA) {
         n = MIN(n, s->buf_sectors);
     }
@@ -1535,8 +1601,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
     return n;
 }
 
-static int convert_read(ImgConvertState *s, int64_t sector_num, int nb_sectors,
-                        uint8_t *buf)
+static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
+                                        int nb_sectors, uint8_t *buf)
 {
     int n;
     int ret;
@@ -1544,19 +1610,26 @@ static int convert_read(ImgConvertState *s, int64_t sector_num, int nb_sectors,
     assert(nb_sectors <= s->buf_sectors);
     while (nb_sectors > 0) {
         BlockBackend *blk;
-        int64_t bs_sectors;
+        QEMUIOVector qiov;
+        struct iovec iov;
+        int src_cur;
+        int64_t bs_sectors, src_cur_offset;
 
         /* In the case of compression with multiple source files, we can get a
          * nb_sectors that spreads into the next part. So we must be able to
          * read across multiple BDSes for one convert_read() call. */
-        convert_select_part(s, sector_num);
-        blk = s->src[s->src_cur];
-        bs_sectors = s->src_sectors[s->src_cur];
-
-        n = MIN(nb_sectors, bs_sectors - (sector_num - s->src_cur_offset));
-        ret = blk_pread(blk,
-                        (sector_num - s->src_cur_offset) << BDRV_SECTOR_BITS,
-                        buf, n << BDRV_SECTOR_BITS);
+        convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
+        blk = s->src[src_cur];
+        bs_sectors = s->src_sectors[src_cur];
+
+        n = MIN(nb_sectors, bs_sectors - (sector_num - src_cur_offset));
+        iov.iov_base = buf;
+        iov.iov_len = n << BDRV_SECTOR_BITS;
+        qemu_iovec_init_external(&qiov, &iov, 1);
+
+        ret = blk_co_preadv(blk,
+                            (sector_num - src_cur_offset) << BDRV_SECTOR_BITS,
+                            n << BDRV_SECTOR_BITS, &qiov, 0);
         if (ret < 0) {
             return ret;
         }
@@ -1569,15 +1642,51 @@ static int convert_read(ImgConvertState *s, int64_t sector_num, int nb_sectors,
     return 0;
 }
 
-static int convert_write(ImgConvertState *s, int64_t sector_num, int nb_sectors,
-                         const uint8_t *buf)
+static int coroutine_fn convert_co_copy_range(ImgConvertState *s,
+                                              int64_t sector_num,
+                                              int nb_sectors)
+{
+    int n;
+    int ret;
+
+    while (nb_sectors > 0) {
+        BlockBackend *blk;
+        int src_cur;
+        int64_t bs_sectors, src_cur_offset;
+
+        convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
+        blk = s->src[src_cur];
+        bs_sectors = s->src_sectors[src_cur];
+
+        n = MIN(nb_sectors, bs_sectors - (sector_num - src_cur_offset));
+
+        ret = blk_co_copy_range(blk, (sector_num - src_cur_offset)
+                                     << BDRV_SECTOR_BITS,
+                                s->target, sector_num << BDRV_SECTOR_BITS,
+                                n << BDRV_SECTOR_BITS, 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        sector_num += n;
+        nb_sectors -= n;
+    }
+
+    return 0;
+}
+
+static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
+                                         int nb_sectors, uint8_t *buf,
+                                         enum ImgConvertBlockStatus status)
 {
     int ret;
+    QEMUIOVector qiov;
+    struct iovec iov;
 
     while (nb_sectors > 0) {
         int n = nb_sectors;
 
-        switch (s->status) {
+        switch (status) {
         case BLK_BACKING_FILE:
             /* If we have a backing file, leave clusters unallocated that are
              * unallocated in the source image, so that the backing file is
@@ -1588,19 +1697,40 @@ static int convert_write(ImgConvertState *s, int64_t sector_num, int nb_sectors,
         case BLK_DATA:
             /* We must always write compressed clusters as a whole, so don't
              * try to find zeroed parts in the buffer. We can only save the
-             * write if the buffer is completely zeroed and we're allowed to
-             * keep the target sparse. */
+             * write of a cluster if it is completely zeroed and we're allowed
+             * to keep the target sparse. Consecutive clusters that are all
+             * written go out in a single request, so that the format can
+             * compress them in parallel. */
             if (s->compressed) {
-                if (s->has_zero_init && s->min_sparse &&
-                    buffer_is_zero(buf, n * BDRV_SECTOR_SIZE))
-                {
+                bool sparse = s->has_zero_init && s->min_sparse;
+                int len = MIN(n, s->cluster_sectors);
+                bool zero = sparse &&
+                            buffer_is_zero(buf, len * BDRV_SECTOR_SIZE);
+
+                while (len < n) {
+                    int next = MIN(n - len, s->cluster_sectors);
+
+                    if (sparse &&
+                        buffer_is_zero(buf + len * BDRV_SECTOR_SIZE,
+                                       next * BDRV_SECTOR_SIZE) != zero) {
+                        break;
+                    }
+                    len += next;
+                }
+                n = len;
+
+                if (zero) {
                     assert(!s->target_has_backing);
                     break;
                 }
 
-                ret = blk_pwrite_compressed(s->target,
-                                            sector_num << BDRV_SECTOR_BITS,
-                                            buf, n << BDRV_SECTOR_BITS);
+                iov.iov_base = buf;
+                iov.iov_len = n << BDRV_SECTOR_BITS;
+                qemu_iovec_init_external(&qiov, &iov, 1);
+
+                ret = blk_co_pwritev(s->target, sector_num << BDRV_SECTOR_BITS,
+                                     n << BDRV_SECTOR_BITS, &qiov,
+                                     BDRV_REQ_WRITE_COMPRESSED);
                 if (ret < 0) {
                     return ret;
                 }
@@ -1613,8 +1743,12 @@ static int convert_write(ImgConvertState *s, int64_t sector_num, int nb_sectors,
             if (!s->min_sparse ||
                 is_allocated_sectors_min(buf, n, &n, s->min_sparse))
             {
-                ret = blk_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
-                                 buf, n << BDRV_SECTOR_BITS, 0);
+                iov.iov_base = buf;
+                iov.iov_len = n << BDRV_SECTOR_BITS;
+                qemu_iovec_init_external(&qiov, &iov, 1);
+
+                ret = blk_co_pwritev(s->target, sector_num << BDRV_SECTOR_BITS,
+                                     n << BDRV_SECTOR_BITS, &qiov, 0);
                 if (ret < 0) {
                     return ret;
                 }
@@ -1626,8 +1760,9 @@ static int convert_write(ImgConvertState *s, int64_t sector_num, int nb_sectors,
             if (s->has_zero_init) {
                 break;
             }
-            ret = blk_pwrite_zeroes(s->target, sector_num << BDRV_SECTOR_BITS,
-                                    n << BDRV_SECTOR_BITS, 0);
+            ret = blk_co_pwrite_zeroes(s->target,
+                                       sector_num << BDRV_SECTOR_BITS,
+                                       n << BDRV_SECTOR_BITS, 0);
             if (ret < 0) {
                 return ret;
             }
@@ -1642,12 +1777,150 @@ static int convert_write(ImgConvertState *s, int64_t sector_num, int nb_sectors,
     return 0;
 }
 
-static int convert_do_copy(ImgConvertState *s)
+/* Wake up the worker waiting to write at s->wr_offs, if any */
+static void convert_co_wake_writer(ImgConvertState *s, bool all)
+{
+    int i;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        /* A waiting coroutine resets its wait_sector_num before it can
+         * enter anybody else, so this never re-enters a running one. */
+        if (s->co[i] && s->wait_sector_num[i] != -1 &&
+            (all || s->wait_sector_num[i] == s->wr_offs))
+        {
+            qemu_coroutine_enter(s->co[i]);
+            if (!all) {
+                break;
+            }
+        }
+    }
+}
+
+static void coroutine_fn convert_co_do_copy(void *opaque)
 {
+    ImgConvertState *s = opaque;
     uint8_t *buf = NULL;
-    int64_t sector_num, allocated_done;
-    int ret;
-    int n;
+    int ret, i;
+    int index = -1;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] == qemu_coroutine_self()) {
+            index = i;
+            break;
+        }
+    }
+    assert(index >= 0);
+
+    s->running_coroutines++;
+    buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+
+    while (1) {
+        int n;
+        int64_t sector_num;
+        enum ImgConvertBlockStatus status;
+        bool copy_range;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        n = convert_iteration_sectors(s, s->sector_num);
+        if (n < 0) {
+            qemu_co_mutex_unlock(&s->lock);
+            s->ret = n;
+            break;
+        }
+        /* Keep the status of this request; other workers move on */
+        sector_num = s->sector_num;
+        status = s->status;
+        if (!s->min_sparse && s->status == BLK_ZERO) {
+            n = MIN(n, s->buf_sectors);
+        }
+        s->sector_num += n;
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
+            s->allocated_done += n;
+            qemu_progress_print(100.0 * s->allocated_done /
+                                        s->allocated_sectors, 0);
+        }
+
+        copy_range = s->copy_range && status == BLK_DATA;
+        if (status == BLK_DATA && !copy_range) {
+            ret = convert_co_read(s, sector_num, n, buf);
+            if (ret < 0) {
+                error_report("error while reading sector %" PRId64
+                             ": %s", sector_num, strerror(-ret));
+                s->ret = ret;
+                break;
+            }
+        } else if (!s->min_sparse && status == BLK_ZERO) {
+            status = BLK_DATA;
+            memset(buf, 0, n * BDRV_SECTOR_SIZE);
+        }
+
+        if (s->wr_in_order) {
+            while (s->wr_offs != sector_num) {
+                if (s->ret != -EINPROGRESS) {
+                    goto out;
+                }
+                s->wait_sector_num[index] = sector_num;
+                qemu_coroutine_yield();
+                s->wait_sector_num[index] = -1;
+            }
+        }
+
+        if (copy_range) {
+            ret = convert_co_copy_range(s, sector_num, n);
+            if (ret < 0) {
+                /* Offloading is not possible for these images, copy through
+                 * the buffer from now on */
+                s->copy_range = false;
+                copy_range = false;
+                ret = convert_co_read(s, sector_num, n, buf);
+                if (ret < 0) {
+                    error_report("error while reading sector %" PRId64
+                                 ": %s", sector_num, strerror(-ret));
+                    s->ret = ret;
+                    break;
+                }
+            }
+        }
+
+        if (!copy_range) {
+            ret = convert_co_write(s, sector_num, n, buf, status);
+            if (ret < 0) {
+                error_report("error while writing sector %" PRId64
+                             ": %s", sector_num, strerror(-ret));
+                s->ret = ret;
+                break;
+            }
+        }
+
+        if (s->wr_in_order) {
+            s->wr_offs = sector_num + n;
+            convert_co_wake_writer(s, false);
+        }
+    }
+
+out:
+    qemu_vfree(buf);
+    s->co[index] = NULL;
+    s->running_coroutines--;
+    if (s->ret != -EINPROGRESS) {
+        /* Failed; don't leave anybody waiting for our write */
+        convert_co_wake_writer(s, true);
+    } else if (!s->running_coroutines) {
+        /* the convert job finished successfully */
+        s->ret = 0;
+    }
+}
+
+static int convert_do_copy(ImgConvertState *s)
+{
+    int ret, i, n;
+    int64_t sector_num = 0;
 
     /* Check whether we have zero initialisation or can get it efficiently */
     s->has_zero_init = s->min_sparse && !s->target_has_backing
@@ -1663,26 +1936,28 @@ static int convert_do_copy(ImgConvertState *s)
         }
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /* Allocate buffer for copied data. For compressed images, the buffer
+     * holds whole clusters, and only one cluster unless the format can
+     * compress several clusters of one write request. */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
-            ret = -EINVAL;
-            goto fail;
+            return -EINVAL;
+        }
+        if (s->compress_multiple_clusters) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
         }
-        s->buf_sectors = s->cluster_sectors;
     }
-    buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
 
     /* Calculate allocated sectors for progress */
     s->allocated_sectors = 0;
-    sector_num = 0;
     while (sector_num < s->total_sectors) {
         n = convert_iteration_sectors(s, sector_num);
         if (n < 0) {
-            ret = n;
-            goto fail;
+            return n;
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
         {
@@ -1692,66 +1967,35 @@ static int convert_do_copy(ImgConvertState *s)
     }
 
     /* Do the copy */
-    s->src_cur = 0;
-    s->src_cur_offset = 0;
     s->sector_next_status = 0;
+    s->ret = -EINPROGRESS;
 
-    sector_num = 0;
-    allocated_done = 0;
-
-    while (sector_num < s->total_sectors) {
-        n = convert_iteration_sectors(s, sector_num);
-        if (n < 0) {
-            ret = n;
-            goto fail;
-        }
-        if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
-        {
-            allocated_done += n;
-            qemu_progress_print(100.0 * allocated_done / s->allocated_sectors,
-                                0);
-        }
-
-        if (s->status == BLK_DATA) {
-            ret = convert_read(s, sector_num, n, buf);
-            if (ret < 0) {
-                error_report("error while reading sector %" PRId64
-                             ": %s", sector_num, strerror(-ret));
-                goto fail;
-            }
-        } else if (!s->min_sparse && s->status == BLK_ZERO) {
-            n = MIN(n, s->buf_sectors);
-            memset(buf, 0, n * BDRV_SECTOR_SIZE);
-            s->status = BLK_DATA;
-        }
-
-        ret = convert_write(s, sector_num, n, buf);
-        if (ret < 0) {
-            error_report("error while writing sector %" PRId64
-                         ": %s", sector_num, strerror(-ret));
-            goto fail;
-        }
+    qemu_co_mutex_init(&s->lock);
+    for (i = 0; i < s->num_coroutines; i++) {
+        s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
+        s->wait_sector_num[i] = -1;
+        qemu_coroutine_enter(s->co[i]);
+    }
 
-        sector_num += n;
+    while (s->running_coroutines) {
+        main_loop_wait(false);
     }
 
-    if (s->compressed) {
+    if (s->ret == 0 && s->compressed) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, NULL, 0);
         if (ret < 0) {
-            goto fail;
+            return ret;
         }
     }
 
-    ret = 0;
-fail:
-    qemu_vfree(buf);
-    return ret;
+    return s->ret;
 }
 
 static int img_convert(int argc, char **argv)
 {
     int c, bs_n, bs_i, compress, cluster_sectors, skip_create;
+    bool compress_multiple_clusters;
     int64_t ret = 0;
     int progress = 0, flags, src_flags;
     bool writethrough, src_writethrough;
@@ -1774,6 +2018,10 @@ static int img_convert(int argc, char **argv)
     QemuOpts *sn_opts = NULL;
     ImgConvertState state;
     bool image_opts = false;
+    bool wr_in_order = true;
+    bool copy_range = false;
+    bool explicit_min_sparse = false;
+    long num_coroutines = 8;
 
     fmt = NULL;
     out_fmt = "raw";
@@ -1789,7 +2037,7 @@ static int img_convert(int argc, char **argv)
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, "hf:O:B:ce6o:s:l:S:pt:T:qn",
+        c = getopt_long(argc, argv, "hf:O:B:Cce6o:s:l:S:pt:T:qnm:W",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1808,6 +2056,9 @@ static int img_convert(int argc, char **argv)
         case 'B':
             out_baseimg = optarg;
             break;
+        case 'C':
+            copy_range = true;
+            break;
         case 'c':
             compress = 1;
             break;
@@ -1864,6 +2115,7 @@ static int img_convert(int argc, char **argv)
             }
 
             min_sparse = sval / BDRV_SECTOR_SIZE;
+            explicit_min_sparse = true;
             break;
         }
         case 'p':
@@ -1881,6 +2133,18 @@ static int img_convert(int argc, char **argv)
         case 'n':
             skip_create = 1;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                ret = -1;
+                goto fail_getopt;
+            }
+            break;
+        case 'W':
+            wr_in_order = false;
+            break;
         case OPTION_OBJECT:
             opts = qemu_opts_parse_noisily(&qemu_object_opts,
                                            optarg, true);
@@ -1894,6 +2158,19 @@ static int img_convert(int argc, char **argv)
         }
     }
 
+    /* Offloaded copies never see the data, so they can neither compress it
+     * nor look for zeroes in it */
+    if (copy_range && compress) {
+        error_report("Cannot enable copy offloading when -c is used");
+        ret = -1;
+        goto fail_getopt;
+    }
+    if (copy_range && explicit_min_sparse) {
+        error_report("Cannot enable copy offloading when -S is used");
+        ret = -1;
+        goto fail_getopt;
+    }
+
     if (qemu_opts_foreach(&qemu_object_opts,
                           user_creatable_add_opts_foreach,
                           NULL, NULL)) {
@@ -2118,6 +2395,7 @@ static int img_convert(int argc, char **argv)
     }
 
     cluster_sectors = 0;
+    compress_multiple_clusters = false;
     ret = bdrv_get_info(out_bs, &bdi);
     if (ret < 0) {
         if (compress) {
@@ -2127,6 +2405,14 @@ static int img_convert(int argc, char **argv)
     } else {
         compress = compress || bdi.needs_compressed_writes;
         cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
+        compress_multiple_clusters = bdi.can_compress_multiple_clusters;
+        /* Formats that need compressed writes append them to the file */
+        if (bdi.needs_compressed_writes && !wr_in_order) {
+            error_report("Out of order writes are not supported by format "
+                         "'%s'", out_fmt);
+            ret = -1;
+            goto out;
+        }
     }
 
     state = (ImgConvertState) {
@@ -2136,10 +2422,14 @@ static int img_convert(int argc, char **argv)
         .total_sectors      = total_sectors,
         .target             = out_blk,
         .compressed         = compress,
+        .compress_multiple_clusters = compress_multiple_clusters,
         .target_has_backing = (bool) out_baseimg,
         .min_sparse         = min_sparse,
         .cluster_sectors    = cluster_sectors,
         .buf_sectors        = bufsectors,
+        .wr_in_order        = wr_in_order,
+        .copy_range         = copy_range && !compress,
+        .num_coroutines     = num_coroutines,
     };
     ret = convert_do_copy(&state);
 
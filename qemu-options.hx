@@ -292,7 +292,10 @@ DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
 STEXI
 @item -mem-prealloc
 @findex -mem-prealloc
-Preallocate memory when using -mem-path.
+Preallocate memory when using -mem-path.  The pages are touched by up to
+one thread per virtual CPU, bounded by the number of host CPUs.  Memory
+backends created with @option{-object} take a @option{prealloc-threads}
+property to choose a different number.
 ETEXI
 
 DEF("k", HAS_ARG, QEMU_OPTION_k,
@@ -518,7 +521,8 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -561,7 +565,7 @@ These options have the same definition as they have in @option{-hdachs}.
 @item cache=@var{cache}
 @var{cache} is "none", "writeback", "unsafe", "directsync" or "writethrough" and controls how the host cache is used to access block data.
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread based disk I/O, native Linux AIO and Linux io_uring.  Unlike native Linux AIO, io_uring does not require @option{cache=none}.
 @item discard=@var{discard}
 @var{discard} is one of "ignore" (or "off") or "unmap" (or "on") and controls whether @dfn{discard} (also known as @dfn{trim} or @dfn{unmap}) requests are ignored or passed to the filesystem.  Some machine types may not support discard requests.
 @item format=@var{format}
@@ -3519,6 +3523,19 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tb-prefetch", 0, QEMU_OPTION_tb_prefetch, \
+    "-tb-prefetch    translate successors of new TBs while the CPUs are idle\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-prefetch
+@findex -tb-prefetch
+Remember the static successors (fall-through and direct branch targets)
+of newly translated blocks, and translate them ahead of time whenever
+all virtual CPUs are idle, so that they are found in the hash table the
+first time they are reached.  Only blocks whose code pages are already
+in the TLB are translated.  Ignored with @option{-icount}.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4][,ipv6]\n" \
     "-incoming rdma:host:port[,ipv4][,ipv6]\n" \
@@ -3529,6 +3546,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                load the migration stream saved in the given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -3547,6 +3566,10 @@ Accept incoming migration from a given filedescriptor.
 @item -incoming exec:@var{cmdline}
 Accept incoming migration as an output from specified external command.
 
+@item -incoming file:@var{filename}
+Load the migration stream that a @code{migrate "file:@var{filename}"}
+command saved.
+
 @item -incoming defer
 Wait for the URI to be specified via migrate_incoming.  The monitor can
 be used to change settings (such as migration parameters) prior to issuing
@@ -62,12 +62,19 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The active timers are kept in a binary min-heap ordered by expire
+ * time, so that arming and deleting a timer is O(log n).  Timers that
+ * expire at the same time fire in the order they were armed.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    QEMUTimer **active_timers;
+    unsigned active_timers_nr;
+    unsigned active_timers_size;
+    uint64_t active_timers_seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -94,6 +101,12 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+/* Return the timer that expires first, or NULL if none is active. */
+static QEMUTimer *timerlist_first(QEMUTimerList *timer_list)
+{
+    return timer_list->active_timers_nr ? timer_list->active_timers[0] : NULL;
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -118,6 +131,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -174,7 +188,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!timer_list->active_timers;
+    return !!timer_list->active_timers_nr;
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -188,11 +202,11 @@ bool timerlist_expired(QEMUTimerList *timer_list)
     int64_t expire_time;
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->active_timers_nr) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return false;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    expire_time = timerlist_first(timer_list)->expire_time;
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     return expire_time < qemu_clock_get_ns(timer_list->clock->type);
@@ -223,11 +237,11 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->active_timers_nr) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return -1;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    expire_time = timerlist_first(timer_list)->expire_time;
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -352,43 +366,100 @@ void timer_free(QEMUTimer *ts)
     g_free(ts);
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+static bool timer_before(QEMUTimer *a, QEMUTimer *b)
 {
-    QEMUTimer **pt, *t;
+    return a->expire_time < b->expire_time
+        || (a->expire_time == b->expire_time && a->seq < b->seq);
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            *pt = t->next;
+static void timer_heap_set(QEMUTimerList *timer_list, unsigned i,
+                           QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timer_heap_up(QEMUTimerList *timer_list, unsigned i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
     }
+    timer_heap_set(timer_list, i, ts);
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static void timer_heap_down(QEMUTimerList *timer_list, unsigned i)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *ts = timer_list->active_timers[i];
+    unsigned nr = timer_list->active_timers_nr;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
     for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
+        unsigned child = 2 * i + 1;
+
+        if (child >= nr) {
             break;
         }
-        pt = &t->next;
+        if (child + 1 < nr
+            && timer_before(timer_list->active_timers[child + 1],
+                            timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[child]);
+        i = child;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    unsigned i = ts->heap_index;
+    QEMUTimer *last;
+
+    if (ts->expire_time == -1) {
+        return;
+    }
+    ts->expire_time = -1;
+
+    assert(i < timer_list->active_timers_nr);
+    assert(timer_list->active_timers[i] == ts);
+    last = timer_list->active_timers[--timer_list->active_timers_nr];
+    if (last != ts) {
+        timer_heap_set(timer_list, i, last);
+        timer_heap_up(timer_list, i);
+        timer_heap_down(timer_list, last->heap_index);
     }
+}
+
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    unsigned i;
+
+    if (timer_list->active_timers_nr == timer_list->active_timers_size) {
+        timer_list->active_timers_size =
+            MAX(timer_list->active_timers_size * 2, 16);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->active_timers_size);
+    }
+
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    *pt = ts;
+    ts->seq = timer_list->active_timers_seq++;
+    i = timer_list->active_timers_nr++;
+    timer_heap_set(timer_list, i, ts);
+    timer_heap_up(timer_list, i);
 
-    return pt == &timer_list->active_timers;
+    return ts->heap_index == 0;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -482,7 +553,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     void *opaque;
 
     qemu_event_reset(&timer_list->timers_done_ev);
-    if (!timer_list->clock->enabled || !timer_list->active_timers) {
+    if (!timer_list->clock->enabled || !timer_list->active_timers_nr) {
         goto out;
     }
 
@@ -510,16 +581,14 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     for(;;) {
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
+        ts = timerlist_first(timer_list);
         if (!timer_expired_ns(ts, current_time)) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             break;
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
         qemu_mutex_unlock(&timer_list->active_timers_lock);
@@ -137,6 +137,7 @@ static inline bool use_goto_tb(DisasContext *ctx, target_ulong dest)
 
 static inline void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
 {
+    tb_prefetch_note(ctx->tb, dest);
     if (use_goto_tb(ctx, dest)) {
         /* chaining is only allowed when the jump is to the same page */
         tcg_gen_goto_tb(n);
@@ -2008,6 +2009,7 @@ void riscv_tcg_init(void)
     }
 
     cpu_env = tcg_global_reg_new_ptr(TCG_AREG0, "env");
+    tcg_ctx.tcg_env = cpu_env;
 
     /* WARNING: cpu_gpr[0] is not allocated ON PURPOSE. Do not use it. */
     /* Use the gen_set_gpr and gen_get_gpr helper functions when accessing */
@@ -0,0 +1,198 @@
+/*
+ * Tiny Code Generator for QEMU: out-of-line generic vector helpers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "tcg-gvec-desc.h"
+
+/* This file is compiled once, and thus we can't include the standard
+   "exec/helper-proto.h", which has includes that are target specific.  */
+
+#include "exec/helper-head.h"
+
+#define DEF_HELPER_FLAGS_2(name, flags, ret, t1, t2) \
+  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2));
+#define DEF_HELPER_FLAGS_3(name, flags, ret, t1, t2, t3) \
+  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2), dh_ctype(t3));
+#define DEF_HELPER_FLAGS_4(name, flags, ret, t1, t2, t3, t4) \
+  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2), dh_ctype(t3), \
+                              dh_ctype(t4));
+
+#include "tcg-runtime.h"
+
+/* Operation sizes are 8 bytes or a multiple of 16 bytes, so the loops
+   below can use 128-bit vector types, with an 8-byte tail handled through
+   temporaries.  The compiler lowers them to SSE2 on x86 hosts (AVX2 if
+   enabled in CFLAGS), to NEON on ARM hosts, and to pairs of 64-bit
+   operations elsewhere.  */
+typedef uint8_t vec8 __attribute__((vector_size(16)));
+typedef uint16_t vec16 __attribute__((vector_size(16)));
+typedef uint32_t vec32 __attribute__((vector_size(16)));
+typedef uint64_t vec64 __attribute__((vector_size(16)));
+
+typedef int8_t svec8 __attribute__((vector_size(16)));
+typedef int16_t svec16 __attribute__((vector_size(16)));
+typedef int32_t svec32 __attribute__((vector_size(16)));
+typedef int64_t svec64 __attribute__((vector_size(16)));
+
+static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
+{
+    intptr_t maxsz = simd_maxsz(desc);
+
+    if (unlikely(maxsz > oprsz)) {
+        memset(d + oprsz, 0, maxsz - oprsz);
+    }
+}
+
+void HELPER(gvec_mov)(void *d, void *a, uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+
+    memmove(d, a, oprsz);
+    clear_high(d, oprsz, desc);
+}
+
+void HELPER(gvec_dup64)(void *d, uint32_t desc, uint64_t c)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    intptr_t i;
+
+    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        *(uint64_t *)(d + i) = c;
+    }
+    clear_high(d, oprsz, desc);
+}
+
+#define DO_GVEC2(NAME, TYPE, OP)                                        \
+void HELPER(NAME)(void *d, void *a, uint32_t desc)                      \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i + sizeof(TYPE) <= oprsz; i += sizeof(TYPE)) {         \
+        *(TYPE *)(d + i) = OP *(TYPE *)(a + i);                         \
+    }                                                                   \
+    if (i < oprsz) {                                                    \
+        TYPE ta = { 0 }, td;                                            \
+        memcpy(&ta, a + i, oprsz - i);                                  \
+        td = OP ta;                                                     \
+        memcpy(d + i, &td, oprsz - i);                                  \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+DO_GVEC2(gvec_not, vec64, ~)
+DO_GVEC2(gvec_neg8, vec8, -)
+DO_GVEC2(gvec_neg16, vec16, -)
+DO_GVEC2(gvec_neg32, vec32, -)
+DO_GVEC2(gvec_neg64, vec64, -)
+
+/* CAST is needed for comparisons, whose result is a signed vector.  */
+#define DO_GVEC3(NAME, TYPE, OP, CAST)                                  \
+void HELPER(NAME)(void *d, void *a, void *b, uint32_t desc)             \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i + sizeof(TYPE) <= oprsz; i += sizeof(TYPE)) {         \
+        *(TYPE *)(d + i) = CAST(*(TYPE *)(a + i) OP *(TYPE *)(b + i));  \
+    }                                                                   \
+    if (i < oprsz) {                                                    \
+        TYPE ta = { 0 }, tb = { 0 }, td;                                \
+        memcpy(&ta, a + i, oprsz - i);                                  \
+        memcpy(&tb, b + i, oprsz - i);                                  \
+        td = CAST(ta OP tb);                                            \
+        memcpy(d + i, &td, oprsz - i);                                  \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+DO_GVEC3(gvec_add8, vec8, +, )
+DO_GVEC3(gvec_add16, vec16, +, )
+DO_GVEC3(gvec_add32, vec32, +, )
+DO_GVEC3(gvec_add64, vec64, +, )
+
+DO_GVEC3(gvec_sub8, vec8, -, )
+DO_GVEC3(gvec_sub16, vec16, -, )
+DO_GVEC3(gvec_sub32, vec32, -, )
+DO_GVEC3(gvec_sub64, vec64, -, )
+
+DO_GVEC3(gvec_and, vec64, &, )
+DO_GVEC3(gvec_or, vec64, |, )
+DO_GVEC3(gvec_xor, vec64, ^, )
+DO_GVEC3(gvec_andc, vec64, & ~, )
+DO_GVEC3(gvec_orc, vec64, | ~, )
+
+/* The shift count is in the descriptor and is less than the lane width.  */
+#define DO_GVEC_SHIFT(NAME, TYPE, OP)                                   \
+void HELPER(NAME)(void *d, void *a, uint32_t desc)                      \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    int shift = simd_data(desc);                                        \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i + sizeof(TYPE) <= oprsz; i += sizeof(TYPE)) {         \
+        *(TYPE *)(d + i) = *(TYPE *)(a + i) OP shift;                   \
+    }                                                                   \
+    if (i < oprsz) {                                                    \
+        TYPE ta = { 0 }, td;                                            \
+        memcpy(&ta, a + i, oprsz - i);                                  \
+        td = ta OP shift;                                               \
+        memcpy(d + i, &td, oprsz - i);                                  \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+DO_GVEC_SHIFT(gvec_shl8i, vec8, <<)
+DO_GVEC_SHIFT(gvec_shl16i, vec16, <<)
+DO_GVEC_SHIFT(gvec_shl32i, vec32, <<)
+DO_GVEC_SHIFT(gvec_shl64i, vec64, <<)
+
+DO_GVEC_SHIFT(gvec_shr8i, vec8, >>)
+DO_GVEC_SHIFT(gvec_shr16i, vec16, >>)
+DO_GVEC_SHIFT(gvec_shr32i, vec32, >>)
+DO_GVEC_SHIFT(gvec_shr64i, vec64, >>)
+
+DO_GVEC_SHIFT(gvec_sar8i, svec8, >>)
+DO_GVEC_SHIFT(gvec_sar16i, svec16, >>)
+DO_GVEC_SHIFT(gvec_sar32i, svec32, >>)
+DO_GVEC_SHIFT(gvec_sar64i, svec64, >>)
+
+/* Vector comparisons yield all ones in the lanes where the condition
+   holds, and zero elsewhere.  */
+#define DO_GVEC_CMP(NAME, OP)                                           \
+    DO_GVEC3(glue(NAME, 8), svec8, OP, (svec8))                         \
+    DO_GVEC3(glue(NAME, 16), svec16, OP, (svec16))                      \
+    DO_GVEC3(glue(NAME, 32), svec32, OP, (svec32))                      \
+    DO_GVEC3(glue(NAME, 64), svec64, OP, (svec64))
+
+#define DO_GVEC_CMPU(NAME, OP)                                          \
+    DO_GVEC3(glue(NAME, 8), vec8, OP, (vec8))                           \
+    DO_GVEC3(glue(NAME, 16), vec16, OP, (vec16))                        \
+    DO_GVEC3(glue(NAME, 32), vec32, OP, (vec32))                        \
+    DO_GVEC3(glue(NAME, 64), vec64, OP, (vec64))
+
+DO_GVEC_CMP(gvec_eq, ==)
+DO_GVEC_CMP(gvec_ne, !=)
+DO_GVEC_CMP(gvec_lt, <)
+DO_GVEC_CMP(gvec_le, <=)
+DO_GVEC_CMPU(gvec_ltu, <)
+DO_GVEC_CMPU(gvec_leu, <=)
@@ -131,6 +131,7 @@ extern bool have_bmi1;
 #define TCG_TARGET_HAS_muls2_i64        1
 #define TCG_TARGET_HAS_muluh_i64        0
 #define TCG_TARGET_HAS_mulsh_i64        0
+#define TCG_TARGET_HAS_gvec_v128        1
 #endif
 
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
@@ -333,6 +333,26 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_MOVSLQ	(0x63 | P_REXW)
 #define OPC_MOVZBL	(0xb6 | P_EXT)
 #define OPC_MOVZWL	(0xb7 | P_EXT)
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_PCMPGTB     (0x64 | P_EXT | P_DATA16)
+#define OPC_PCMPGTW     (0x65 | P_EXT | P_DATA16)
+#define OPC_PCMPGTD     (0x66 | P_EXT | P_DATA16)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
 #define OPC_POP_r32	(0x58)
 #define OPC_PUSH_r32	(0x50)
 #define OPC_PUSH_Iv	(0x68)
@@ -431,6 +451,11 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
 
     rex = 0;
     rex |= (opc & P_REXW) ? 0x8 : 0x0;  /* REX.W */
@@ -465,6 +490,11 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & (P_EXT | P_EXT38)) {
         tcg_out8(s, 0x0f);
         if (opc & P_EXT38) {
@@ -686,6 +716,48 @@ static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
     }
 }
 
+#if TCG_TARGET_REG_BITS == 64
+/* Every x86_64 host has SSE2.  The operands are loaded into %xmm0 and
+   %xmm1, which are call-clobbered and otherwise unused by TCG.  */
+static void tcg_out_gvec_v128(TCGContext *s, TCGGvecOp op, intptr_t dofs,
+                              intptr_t aofs, intptr_t bofs)
+{
+    static const int v128_opc[] = {
+        [TCG_GVEC_ADD8] = OPC_PADDB,
+        [TCG_GVEC_ADD16] = OPC_PADDW,
+        [TCG_GVEC_ADD32] = OPC_PADDD,
+        [TCG_GVEC_ADD64] = OPC_PADDQ,
+        [TCG_GVEC_SUB8] = OPC_PSUBB,
+        [TCG_GVEC_SUB16] = OPC_PSUBW,
+        [TCG_GVEC_SUB32] = OPC_PSUBD,
+        [TCG_GVEC_SUB64] = OPC_PSUBQ,
+        [TCG_GVEC_AND] = OPC_PAND,
+        [TCG_GVEC_OR] = OPC_POR,
+        [TCG_GVEC_XOR] = OPC_PXOR,
+        [TCG_GVEC_ANDC] = OPC_PANDN,
+        [TCG_GVEC_EQ8] = OPC_PCMPEQB,
+        [TCG_GVEC_EQ16] = OPC_PCMPEQW,
+        [TCG_GVEC_EQ32] = OPC_PCMPEQD,
+        [TCG_GVEC_LT8] = OPC_PCMPGTB,
+        [TCG_GVEC_LT16] = OPC_PCMPGTW,
+        [TCG_GVEC_LT32] = OPC_PCMPGTD,
+    };
+    intptr_t t;
+
+    tcg_debug_assert(op > TCG_GVEC_NONE && op < ARRAY_SIZE(v128_opc));
+
+    /* PANDN computes ~a & b and PCMPGT computes a > b, so swap the
+       operands for andc and for the less-than comparisons.  */
+    if (op == TCG_GVEC_ANDC || op >= TCG_GVEC_LT8) {
+        t = aofs, aofs = bofs, bofs = t;
+    }
+    tcg_out_modrm_offset(s, OPC_MOVDQU_VxWx, 0, TCG_AREG0, aofs);
+    tcg_out_modrm_offset(s, OPC_MOVDQU_VxWx, 1, TCG_AREG0, bofs);
+    tcg_out_modrm(s, v128_opc[op], 0, 1);
+    tcg_out_modrm_offset(s, OPC_MOVDQU_WxVx, 0, TCG_AREG0, dofs);
+}
+#endif
+
 static inline void tcg_out_mb(TCGContext *s, TCGArg a0)
 {
     /* Given the strength of x86 memory ordering, we only need care for
@@ -2146,6 +2218,11 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     case INDEX_op_mb:
         tcg_out_mb(s, args[0]);
         break;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_gvec_v128:
+        tcg_out_gvec_v128(s, args[0], args[1], args[2], args[3]);
+        break;
+#endif
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
     case INDEX_op_movi_i32: /* Always emitted via tcg_out_movi.  */
@@ -2271,6 +2348,8 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_muls2_i64, { "a", "d", "a", "r" } },
     { INDEX_op_add2_i64, { "r", "r", "0", "1", "re", "re" } },
     { INDEX_op_sub2_i64, { "r", "r", "0", "1", "re", "re" } },
+
+    { INDEX_op_gvec_v128, { } },
 #endif
 
 #if TCG_TARGET_REG_BITS == 64
@@ -0,0 +1,734 @@
+/*
+ * Tiny Code Generator for QEMU: generic vector operations
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg-op-gvec.h"
+#include "tcg-gvec-desc.h"
+
+/* Vectors of up to this many bytes are expanded inline, when the
+   operation has a 128-bit or a 64-bit expansion.  */
+#define MAX_UNROLL  32
+
+typedef void gen_helper_gvec_2(TCGv_ptr, TCGv_ptr, TCGv_i32);
+typedef void gen_helper_gvec_3(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_i32);
+
+/* Expansion of an operation, either on 64-bit chunks or, for all sizes,
+   through an out-of-line helper.  fni8 may be NULL.  v128 is the
+   gvec_v128 operation used on 16-byte chunks when the backend has it,
+   or TCG_GVEC_NONE.  */
+typedef struct GVecGen2 {
+    void (*fni8)(TCGv_i64, TCGv_i64, int64_t);
+    gen_helper_gvec_2 *fno;
+} GVecGen2;
+
+typedef struct GVecGen3 {
+    void (*fni8)(TCGv_i64, TCGv_i64, TCGv_i64);
+    gen_helper_gvec_3 *fno;
+    TCGGvecOp v128;
+} GVecGen3;
+
+static uint64_t dup_const(unsigned vece, uint64_t c)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x0101010101010101ull * (uint8_t)c;
+    case MO_16:
+        return 0x0001000100010001ull * (uint16_t)c;
+    case MO_32:
+        return 0x0000000100000001ull * (uint32_t)c;
+    case MO_64:
+        return c;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void check_size_align(uint32_t oprsz, uint32_t maxsz, uint32_t ofs)
+{
+    tcg_debug_assert(oprsz == 8 || (oprsz != 0 && oprsz % 16 == 0));
+    tcg_debug_assert(maxsz >= oprsz && maxsz % 8 == 0);
+    tcg_debug_assert(maxsz <= SIMD_MAXSZ);
+    tcg_debug_assert(ofs % (oprsz == 8 ? 8 : 16) == 0);
+}
+
+static TCGv_ptr gvec_ptr(uint32_t ofs)
+{
+    TCGv_ptr p = tcg_temp_new_ptr();
+
+    tcg_gen_addi_ptr(p, tcg_ctx.tcg_env, ofs);
+    return p;
+}
+
+/* Clear the bytes [oprsz, maxsz) of the destination.  */
+static void expand_clr(uint32_t dofs, uint32_t oprsz, uint32_t maxsz)
+{
+    TCGv_i64 zero;
+    uint32_t i;
+
+    if (maxsz == oprsz) {
+        return;
+    }
+    zero = tcg_const_i64(0);
+    for (i = oprsz; i < maxsz; i += 8) {
+        tcg_gen_st_i64(zero, tcg_ctx.tcg_env, dofs + i);
+    }
+    tcg_temp_free_i64(zero);
+}
+
+static void expand_2_i64(uint32_t dofs, uint32_t aofs, uint32_t oprsz,
+                         int64_t c, void (*fni8)(TCGv_i64, TCGv_i64, int64_t))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, tcg_ctx.tcg_env, aofs + i);
+        fni8(t0, t0, c);
+        tcg_gen_st_i64(t0, tcg_ctx.tcg_env, dofs + i);
+    }
+    tcg_temp_free_i64(t0);
+}
+
+static void expand_3_i64(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                         uint32_t oprsz,
+                         void (*fni8)(TCGv_i64, TCGv_i64, TCGv_i64))
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, tcg_ctx.tcg_env, aofs + i);
+        tcg_gen_ld_i64(t1, tcg_ctx.tcg_env, bofs + i);
+        fni8(t0, t0, t1);
+        tcg_gen_st_i64(t0, tcg_ctx.tcg_env, dofs + i);
+    }
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t0);
+}
+
+static void expand_3_v128(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                          uint32_t oprsz, TCGGvecOp op)
+{
+    uint32_t i;
+
+    for (i = 0; i < oprsz; i += 16) {
+        tcg_gen_op4(&tcg_ctx, INDEX_op_gvec_v128, op,
+                    dofs + i, aofs + i, bofs + i);
+    }
+}
+
+static void gen_gvec_2(uint32_t dofs, uint32_t aofs, uint32_t oprsz,
+                       uint32_t maxsz, int64_t c, const GVecGen2 *g)
+{
+    check_size_align(oprsz, maxsz, dofs | aofs);
+
+    if (g->fni8 && oprsz <= MAX_UNROLL) {
+        expand_2_i64(dofs, aofs, oprsz, c, g->fni8);
+        expand_clr(dofs, oprsz, maxsz);
+    } else {
+        TCGv_ptr d = gvec_ptr(dofs);
+        TCGv_ptr a = gvec_ptr(aofs);
+        TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, c));
+
+        g->fno(d, a, desc);
+
+        tcg_temp_free_i32(desc);
+        tcg_temp_free_ptr(a);
+        tcg_temp_free_ptr(d);
+    }
+}
+
+static void gen_gvec_3(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                       uint32_t oprsz, uint32_t maxsz, const GVecGen3 *g)
+{
+    check_size_align(oprsz, maxsz, dofs | aofs | bofs);
+
+    if (TCG_TARGET_HAS_gvec_v128 && g->v128 != TCG_GVEC_NONE
+        && oprsz % 16 == 0 && oprsz <= MAX_UNROLL) {
+        expand_3_v128(dofs, aofs, bofs, oprsz, g->v128);
+        expand_clr(dofs, oprsz, maxsz);
+    } else if (g->fni8 && oprsz <= MAX_UNROLL) {
+        expand_3_i64(dofs, aofs, bofs, oprsz, g->fni8);
+        expand_clr(dofs, oprsz, maxsz);
+    } else {
+        TCGv_ptr d = gvec_ptr(dofs);
+        TCGv_ptr a = gvec_ptr(aofs);
+        TCGv_ptr b = gvec_ptr(bofs);
+        TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, 0));
+
+        g->fno(d, a, b, desc);
+
+        tcg_temp_free_i32(desc);
+        tcg_temp_free_ptr(b);
+        tcg_temp_free_ptr(a);
+        tcg_temp_free_ptr(d);
+    }
+}
+
+/* Moves and logical operations.  */
+
+static void gen_mov_i64(TCGv_i64 d, TCGv_i64 a, int64_t unused)
+{
+    tcg_gen_mov_i64(d, a);
+}
+
+static void gen_not_i64(TCGv_i64 d, TCGv_i64 a, int64_t unused)
+{
+    tcg_gen_not_i64(d, a);
+}
+
+void tcg_gen_gvec_mov(uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g = { gen_mov_i64, gen_helper_gvec_mov };
+
+    gen_gvec_2(dofs, aofs, oprsz, maxsz, 0, &g);
+}
+
+void tcg_gen_gvec_not(uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g = { gen_not_i64, gen_helper_gvec_not };
+
+    gen_gvec_2(dofs, aofs, oprsz, maxsz, 0, &g);
+}
+
+void tcg_gen_gvec_and(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { tcg_gen_and_i64, gen_helper_gvec_and,
+                                TCG_GVEC_AND };
+
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_or(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                     uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { tcg_gen_or_i64, gen_helper_gvec_or,
+                                TCG_GVEC_OR };
+
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_xor(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { tcg_gen_xor_i64, gen_helper_gvec_xor,
+                                TCG_GVEC_XOR };
+
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_andc(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                       uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { tcg_gen_andc_i64, gen_helper_gvec_andc,
+                                TCG_GVEC_ANDC };
+
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+void tcg_gen_gvec_orc(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g = { tcg_gen_orc_i64, gen_helper_gvec_orc };
+
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g);
+}
+
+/* Lane-wise arithmetic.  Lanes narrower than 64 bits are handled within
+   a 64-bit register by keeping carries from crossing the lane boundaries:
+   the top bit of each lane is computed separately with an xor.  */
+
+static void gen_addv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andi_i64(t1, a, ~m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void gen_subv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_ori_i64(t1, a, m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void gen_negv_mask(TCGv_i64 d, TCGv_i64 b, uint64_t m)
+{
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_not_i64(t3, b);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_movi_i64(d, m);
+    tcg_gen_sub_i64(d, d, t2);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+#define GEN_LANE_OPS(BITS, MO)                                          \
+static void gen_add##BITS##_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)     \
+{                                                                       \
+    gen_addv_mask(d, a, b, dup_const(MO, 1ull << (BITS - 1)));          \
+}                                                                       \
+static void gen_sub##BITS##_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)     \
+{                                                                       \
+    gen_subv_mask(d, a, b, dup_const(MO, 1ull << (BITS - 1)));          \
+}                                                                       \
+static void gen_neg##BITS##_i64(TCGv_i64 d, TCGv_i64 a, int64_t unused) \
+{                                                                       \
+    gen_negv_mask(d, a, dup_const(MO, 1ull << (BITS - 1)));             \
+}
+
+GEN_LANE_OPS(8, MO_8)
+GEN_LANE_OPS(16, MO_16)
+GEN_LANE_OPS(32, MO_32)
+
+static void gen_neg64_i64(TCGv_i64 d, TCGv_i64 a, int64_t unused)
+{
+    tcg_gen_neg_i64(d, a);
+}
+
+void tcg_gen_gvec_add(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g[4] = {
+        { gen_add8_i64, gen_helper_gvec_add8, TCG_GVEC_ADD8 },
+        { gen_add16_i64, gen_helper_gvec_add16, TCG_GVEC_ADD16 },
+        { gen_add32_i64, gen_helper_gvec_add32, TCG_GVEC_ADD32 },
+        { tcg_gen_add_i64, gen_helper_gvec_add64, TCG_GVEC_ADD64 },
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g[vece]);
+}
+
+void tcg_gen_gvec_sub(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 g[4] = {
+        { gen_sub8_i64, gen_helper_gvec_sub8, TCG_GVEC_SUB8 },
+        { gen_sub16_i64, gen_helper_gvec_sub16, TCG_GVEC_SUB16 },
+        { gen_sub32_i64, gen_helper_gvec_sub32, TCG_GVEC_SUB32 },
+        { tcg_gen_sub_i64, gen_helper_gvec_sub64, TCG_GVEC_SUB64 },
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g[vece]);
+}
+
+void tcg_gen_gvec_neg(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g[4] = {
+        { gen_neg8_i64, gen_helper_gvec_neg8 },
+        { gen_neg16_i64, gen_helper_gvec_neg16 },
+        { gen_neg32_i64, gen_helper_gvec_neg32 },
+        { gen_neg64_i64, gen_helper_gvec_neg64 },
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    gen_gvec_2(dofs, aofs, oprsz, maxsz, 0, &g[vece]);
+}
+
+/* Shifts by immediate.  The 64-bit expansion shifts the whole register
+   and masks off the bits that crossed into the neighbouring lane.  */
+
+#define GEN_SHIFT_OPS(BITS, MO)                                         \
+static void gen_shl##BITS##i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)     \
+{                                                                       \
+    tcg_gen_shli_i64(d, a, c);                                          \
+    tcg_gen_andi_i64(d, d, dup_const(MO, MAKE_64BIT_MASK(c, BITS - c)));\
+}                                                                       \
+static void gen_shr##BITS##i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)     \
+{                                                                       \
+    tcg_gen_shri_i64(d, a, c);                                          \
+    tcg_gen_andi_i64(d, d, dup_const(MO, MAKE_64BIT_MASK(0, BITS - c)));\
+}                                                                       \
+static void gen_sar##BITS##i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)     \
+{                                                                       \
+    uint64_t s_mask = dup_const(MO, 1ull << (BITS - 1 - c));            \
+    uint64_t c_mask = dup_const(MO, MAKE_64BIT_MASK(0, BITS - c));      \
+    TCGv_i64 s = tcg_temp_new_i64();                                    \
+                                                                        \
+    tcg_gen_shri_i64(d, a, c);                                          \
+    tcg_gen_andi_i64(s, d, s_mask);      /* isolate (shifted) sign */   \
+    tcg_gen_muli_i64(s, s, (2ull << c) - 2);  /* replicate it upward */ \
+    tcg_gen_andi_i64(d, d, c_mask);      /* clear out the high bits */  \
+    tcg_gen_or_i64(d, d, s);                                            \
+    tcg_temp_free_i64(s);                                               \
+}
+
+GEN_SHIFT_OPS(8, MO_8)
+GEN_SHIFT_OPS(16, MO_16)
+GEN_SHIFT_OPS(32, MO_32)
+
+static void gen_shl64i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_shli_i64(d, a, c);
+}
+
+static void gen_shr64i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_shri_i64(d, a, c);
+}
+
+static void gen_sar64i_i64(TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_sari_i64(d, a, c);
+}
+
+void tcg_gen_gvec_shli(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g[4] = {
+        { gen_shl8i_i64, gen_helper_gvec_shl8i },
+        { gen_shl16i_i64, gen_helper_gvec_shl16i },
+        { gen_shl32i_i64, gen_helper_gvec_shl32i },
+        { gen_shl64i_i64, gen_helper_gvec_shl64i },
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    if (shift == 0) {
+        tcg_gen_gvec_mov(dofs, aofs, oprsz, maxsz);
+    } else {
+        gen_gvec_2(dofs, aofs, oprsz, maxsz, shift, &g[vece]);
+    }
+}
+
+void tcg_gen_gvec_shri(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g[4] = {
+        { gen_shr8i_i64, gen_helper_gvec_shr8i },
+        { gen_shr16i_i64, gen_helper_gvec_shr16i },
+        { gen_shr32i_i64, gen_helper_gvec_shr32i },
+        { gen_shr64i_i64, gen_helper_gvec_shr64i },
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    if (shift == 0) {
+        tcg_gen_gvec_mov(dofs, aofs, oprsz, maxsz);
+    } else {
+        gen_gvec_2(dofs, aofs, oprsz, maxsz, shift, &g[vece]);
+    }
+}
+
+void tcg_gen_gvec_sari(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen2 g[4] = {
+        { gen_sar8i_i64, gen_helper_gvec_sar8i },
+        { gen_sar16i_i64, gen_helper_gvec_sar16i },
+        { gen_sar32i_i64, gen_helper_gvec_sar32i },
+        { gen_sar64i_i64, gen_helper_gvec_sar64i },
+    };
+
+    tcg_debug_assert(vece <= MO_64);
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    if (shift == 0) {
+        tcg_gen_gvec_mov(dofs, aofs, oprsz, maxsz);
+    } else {
+        gen_gvec_2(dofs, aofs, oprsz, maxsz, shift, &g[vece]);
+    }
+}
+
+/* Comparisons.  Only 64-bit lanes have an inline 64-bit expansion;
+   equality and signed less-than also have a 128-bit one.  */
+
+#define GEN_CMP64(NAME, COND)                                           \
+static void NAME(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)                    \
+{                                                                       \
+    tcg_gen_setcond_i64(COND, d, a, b);                                 \
+    tcg_gen_neg_i64(d, d);                                              \
+}
+
+GEN_CMP64(gen_eq64_i64, TCG_COND_EQ)
+GEN_CMP64(gen_ne64_i64, TCG_COND_NE)
+GEN_CMP64(gen_lt64_i64, TCG_COND_LT)
+GEN_CMP64(gen_le64_i64, TCG_COND_LE)
+GEN_CMP64(gen_ltu64_i64, TCG_COND_LTU)
+GEN_CMP64(gen_leu64_i64, TCG_COND_LEU)
+
+void tcg_gen_gvec_cmp(TCGCond cond, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz)
+{
+    static const GVecGen3 eq[4] = {
+        { NULL, gen_helper_gvec_eq8, TCG_GVEC_EQ8 },
+        { NULL, gen_helper_gvec_eq16, TCG_GVEC_EQ16 },
+        { NULL, gen_helper_gvec_eq32, TCG_GVEC_EQ32 },
+        { gen_eq64_i64, gen_helper_gvec_eq64 },
+    };
+    static const GVecGen3 ne[4] = {
+        { NULL, gen_helper_gvec_ne8 },
+        { NULL, gen_helper_gvec_ne16 },
+        { NULL, gen_helper_gvec_ne32 },
+        { gen_ne64_i64, gen_helper_gvec_ne64 },
+    };
+    static const GVecGen3 lt[4] = {
+        { NULL, gen_helper_gvec_lt8, TCG_GVEC_LT8 },
+        { NULL, gen_helper_gvec_lt16, TCG_GVEC_LT16 },
+        { NULL, gen_helper_gvec_lt32, TCG_GVEC_LT32 },
+        { gen_lt64_i64, gen_helper_gvec_lt64 },
+    };
+    static const GVecGen3 le[4] = {
+        { NULL, gen_helper_gvec_le8 },
+        { NULL, gen_helper_gvec_le16 },
+        { NULL, gen_helper_gvec_le32 },
+        { gen_le64_i64, gen_helper_gvec_le64 },
+    };
+    static const GVecGen3 ltu[4] = {
+        { NULL, gen_helper_gvec_ltu8 },
+        { NULL, gen_helper_gvec_ltu16 },
+        { NULL, gen_helper_gvec_ltu32 },
+        { gen_ltu64_i64, gen_helper_gvec_ltu64 },
+    };
+    static const GVecGen3 leu[4] = {
+        { NULL, gen_helper_gvec_leu8 },
+        { NULL, gen_helper_gvec_leu16 },
+        { NULL, gen_helper_gvec_leu32 },
+        { gen_leu64_i64, gen_helper_gvec_leu64 },
+    };
+    const GVecGen3 *g;
+
+    tcg_debug_assert(vece <= MO_64);
+
+    /* Reduce the greater-than conditions to less-than.  */
+    switch (cond) {
+    case TCG_COND_NEVER:
+    case TCG_COND_ALWAYS:
+        tcg_gen_gvec_dupi(MO_64, dofs, oprsz, maxsz,
+                          cond == TCG_COND_ALWAYS ? -1 : 0);
+        return;
+    case TCG_COND_GT:
+    case TCG_COND_GE:
+    case TCG_COND_GTU:
+    case TCG_COND_GEU:
+        tcg_gen_gvec_cmp(tcg_swap_cond(cond), vece, dofs, bofs, aofs,
+                         oprsz, maxsz);
+        return;
+    case TCG_COND_EQ:
+        g = eq;
+        break;
+    case TCG_COND_NE:
+        g = ne;
+        break;
+    case TCG_COND_LT:
+        g = lt;
+        break;
+    case TCG_COND_LE:
+        g = le;
+        break;
+    case TCG_COND_LTU:
+        g = ltu;
+        break;
+    case TCG_COND_LEU:
+        g = leu;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    gen_gvec_3(dofs, aofs, bofs, oprsz, maxsz, &g[vece]);
+}
+
+/* Replication of a scalar.  */
+
+static void do_dup_i64(uint32_t dofs, uint32_t oprsz, uint32_t maxsz,
+                       TCGv_i64 val)
+{
+    check_size_align(oprsz, maxsz, dofs);
+
+    if (oprsz <= MAX_UNROLL) {
+        uint32_t i;
+
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_st_i64(val, tcg_ctx.tcg_env, dofs + i);
+        }
+        expand_clr(dofs, oprsz, maxsz);
+    } else {
+        TCGv_ptr d = gvec_ptr(dofs);
+        TCGv_i32 desc = tcg_const_i32(simd_desc(oprsz, maxsz, 0));
+
+        gen_helper_gvec_dup64(d, desc, val);
+
+        tcg_temp_free_i32(desc);
+        tcg_temp_free_ptr(d);
+    }
+}
+
+void tcg_gen_gvec_dup_i64(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          uint32_t maxsz, TCGv_i64 in)
+{
+    TCGv_i64 t = tcg_temp_new_i64();
+
+    switch (vece) {
+    case MO_8:
+        tcg_gen_ext8u_i64(t, in);
+        tcg_gen_muli_i64(t, t, dup_const(MO_8, 1));
+        break;
+    case MO_16:
+        tcg_gen_ext16u_i64(t, in);
+        tcg_gen_muli_i64(t, t, dup_const(MO_16, 1));
+        break;
+    case MO_32:
+        tcg_gen_deposit_i64(t, in, in, 32, 32);
+        break;
+    case MO_64:
+        tcg_gen_mov_i64(t, in);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    do_dup_i64(dofs, oprsz, maxsz, t);
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_gvec_dup_i32(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          uint32_t maxsz, TCGv_i32 in)
+{
+    TCGv_i64 t = tcg_temp_new_i64();
+
+    tcg_debug_assert(vece <= MO_32);
+    tcg_gen_extu_i32_i64(t, in);
+    tcg_gen_gvec_dup_i64(vece, dofs, oprsz, maxsz, t);
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_gvec_dupi(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                       uint32_t maxsz, uint64_t imm)
+{
+    TCGv_i64 t = tcg_const_i64(dup_const(vece, imm));
+
+    do_dup_i64(dofs, oprsz, maxsz, t);
+    tcg_temp_free_i64(t);
+}
+
+/* Guest memory accesses.  When guest and host have the same endianness,
+   the byte order of any lane size is preserved by 64-bit accesses.  */
+
+#if defined(HOST_WORDS_BIGENDIAN) == defined(TARGET_WORDS_BIGENDIAN)
+#define GVEC_LDST_UNIT(vece)  MO_64
+#else
+#define GVEC_LDST_UNIT(vece)  (vece)
+#endif
+
+void tcg_gen_gvec_ld(unsigned vece, uint32_t dofs, TCGv addr, TCGArg idx,
+                     uint32_t oprsz, uint32_t maxsz)
+{
+    unsigned unit = GVEC_LDST_UNIT(vece);
+    TCGv_i64 t = tcg_temp_new_i64();
+    TCGv a = tcg_temp_new();
+    uint32_t i;
+
+    check_size_align(oprsz, maxsz, dofs);
+
+    for (i = 0; i < oprsz; i += 1 << unit) {
+        tcg_gen_addi_tl(a, addr, i);
+        tcg_gen_qemu_ld_i64(t, a, idx, unit | MO_TE);
+        switch (unit) {
+        case MO_8:
+            tcg_gen_st8_i64(t, tcg_ctx.tcg_env, dofs + i);
+            break;
+        case MO_16:
+            tcg_gen_st16_i64(t, tcg_ctx.tcg_env, dofs + i);
+            break;
+        case MO_32:
+            tcg_gen_st32_i64(t, tcg_ctx.tcg_env, dofs + i);
+            break;
+        default:
+            tcg_gen_st_i64(t, tcg_ctx.tcg_env, dofs + i);
+            break;
+        }
+    }
+    expand_clr(dofs, oprsz, maxsz);
+
+    tcg_temp_free(a);
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_gvec_st(unsigned vece, uint32_t aofs, TCGv addr, TCGArg idx,
+                     uint32_t oprsz)
+{
+    unsigned unit = GVEC_LDST_UNIT(vece);
+    TCGv_i64 t = tcg_temp_new_i64();
+    TCGv a = tcg_temp_new();
+    uint32_t i;
+
+    check_size_align(oprsz, oprsz, aofs);
+
+    for (i = 0; i < oprsz; i += 1 << unit) {
+        switch (unit) {
+        case MO_8:
+            tcg_gen_ld8u_i64(t, tcg_ctx.tcg_env, aofs + i);
+            break;
+        case MO_16:
+            tcg_gen_ld16u_i64(t, tcg_ctx.tcg_env, aofs + i);
+            break;
+        case MO_32:
+            tcg_gen_ld32u_i64(t, tcg_ctx.tcg_env, aofs + i);
+            break;
+        default:
+            tcg_gen_ld_i64(t, tcg_ctx.tcg_env, aofs + i);
+            break;
+        }
+        tcg_gen_addi_tl(a, addr, i);
+        tcg_gen_qemu_st_i64(t, a, idx, unit | MO_TE);
+    }
+
+    tcg_temp_free(a);
+    tcg_temp_free_i64(t);
+}
@@ -0,0 +1,94 @@
+/*
+ * Tiny Code Generator for QEMU: generic vector operations
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TCG_OP_GVEC_H
+#define TCG_OP_GVEC_H
+
+/*
+ * "Generic" vectors.  All operands are given as offsets from tcg_ctx.tcg_env
+ * (which the frontend must have set) and must be 8-byte aligned.  The
+ * operands must not be backed by TCG globals.
+ *
+ * @vece is the log2 of the lane size, as a TCGMemOp size (MO_8 ... MO_64).
+ * @oprsz is the number of bytes operated on, either 8 or a multiple of 16.
+ * @maxsz is the size of the destination register, at least @oprsz and at
+ * most SIMD_MAXSZ; bytes of the destination in [@oprsz, @maxsz) are
+ * cleared, as AArch64 and AVX do for operations on short vectors.
+ *
+ * Short vectors are expanded inline, with host vector instructions if the
+ * backend provides gvec_v128 for the operation and 64-bit integer operations
+ * otherwise; longer ones call out-of-line helpers written with host vector
+ * types.
+ */
+
+void tcg_gen_gvec_mov(uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_not(uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_neg(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+void tcg_gen_gvec_add(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_sub(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz, uint32_t maxsz);
+
+void tcg_gen_gvec_and(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_or(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                     uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_xor(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_andc(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                       uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_orc(uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+/* Shift each lane by an immediate, 0 <= shift < lane width.  */
+void tcg_gen_gvec_shli(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_shri(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_sari(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       int64_t shift, uint32_t oprsz, uint32_t maxsz);
+
+/* Set each lane to all ones if the condition holds, to zero otherwise.  */
+void tcg_gen_gvec_cmp(TCGCond cond, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz, uint32_t maxsz);
+
+/* Replicate a scalar (the low lane bits of @in, or @imm) in every lane.  */
+void tcg_gen_gvec_dup_i32(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          uint32_t maxsz, TCGv_i32 in);
+void tcg_gen_gvec_dup_i64(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          uint32_t maxsz, TCGv_i64 in);
+void tcg_gen_gvec_dupi(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                       uint32_t maxsz, uint64_t imm);
+
+/* Load or store @oprsz bytes of guest memory, as lanes of 1 << @vece
+   bytes in guest byte order.  Loads clear the destination up to @maxsz.  */
+void tcg_gen_gvec_ld(unsigned vece, uint32_t dofs, TCGv addr, TCGArg idx,
+                     uint32_t oprsz, uint32_t maxsz);
+void tcg_gen_gvec_st(unsigned vece, uint32_t aofs, TCGv addr, TCGArg idx,
+                     uint32_t oprsz);
+
+#endif
@@ -43,6 +43,8 @@ DEF(br, 0, 0, 1, TCG_OPF_BB_END)
 #endif
 
 DEF(mb, 0, 0, 1, 0)
+DEF(gvec_v128, 0, 0, 4,
+    TCG_OPF_SIDE_EFFECTS | IMPL(TCG_TARGET_HAS_gvec_v128))
 
 DEF(mov_i32, 1, 1, 0, TCG_OPF_NOT_PRESENT)
 DEF(movi_i32, 1, 0, 1, TCG_OPF_NOT_PRESENT)
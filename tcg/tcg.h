@@ -130,6 +130,9 @@ typedef uint64_t TCGRegSet;
 #ifndef TCG_TARGET_deposit_i64_valid
 #define TCG_TARGET_deposit_i64_valid(ofs, len) 1
 #endif
+#ifndef TCG_TARGET_HAS_gvec_v128
+#define TCG_TARGET_HAS_gvec_v128        0
+#endif
 
 /* Only one of DIV or DIV2 should be defined.  */
 #if defined(TCG_TARGET_HAS_div_i32)
@@ -482,6 +485,31 @@ typedef enum {
     TCG_BAR_SC    = 0x30,  /* No ops cross barrier; OR of the above */
 } TCGBar;
 
+/* Operations of the gvec_v128 opcode.  TCG_GVEC_ANDC is a & ~b and the
+   TCG_GVEC_LT* comparisons are signed; the comparisons set each lane to
+   all ones when true and to zero otherwise.  */
+typedef enum {
+    TCG_GVEC_NONE,
+    TCG_GVEC_ADD8,
+    TCG_GVEC_ADD16,
+    TCG_GVEC_ADD32,
+    TCG_GVEC_ADD64,
+    TCG_GVEC_SUB8,
+    TCG_GVEC_SUB16,
+    TCG_GVEC_SUB32,
+    TCG_GVEC_SUB64,
+    TCG_GVEC_AND,
+    TCG_GVEC_OR,
+    TCG_GVEC_XOR,
+    TCG_GVEC_ANDC,
+    TCG_GVEC_EQ8,
+    TCG_GVEC_EQ16,
+    TCG_GVEC_EQ32,
+    TCG_GVEC_LT8,
+    TCG_GVEC_LT16,
+    TCG_GVEC_LT32,
+} TCGGvecOp;
+
 /* Conditions.  Note that these are laid out for easy manipulation by
    the functions below:
      bit 0 is used for inverting;
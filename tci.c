@@ -462,6 +462,58 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
 # define qemu_st_beq(X)  stq_be_p(g2h(taddr), X)
 #endif
 
+/* Fetch the next opcode.  The opcode and size bytes are skipped. */
+#if defined(CONFIG_DEBUG_TCG) && !defined(NDEBUG)
+# define TCI_FETCH_DEBUG() \
+    do { \
+        op_size = tb_ptr[1]; \
+        old_code_ptr = tb_ptr; \
+    } while (0)
+#else
+# define TCI_FETCH_DEBUG() do { } while (0)
+#endif
+
+#if defined(GETPC)
+# define TCI_FETCH_PC() (tci_tb_ptr = (uintptr_t)tb_ptr)
+#else
+# define TCI_FETCH_PC() do { } while (0)
+#endif
+
+#define TCI_FETCH() \
+    do { \
+        opc = tb_ptr[0]; \
+        TCI_FETCH_DEBUG(); \
+        TCI_FETCH_PC(); \
+        tb_ptr += 2; \
+    } while (0)
+
+/* With GCC's labels as values, each handler ends by jumping directly to
+   the handler of the following opcode instead of returning to the top of
+   a central switch.  This gives the host branch predictor one indirect
+   branch per handler to learn from rather than a single shared one.
+   NEXT() finishes a handler that fell through to the following opcode,
+   JUMP() one that has already set tb_ptr to a branch target. */
+#if defined(__GNUC__)
+# define TCI_THREADED_DISPATCH
+# define CASE(op)       case op: L_##op
+# define CASE_DEFAULT   default: L_default
+# define JUMP() \
+    do { \
+        TCI_FETCH(); \
+        goto *dispatch[opc]; \
+    } while (0)
+# define NEXT() \
+    do { \
+        tci_assert(tb_ptr == old_code_ptr + op_size); \
+        JUMP(); \
+    } while (0)
+#else
+# define CASE(op)       case op
+# define CASE_DEFAULT   default
+# define NEXT()         break
+# define JUMP()         continue
+#endif
+
 /* Interpret pseudo code in tb. */
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
 {
@@ -469,40 +521,201 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
     uintptr_t sp_value = (uintptr_t)(tcg_temps + CPU_TEMP_BUF_NLONGS);
     uintptr_t ret = 0;
 
-    tci_reg[TCG_AREG0] = (tcg_target_ulong)env;
-    tci_reg[TCG_REG_CALL_STACK] = sp_value;
-    tci_assert(tb_ptr);
-
-    for (;;) {
-        TCGOpcode opc = tb_ptr[0];
+    TCGOpcode opc;
 #if defined(CONFIG_DEBUG_TCG) && !defined(NDEBUG)
-        uint8_t op_size = tb_ptr[1];
-        uint8_t *old_code_ptr = tb_ptr;
-#endif
-        tcg_target_ulong t0;
-        tcg_target_ulong t1;
-        tcg_target_ulong t2;
-        tcg_target_ulong label;
-        TCGCond condition;
-        target_ulong taddr;
-        uint8_t tmp8;
-        uint16_t tmp16;
-        uint32_t tmp32;
-        uint64_t tmp64;
+    uint8_t op_size;
+    uint8_t *old_code_ptr;
+#endif
+    tcg_target_ulong t0;
+    tcg_target_ulong t1;
+    tcg_target_ulong t2;
+    tcg_target_ulong label;
+    TCGCond condition;
+    target_ulong taddr;
+    uint8_t tmp8;
+    uint16_t tmp16;
+    uint32_t tmp32;
+    uint64_t tmp64;
 #if TCG_TARGET_REG_BITS == 32
-        uint64_t v64;
+    uint64_t v64;
 #endif
-        TCGMemOpIdx oi;
+    TCGMemOpIdx oi;
 
-#if defined(GETPC)
-        tci_tb_ptr = (uintptr_t)tb_ptr;
+#if defined(TCI_THREADED_DISPATCH)
+    /* Handler address for every opcode, indexed by the opcode byte.
+       Opcodes which the interpreter does not implement share the
+       default handler. */
+    static void * const dispatch[NB_OPS] = {
+        [0 ... NB_OPS - 1] = &&L_default,
+        [INDEX_op_call] = &&L_INDEX_op_call,
+        [INDEX_op_br] = &&L_INDEX_op_br,
+        [INDEX_op_setcond_i32] = &&L_INDEX_op_setcond_i32,
+#if TCG_TARGET_REG_BITS == 32
+        [INDEX_op_setcond2_i32] = &&L_INDEX_op_setcond2_i32,
+#elif TCG_TARGET_REG_BITS == 64
+        [INDEX_op_setcond_i64] = &&L_INDEX_op_setcond_i64,
+#endif
+        [INDEX_op_mov_i32] = &&L_INDEX_op_mov_i32,
+        [INDEX_op_movi_i32] = &&L_INDEX_op_movi_i32,
+        [INDEX_op_ld8u_i32] = &&L_INDEX_op_ld8u_i32,
+        [INDEX_op_ld8s_i32] = &&L_INDEX_op_ld8s_i32,
+        [INDEX_op_ld16u_i32] = &&L_INDEX_op_ld16u_i32,
+        [INDEX_op_ld16s_i32] = &&L_INDEX_op_ld16s_i32,
+        [INDEX_op_ld_i32] = &&L_INDEX_op_ld_i32,
+        [INDEX_op_st8_i32] = &&L_INDEX_op_st8_i32,
+        [INDEX_op_st16_i32] = &&L_INDEX_op_st16_i32,
+        [INDEX_op_st_i32] = &&L_INDEX_op_st_i32,
+        [INDEX_op_add_i32] = &&L_INDEX_op_add_i32,
+        [INDEX_op_sub_i32] = &&L_INDEX_op_sub_i32,
+        [INDEX_op_mul_i32] = &&L_INDEX_op_mul_i32,
+#if TCG_TARGET_HAS_div_i32
+        [INDEX_op_div_i32] = &&L_INDEX_op_div_i32,
+        [INDEX_op_divu_i32] = &&L_INDEX_op_divu_i32,
+        [INDEX_op_rem_i32] = &&L_INDEX_op_rem_i32,
+        [INDEX_op_remu_i32] = &&L_INDEX_op_remu_i32,
+#elif TCG_TARGET_HAS_div2_i32
+        [INDEX_op_div2_i32] = &&L_INDEX_op_div2_i32,
+        [INDEX_op_divu2_i32] = &&L_INDEX_op_divu2_i32,
+#endif
+        [INDEX_op_and_i32] = &&L_INDEX_op_and_i32,
+        [INDEX_op_or_i32] = &&L_INDEX_op_or_i32,
+        [INDEX_op_xor_i32] = &&L_INDEX_op_xor_i32,
+        [INDEX_op_shl_i32] = &&L_INDEX_op_shl_i32,
+        [INDEX_op_shr_i32] = &&L_INDEX_op_shr_i32,
+        [INDEX_op_sar_i32] = &&L_INDEX_op_sar_i32,
+#if TCG_TARGET_HAS_rot_i32
+        [INDEX_op_rotl_i32] = &&L_INDEX_op_rotl_i32,
+        [INDEX_op_rotr_i32] = &&L_INDEX_op_rotr_i32,
+#endif
+#if TCG_TARGET_HAS_deposit_i32
+        [INDEX_op_deposit_i32] = &&L_INDEX_op_deposit_i32,
+#endif
+        [INDEX_op_brcond_i32] = &&L_INDEX_op_brcond_i32,
+#if TCG_TARGET_REG_BITS == 32
+        [INDEX_op_add2_i32] = &&L_INDEX_op_add2_i32,
+        [INDEX_op_sub2_i32] = &&L_INDEX_op_sub2_i32,
+        [INDEX_op_brcond2_i32] = &&L_INDEX_op_brcond2_i32,
+        [INDEX_op_mulu2_i32] = &&L_INDEX_op_mulu2_i32,
+#endif /* TCG_TARGET_REG_BITS == 32 */
+#if TCG_TARGET_HAS_ext8s_i32
+        [INDEX_op_ext8s_i32] = &&L_INDEX_op_ext8s_i32,
+#endif
+#if TCG_TARGET_HAS_ext16s_i32
+        [INDEX_op_ext16s_i32] = &&L_INDEX_op_ext16s_i32,
+#endif
+#if TCG_TARGET_HAS_ext8u_i32
+        [INDEX_op_ext8u_i32] = &&L_INDEX_op_ext8u_i32,
+#endif
+#if TCG_TARGET_HAS_ext16u_i32
+        [INDEX_op_ext16u_i32] = &&L_INDEX_op_ext16u_i32,
+#endif
+#if TCG_TARGET_HAS_bswap16_i32
+        [INDEX_op_bswap16_i32] = &&L_INDEX_op_bswap16_i32,
+#endif
+#if TCG_TARGET_HAS_bswap32_i32
+        [INDEX_op_bswap32_i32] = &&L_INDEX_op_bswap32_i32,
+#endif
+#if TCG_TARGET_HAS_not_i32
+        [INDEX_op_not_i32] = &&L_INDEX_op_not_i32,
+#endif
+#if TCG_TARGET_HAS_neg_i32
+        [INDEX_op_neg_i32] = &&L_INDEX_op_neg_i32,
+#endif
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_mov_i64] = &&L_INDEX_op_mov_i64,
+        [INDEX_op_movi_i64] = &&L_INDEX_op_movi_i64,
+        [INDEX_op_ld8u_i64] = &&L_INDEX_op_ld8u_i64,
+        [INDEX_op_ld8s_i64] = &&L_INDEX_op_ld8s_i64,
+        [INDEX_op_ld16u_i64] = &&L_INDEX_op_ld16u_i64,
+        [INDEX_op_ld16s_i64] = &&L_INDEX_op_ld16s_i64,
+        [INDEX_op_ld32u_i64] = &&L_INDEX_op_ld32u_i64,
+        [INDEX_op_ld32s_i64] = &&L_INDEX_op_ld32s_i64,
+        [INDEX_op_ld_i64] = &&L_INDEX_op_ld_i64,
+        [INDEX_op_st8_i64] = &&L_INDEX_op_st8_i64,
+        [INDEX_op_st16_i64] = &&L_INDEX_op_st16_i64,
+        [INDEX_op_st32_i64] = &&L_INDEX_op_st32_i64,
+        [INDEX_op_st_i64] = &&L_INDEX_op_st_i64,
+        [INDEX_op_add_i64] = &&L_INDEX_op_add_i64,
+        [INDEX_op_sub_i64] = &&L_INDEX_op_sub_i64,
+        [INDEX_op_mul_i64] = &&L_INDEX_op_mul_i64,
+#if TCG_TARGET_HAS_div_i64
+        [INDEX_op_div_i64] = &&L_INDEX_op_div_i64,
+        [INDEX_op_divu_i64] = &&L_INDEX_op_divu_i64,
+        [INDEX_op_rem_i64] = &&L_INDEX_op_rem_i64,
+        [INDEX_op_remu_i64] = &&L_INDEX_op_remu_i64,
+#elif TCG_TARGET_HAS_div2_i64
+        [INDEX_op_div2_i64] = &&L_INDEX_op_div2_i64,
+        [INDEX_op_divu2_i64] = &&L_INDEX_op_divu2_i64,
+#endif
+        [INDEX_op_and_i64] = &&L_INDEX_op_and_i64,
+        [INDEX_op_or_i64] = &&L_INDEX_op_or_i64,
+        [INDEX_op_xor_i64] = &&L_INDEX_op_xor_i64,
+        [INDEX_op_shl_i64] = &&L_INDEX_op_shl_i64,
+        [INDEX_op_shr_i64] = &&L_INDEX_op_shr_i64,
+        [INDEX_op_sar_i64] = &&L_INDEX_op_sar_i64,
+#if TCG_TARGET_HAS_rot_i64
+        [INDEX_op_rotl_i64] = &&L_INDEX_op_rotl_i64,
+        [INDEX_op_rotr_i64] = &&L_INDEX_op_rotr_i64,
+#endif
+#if TCG_TARGET_HAS_deposit_i64
+        [INDEX_op_deposit_i64] = &&L_INDEX_op_deposit_i64,
+#endif
+        [INDEX_op_brcond_i64] = &&L_INDEX_op_brcond_i64,
+#if TCG_TARGET_HAS_ext8u_i64
+        [INDEX_op_ext8u_i64] = &&L_INDEX_op_ext8u_i64,
+#endif
+#if TCG_TARGET_HAS_ext8s_i64
+        [INDEX_op_ext8s_i64] = &&L_INDEX_op_ext8s_i64,
+#endif
+#if TCG_TARGET_HAS_ext16s_i64
+        [INDEX_op_ext16s_i64] = &&L_INDEX_op_ext16s_i64,
+#endif
+#if TCG_TARGET_HAS_ext16u_i64
+        [INDEX_op_ext16u_i64] = &&L_INDEX_op_ext16u_i64,
+#endif
+#if TCG_TARGET_HAS_ext32s_i64
+        [INDEX_op_ext32s_i64] = &&L_INDEX_op_ext32s_i64,
+#endif
+        [INDEX_op_ext_i32_i64] = &&L_INDEX_op_ext_i32_i64,
+#if TCG_TARGET_HAS_ext32u_i64
+        [INDEX_op_ext32u_i64] = &&L_INDEX_op_ext32u_i64,
+#endif
+        [INDEX_op_extu_i32_i64] = &&L_INDEX_op_extu_i32_i64,
+#if TCG_TARGET_HAS_bswap16_i64
+        [INDEX_op_bswap16_i64] = &&L_INDEX_op_bswap16_i64,
+#endif
+#if TCG_TARGET_HAS_bswap32_i64
+        [INDEX_op_bswap32_i64] = &&L_INDEX_op_bswap32_i64,
+#endif
+#if TCG_TARGET_HAS_bswap64_i64
+        [INDEX_op_bswap64_i64] = &&L_INDEX_op_bswap64_i64,
+#endif
+#if TCG_TARGET_HAS_not_i64
+        [INDEX_op_not_i64] = &&L_INDEX_op_not_i64,
+#endif
+#if TCG_TARGET_HAS_neg_i64
+        [INDEX_op_neg_i64] = &&L_INDEX_op_neg_i64,
+#endif
+#endif /* TCG_TARGET_REG_BITS == 64 */
+        [INDEX_op_exit_tb] = &&L_INDEX_op_exit_tb,
+        [INDEX_op_goto_tb] = &&L_INDEX_op_goto_tb,
+        [INDEX_op_qemu_ld_i32] = &&L_INDEX_op_qemu_ld_i32,
+        [INDEX_op_qemu_ld_i64] = &&L_INDEX_op_qemu_ld_i64,
+        [INDEX_op_qemu_st_i32] = &&L_INDEX_op_qemu_st_i32,
+        [INDEX_op_qemu_st_i64] = &&L_INDEX_op_qemu_st_i64,
+        [INDEX_op_mb] = &&L_INDEX_op_mb,
+    };
 #endif
 
-        /* Skip opcode and size entry. */
-        tb_ptr += 2;
+    tci_reg[TCG_AREG0] = (tcg_target_ulong)env;
+    tci_reg[TCG_REG_CALL_STACK] = sp_value;
+    tci_assert(tb_ptr);
+
+    for (;;) {
+        TCI_FETCH();
 
         switch (opc) {
-        case INDEX_op_call:
+        CASE(INDEX_op_call):
             t0 = tci_read_ri(&tb_ptr);
 #if TCG_TARGET_REG_BITS == 32
             tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
@@ -525,194 +738,194 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
                                           tci_read_reg(TCG_REG_R5));
             tci_write_reg(TCG_REG_R0, tmp64);
 #endif
-            break;
-        case INDEX_op_br:
+            NEXT();
+        CASE(INDEX_op_br):
             label = tci_read_label(&tb_ptr);
             tci_assert(tb_ptr == old_code_ptr + op_size);
             tb_ptr = (uint8_t *)label;
-            continue;
-        case INDEX_op_setcond_i32:
+            JUMP();
+        CASE(INDEX_op_setcond_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg32(t0, tci_compare32(t1, t2, condition));
-            break;
+            NEXT();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_setcond2_i32:
+        CASE(INDEX_op_setcond2_i32):
             t0 = *tb_ptr++;
             tmp64 = tci_read_r64(&tb_ptr);
             v64 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg32(t0, tci_compare64(tmp64, v64, condition));
-            break;
+            NEXT();
 #elif TCG_TARGET_REG_BITS == 64
-        case INDEX_op_setcond_i64:
+        CASE(INDEX_op_setcond_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg64(t0, tci_compare64(t1, t2, condition));
-            break;
+            NEXT();
 #endif
-        case INDEX_op_mov_i32:
+        CASE(INDEX_op_mov_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
-        case INDEX_op_movi_i32:
+            NEXT();
+        CASE(INDEX_op_movi_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_i32(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            NEXT();
 
             /* Load/store operations (32 bit). */
 
-        case INDEX_op_ld8u_i32:
+        CASE(INDEX_op_ld8u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i32:
-        case INDEX_op_ld16u_i32:
+            NEXT();
+        CASE(INDEX_op_ld8s_i32):
+        CASE(INDEX_op_ld16u_i32):
             TODO();
-            break;
-        case INDEX_op_ld16s_i32:
+            NEXT();
+        CASE(INDEX_op_ld16s_i32):
             TODO();
-            break;
-        case INDEX_op_ld_i32:
+            NEXT();
+        CASE(INDEX_op_ld_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i32:
+            NEXT();
+        CASE(INDEX_op_st8_i32):
             t0 = tci_read_r8(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i32:
+            NEXT();
+        CASE(INDEX_op_st16_i32):
             t0 = tci_read_r16(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i32:
+            NEXT();
+        CASE(INDEX_op_st_i32):
             t0 = tci_read_r32(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_assert(t1 != sp_value || (int32_t)t2 < 0);
             *(uint32_t *)(t1 + t2) = t0;
-            break;
+            NEXT();
 
             /* Arithmetic operations (32 bit). */
 
-        case INDEX_op_add_i32:
+        CASE(INDEX_op_add_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i32:
+            NEXT();
+        CASE(INDEX_op_sub_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i32:
+            NEXT();
+        CASE(INDEX_op_mul_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 * t2);
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_div_i32
-        case INDEX_op_div_i32:
+        CASE(INDEX_op_div_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, (int32_t)t1 / (int32_t)t2);
-            break;
-        case INDEX_op_divu_i32:
+            NEXT();
+        CASE(INDEX_op_divu_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 / t2);
-            break;
-        case INDEX_op_rem_i32:
+            NEXT();
+        CASE(INDEX_op_rem_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, (int32_t)t1 % (int32_t)t2);
-            break;
-        case INDEX_op_remu_i32:
+            NEXT();
+        CASE(INDEX_op_remu_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 % t2);
-            break;
+            NEXT();
 #elif TCG_TARGET_HAS_div2_i32
-        case INDEX_op_div2_i32:
-        case INDEX_op_divu2_i32:
+        CASE(INDEX_op_div2_i32):
+        CASE(INDEX_op_divu2_i32):
             TODO();
-            break;
+            NEXT();
 #endif
-        case INDEX_op_and_i32:
+        CASE(INDEX_op_and_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i32:
+            NEXT();
+        CASE(INDEX_op_or_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i32:
+            NEXT();
+        CASE(INDEX_op_xor_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 ^ t2);
-            break;
+            NEXT();
 
             /* Shift/rotate operations (32 bit). */
 
-        case INDEX_op_shl_i32:
+        CASE(INDEX_op_shl_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 << (t2 & 31));
-            break;
-        case INDEX_op_shr_i32:
+            NEXT();
+        CASE(INDEX_op_shr_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 >> (t2 & 31));
-            break;
-        case INDEX_op_sar_i32:
+            NEXT();
+        CASE(INDEX_op_sar_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, ((int32_t)t1 >> (t2 & 31)));
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_rot_i32
-        case INDEX_op_rotl_i32:
+        CASE(INDEX_op_rotl_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, rol32(t1, t2 & 31));
-            break;
-        case INDEX_op_rotr_i32:
+            NEXT();
+        CASE(INDEX_op_rotr_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, ror32(t1, t2 & 31));
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_deposit_i32
-        case INDEX_op_deposit_i32:
+        CASE(INDEX_op_deposit_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             t2 = tci_read_r32(&tb_ptr);
@@ -720,9 +933,9 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             tmp8 = *tb_ptr++;
             tmp32 = (((1 << tmp8) - 1) << tmp16);
             tci_write_reg32(t0, (t1 & ~tmp32) | ((t2 << tmp16) & tmp32));
-            break;
+            NEXT();
 #endif
-        case INDEX_op_brcond_i32:
+        CASE(INDEX_op_brcond_i32):
             t0 = tci_read_r32(&tb_ptr);
             t1 = tci_read_ri32(&tb_ptr);
             condition = *tb_ptr++;
@@ -730,25 +943,25 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (tci_compare32(t0, t1, condition)) {
                 tci_assert(tb_ptr == old_code_ptr + op_size);
                 tb_ptr = (uint8_t *)label;
-                continue;
+                JUMP();
             }
-            break;
+            NEXT();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_add2_i32:
+        CASE(INDEX_op_add2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             tmp64 = tci_read_r64(&tb_ptr);
             tmp64 += tci_read_r64(&tb_ptr);
             tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_sub2_i32:
+            NEXT();
+        CASE(INDEX_op_sub2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             tmp64 = tci_read_r64(&tb_ptr);
             tmp64 -= tci_read_r64(&tb_ptr);
             tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_brcond2_i32:
+            NEXT();
+        CASE(INDEX_op_brcond2_i32):
             tmp64 = tci_read_r64(&tb_ptr);
             v64 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
@@ -756,230 +969,230 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (tci_compare64(tmp64, v64, condition)) {
                 tci_assert(tb_ptr == old_code_ptr + op_size);
                 tb_ptr = (uint8_t *)label;
-                continue;
+                JUMP();
             }
-            break;
-        case INDEX_op_mulu2_i32:
+            NEXT();
+        CASE(INDEX_op_mulu2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             t2 = tci_read_r32(&tb_ptr);
             tmp64 = tci_read_r32(&tb_ptr);
             tci_write_reg64(t1, t0, t2 * tmp64);
-            break;
+            NEXT();
 #endif /* TCG_TARGET_REG_BITS == 32 */
 #if TCG_TARGET_HAS_ext8s_i32
-        case INDEX_op_ext8s_i32:
+        CASE(INDEX_op_ext8s_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r8s(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16s_i32
-        case INDEX_op_ext16s_i32:
+        CASE(INDEX_op_ext16s_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16s(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_ext8u_i32
-        case INDEX_op_ext8u_i32:
+        CASE(INDEX_op_ext8u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r8(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16u_i32
-        case INDEX_op_ext16u_i32:
+        CASE(INDEX_op_ext16u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap16_i32
-        case INDEX_op_bswap16_i32:
+        CASE(INDEX_op_bswap16_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg32(t0, bswap16(t1));
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap32_i32
-        case INDEX_op_bswap32_i32:
+        CASE(INDEX_op_bswap32_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, bswap32(t1));
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_not_i32
-        case INDEX_op_not_i32:
+        CASE(INDEX_op_not_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, ~t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_neg_i32
-        case INDEX_op_neg_i32:
+        CASE(INDEX_op_neg_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, -t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_mov_i64:
+        CASE(INDEX_op_mov_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
-        case INDEX_op_movi_i64:
+            NEXT();
+        CASE(INDEX_op_movi_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_i64(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            NEXT();
 
             /* Load/store operations (64 bit). */
 
-        case INDEX_op_ld8u_i64:
+        CASE(INDEX_op_ld8u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i64:
-        case INDEX_op_ld16u_i64:
-        case INDEX_op_ld16s_i64:
+            NEXT();
+        CASE(INDEX_op_ld8s_i64):
+        CASE(INDEX_op_ld16u_i64):
+        CASE(INDEX_op_ld16s_i64):
             TODO();
-            break;
-        case INDEX_op_ld32u_i64:
+            NEXT();
+        CASE(INDEX_op_ld32u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld32s_i64:
+            NEXT();
+        CASE(INDEX_op_ld32s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32s(t0, *(int32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld_i64:
+            NEXT();
+        CASE(INDEX_op_ld_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg64(t0, *(uint64_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i64:
+            NEXT();
+        CASE(INDEX_op_st8_i64):
             t0 = tci_read_r8(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i64:
+            NEXT();
+        CASE(INDEX_op_st16_i64):
             t0 = tci_read_r16(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st32_i64:
+            NEXT();
+        CASE(INDEX_op_st32_i64):
             t0 = tci_read_r32(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint32_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i64:
+            NEXT();
+        CASE(INDEX_op_st_i64):
             t0 = tci_read_r64(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_assert(t1 != sp_value || (int32_t)t2 < 0);
             *(uint64_t *)(t1 + t2) = t0;
-            break;
+            NEXT();
 
             /* Arithmetic operations (64 bit). */
 
-        case INDEX_op_add_i64:
+        CASE(INDEX_op_add_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i64:
+            NEXT();
+        CASE(INDEX_op_sub_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i64:
+            NEXT();
+        CASE(INDEX_op_mul_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 * t2);
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_div_i64
-        case INDEX_op_div_i64:
-        case INDEX_op_divu_i64:
-        case INDEX_op_rem_i64:
-        case INDEX_op_remu_i64:
+        CASE(INDEX_op_div_i64):
+        CASE(INDEX_op_divu_i64):
+        CASE(INDEX_op_rem_i64):
+        CASE(INDEX_op_remu_i64):
             TODO();
-            break;
+            NEXT();
 #elif TCG_TARGET_HAS_div2_i64
-        case INDEX_op_div2_i64:
-        case INDEX_op_divu2_i64:
+        CASE(INDEX_op_div2_i64):
+        CASE(INDEX_op_divu2_i64):
             TODO();
-            break;
+            NEXT();
 #endif
-        case INDEX_op_and_i64:
+        CASE(INDEX_op_and_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i64:
+            NEXT();
+        CASE(INDEX_op_or_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i64:
+            NEXT();
+        CASE(INDEX_op_xor_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 ^ t2);
-            break;
+            NEXT();
 
             /* Shift/rotate operations (64 bit). */
 
-        case INDEX_op_shl_i64:
+        CASE(INDEX_op_shl_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 << (t2 & 63));
-            break;
-        case INDEX_op_shr_i64:
+            NEXT();
+        CASE(INDEX_op_shr_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 >> (t2 & 63));
-            break;
-        case INDEX_op_sar_i64:
+            NEXT();
+        CASE(INDEX_op_sar_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, ((int64_t)t1 >> (t2 & 63)));
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_rot_i64
-        case INDEX_op_rotl_i64:
+        CASE(INDEX_op_rotl_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, rol64(t1, t2 & 63));
-            break;
-        case INDEX_op_rotr_i64:
+            NEXT();
+        CASE(INDEX_op_rotr_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, ror64(t1, t2 & 63));
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_deposit_i64
-        case INDEX_op_deposit_i64:
+        CASE(INDEX_op_deposit_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             t2 = tci_read_r64(&tb_ptr);
@@ -987,9 +1200,9 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             tmp8 = *tb_ptr++;
             tmp64 = (((1ULL << tmp8) - 1) << tmp16);
             tci_write_reg64(t0, (t1 & ~tmp64) | ((t2 << tmp16) & tmp64));
-            break;
+            NEXT();
 #endif
-        case INDEX_op_brcond_i64:
+        CASE(INDEX_op_brcond_i64):
             t0 = tci_read_r64(&tb_ptr);
             t1 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
@@ -997,106 +1210,105 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (tci_compare64(t0, t1, condition)) {
                 tci_assert(tb_ptr == old_code_ptr + op_size);
                 tb_ptr = (uint8_t *)label;
-                continue;
+                JUMP();
             }
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_ext8u_i64
-        case INDEX_op_ext8u_i64:
+        CASE(INDEX_op_ext8u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r8(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_ext8s_i64
-        case INDEX_op_ext8s_i64:
+        CASE(INDEX_op_ext8s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r8s(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16s_i64
-        case INDEX_op_ext16s_i64:
+        CASE(INDEX_op_ext16s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r16s(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16u_i64
-        case INDEX_op_ext16u_i64:
+        CASE(INDEX_op_ext16u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_ext32s_i64
-        case INDEX_op_ext32s_i64:
+        CASE(INDEX_op_ext32s_i64):
 #endif
-        case INDEX_op_ext_i32_i64:
+        CASE(INDEX_op_ext_i32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32s(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_ext32u_i64
-        case INDEX_op_ext32u_i64:
+        CASE(INDEX_op_ext32u_i64):
 #endif
-        case INDEX_op_extu_i32_i64:
+        CASE(INDEX_op_extu_i32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            NEXT();
 #if TCG_TARGET_HAS_bswap16_i64
-        case INDEX_op_bswap16_i64:
+        CASE(INDEX_op_bswap16_i64):
             TODO();
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg64(t0, bswap16(t1));
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap32_i64
-        case INDEX_op_bswap32_i64:
+        CASE(INDEX_op_bswap32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg64(t0, bswap32(t1));
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap64_i64
-        case INDEX_op_bswap64_i64:
+        CASE(INDEX_op_bswap64_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, bswap64(t1));
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_not_i64
-        case INDEX_op_not_i64:
+        CASE(INDEX_op_not_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, ~t1);
-            break;
+            NEXT();
 #endif
 #if TCG_TARGET_HAS_neg_i64
-        case INDEX_op_neg_i64:
+        CASE(INDEX_op_neg_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, -t1);
-            break;
+            NEXT();
 #endif
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
             /* QEMU specific operations. */
 
-        case INDEX_op_exit_tb:
+        CASE(INDEX_op_exit_tb):
             ret = *(uint64_t *)tb_ptr;
             goto exit;
-            break;
-        case INDEX_op_goto_tb:
+        CASE(INDEX_op_goto_tb):
             /* Jump address is aligned */
             tb_ptr = QEMU_ALIGN_PTR_UP(tb_ptr, 4);
             t0 = atomic_read((int32_t *)tb_ptr);
             tb_ptr += sizeof(int32_t);
             tci_assert(tb_ptr == old_code_ptr + op_size);
             tb_ptr += (int32_t)t0;
-            continue;
-        case INDEX_op_qemu_ld_i32:
+            JUMP();
+        CASE(INDEX_op_qemu_ld_i32):
             t0 = *tb_ptr++;
             taddr = tci_read_ulong(&tb_ptr);
             oi = tci_read_i(&tb_ptr);
@@ -1129,8 +1341,8 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
                 tcg_abort();
             }
             tci_write_reg(t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld_i64:
+            NEXT();
+        CASE(INDEX_op_qemu_ld_i64):
             t0 = *tb_ptr++;
             if (TCG_TARGET_REG_BITS == 32) {
                 t1 = *tb_ptr++;
@@ -1181,8 +1393,8 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (TCG_TARGET_REG_BITS == 32) {
                 tci_write_reg(t1, tmp64 >> 32);
             }
-            break;
-        case INDEX_op_qemu_st_i32:
+            NEXT();
+        CASE(INDEX_op_qemu_st_i32):
             t0 = tci_read_r(&tb_ptr);
             taddr = tci_read_ulong(&tb_ptr);
             oi = tci_read_i(&tb_ptr);
@@ -1205,8 +1417,8 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             default:
                 tcg_abort();
             }
-            break;
-        case INDEX_op_qemu_st_i64:
+            NEXT();
+        CASE(INDEX_op_qemu_st_i64):
             tmp64 = tci_read_r64(&tb_ptr);
             taddr = tci_read_ulong(&tb_ptr);
             oi = tci_read_i(&tb_ptr);
@@ -1235,14 +1447,14 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             default:
                 tcg_abort();
             }
-            break;
-        case INDEX_op_mb:
+            NEXT();
+        CASE(INDEX_op_mb):
             /* Ensure ordering for all kinds */
             smp_mb();
-            break;
-        default:
+            NEXT();
+        CASE_DEFAULT:
             TODO();
-            break;
+            NEXT();
         }
         tci_assert(tb_ptr == old_code_ptr + op_size);
     }
@@ -0,0 +1,155 @@
+/*
+ * QTest testcase for incremental updates of the memory dispatch map
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+/* The std VGA card has a 16 MiB RAM BAR (the framebuffer) and a 4 KiB
+ * MMIO BAR.  Moving them around the PCI hole removes and adds ranges that
+ * cover whole 2 MiB nodes of the dispatch map, and ranges that split them.
+ */
+#define VGA_DEVFN               QPCI_DEVFN(4, 0)
+#define VGA_FB_SIZE             (16 * 1024 * 1024)
+#define VGA_MMIO_QEXT_BYTEORDER 0x604
+#define VGA_QEXT_LITTLE_ENDIAN  0x1e1e1e1e
+
+#define HOLE_BASE               0xe0000000ULL
+#define PROBE_START             (HOLE_BASE - 0x200000)
+#define PROBE_END               (HOLE_BASE + 0x3000000)
+#define PROBE_STEP              0x10000
+#define PROBE_OFFSET            0x3004
+#define NUM_PROBES              ((PROBE_END - PROBE_START) / PROBE_STEP * 2)
+
+static QPCIDevice *vga_start(QPCIBus **pbus)
+{
+    QPCIDevice *dev;
+
+    qtest_start("-vga none -device VGA,addr=04.0");
+    *pbus = qpci_init_pc();
+    dev = qpci_device_find(*pbus, VGA_DEVFN);
+    g_assert(dev != NULL);
+    return dev;
+}
+
+static void vga_end(QPCIBus *bus, QPCIDevice *dev)
+{
+    g_free(dev);
+    qpci_free_pc(bus);
+    qtest_end();
+}
+
+static void set_bars(QPCIDevice *dev, uint32_t fb, uint32_t mmio)
+{
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, fb);
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_2, mmio);
+}
+
+static uint32_t fb_pattern(uint32_t offset)
+{
+    return 0x5a000000 | offset;
+}
+
+static void fill_fb(uint32_t fb)
+{
+    uint32_t off;
+
+    for (off = 0; off < VGA_FB_SIZE; off += PROBE_STEP) {
+        writel(fb + off, fb_pattern(off));
+        writel(fb + off + PROBE_OFFSET, fb_pattern(off + PROBE_OFFSET));
+    }
+}
+
+static void check_layout(uint32_t fb, uint32_t mmio)
+{
+    uint32_t off;
+
+    for (off = 0; off < VGA_FB_SIZE; off += PROBE_STEP) {
+        g_assert_cmphex(readl(fb + off), ==, fb_pattern(off));
+        g_assert_cmphex(readl(fb + off + PROBE_OFFSET), ==,
+                        fb_pattern(off + PROBE_OFFSET));
+    }
+    g_assert_cmphex(readl(mmio + VGA_MMIO_QEXT_BYTEORDER), ==,
+                    VGA_QEXT_LITTLE_ENDIAN);
+}
+
+static void read_probes(uint32_t *probes)
+{
+    uint64_t addr;
+    int i = 0;
+
+    for (addr = PROBE_START; addr < PROBE_END; addr += PROBE_STEP) {
+        probes[i++] = readl(addr);
+        probes[i++] = readl(addr + PROBE_OFFSET);
+    }
+    g_assert_cmpint(i, ==, NUM_PROBES);
+}
+
+static void test_bar_churn(void)
+{
+    const uint32_t final_fb = HOLE_BASE + 0x400000;
+    const uint32_t final_mmio = HOLE_BASE + 0x1403000;
+    uint32_t *expected = g_new(uint32_t, NUM_PROBES);
+    uint32_t *probes = g_new(uint32_t, NUM_PROBES);
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    int i;
+
+    /* Reference: the final layout, programmed in one go.  */
+    dev = vga_start(&bus);
+    set_bars(dev, final_fb, final_mmio);
+    qpci_device_enable(dev);
+    fill_fb(final_fb);
+    check_layout(final_fb, final_mmio);
+    read_probes(expected);
+    vga_end(bus, dev);
+
+    dev = vga_start(&bus);
+    set_bars(dev, HOLE_BASE, HOLE_BASE + 0x2000000);
+    qpci_device_enable(dev);
+    fill_fb(HOLE_BASE);
+    check_layout(HOLE_BASE, HOLE_BASE + 0x2000000);
+
+    /* Leave whole 2 MiB nodes unassigned, then map a page inside one.  */
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, HOLE_BASE + 0x1000000);
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_2, HOLE_BASE + 0x203000);
+    check_layout(HOLE_BASE + 0x1000000, HOLE_BASE + 0x203000);
+
+    /* Map the framebuffer back over part of the range it left, and move
+     * the MMIO BAR into the range the framebuffer leaves this time.
+     */
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, final_fb);
+    check_layout(final_fb, HOLE_BASE + 0x203000);
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_2, final_mmio);
+    check_layout(final_fb, final_mmio);
+
+    /* Remove and re-add everything.  */
+    qpci_config_writew(dev, PCI_COMMAND, 0);
+    qpci_device_enable(dev);
+    check_layout(final_fb, final_mmio);
+
+    read_probes(probes);
+    for (i = 0; i < NUM_PROBES; i++) {
+        g_assert_cmphex(probes[i], ==, expected[i]);
+    }
+    vga_end(bus, dev);
+
+    g_free(probes);
+    g_free(expected);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/memory/dispatch/bar-churn", test_bar_churn);
+
+    return g_test_run();
+}
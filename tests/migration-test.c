@@ -1,5 +1,5 @@
 /*
- * QTest testcase for postcopy
+ * QTest testcase for migration
  *
  * Copyright (c) 2016 Red Hat, Inc. and/or its affiliates
  *   based on the vhost-user-test.c that is:
@@ -353,14 +353,14 @@ static void cleanup(const char *filename)
     g_free(path);
 }
 
-static void test_migrate(void)
+/*
+ * Start the source and the destination.  @incoming is the -incoming
+ * argument of the destination, "defer" if the test issues migrate-incoming.
+ */
+static void test_migrate_start(QTestState **from, QTestState **to,
+                               const char *incoming)
 {
-    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
-    QTestState *global = global_qtest, *from, *to;
-    unsigned char dest_byte_a, dest_byte_b, dest_byte_c, dest_byte_d;
-    gchar *cmd, *cmd_src, *cmd_dst;
-    QDict *rsp;
-
+    gchar *cmd_src, *cmd_dst;
     char *bootpath = g_strdup_printf("%s/bootsect", tmpfs);
     const char *arch = qtest_get_arch();
 
@@ -378,7 +378,7 @@ static void test_migrate(void)
                                   " -serial file:%s/dest_serial"
                                   " -drive file=%s,format=raw"
                                   " -incoming %s",
-                                  tmpfs, bootpath, uri);
+                                  tmpfs, bootpath, incoming);
     } else if (strcmp(arch, "ppc64") == 0) {
         init_bootfile_ppc(bootpath);
         cmd_src = g_strdup_printf("-machine accel=kvm:tcg -m 256M"
@@ -390,71 +390,168 @@ static void test_migrate(void)
                                   " -name pcdest,debug-threads=on"
                                   " -serial file:%s/dest_serial"
                                   " -incoming %s",
-                                  tmpfs, uri);
+                                  tmpfs, incoming);
     } else {
         g_assert_not_reached();
     }
 
     g_free(bootpath);
 
-    from = qtest_start(cmd_src);
+    *from = qtest_start(cmd_src);
     g_free(cmd_src);
 
-    to = qtest_init(cmd_dst);
+    *to = qtest_init(cmd_dst);
     g_free(cmd_dst);
+}
 
-    global_qtest = from;
-    rsp = qmp("{ 'execute': 'migrate-set-capabilities',"
-                  "'arguments': { "
-                      "'capabilities': [ {"
-                          "'capability': 'postcopy-ram',"
-                          "'state': true } ] } }");
-    g_assert(qdict_haskey(rsp, "return"));
-    QDECREF(rsp);
+/*
+ * Quit both sides.  With @test_dest, first check that the destination
+ * is running the guest and that its RAM is consistent once stopped.
+ */
+static void test_migrate_end(QTestState *from, QTestState *to, bool test_dest)
+{
+    unsigned char dest_byte_a, dest_byte_b, dest_byte_c, dest_byte_d;
 
-    global_qtest = to;
-    rsp = qmp("{ 'execute': 'migrate-set-capabilities',"
-                  "'arguments': { "
-                      "'capabilities': [ {"
-                          "'capability': 'postcopy-ram',"
-                          "'state': true } ] } }");
+    qtest_quit(from);
+
+    if (test_dest) {
+        global_qtest = to;
+
+        qtest_memread(to, start_address, &dest_byte_a, 1);
+
+        /* Destination still running, wait for a byte to change */
+        do {
+            qtest_memread(to, start_address, &dest_byte_b, 1);
+            usleep(10 * 1000);
+        } while (dest_byte_a == dest_byte_b);
+
+        QDECREF(return_or_event(qmp("{ 'execute' : 'stop'}")));
+        /* With it stopped, check nothing changes */
+        qtest_memread(to, start_address, &dest_byte_c, 1);
+        sleep(1);
+        qtest_memread(to, start_address, &dest_byte_d, 1);
+        g_assert_cmpint(dest_byte_c, ==, dest_byte_d);
+
+        check_guests_ram();
+    }
+
+    qtest_quit(to);
+
+    cleanup("bootsect");
+    cleanup("migsocket");
+    cleanup("src_serial");
+    cleanup("dest_serial");
+}
+
+static void migrate_check_return(QTestState *who, const char *command)
+{
+    QDict *rsp;
+
+    global_qtest = who;
+    rsp = return_or_event(qmp(command));
     g_assert(qdict_haskey(rsp, "return"));
     QDECREF(rsp);
+}
+
+static void migrate_set_capability(QTestState *who, const char *capability,
+                                   const char *value)
+{
+    gchar *cmd;
+
+    cmd = g_strdup_printf("{ 'execute': 'migrate-set-capabilities',"
+                          "'arguments': { "
+                              "'capabilities': [ {"
+                                  "'capability': '%s',"
+                                  "'state': %s } ] } }",
+                          capability, value);
+    migrate_check_return(who, cmd);
+    g_free(cmd);
+}
+
+static void migrate_set_parameter(QTestState *who, const char *parameter,
+                                  const char *value)
+{
+    gchar *cmd;
+
+    cmd = g_strdup_printf("{ 'execute': 'migrate-set-parameters',"
+                          "'arguments': { '%s': %s } }",
+                          parameter, value);
+    migrate_check_return(who, cmd);
+    g_free(cmd);
+}
+
+static void migrate_set_speed(QTestState *who, const char *value)
+{
+    gchar *cmd;
+
+    cmd = g_strdup_printf("{ 'execute': 'migrate_set_speed',"
+                          "'arguments': { 'value': %s } }", value);
+    migrate_check_return(who, cmd);
+    g_free(cmd);
+}
 
+static void migrate_set_downtime(QTestState *who, const char *value)
+{
+    gchar *cmd;
+
+    cmd = g_strdup_printf("{ 'execute': 'migrate_set_downtime',"
+                          "'arguments': { 'value': %s } }", value);
+    migrate_check_return(who, cmd);
+    g_free(cmd);
+}
+
+static void migrate(QTestState *who, const char *uri)
+{
+    gchar *cmd;
+
+    cmd = g_strdup_printf("{ 'execute': 'migrate',"
+                          "'arguments': { 'uri': '%s' } }",
+                          uri);
+    migrate_check_return(who, cmd);
+    g_free(cmd);
+}
+
+static void migrate_incoming(QTestState *who, const char *uri)
+{
+    gchar *cmd;
+
+    cmd = g_strdup_printf("{ 'execute': 'migrate-incoming',"
+                          "'arguments': { 'uri': '%s' } }",
+                          uri);
+    migrate_check_return(who, cmd);
+    g_free(cmd);
+}
+
+/*
+ * Start migrating to @uri slowly enough that it cannot converge, and
+ * wait for a pass over RAM to finish.
+ */
+static void migrate_start_slow(QTestState *from, const char *uri)
+{
     /* We want to pick a speed slow enough that the test completes
      * quickly, but that it doesn't complete precopy even on a slow
      * machine, so also set the downtime.
      */
-    global_qtest = from;
-    rsp = qmp("{ 'execute': 'migrate_set_speed',"
-              "'arguments': { 'value': 100000000 } }");
-    g_assert(qdict_haskey(rsp, "return"));
-    QDECREF(rsp);
-
+    migrate_set_speed(from, "100000000");
     /* 1ms downtime - it should never finish precopy */
-    rsp = qmp("{ 'execute': 'migrate_set_downtime',"
-              "'arguments': { 'value': 0.001 } }");
-    g_assert(qdict_haskey(rsp, "return"));
-    QDECREF(rsp);
-
+    migrate_set_downtime(from, "0.001");
 
     /* Wait for the first serial output from the source */
     wait_for_serial("src_serial");
 
-    cmd = g_strdup_printf("{ 'execute': 'migrate',"
-                          "'arguments': { 'uri': '%s' } }",
-                          uri);
-    rsp = qmp(cmd);
-    g_free(cmd);
-    g_assert(qdict_haskey(rsp, "return"));
-    QDECREF(rsp);
+    migrate(from, uri);
 
+    global_qtest = from;
     wait_for_migration_pass();
+}
 
-    rsp = return_or_event(qmp("{ 'execute': 'migrate-start-postcopy' }"));
-    g_assert(qdict_haskey(rsp, "return"));
-    QDECREF(rsp);
+/* Let a migration started by migrate_start_slow() complete */
+static void migrate_finish_precopy(QTestState *from, QTestState *to)
+{
+    /* 10s downtime is far more than the guest needs to converge */
+    migrate_set_downtime(from, "10");
 
+    global_qtest = from;
     if (!got_stop) {
         qmp_eventwait("STOP");
     }
@@ -465,50 +562,217 @@ static void test_migrate(void)
     wait_for_serial("dest_serial");
     global_qtest = from;
     wait_for_migration_complete();
+}
 
-    qtest_quit(from);
+static void test_postcopy(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *global = global_qtest, *from, *to;
+
+    test_migrate_start(&from, &to, uri);
+
+    migrate_set_capability(from, "postcopy-ram", "true");
+    migrate_set_capability(to, "postcopy-ram", "true");
+
+    migrate_start_slow(from, uri);
+
+    migrate_check_return(from, "{ 'execute': 'migrate-start-postcopy' }");
+
+    if (!got_stop) {
+        qmp_eventwait("STOP");
+    }
 
     global_qtest = to;
+    qmp_eventwait("RESUME");
 
-    qtest_memread(to, start_address, &dest_byte_a, 1);
+    wait_for_serial("dest_serial");
+    global_qtest = from;
+    wait_for_migration_complete();
 
-    /* Destination still running, wait for a byte to change */
-    do {
-        qtest_memread(to, start_address, &dest_byte_b, 1);
-        usleep(10 * 1000);
-    } while (dest_byte_a == dest_byte_b);
+    test_migrate_end(from, to, true);
+    g_free(uri);
 
-    qmp("{ 'execute' : 'stop'}");
-    /* With it stopped, check nothing changes */
-    qtest_memread(to, start_address, &dest_byte_c, 1);
-    sleep(1);
-    qtest_memread(to, start_address, &dest_byte_d, 1);
-    g_assert_cmpint(dest_byte_c, ==, dest_byte_d);
+    global_qtest = global;
+}
+
+static void test_multifd_unix(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *global = global_qtest, *from, *to;
 
-    check_guests_ram();
+    test_migrate_start(&from, &to, uri);
 
-    qtest_quit(to);
+    migrate_set_capability(from, "x-multifd", "true");
+    migrate_set_capability(to, "x-multifd", "true");
+    migrate_set_parameter(from, "x-multifd-channels", "4");
+    migrate_set_parameter(to, "x-multifd-channels", "4");
+
+    migrate_start_slow(from, uri);
+    migrate_finish_precopy(from, to);
+
+    test_migrate_end(from, to, true);
     g_free(uri);
 
     global_qtest = global;
+}
 
-    cleanup("bootsect");
-    cleanup("migsocket");
-    cleanup("src_serial");
-    cleanup("dest_serial");
+/*
+ * Only the source enables compression: the destination must still wait
+ * for its decompression threads before the guest runs.
+ */
+static void test_compress_source_only(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *global = global_qtest, *from, *to;
+
+    test_migrate_start(&from, &to, uri);
+
+    migrate_set_capability(from, "compress", "true");
+    migrate_set_parameter(from, "compress-threads", "4");
+    migrate_set_parameter(from, "compress-level", "1");
+    migrate_set_parameter(to, "decompress-threads", "1");
+
+    migrate_start_slow(from, uri);
+    migrate_finish_precopy(from, to);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+
+    global_qtest = global;
+}
+
+/*
+ * Save to a file with x-mapped-ram and restore it into a destination
+ * whose RAM is not zero: the pages the guest never touched, which are
+ * not in the file, must read as zero afterwards.
+ */
+static void test_mapped_ram_restore(void)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *global = global_qtest, *from, *to;
+    const unsigned dirty_size = 16 * 1024 * 1024;
+    unsigned address;
+
+    test_migrate_start(&from, &to, "defer");
+
+    migrate_set_capability(from, "x-mapped-ram", "true");
+    migrate_set_capability(to, "x-mapped-ram", "true");
+
+    /* Save a stopped guest, so that the file is complete in one pass */
+    wait_for_serial("src_serial");
+    migrate_check_return(from, "{ 'execute' : 'stop'}");
+    migrate_set_speed(from, "10000000000");
+    migrate(from, uri);
+    global_qtest = from;
+    wait_for_migration_complete();
+
+    /* RAM above end_address is never written by the guest */
+    qtest_memset(to, end_address, 0x5a, dirty_size);
+    migrate_incoming(to, uri);
+
+    global_qtest = to;
+    qmp_eventwait("RESUME");
+    wait_for_serial("dest_serial");
+
+    for (address = end_address; address < end_address + dirty_size;
+         address += 4096) {
+        uint8_t b;
+
+        qtest_memread(to, address, &b, 1);
+        g_assert_cmphex(b, ==, 0);
+    }
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+
+    global_qtest = global;
+}
+
+/* Transports that cannot carry the multifd channels are refused upfront */
+static void test_multifd_bad_transport(void)
+{
+    QTestState *global = global_qtest, *from, *to;
+    QDict *rsp;
+
+    test_migrate_start(&from, &to, "defer");
+
+    migrate_set_capability(to, "x-multifd", "true");
+
+    global_qtest = to;
+    rsp = return_or_event(qmp("{ 'execute': 'migrate-incoming',"
+                              "'arguments': { 'uri': 'exec:cat' } }"));
+    g_assert(qdict_haskey(rsp, "error"));
+    QDECREF(rsp);
+
+    test_migrate_end(from, to, false);
+
+    global_qtest = global;
+}
+
+static int unix_socket_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    g_assert_cmpint(fd, >=, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    g_assert_cmpint(strlen(path), <, sizeof(addr.sun_path));
+    strcpy(addr.sun_path, path);
+    g_assert_cmpint(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+    return fd;
+}
+
+/*
+ * A channel with a broken header fails the incoming migration, and the
+ * destination is left able to accept another one.
+ */
+static void test_multifd_bad_channel(void)
+{
+    char *path = g_strdup_printf("%s/migsocket", tmpfs);
+    char *uri = g_strdup_printf("unix:%s", path);
+    QTestState *global = global_qtest, *from, *to;
+    char garbage[16];
+    char c;
+    int main_fd, channel_fd;
+
+    test_migrate_start(&from, &to, "defer");
+
+    migrate_set_capability(from, "x-multifd", "true");
+    migrate_set_capability(to, "x-multifd", "true");
+    migrate_incoming(to, uri);
+
+    main_fd = unix_socket_connect(path);
+    channel_fd = unix_socket_connect(path);
+    memset(garbage, 0xff, sizeof(garbage));
+    g_assert_cmpint(write(channel_fd, garbage, sizeof(garbage)), ==,
+                    sizeof(garbage));
+
+    /* The destination drops the main connection when the channel fails */
+    g_assert_cmpint(read(main_fd, &c, 1), ==, 0);
+    close(channel_fd);
+    close(main_fd);
+
+    migrate_start_slow(from, uri);
+    migrate_finish_precopy(from, to);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+    g_free(path);
+
+    global_qtest = global;
 }
 
 int main(int argc, char **argv)
 {
-    char template[] = "/tmp/postcopy-test-XXXXXX";
+    char template[] = "/tmp/migration-test-XXXXXX";
     int ret;
 
     g_test_init(&argc, &argv, NULL);
 
-    if (!ufd_version_check()) {
-        return 0;
-    }
-
     tmpfs = mkdtemp(template);
     if (!tmpfs) {
         g_test_message("mkdtemp on path (%s): %s\n", template, strerror(errno));
@@ -517,7 +781,16 @@ int main(int argc, char **argv)
 
     module_call_init(MODULE_INIT_QOM);
 
-    qtest_add_func("/postcopy", test_migrate);
+    if (ufd_version_check()) {
+        qtest_add_func("/migration/postcopy", test_postcopy);
+    }
+    qtest_add_func("/migration/compress/source-only",
+                   test_compress_source_only);
+    qtest_add_func("/migration/mapped-ram/restore", test_mapped_ram_restore);
+    qtest_add_func("/migration/multifd/unix", test_multifd_unix);
+    qtest_add_func("/migration/multifd/bad-transport",
+                   test_multifd_bad_transport);
+    qtest_add_func("/migration/multifd/bad-channel", test_multifd_bad_channel);
 
     ret = g_test_run();
 
@@ -109,6 +109,27 @@ COMPARISONS = [
     ]),
 
 
+    # Looking at effect of the multi-thread compression method,
+    # each at its fastest level, over a link slow enough for
+    # compression to matter
+    Comparison("compr-mt-method", scenarios = [
+        Scenario("compr-mt-method-zlib",
+                 compression_mt=True, compression_mt_threads=4,
+                 compression_mt_method="zlib", compression_mt_level=1,
+                 bandwidth=125),
+        Scenario("compr-mt-method-lz4",
+                 compression_mt=True, compression_mt_threads=4,
+                 compression_mt_method="lz4", compression_mt_level=0,
+                 bandwidth=125),
+        Scenario("compr-mt-method-zstd",
+                 compression_mt=True, compression_mt_threads=4,
+                 compression_mt_method="zstd", compression_mt_level=1,
+                 bandwidth=125),
+        Scenario("compr-mt-method-none",
+                 bandwidth=125),
+    ]),
+
+
     # Looking at effect of xbzrle compression with varying
     # cache sizes
     Comparison("compr-xbzrle", scenarios = [
@@ -162,6 +162,9 @@ class Engine(object):
                                ])
             resp = src.command("migrate-set-parameters",
                                compress_threads=scenario._compression_mt_threads)
+            resp = src.command("migrate-set-parameters",
+                               compress_method=scenario._compression_mt_method,
+                               compress_level=scenario._compression_mt_level)
             resp = dst.command("migrate-set-capabilities",
                                capabilities = [
                                    { "capability": "compress",
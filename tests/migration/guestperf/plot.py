@@ -550,6 +550,10 @@ class Plot(object):
     <th>MT compression threads:</th>
     <td>%d</td>
   </tr>
+  <tr>
+    <th>MT compression method:</th>
+    <td>%s (level %d)</td>
+  </tr>
   <tr>
     <th>XBZRLE compression:</th>
     <td>%s</td>
@@ -564,6 +568,7 @@ class Plot(object):
        "yes" if scenario._post_copy else "no", scenario._post_copy_iters,
        "yes" if scenario._auto_converge else "no", scenario._auto_converge_step,
        "yes" if scenario._compression_mt else "no", scenario._compression_mt_threads,
+       scenario._compression_mt_method, scenario._compression_mt_level,
        "yes" if scenario._compression_xbzrle else "no", scenario._compression_xbzrle_cache))
 
             pieces.append("""
@@ -29,7 +29,8 @@ class Scenario(object):
                  post_copy=False, post_copy_iters=5,
                  auto_converge=False, auto_converge_step=10,
                  compression_mt=False, compression_mt_threads=1,
-                 compression_xbzrle=False, compression_xbzrle_cache=10):
+                 compression_xbzrle=False, compression_xbzrle_cache=10,
+                 compression_mt_method="zlib", compression_mt_level=1):
 
         self._name = name
 
@@ -52,6 +53,8 @@ class Scenario(object):
 
         self._compression_mt = compression_mt
         self._compression_mt_threads = compression_mt_threads
+        self._compression_mt_method = compression_mt_method # zlib, lz4 or zstd
+        self._compression_mt_level = compression_mt_level
 
         self._compression_xbzrle = compression_xbzrle
         self._compression_xbzrle_cache = compression_xbzrle_cache # percentage of guest RAM
@@ -73,6 +76,8 @@ class Scenario(object):
             "compression_mt_threads": self._compression_mt_threads,
             "compression_xbzrle": self._compression_xbzrle,
             "compression_xbzrle_cache": self._compression_xbzrle_cache,
+            "compression_mt_method": self._compression_mt_method,
+            "compression_mt_level": self._compression_mt_level,
         }
 
     @classmethod
@@ -92,4 +97,6 @@ class Scenario(object):
             data["compression_mt"],
             data["compression_mt_threads"],
             data["compression_xbzrle"],
-            data["compression_xbzrle_cache"])
+            data["compression_xbzrle_cache"],
+            data.get("compression_mt_method", "zlib"),
+            data.get("compression_mt_level", 1))
@@ -117,6 +117,9 @@ class Shell(BaseShell):
 
         parser.add_argument("--compression-mt", dest="compression_mt", default=False, action="store_true")
         parser.add_argument("--compression-mt-threads", dest="compression_mt_threads", default=1, type=int)
+        parser.add_argument("--compression-mt-method", dest="compression_mt_method", default="zlib",
+                            choices=["zlib", "lz4", "zstd"])
+        parser.add_argument("--compression-mt-level", dest="compression_mt_level", default=1, type=int)
 
         parser.add_argument("--compression-xbzrle", dest="compression_xbzrle", default=False, action="store_true")
         parser.add_argument("--compression-xbzrle-cache", dest="compression_xbzrle_cache", default=10, type=int)
@@ -139,6 +142,8 @@ class Shell(BaseShell):
 
                         compression_mt=args.compression_mt,
                         compression_mt_threads=args.compression_mt_threads,
+                        compression_mt_method=args.compression_mt_method,
+                        compression_mt_level=args.compression_mt_level,
 
                         compression_xbzrle=args.compression_xbzrle,
                         compression_xbzrle_cache=args.compression_xbzrle_cache)
@@ -7,6 +7,9 @@
 #   io=readwrite
 #   when=before
 #
+#   [structured-read]
+#   chunks=data 2048 2048,hole 0 2048
+#
 # Note that Python's ConfigParser squashes together all sections with the same
 # name, so give each [inject-error] a unique name.
 #
@@ -29,6 +32,16 @@
 #           "after" - alias for -1
 #           default: before
 #
+# structured-read options:
+#   chunks - comma-separated list of the chunks that answer every read, each
+#            "data <offset> <length>" or "hole <offset> <length>" with the
+#            offset relative to the start of the request; a final chunk of
+#            type NONE completes the reply.  The chunks need not cover the
+#            request, nor stay inside it.
+#
+# With a [structured-read] section, the server uses fixed newstyle
+# negotiation and accepts NBD_OPT_STRUCTURED_REPLY.
+#
 # Currently the only error injection action is to terminate the server process.
 # This resets the TCP connection and thus forces the client to handle
 # unexpected connection termination.
@@ -61,6 +74,16 @@ NBD_PASSWD = 0x4e42444d41474943
 NBD_OPTS_MAGIC = 0x49484156454F5054
 NBD_CLIENT_MAGIC = 0x0000420281861253
 NBD_OPT_EXPORT_NAME = 1 << 0
+NBD_OPT_STRUCTURED_REPLY = 8
+NBD_REP_MAGIC = 0x3e889045565a9
+NBD_REP_ACK = 1
+NBD_REP_ERR_UNSUP = (1 << 31) | 1
+NBD_FLAG_FIXED_NEWSTYLE = 1 << 0
+NBD_STRUCTURED_REPLY_MAGIC = 0x668e33ef
+NBD_REPLY_FLAG_DONE = 1 << 0
+NBD_REPLY_TYPE_NONE = 0
+NBD_REPLY_TYPE_OFFSET_DATA = 1
+NBD_REPLY_TYPE_OFFSET_HOLE = 2
 
 # Protocol structs
 neg_classic_struct = struct.Struct('>QQQI124x')
@@ -71,6 +94,8 @@ neg2_struct = struct.Struct('>QH124x')
 request_tuple = collections.namedtuple('Request', 'magic type handle from_ len')
 request_struct = struct.Struct('>IIQQI')
 reply_struct = struct.Struct('>IIQ')
+option_reply_struct = struct.Struct('>QIII')
+chunk_struct = struct.Struct('>IHHQI')
 
 def err(msg):
     sys.stderr.write(msg + '\n')
@@ -135,26 +160,38 @@ def negotiate_classic(conn):
                                   FAKE_DISK_SIZE, 0)
     conn.send(buf, event='neg-classic')
 
-def negotiate_export(conn):
+def negotiate_export(conn, structured):
     # Send negotiation part 1
-    buf = neg1_struct.pack(NBD_PASSWD, NBD_OPTS_MAGIC, 0)
+    flags = NBD_FLAG_FIXED_NEWSTYLE if structured else 0
+    buf = neg1_struct.pack(NBD_PASSWD, NBD_OPTS_MAGIC, flags)
     conn.send(buf, event='neg1')
 
-    # Receive export option
+    # Receive export option, answering the options before it
     buf = conn.recv(export_struct.size, event='export')
     export = export_tuple._make(export_struct.unpack(buf))
-    assert export.magic == NBD_OPTS_MAGIC
-    assert export.opt == NBD_OPT_EXPORT_NAME
-    name = conn.recv(export.len, event='export-name')
+    while True:
+        assert export.magic == NBD_OPTS_MAGIC
+        name = conn.recv(export.len, event='export-name')
+        if export.opt == NBD_OPT_EXPORT_NAME:
+            break
+        assert structured
+        if export.opt == NBD_OPT_STRUCTURED_REPLY:
+            reply = NBD_REP_ACK
+        else:
+            reply = NBD_REP_ERR_UNSUP
+        buf = option_reply_struct.pack(NBD_REP_MAGIC, export.opt, reply, 0)
+        conn.send(buf, event='option')
+        buf = conn.recv(export_struct.size - 4, event='export')
+        export = export_tuple._make(export_struct.unpack('\0' * 4 + buf))
 
     # Send negotiation part 2
     buf = neg2_struct.pack(FAKE_DISK_SIZE, 0)
     conn.send(buf, event='neg2')
 
-def negotiate(conn, use_export):
+def negotiate(conn, use_export, chunks):
     '''Negotiate export with client'''
     if use_export:
-        negotiate_export(conn)
+        negotiate_export(conn, chunks is not None)
     else:
         negotiate_classic(conn)
 
@@ -169,11 +206,29 @@ def write_reply(conn, error, handle):
     buf = reply_struct.pack(NBD_REPLY_MAGIC, error, handle)
     conn.send(buf, event='reply')
 
-def handle_connection(conn, use_export):
-    negotiate(conn, use_export)
+def write_chunk(conn, flags, type_, handle, payload):
+    buf = chunk_struct.pack(NBD_STRUCTURED_REPLY_MAGIC, flags, type_, handle,
+                            len(payload))
+    conn.send(buf, event='reply')
+    conn.send(payload, event='data')
+
+def write_structured_read(conn, req, chunks):
+    for kind, offset, length in chunks:
+        if kind == 'data':
+            write_chunk(conn, 0, NBD_REPLY_TYPE_OFFSET_DATA, req.handle,
+                        struct.pack('>Q', req.from_ + offset) + '\x11' * length)
+        else:
+            write_chunk(conn, 0, NBD_REPLY_TYPE_OFFSET_HOLE, req.handle,
+                        struct.pack('>QI', req.from_ + offset, length))
+    write_chunk(conn, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_NONE, req.handle, '')
+
+def handle_connection(conn, use_export, chunks):
+    negotiate(conn, use_export, chunks)
     while True:
         req = read_request(conn)
-        if req.type == NBD_CMD_READ:
+        if req.type == NBD_CMD_READ and chunks is not None:
+            write_structured_read(conn, req, chunks)
+        elif req.type == NBD_CMD_READ:
             write_reply(conn, 0, req.handle)
             conn.send('\0' * req.len, event='data')
         elif req.type == NBD_CMD_WRITE:
@@ -186,16 +241,16 @@ def handle_connection(conn, use_export):
             break
     conn.close()
 
-def run_server(sock, rules, use_export):
+def run_server(sock, rules, use_export, chunks):
     while True:
         conn, _ = sock.accept()
-        handle_connection(FaultInjectionSocket(conn, rules), use_export)
+        handle_connection(FaultInjectionSocket(conn, rules), use_export, chunks)
 
 def parse_inject_error(name, options):
     if 'event' not in options:
         err('missing \"event\" option in %s' % name)
     event = options['event']
-    if event not in ('neg-classic', 'neg1', 'export', 'neg2', 'request', 'reply', 'data'):
+    if event not in ('neg-classic', 'neg1', 'export', 'option', 'neg2', 'request', 'reply', 'data'):
         err('invalid \"event\" option value \"%s\" in %s' % (event, name))
     io = options.get('io', 'readwrite')
     if io not in ('read', 'write', 'readwrite'):
@@ -212,15 +267,35 @@ def parse_inject_error(name, options):
             err('invalid \"when\" option value \"%s\" in %s' % (when, name))
     return Rule(name, event, io, when)
 
+def parse_structured_read(name, options):
+    chunks = []
+    for chunk in options.get('chunks', '').split(','):
+        if not chunk.strip():
+            continue
+        try:
+            kind, offset, length = chunk.split()
+            offset = int(offset)
+            length = int(length)
+        except ValueError:
+            err('invalid chunk \"%s\" in %s' % (chunk, name))
+        if kind not in ('data', 'hole'):
+            err('invalid chunk type \"%s\" in %s' % (kind, name))
+        chunks.append((kind, offset, length))
+    return chunks
+
 def parse_config(config):
     rules = []
+    chunks = None
     for name in config.sections():
         if name.startswith('inject-error'):
             options = dict(config.items(name))
             rules.append(parse_inject_error(name, options))
+        elif name == 'structured-read':
+            options = dict(config.items(name))
+            chunks = parse_structured_read(name, options)
         else:
             err('invalid config section name: %s' % name)
-    return rules
+    return rules, chunks
 
 def load_rules(filename):
     config = ConfigParser.RawConfigParser()
@@ -256,8 +331,10 @@ def main(args):
     elif len(args) == 4:
         usage(args)
     sock = open_socket(args[1 if use_export else 2])
-    rules = load_rules(args[2 if use_export else 3])
-    run_server(sock, rules, use_export)
+    rules, chunks = load_rules(args[2 if use_export else 3])
+    if chunks is not None and not use_export:
+        err('structured reads need newstyle negotiation')
+    run_server(sock, rules, use_export, chunks)
     return 0
 
 if __name__ == '__main__':
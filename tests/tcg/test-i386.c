@@ -2665,6 +2665,65 @@ void test_sse(void)
     asm volatile ("emms");
 }
 
+/* Values at lane boundaries, to check carries and signs do not cross
+   lanes in the inline expansions of the integer MMX/SSE ops.  */
+static uint64_t __attribute__((aligned(16))) lane_values[4][2] = {
+    { 0x7fff7fff7f7f7fff, 0xffffffffffffffff },
+    { 0x0001000101010001, 0x0000000000000001 },
+    { 0x8000000080808000, 0x7fffffff80000000 },
+    { 0xffff0001ff01ffff, 0x8000000000000000 },
+};
+
+#define SSE_LANE_OP(op)\
+{\
+    int i;\
+    for(i=0;i<2;i++) {\
+    a.q[0] = lane_values[2*i][0];\
+    a.q[1] = lane_values[2*i][1];\
+    b.q[0] = lane_values[2*i+1][0];\
+    b.q[1] = lane_values[2*i+1][1];\
+    asm volatile (#op " %2, %0" : "=x" (r.dq) : "0" (a.dq), "x" (b.dq));\
+    asm volatile (#op " %2, %0" : "=x" (m.dq) : "0" (a.dq), "m" (b.dq));\
+    asm volatile (#op " %2, %0" : "=y" (r2) : "0" (a.q[0]), "y" (b.q[0]));\
+    asm volatile (#op " %2, %0" : "=y" (m2) : "0" (a.q[0]), "m" (b.q[0]));\
+    printf("%-9s: a=" FMT64X "" FMT64X " b=" FMT64X "" FMT64X\
+           " r=" FMT64X "" FMT64X " m=" FMT64X "" FMT64X\
+           " r64=" FMT64X " m64=" FMT64X "\n",\
+           #op,\
+           a.q[1], a.q[0],\
+           b.q[1], b.q[0],\
+           r.q[1], r.q[0],\
+           m.q[1], m.q[0],\
+           r2, m2);\
+    }\
+}
+
+void test_sse_lanes(void)
+{
+    XMMReg r, m, a, b;
+    uint64_t r2, m2;
+
+    SSE_LANE_OP(paddb);
+    SSE_LANE_OP(paddw);
+    SSE_LANE_OP(paddd);
+    SSE_LANE_OP(paddq);
+    SSE_LANE_OP(psubb);
+    SSE_LANE_OP(psubw);
+    SSE_LANE_OP(psubd);
+    SSE_LANE_OP(psubq);
+    SSE_LANE_OP(pand);
+    SSE_LANE_OP(pandn);
+    SSE_LANE_OP(por);
+    SSE_LANE_OP(pxor);
+    SSE_LANE_OP(pcmpeqb);
+    SSE_LANE_OP(pcmpeqw);
+    SSE_LANE_OP(pcmpeqd);
+    SSE_LANE_OP(pcmpgtb);
+    SSE_LANE_OP(pcmpgtw);
+    SSE_LANE_OP(pcmpgtd);
+    asm volatile ("emms");
+}
+
 #endif
 
 #define TEST_CONV_RAX(op)\
@@ -2759,6 +2818,7 @@ int main(int argc, char **argv)
     test_conv();
 #ifdef TEST_SSE
     test_sse();
+    test_sse_lanes();
     test_fxsave();
 #endif
     return 0;
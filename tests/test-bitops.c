@@ -8,6 +8,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/bitops.h"
+#include "qemu/thread.h"
 
 typedef struct {
     uint32_t value;
@@ -133,6 +134,74 @@ static void test_half_unshuffle64(void)
     }
 }
 
+/*
+ * Merge ranges of bits into one bitmap from several threads, the way the
+ * migration bitmap is synced: the ranges do not start on word boundaries,
+ * so neighbouring ranges set bits in the same words concurrently.
+ */
+#define SYNC_BITS 4096
+#define SYNC_THREADS 4
+
+typedef struct {
+    unsigned long *dest;
+    long start;
+    long end;
+    long newly_set;
+} SyncRange;
+
+static void *sync_range_thread(void *opaque)
+{
+    SyncRange *r = opaque;
+    long i;
+
+    for (i = r->start; i < r->end; i++) {
+        if (!test_and_set_bit_atomic(i, r->dest)) {
+            r->newly_set++;
+        }
+    }
+    return NULL;
+}
+
+static void test_test_and_set_bit_atomic(void)
+{
+    static const long bounds[SYNC_THREADS + 1] = {
+        0, 1001, 2050, 3007, SYNC_BITS
+    };
+    unsigned long dest[BITS_TO_LONGS(SYNC_BITS)];
+    QemuThread threads[SYNC_THREADS];
+    SyncRange ranges[SYNC_THREADS];
+    int iter, i;
+
+    for (iter = 0; iter < 100; iter++) {
+        long preset = 0, total = 0;
+
+        /* Bits already set in the destination must not be counted */
+        memset(dest, 0, sizeof(dest));
+        for (i = 0; i < SYNC_BITS; i += 7) {
+            set_bit(i, dest);
+            preset++;
+        }
+
+        for (i = 0; i < SYNC_THREADS; i++) {
+            ranges[i].dest = dest;
+            ranges[i].start = bounds[i];
+            ranges[i].end = bounds[i + 1];
+            ranges[i].newly_set = 0;
+            qemu_thread_create(&threads[i], "sync", sync_range_thread,
+                               &ranges[i], QEMU_THREAD_JOINABLE);
+        }
+        for (i = 0; i < SYNC_THREADS; i++) {
+            qemu_thread_join(&threads[i]);
+            total += ranges[i].newly_set;
+        }
+
+        g_assert_cmpint(total, ==, SYNC_BITS - preset);
+        for (i = 0; i < BITS_TO_LONGS(SYNC_BITS); i++) {
+            g_assert_cmphex(dest[i], ==, ~0UL);
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -142,5 +211,7 @@ int main(int argc, char **argv)
     g_test_add_func("/bitops/half_shuffle64", test_half_shuffle64);
     g_test_add_func("/bitops/half_unshuffle32", test_half_unshuffle32);
     g_test_add_func("/bitops/half_unshuffle64", test_half_unshuffle64);
+    g_test_add_func("/bitops/test_and_set_bit_atomic",
+                    test_test_and_set_bit_atomic);
     return g_test_run();
 }
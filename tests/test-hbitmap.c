@@ -634,6 +634,85 @@ static void test_hbitmap_truncate_shrink_large(TestHBitmapData *data,
     hbitmap_test_truncate(data, size, -diff, 0);
 }
 
+static void test_hbitmap_serialize_roundtrip(TestHBitmapData *data,
+                                             const void *unused)
+{
+    uint64_t size = L2 + 77;
+    uint64_t gran, start, count, i;
+    uint8_t *buf;
+    HBitmap *hb;
+
+    hbitmap_test_init(data, size, 0);
+    hbitmap_test_set(data, 0, 1);
+    hbitmap_test_set(data, 65, 200);
+    hbitmap_test_set(data, L2 - 3, 10);
+    hbitmap_test_set(data, size - 1, 1);
+
+    gran = hbitmap_serialization_granularity(data->hb);
+    g_assert_cmpint(gran, ==, 64);
+    buf = g_malloc0(hbitmap_serialization_size(data->hb, 0, size));
+
+    /* Transfer the bitmap in chunks of 3 * gran items */
+    hb = hbitmap_alloc(size, 0);
+    for (start = 0; start < size; start += count) {
+        count = MIN(3 * gran, size - start);
+        hbitmap_serialize_part(data->hb, buf, start, count);
+        hbitmap_deserialize_part(hb, buf, start, count, false);
+    }
+    hbitmap_deserialize_finish(hb);
+
+    g_assert_cmpint(hbitmap_count(hb), ==, hbitmap_count(data->hb));
+    for (i = 0; i < size; i++) {
+        g_assert_cmpint(hbitmap_get(hb, i), ==, hbitmap_get(data->hb, i));
+    }
+
+    hbitmap_free(hb);
+    g_free(buf);
+}
+
+static void test_hbitmap_serialize_ones(TestHBitmapData *data,
+                                        const void *unused)
+{
+    uint64_t size = L1 * 3 + 5;
+    uint64_t gran;
+    HBitmapIter hbi;
+
+    hbitmap_test_init(data, size, 0);
+    gran = hbitmap_serialization_granularity(data->hb);
+
+    /* The bits past the end of the bitmap must not show up */
+    hbitmap_deserialize_ones(data->hb, 0, size, true);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, size);
+    hbitmap_iter_init(&hbi, data->hb, size - 1);
+    g_assert_cmpint(hbitmap_iter_next(&hbi), ==, size - 1);
+    g_assert_cmpint(hbitmap_iter_next(&hbi), <, 0);
+
+    hbitmap_deserialize_zeroes(data->hb, gran, size - gran, true);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, gran);
+    g_assert_true(hbitmap_get(data->hb, gran - 1));
+    g_assert_false(hbitmap_get(data->hb, gran));
+}
+
+static void test_hbitmap_serialize_granularity(TestHBitmapData *data,
+                                               const void *unused)
+{
+    uint64_t size = L2;
+    uint8_t *buf;
+    size_t buf_size;
+
+    /* One bit is stored per group of 2^granularity items */
+    hbitmap_test_init(data, size, 2);
+    g_assert_cmpint(hbitmap_serialization_granularity(data->hb), ==, 256);
+    hbitmap_set(data->hb, 8, 1);
+
+    buf_size = hbitmap_serialization_size(data->hb, 0, size);
+    g_assert_cmpint(buf_size, ==, size / 4 / 8);
+    buf = g_malloc0(buf_size);
+    hbitmap_serialize_part(data->hb, buf, 0, size);
+    g_assert_cmpint(buf[0], ==, 0x04);
+    g_free(buf);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -661,6 +740,12 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
+    hbitmap_test_add("/hbitmap/serialize/roundtrip",
+                     test_hbitmap_serialize_roundtrip);
+    hbitmap_test_add("/hbitmap/serialize/ones",
+                     test_hbitmap_serialize_ones);
+    hbitmap_test_add("/hbitmap/serialize/granularity",
+                     test_hbitmap_serialize_granularity);
 
     hbitmap_test_add("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
     hbitmap_test_add("/hbitmap/truncate/grow/negligible",
@@ -0,0 +1,170 @@
+/*
+ * Test the adaptive request limits of the mirror block job
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "block/mirror-adapt.h"
+
+#define IN_FLIGHT       16
+#define IO_SECTORS      2048
+#define IO_SECTORS_MIN  128
+#define IO_SECTORS_MAX  32768
+
+/* Bytes copied in an interval; the throughput is ten times this per second */
+#define BASE_BYTES      (100 * 1024 * MIRROR_ADAPT_MIN_OPS * 25)
+#define LATENCY         1000
+
+static int64_t now;
+
+static void adapt_init(MirrorAdapt *a)
+{
+    now = 0;
+    mirror_adapt_init(a, IN_FLIGHT, IO_SECTORS, IO_SECTORS_MIN,
+                      IO_SECTORS_MAX, now);
+}
+
+/*
+ * Complete requests for one interval, copying @bytes with a latency of
+ * @latency ns per KiB.
+ *
+ * Returns: whether the limits were reconsidered at the end
+ */
+static bool run_interval(MirrorAdapt *a, bool saturated, uint64_t bytes,
+                         uint64_t latency)
+{
+    uint64_t op_bytes = bytes / MIRROR_ADAPT_MIN_OPS;
+    bool adapted = false;
+    int i;
+
+    for (i = 0; i < MIRROR_ADAPT_MIN_OPS; i++) {
+        a->saturated |= saturated;
+        now += MIRROR_ADAPT_INTERVAL / MIRROR_ADAPT_MIN_OPS;
+        adapted = mirror_adapt_request_done(a, op_bytes,
+                                            latency * (op_bytes >> 10), now);
+        g_assert(!adapted || i == MIRROR_ADAPT_MIN_OPS - 1);
+    }
+    return adapted;
+}
+
+static void test_unsaturated(void)
+{
+    MirrorAdapt a;
+
+    adapt_init(&a);
+    g_assert(!run_interval(&a, false, BASE_BYTES, LATENCY));
+    g_assert(!run_interval(&a, false, BASE_BYTES * 2, LATENCY));
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS);
+}
+
+static void test_grow(void)
+{
+    MirrorAdapt a;
+
+    adapt_init(&a);
+    g_assert(run_interval(&a, true, BASE_BYTES, LATENCY));
+    g_assert_cmpint(a.last_throughput, ==, BASE_BYTES * 10);
+    g_assert_cmpint(a.last_latency, ==, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 2);
+
+    /* Better again, same knob */
+    g_assert(run_interval(&a, true, BASE_BYTES * 2, LATENCY));
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 4);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS);
+
+    /* No change, the request size is probed instead */
+    g_assert(run_interval(&a, true, BASE_BYTES * 2, LATENCY));
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 4);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS * 2);
+}
+
+/* A drop in throughput reverses exactly the step that caused it */
+static void test_undo(void)
+{
+    MirrorAdapt a;
+
+    adapt_init(&a);
+    run_interval(&a, true, BASE_BYTES, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 2);
+
+    /* No change: the request size doubles */
+    run_interval(&a, true, BASE_BYTES, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 2);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS * 2);
+
+    /* Worse: the request size goes back, the queue depth is kept */
+    run_interval(&a, true, BASE_BYTES / 2, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 2);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS);
+
+    /* Worse again: there is no step left to undo */
+    run_interval(&a, true, BASE_BYTES / 4, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 2);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS);
+
+    /* Better: grow the knob that is next in turn */
+    run_interval(&a, true, BASE_BYTES, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 2);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS * 2);
+}
+
+static void test_congestion(void)
+{
+    MirrorAdapt a;
+
+    adapt_init(&a);
+    run_interval(&a, true, BASE_BYTES, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, IN_FLIGHT + 2);
+
+    /* Latency above twice the best seen halves the queue depth */
+    run_interval(&a, true, BASE_BYTES * 2, LATENCY * 3);
+    g_assert_cmpint(a.max_in_flight, ==, (IN_FLIGHT + 2) / 2);
+
+    /* The halving is not a step, a drop in throughput keeps it */
+    run_interval(&a, true, BASE_BYTES, LATENCY);
+    g_assert_cmpint(a.max_in_flight, ==, (IN_FLIGHT + 2) / 2);
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS);
+}
+
+static void test_limits(void)
+{
+    MirrorAdapt a;
+    uint64_t bytes = BASE_BYTES;
+    int i;
+
+    adapt_init(&a);
+    for (i = 0; i < 40; i++) {
+        run_interval(&a, true, bytes, LATENCY);
+        g_assert_cmpint(a.max_in_flight, <=, MIRROR_ADAPT_MAX_IN_FLIGHT);
+        bytes = bytes * 5 / 4;
+    }
+    g_assert_cmpint(a.max_in_flight, ==, MIRROR_ADAPT_MAX_IN_FLIGHT);
+
+    /* Flat throughput alternates between the knobs */
+    for (i = 0; i < 20; i++) {
+        run_interval(&a, true, bytes, LATENCY);
+        g_assert_cmpint(a.max_io_sectors, <=, IO_SECTORS_MAX);
+    }
+    g_assert_cmpint(a.max_io_sectors, ==, IO_SECTORS_MAX);
+
+    /* Congestion every interval brings the queue depth down to one */
+    for (i = 0; i < 10; i++) {
+        run_interval(&a, true, bytes, LATENCY * 3);
+    }
+    g_assert_cmpint(a.max_in_flight, ==, 1);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/mirror-adapt/unsaturated", test_unsaturated);
+    g_test_add_func("/mirror-adapt/grow", test_grow);
+    g_test_add_func("/mirror-adapt/undo", test_undo);
+    g_test_add_func("/mirror-adapt/congestion", test_congestion);
+    g_test_add_func("/mirror-adapt/limits", test_limits);
+    return g_test_run();
+}
@@ -0,0 +1,147 @@
+/*
+ * XBZRLE page cache unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "migration/page_cache.h"
+
+#define PAGE_SIZE 4096
+
+/* 8 sets of 8 pages; pages NR_SETS pages apart share a set */
+#define NR_PAGES 64
+#define NR_SETS 8
+
+static uint8_t page[PAGE_SIZE];
+
+static uint64_t set_addr(int set, int i)
+{
+    return ((uint64_t)i * NR_SETS + set) * PAGE_SIZE;
+}
+
+static void insert(PageCache *cache, uint64_t addr, uint64_t age)
+{
+    memset(page, addr / PAGE_SIZE, PAGE_SIZE);
+    g_assert_cmpint(cache_insert(cache, addr, page, age), ==, 0);
+}
+
+static void check_cached(PageCache *cache, uint64_t addr, uint64_t age)
+{
+    uint8_t *data;
+
+    g_assert(cache_is_cached(cache, addr, age));
+    data = get_cached_data(cache, addr);
+    g_assert(data);
+    g_assert_cmpint(data[0], ==, (uint8_t)(addr / PAGE_SIZE));
+    g_assert_cmpint(data[PAGE_SIZE - 1], ==, (uint8_t)(addr / PAGE_SIZE));
+}
+
+/* Pages that map to the same set do not evict each other. */
+static void test_collisions(void)
+{
+    PageCache *cache = cache_init(NR_PAGES, PAGE_SIZE);
+    int i;
+
+    for (i = 0; i < NR_PAGES / NR_SETS; i++) {
+        insert(cache, set_addr(3, i), 0);
+    }
+    for (i = 0; i < NR_PAGES / NR_SETS; i++) {
+        check_cached(cache, set_addr(3, i), 0);
+    }
+    g_assert(!cache_is_cached(cache, set_addr(4, 0), 0));
+    g_assert(get_cached_data(cache, set_addr(4, 0)) == NULL);
+    cache_fini(cache);
+}
+
+/* A full set evicts its least recently used page, unless it is fresh. */
+static void test_replacement(void)
+{
+    PageCache *cache = cache_init(NR_PAGES, PAGE_SIZE);
+    int i;
+
+    for (i = 0; i < NR_PAGES / NR_SETS; i++) {
+        insert(cache, set_addr(0, i), 0);
+    }
+    /* touch all of them but page 2 */
+    for (i = 0; i < NR_PAGES / NR_SETS; i++) {
+        if (i != 2) {
+            check_cached(cache, set_addr(0, i), 1);
+        }
+    }
+
+    /* page 2 is still considered fresh */
+    memset(page, 0, PAGE_SIZE);
+    g_assert_cmpint(cache_insert(cache, set_addr(0, 8), page, 1), ==, -1);
+
+    insert(cache, set_addr(0, 8), 2);
+    g_assert(!cache_is_cached(cache, set_addr(0, 2), 2));
+    for (i = 0; i < NR_PAGES / NR_SETS + 1; i++) {
+        if (i != 2) {
+            check_cached(cache, set_addr(0, i), 2);
+        }
+    }
+
+    /* updating a cached page never evicts anything */
+    insert(cache, set_addr(0, 8), 2);
+    for (i = 0; i < NR_PAGES / NR_SETS + 1; i++) {
+        if (i != 2) {
+            check_cached(cache, set_addr(0, i), 2);
+        }
+    }
+    cache_fini(cache);
+}
+
+/* Shrinking the cache keeps the most recently used pages. */
+static void test_resize(void)
+{
+    PageCache *cache = cache_init(NR_PAGES, PAGE_SIZE);
+    int i;
+
+    for (i = 0; i < NR_PAGES; i++) {
+        insert(cache, (uint64_t)i * PAGE_SIZE, 0);
+    }
+    g_assert_cmpint(cache_resize(cache, NR_PAGES / 2), ==, NR_PAGES / 2);
+    for (i = NR_PAGES / 2; i < NR_PAGES; i++) {
+        check_cached(cache, (uint64_t)i * PAGE_SIZE, 0);
+    }
+    for (i = 0; i < NR_PAGES / 2; i++) {
+        g_assert(!cache_is_cached(cache, (uint64_t)i * PAGE_SIZE, 0));
+    }
+
+    g_assert_cmpint(cache_resize(cache, NR_PAGES * 2), ==, NR_PAGES * 2);
+    for (i = NR_PAGES / 2; i < NR_PAGES; i++) {
+        check_cached(cache, (uint64_t)i * PAGE_SIZE, 0);
+    }
+    cache_fini(cache);
+}
+
+/* Caches smaller than a set are fully associative. */
+static void test_small(void)
+{
+    PageCache *cache = cache_init(3, PAGE_SIZE);
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        insert(cache, (uint64_t)i * 64 * PAGE_SIZE, 0);
+    }
+    for (i = 0; i < 2; i++) {
+        check_cached(cache, (uint64_t)i * 64 * PAGE_SIZE, 0);
+    }
+    memset(page, 0, PAGE_SIZE);
+    g_assert_cmpint(cache_insert(cache, 128 * PAGE_SIZE, page, 0), ==, -1);
+    cache_fini(cache);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/page_cache/collisions", test_collisions);
+    g_test_add_func("/page_cache/replacement", test_replacement);
+    g_test_add_func("/page_cache/resize", test_resize);
+    g_test_add_func("/page_cache/small", test_small);
+    return g_test_run();
+}
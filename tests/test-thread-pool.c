@@ -221,6 +221,46 @@ static void test_cancel_async(void)
     do_test_cancel(false);
 }
 
+static void test_stats(void)
+{
+    ThreadPoolStats before, after;
+
+    thread_pool_get_stats(pool, &before);
+    test_submit_many();
+    thread_pool_get_stats(pool, &after);
+
+    g_assert_cmpint(after.requests - before.requests, ==, 100);
+    g_assert_cmpint(after.stolen, <=, after.requests);
+    g_assert_cmpint(after.queue_depth, ==, 0);
+    g_assert_cmpint(after.max_wait_ns, >=, before.max_wait_ns);
+    g_assert_cmpint(after.total_wait_ns, >=, after.max_wait_ns);
+}
+
+static void test_params(void)
+{
+    ThreadPoolStats stats;
+    Error *local_err = NULL;
+
+    aio_context_set_thread_pool_params(ctx, 4, 2, 1000, &local_err);
+    error_free_or_abort(&local_err);
+    aio_context_set_thread_pool_params(ctx, 0, 0, 1000, &local_err);
+    error_free_or_abort(&local_err);
+    aio_context_set_thread_pool_params(ctx, 0, 8, 0, &local_err);
+    error_free_or_abort(&local_err);
+
+    /* The pool is topped up to the minimum right away.  */
+    aio_context_set_thread_pool_params(ctx, 4, 8, 1000, &error_abort);
+    thread_pool_get_stats(pool, &stats);
+    g_assert_cmpint(stats.cur_threads, >=, 4);
+
+    test_submit_many();
+
+    aio_context_set_thread_pool_params(ctx, THREAD_POOL_MIN_THREADS_DEFAULT,
+                                       THREAD_POOL_MAX_THREADS_DEFAULT,
+                                       THREAD_POOL_IDLE_TIMEOUT_DEFAULT,
+                                       &error_abort);
+}
+
 int main(int argc, char **argv)
 {
     int ret;
@@ -242,6 +282,8 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
+    g_test_add_func("/thread-pool/stats", test_stats);
+    g_test_add_func("/thread-pool/params", test_params);
 
     ret = g_test_run();
 
@@ -0,0 +1,186 @@
+/*
+ * QEMUTimerList tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+/* This is the clock for QEMU_CLOCK_VIRTUAL */
+static int64_t my_clock_value;
+
+int64_t cpu_get_clock(void)
+{
+    return my_clock_value;
+}
+
+#define NR_TIMERS 1024
+
+typedef struct TestTimer {
+    QEMUTimer timer;
+    int index;
+    int64_t expected;
+} TestTimer;
+
+static TestTimer timers[NR_TIMERS];
+static int fired[NR_TIMERS];
+static int nr_fired;
+
+static void test_cb(void *opaque)
+{
+    TestTimer *t = opaque;
+
+    g_assert_cmpint(my_clock_value, >=, t->expected);
+    fired[nr_fired++] = t->index;
+}
+
+static QEMUTimerList *setup(void)
+{
+    QEMUTimerList *tl = timerlist_new(QEMU_CLOCK_VIRTUAL, NULL, NULL);
+    int i;
+
+    my_clock_value = 0;
+    nr_fired = 0;
+    for (i = 0; i < NR_TIMERS; i++) {
+        timers[i].index = i;
+        timer_init_tl(&timers[i].timer, tl, SCALE_NS, test_cb, &timers[i]);
+    }
+    return tl;
+}
+
+static void teardown(QEMUTimerList *tl)
+{
+    int i;
+
+    for (i = 0; i < NR_TIMERS; i++) {
+        timer_del(&timers[i].timer);
+        timer_deinit(&timers[i].timer);
+    }
+    timerlist_free(tl);
+}
+
+static void arm(int i, int64_t expire)
+{
+    timers[i].expected = expire;
+    timer_mod_ns(&timers[i].timer, expire);
+}
+
+/* Timers fire in expire order, whatever order they were armed in. */
+static void test_order(void)
+{
+    QEMUTimerList *tl = setup();
+    int64_t last = -1;
+    int i;
+
+    for (i = 0; i < NR_TIMERS; i++) {
+        arm(i, g_test_rand_int_range(1, 1000000));
+    }
+    /* re-arm and delete some of them */
+    for (i = 0; i < NR_TIMERS; i += 3) {
+        arm(i, g_test_rand_int_range(1, 1000000));
+    }
+    for (i = 1; i < NR_TIMERS; i += 7) {
+        timer_del(&timers[i].timer);
+    }
+
+    g_assert_cmpint(timerlist_deadline_ns(tl), >, 0);
+    my_clock_value = 1000000;
+    timerlist_run_timers(tl);
+    g_assert(!timerlist_has_timers(tl));
+
+    for (i = 0; i < nr_fired; i++) {
+        TestTimer *t = &timers[fired[i]];
+
+        g_assert_cmpint(t->index % 7, !=, 1);
+        g_assert_cmpint(t->expected, >=, last);
+        last = t->expected;
+    }
+    g_assert_cmpint(nr_fired, ==, NR_TIMERS - (NR_TIMERS + 5) / 7);
+    teardown(tl);
+}
+
+/* Timers with the same expire time fire in the order they were armed. */
+static void test_fifo(void)
+{
+    QEMUTimerList *tl = setup();
+    int i;
+
+    for (i = NR_TIMERS - 1; i >= 0; i--) {
+        arm(i, 100 + (i & 1));
+    }
+
+    my_clock_value = 100;
+    timerlist_run_timers(tl);
+    g_assert_cmpint(nr_fired, ==, NR_TIMERS / 2);
+    for (i = 0; i < nr_fired; i++) {
+        g_assert_cmpint(fired[i], ==, NR_TIMERS - 2 - 2 * i);
+    }
+
+    my_clock_value = 101;
+    timerlist_run_timers(tl);
+    g_assert_cmpint(nr_fired, ==, NR_TIMERS);
+    teardown(tl);
+}
+
+/* Only expired timers run, and the deadline follows the earliest one. */
+static void test_deadline(void)
+{
+    QEMUTimerList *tl = setup();
+
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, -1);
+    arm(0, 300);
+    arm(1, 200);
+    arm(2, 400);
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 200);
+
+    timer_del(&timers[1].timer);
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 300);
+
+    my_clock_value = 350;
+    timerlist_run_timers(tl);
+    g_assert_cmpint(nr_fired, ==, 1);
+    g_assert_cmpint(fired[0], ==, 0);
+    g_assert(!timer_pending(&timers[0].timer));
+    g_assert(timer_pending(&timers[2].timer));
+    g_assert_cmpint(timerlist_deadline_ns(tl), ==, 50);
+    teardown(tl);
+}
+
+/* Re-arm timers the way a guest rewriting its compare registers does. */
+static void perf_rearm(void)
+{
+    QEMUTimerList *tl = setup();
+    unsigned long i, maxcycles = 10000000;
+    double duration;
+
+    for (i = 0; i < NR_TIMERS; i++) {
+        arm(i, g_test_rand_int_range(1, 1000000000));
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < maxcycles; i++) {
+        timer_mod_ns(&timers[i % NR_TIMERS].timer,
+                     g_test_rand_int_range(1, 1000000000));
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Re-arm %lu times with %d active timers: %f s\n",
+                   maxcycles, NR_TIMERS, duration);
+    teardown(tl);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    init_clocks();
+
+    g_test_add_func("/timerlist/order", test_order);
+    g_test_add_func("/timerlist/fifo", test_fifo);
+    g_test_add_func("/timerlist/deadline", test_deadline);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/rearm", perf_rearm);
+    }
+    return g_test_run();
+}
@@ -174,6 +174,153 @@ static void test_encode_decode(void)
     }
 }
 
+/* Byte at a time version of xbzrle_encode_buffer, overflow checks included */
+static int encode_ref(const uint8_t *old_buf, const uint8_t *new_buf,
+                      int slen, uint8_t *dst, int dlen)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0;
+
+    while (i < slen) {
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        for (zrun_len = 0; i < slen && old_buf[i] == new_buf[i]; i++) {
+            zrun_len++;
+        }
+        if (zrun_len == slen) {
+            return 0;
+        }
+        if (i == slen) {
+            return d;
+        }
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        for (nzrun_len = 0; i < slen && old_buf[i] != new_buf[i]; i++) {
+            nzrun_len++;
+        }
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + i - nzrun_len, nzrun_len);
+        d += nzrun_len;
+    }
+    return d;
+}
+
+/* Dirty a random number of runs, of random length, of a copy of @old */
+static void dirty_page(const uint8_t *old, uint8_t *new, int len,
+                       int max_runs, int max_run_len)
+{
+    int runs = g_test_rand_int_range(0, max_runs + 1);
+    int i, j;
+
+    memcpy(new, old, len);
+    for (i = 0; i < runs; i++) {
+        int start = g_test_rand_int_range(0, len);
+        int run_len = g_test_rand_int_range(1, max_run_len + 1);
+
+        for (j = start; j < MIN(start + run_len, len); j++) {
+            /* a random byte is sometimes equal to the old one, keep it so */
+            new[j] = g_test_rand_int();
+        }
+    }
+}
+
+static void encode_accel_fuzz(void)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE);
+    uint8_t *new = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *expected = g_malloc(PAGE_SIZE);
+    int i, j, rc, ref;
+
+    for (i = 0; i < 10000; i++) {
+        int slen = (i & 1) ? PAGE_SIZE
+                   : g_test_rand_int_range(1, PAGE_SIZE / 8 + 1) * 8;
+        int dlen = g_test_rand_int_range(2, slen + 1);
+
+        for (j = 0; j < slen; j++) {
+            old[j] = g_test_rand_int();
+        }
+        dirty_page(old, new, slen, 1 << (i % 9), 1 << (i % 11));
+
+        rc = xbzrle_encode_buffer(old, new, slen, compressed, dlen);
+        ref = encode_ref(old, new, slen, expected, dlen);
+        g_assert_cmpint(rc, ==, ref);
+        if (rc <= 0) {
+            continue;
+        }
+        g_assert(memcmp(compressed, expected, rc) == 0);
+
+        rc = xbzrle_decode_buffer(compressed, rc, old, slen);
+        g_assert_cmpint(rc, <=, slen);
+        g_assert(memcmp(old, new, slen) == 0);
+    }
+
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+    g_free(expected);
+}
+
+static void encode_accel_perf(int accel, const char *name,
+                              int max_runs, int max_run_len)
+{
+    int pages = 4096, i, rc;
+    uint8_t *old = g_malloc(pages * PAGE_SIZE);
+    uint8_t *new = g_malloc(pages * PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    unsigned long encoded = 0, maxcycles = 100;
+    double duration;
+
+    for (i = 0; i < pages * PAGE_SIZE; i++) {
+        old[i] = g_test_rand_int();
+    }
+    for (i = 0; i < pages; i++) {
+        dirty_page(old + i * PAGE_SIZE, new + i * PAGE_SIZE, PAGE_SIZE,
+                   max_runs, max_run_len);
+    }
+
+    rc = 0;
+    g_test_timer_start();
+    while (maxcycles--) {
+        for (i = 0; i < pages; i++) {
+            rc |= xbzrle_encode_buffer(old + i * PAGE_SIZE, new + i * PAGE_SIZE,
+                                       PAGE_SIZE, compressed, PAGE_SIZE);
+            encoded += PAGE_SIZE;
+        }
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("accel %d, %s: %lu MB in %f s, %f MB/s (%d)\n",
+                   accel, name, encoded >> 20, duration,
+                   (encoded >> 20) / duration, rc);
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+}
+
+/* Check each accelerated encoder against encode_ref, best one first. */
+static void test_encode_accel(void)
+{
+    int accel = 0;
+
+    do {
+        encode_accel_fuzz();
+        if (g_test_perf()) {
+            encode_accel_perf(accel, "unchanged", 0, 0);
+            encode_accel_perf(accel, "few long runs", 4, 256);
+            encode_accel_perf(accel, "many short runs", 64, 8);
+        }
+        accel++;
+    } while (test_xbzrle_next_accel());
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +333,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -19,6 +19,8 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
@@ -26,6 +28,7 @@
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolQueue ThreadPoolQueue;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -38,35 +41,75 @@ struct ThreadPoolElement {
     ThreadPool *pool;
     ThreadPoolFunc *func;
     void *arg;
+    int64_t submit_time;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
+    /* Moving state out of THREAD_QUEUED is protected by queue->lock.  After
      * that, only the worker thread can write to it.  Reads and writes
      * of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Access to this list is protected by queue->lock.  */
+    ThreadPoolQueue *queue;
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
-    /* Access to this list is protected by the global mutex.  */
-    QLIST_ENTRY(ThreadPoolElement) all;
+    /* Pushed to pool->done_list atomically, then moved to pool->completing
+     * by the AioContext.
+     */
+    QSLIST_ENTRY(ThreadPoolElement) completed;
 };
 
+/* Requests are spread across one queue per worker, so that submission and
+ * workers picking up requests do not all serialize on a single lock.  A
+ * worker drains its own queue first and then steals from the others; the
+ * pool semaphore counts the requests in all queues together, so a worker
+ * that got a token is guaranteed to find something to do somewhere.
+ */
+#define THREAD_POOL_NR_QUEUES 64
+
+struct ThreadPoolQueue {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+
+    /* Written under lock with atomic ops, so that empty queues can be
+     * skipped without taking the lock.
+     */
+    int depth;
+
+    /* Statistics, protected by lock.  */
+    uint64_t requests;
+    uint64_t stolen;
+    uint64_t total_wait_ns;
+    uint64_t max_wait_ns;
+} QEMU_ALIGNED(64);
+
 struct ThreadPool {
+    ThreadPoolQueue queues[THREAD_POOL_NR_QUEUES];
+
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
+    /* Finished requests, pushed by the workers without taking any lock.  */
+    QSLIST_HEAD(, ThreadPoolElement) done_list;
+
     /* The following variables are only accessed from one AioContext. */
-    QLIST_HEAD(, ThreadPoolElement) head;
+    QSLIST_HEAD(, ThreadPoolElement) completing;
+    unsigned next_queue;
+    int nr_requests;     /* submitted but not completed yet */
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /* The following variables are protected by lock.  idle_threads is
+     * modified with atomic ops; idle_threads, cur_threads, max_threads
+     * and idle_timeout are also read without the lock.
+     */
+    uint64_t used_queues; /* bitmap of queues that have an owner */
+    int min_threads;
+    int max_threads;
+    int idle_timeout;
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
@@ -74,34 +117,134 @@ struct ThreadPool {
     bool stopping;
 };
 
+static int thread_pool_queued(ThreadPool *pool)
+{
+    int i, queued = 0;
+
+    for (i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        queued += atomic_read(&pool->queues[i].depth);
+    }
+    return queued;
+}
+
+/* Pick the lowest unowned queue as the worker's own, or none if there are
+ * more workers than queues; those workers only steal.  Runs with lock taken.
+ */
+static int thread_pool_claim_queue(ThreadPool *pool)
+{
+    int i;
+
+    if (pool->used_queues == ~0ULL) {
+        return -1;
+    }
+    i = ctz64(~pool->used_queues);
+    pool->used_queues |= 1ULL << i;
+    return i;
+}
+
+static ThreadPoolElement *thread_pool_queue_pop(ThreadPoolQueue *q,
+                                               bool steal)
+{
+    ThreadPoolElement *req;
+
+    if (!atomic_read(&q->depth)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&q->lock);
+    req = QTAILQ_FIRST(&q->request_list);
+    if (req) {
+        uint64_t wait_ns = get_clock() - req->submit_time;
+
+        QTAILQ_REMOVE(&q->request_list, req, reqs);
+        atomic_dec(&q->depth);
+        req->state = THREAD_ACTIVE;
+
+        q->requests++;
+        q->stolen += steal;
+        q->total_wait_ns += wait_ns;
+        q->max_wait_ns = MAX(q->max_wait_ns, wait_ns);
+    }
+    qemu_mutex_unlock(&q->lock);
+    return req;
+}
+
+/* Called after taking a token from the semaphore, so there is a request
+ * for us in one of the queues.  It may be moved under our feet by other
+ * workers, but only by those who have a token of their own, hence the loop.
+ */
+static ThreadPoolElement *thread_pool_take(ThreadPool *pool, int own)
+{
+    ThreadPoolElement *req;
+    int i, start = own < 0 ? 0 : own;
+
+    for (;;) {
+        for (i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+            int n = (start + i) % THREAD_POOL_NR_QUEUES;
+
+            req = thread_pool_queue_pop(&pool->queues[n], n != own);
+            if (req) {
+                return req;
+            }
+        }
+    }
+}
+
+/* Decide whether the worker owning queue @own should exit.  */
+static bool thread_pool_retire(ThreadPool *pool, int own, bool timed_out)
+{
+    bool retire;
+
+    qemu_mutex_lock(&pool->lock);
+
+    /* Read the queues after idle_threads was decremented.  Pairs with
+     * thread_pool_submit_aio(), which reads idle_threads after queuing
+     * the request: either it spawns a new thread, or we see the request.
+     */
+    smp_mb();
+    retire = pool->stopping ||
+             pool->cur_threads > pool->max_threads ||
+             (timed_out && pool->cur_threads > pool->min_threads &&
+              !thread_pool_queued(pool));
+    if (retire) {
+        if (own >= 0) {
+            pool->used_queues &= ~(1ULL << own);
+        }
+        pool->cur_threads--;
+        qemu_cond_signal(&pool->worker_stopped);
+    }
+
+    qemu_mutex_unlock(&pool->lock);
+    return retire;
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    int own;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    own = thread_pool_claim_queue(pool);
     do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (!pool->stopping) {
+    for (;;) {
         ThreadPoolElement *req;
         int ret;
 
-        do {
-            pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
-            break;
-        }
+        atomic_inc(&pool->idle_threads);
+        ret = qemu_sem_timedwait(&pool->sem, atomic_read(&pool->idle_timeout));
+        atomic_dec(&pool->idle_threads);
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
+        if (ret == -1 || atomic_read(&pool->stopping)) {
+            if (thread_pool_retire(pool, own, ret == -1)) {
+                break;
+            }
+            continue;
+        }
 
+        req = thread_pool_take(pool, own);
         ret = req->func(req->arg);
 
         req->ret = ret;
@@ -109,14 +252,17 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, req, completed);
         qemu_bh_schedule(pool->completion_bh);
+
+        /* Shrink towards a lowered max_threads.  */
+        if (atomic_read(&pool->cur_threads) >
+            atomic_read(&pool->max_threads) &&
+            thread_pool_retire(pool, own, false)) {
+            break;
+        }
     }
 
-    pool->cur_threads--;
-    qemu_cond_signal(&pool->worker_stopped);
-    qemu_mutex_unlock(&pool->lock);
     return NULL;
 }
 
@@ -160,20 +306,39 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/* Move finished requests to the completing list, in the order in which
+ * they finished.
+ */
+static void thread_pool_grab_done(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) list;
+    ThreadPoolElement *elem;
+
+    QSLIST_MOVE_ATOMIC(&list, &pool->done_list);
+    while ((elem = QSLIST_FIRST(&list))) {
+        QSLIST_REMOVE_HEAD(&list, completed);
+        QSLIST_INSERT_HEAD(&pool->completing, elem, completed);
+    }
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
+    for (;;) {
+        if (QSLIST_EMPTY(&pool->completing)) {
+            thread_pool_grab_done(pool);
+        }
+        elem = QSLIST_FIRST(&pool->completing);
+        if (!elem) {
+            break;
         }
 
+        QSLIST_REMOVE_HEAD(&pool->completing, completed);
+        pool->nr_requests--;
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
-        QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
             /* Read state before ret.  */
@@ -185,11 +350,8 @@ restart:
             qemu_bh_schedule(pool->completion_bh);
 
             elem->common.cb(elem->common.opaque, elem->ret);
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 }
 
@@ -197,10 +359,11 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
+    ThreadPoolQueue *q = elem->queue;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    qemu_mutex_lock(&pool->lock);
+    qemu_mutex_lock(&q->lock);
     if (elem->state == THREAD_QUEUED &&
         /* No thread has yet started working on elem. we can try to "steal"
          * the item from the worker if we can get a signal from the
@@ -208,14 +371,17 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          * the lock taken and ensure that elem will remain THREAD_QUEUED.
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        QTAILQ_REMOVE(&q->request_list, elem, reqs);
+        atomic_dec(&q->depth);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, elem, completed);
+        qemu_bh_schedule(pool->completion_bh);
     }
 
-    qemu_mutex_unlock(&pool->lock);
+    qemu_mutex_unlock(&q->lock);
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -236,23 +402,41 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolQueue *q;
+    int nr_queues;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->submit_time = get_clock();
 
-    QLIST_INSERT_HEAD(&pool->head, req, all);
+    pool->nr_requests++;
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    /* Round-robin over the queues of the running workers.  */
+    nr_queues = MIN(atomic_read(&pool->cur_threads), THREAD_POOL_NR_QUEUES);
+    q = &pool->queues[pool->next_queue++ % MAX(nr_queues, 1)];
+
+    qemu_mutex_lock(&q->lock);
+    req->queue = q;
+    QTAILQ_INSERT_TAIL(&q->request_list, req, reqs);
+    atomic_inc(&q->depth);
+    qemu_mutex_unlock(&q->lock);
+
+    /* Read idle_threads after queuing the request, see thread_pool_retire().
+     * The atomic_inc() above is a full barrier.
+     */
+    if (atomic_read(&pool->idle_threads) == 0) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->idle_threads == 0 &&
+            pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
     qemu_sem_post(&pool->sem);
     return &req->common;
 }
@@ -285,8 +469,52 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+{
+    qemu_mutex_lock(&pool->lock);
+
+    pool->min_threads = ctx->thread_pool_min;
+    atomic_set(&pool->max_threads, ctx->thread_pool_max);
+    atomic_set(&pool->idle_timeout, ctx->thread_pool_idle_timeout);
+
+    /* Workers above the new maximum exit when they are done with their
+     * current request, or when they time out.
+     */
+    while (pool->cur_threads < pool->min_threads) {
+        spawn_thread(pool);
+    }
+
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    qemu_mutex_lock(&pool->lock);
+    stats->cur_threads = pool->cur_threads;
+    stats->idle_threads = atomic_read(&pool->idle_threads);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        ThreadPoolQueue *q = &pool->queues[i];
+
+        qemu_mutex_lock(&q->lock);
+        stats->queue_depth += q->depth;
+        stats->requests += q->requests;
+        stats->stolen += q->stolen;
+        stats->total_wait_ns += q->total_wait_ns;
+        stats->max_wait_ns = MAX(stats->max_wait_ns, q->max_wait_ns);
+        qemu_mutex_unlock(&q->lock);
+    }
+}
+
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
+    int i;
+
     if (!ctx) {
         ctx = qemu_get_aio_context();
     }
@@ -297,27 +525,34 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
-    QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    for (i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        qemu_mutex_init(&pool->queues[i].lock);
+        QTAILQ_INIT(&pool->queues[i].request_list);
+    }
+    QSLIST_INIT(&pool->done_list);
+    QSLIST_INIT(&pool->completing);
+
+    thread_pool_update_params(pool, ctx);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
 {
-    ThreadPool *pool = g_new(ThreadPool, 1);
+    ThreadPool *pool = qemu_memalign(64, sizeof(ThreadPool));
     thread_pool_init_one(pool, ctx);
     return pool;
 }
 
 void thread_pool_free(ThreadPool *pool)
 {
+    int i;
+
     if (!pool) {
         return;
     }
 
-    assert(QLIST_EMPTY(&pool->head));
+    assert(pool->nr_requests == 0);
 
     qemu_mutex_lock(&pool->lock);
 
@@ -336,8 +571,11 @@ void thread_pool_free(ThreadPool *pool)
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
+    for (i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        qemu_mutex_destroy(&pool->queues[i].lock);
+    }
     qemu_sem_destroy(&pool->sem);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
-    g_free(pool);
+    qemu_vfree(pool);
 }
@@ -154,6 +154,8 @@ void tb_lock_reset(void)
 }
 
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr);
 
 void cpu_gen_init(void)
 {
@@ -763,16 +765,112 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Start generating code at the beginning of region 'i'.  As in
+   tcg_prologue_init, leave 1k of slack at the end of the region so
+   that a single opcode can never overrun it.  */
+static void tb_region_enter(int i)
+{
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+    tcg_ctx.tb_ctx.cur_region = i;
+    tcg_ctx.code_gen_ptr = r->start;
+    tcg_ctx.code_gen_highwater = r->end - 1024;
+}
+
+/* Split the code buffer (minus the prologue) and the TB array into
+   regions, and make all of them empty.  */
+static void tb_region_init(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t size = tcg_ctx.code_gen_buffer_size;
+    int i, n;
+
+    n = size / TB_REGION_MIN_SIZE;
+    n = MAX(1, MIN(n, TB_REGION_COUNT));
+
+    ctx->nb_regions = n;
+    ctx->region_size = QEMU_ALIGN_DOWN(size / n, CODE_GEN_ALIGN);
+    ctx->region_max_blocks = tcg_ctx.code_gen_max_blocks / n;
+    ctx->nb_tbs = 0;
+
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        r->start = tcg_ctx.code_gen_buffer + i * ctx->region_size;
+        if (i == n - 1) {
+            r->end = tcg_ctx.code_gen_buffer + size;
+        } else {
+            r->end = r->start + ctx->region_size;
+        }
+        r->ptr = r->start;
+        r->tbs = ctx->tbs + i * ctx->region_max_blocks;
+        r->nb_tbs = 0;
+    }
+    tb_region_enter(0);
+}
+
+/* Invalidate every TB in region 'r', unlinking it from the TBs that
+   survive.  The jump caches only lose the entries pointing into the
+   region.  */
+static void tb_region_evict(TBRegion *r)
+{
+    CPUState *cpu;
+    int i;
+
+    for (i = 0; i < r->nb_tbs; i++) {
+        TranslationBlock *tb = &r->tbs[i];
+
+        if (!tb->invalid) {
+            do_tb_phys_invalidate(tb, -1);
+            tcg_ctx.tb_ctx.tb_evict_count++;
+        }
+    }
+    tcg_ctx.tb_ctx.nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    r->ptr = r->start;
+
+    /* The TB that a CPU has just left may be gone; make sure it is not
+       chained to the next one.  */
+    CPU_FOREACH(cpu) {
+        atomic_mb_set(&cpu->tb_flushed, true);
+    }
+    tcg_ctx.tb_ctx.tb_region_evict_count++;
+}
+
+/* The current region is full: switch to the next one, evicting the
+   oldest translations if it is in use.  With a single region, this
+   is equivalent to a full tb_flush.  */
+static void tb_region_advance(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    int next = (ctx->cur_region + 1) % ctx->nb_regions;
+
+    ctx->regions[ctx->cur_region].ptr = tcg_ctx.code_gen_ptr;
+    if (ctx->regions[next].nb_tbs) {
+        tb_region_evict(&ctx->regions[next]);
+    }
+    tb_region_enter(next);
+}
+
+/* Allocate a new translation block in the current region. Return NULL
+   if too many translation blocks are in the region.  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks) {
+    /* The regions can only be laid out once the prologue is in place,
+       which user mode emulation only does after tcg_exec_init.  */
+    if (unlikely(ctx->nb_regions == 0)) {
+        tb_region_init();
+    }
+    r = &ctx->regions[ctx->cur_region];
+    if (r->nb_tbs >= ctx->region_max_blocks) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs++];
+    ctx->nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
     tb->invalid = false;
@@ -781,13 +879,16 @@ static TranslationBlock *tb_alloc(target_ulong pc)
 
 void tb_free(TranslationBlock *tb)
 {
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &ctx->regions[ctx->cur_region];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+        r->nb_tbs--;
+        ctx->nb_tbs--;
     }
 }
 
@@ -861,11 +962,10 @@ void tb_flush(CPUState *cpu)
         atomic_mb_set(&cpu->tb_flushed, true);
     }
 
-    tcg_ctx.tb_ctx.nb_tbs = 0;
     qht_reset_size(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    tb_region_init();
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     tcg_ctx.tb_ctx.tb_flush_count++;
@@ -989,8 +1089,8 @@ static inline void tb_jmp_unlink(TranslationBlock *tb)
     }
 }
 
-/* invalidate one TB */
-void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr)
 {
     CPUState *cpu;
     PageDesc *p;
@@ -1030,7 +1130,12 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
+}
 
+/* invalidate one TB */
+void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+{
+    do_tb_phys_invalidate(tb, page_addr);
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
@@ -1173,8 +1278,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
  buffer_overflow:
-        /* flush must be done */
-        tb_flush(cpu);
+        /* the region is full: drop the partial TB and recycle the
+           oldest region instead of flushing everything */
+        if (tb) {
+            tb_free(tb);
+        }
+        tb_region_advance();
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         assert(tb != NULL);
@@ -1196,6 +1305,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
     tcg_ctx.cpu = ENV_GET_CPU(env);
     gen_intermediate_code(env, tb);
+    tb_prefetch_note(tb, tb->pc + tb->size);
     tcg_ctx.cpu = NULL;
 
     trace_translate_block(tb, tb->pc, tb->tc_ptr);
@@ -1516,23 +1626,32 @@ static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
-    uintptr_t v;
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
+    int m_min, m_max, m, i;
+    uintptr_t v, end;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (ctx->nb_tbs <= 0) {
+        return NULL;
+    }
+    if (tc_ptr < (uintptr_t)ctx->regions[0].start) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    /* TBs are only sorted within a region */
+    i = (tc_ptr - (uintptr_t)ctx->regions[0].start) / ctx->region_size;
+    i = MIN(i, ctx->nb_regions - 1);
+    r = &ctx->regions[i];
+    end = (uintptr_t)(i == ctx->cur_region ? tcg_ctx.code_gen_ptr : r->ptr);
+    if (r->nb_tbs <= 0 || tc_ptr >= end) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1542,7 +1661,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -1713,10 +1832,22 @@ static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
     g_free(hgram);
 }
 
+static size_t tb_region_used(int i)
+{
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+    if (i == tcg_ctx.tb_ctx.cur_region) {
+        return tcg_ctx.code_gen_ptr - r->start;
+    }
+    return r->ptr - r->start;
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    size_t code_size;
     TranslationBlock *tb;
     struct qht_stats hst;
 
@@ -1725,40 +1856,49 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-            direct_jmp_count++;
-            if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-                direct_jmp2_count++;
+    code_size = 0;
+    for (j = 0; j < ctx->nb_regions; j++) {
+        TBRegion *r = &ctx->regions[j];
+
+        code_size += tb_region_used(j);
+        for (i = 0; i < r->nb_tbs; i++) {
+            tb = &r->tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+                direct_jmp_count++;
+                if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_highwater - tcg_ctx.code_gen_buffer);
+    cpu_fprintf(f, "gen code size       %zd/%zd\n",
+                code_size, tcg_ctx.code_gen_buffer_size);
     cpu_fprintf(f, "TB count            %d/%d\n",
-            tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
+            ctx->nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
-            tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
-                    tcg_ctx.tb_ctx.nb_tbs : 0,
+            ctx->nb_tbs ? target_code_size / ctx->nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zd bytes (expansion ratio: %0.1f)\n",
+            ctx->nb_tbs ? code_size / ctx->nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
+    cpu_fprintf(f, "TB regions          %d (current %d)\n",
+                ctx->nb_regions, ctx->cur_region);
+    for (j = 0; j < ctx->nb_regions; j++) {
+        TBRegion *r = &ctx->regions[j];
+
+        cpu_fprintf(f, "  region %-2d         %zd/%td bytes, %d/%d TBs\n",
+                    j, tb_region_used(j), r->end - r->start,
+                    r->nb_tbs, ctx->region_max_blocks);
+    }
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1776,6 +1916,12 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d\n",
+            tcg_ctx.tb_ctx.tb_region_evict_count);
+    cpu_fprintf(f, "TB evict count      %d\n",
+            tcg_ctx.tb_ctx.tb_evict_count);
+    cpu_fprintf(f, "TB prefetch count   %d\n",
+            tcg_ctx.tb_ctx.tb_prefetch_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
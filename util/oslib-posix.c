@@ -39,6 +39,7 @@
 #include <libgen.h>
 #include <sys/signal.h>
 #include "qemu/cutils.h"
+#include "qemu/thread.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
@@ -311,56 +312,152 @@ char *qemu_get_exec_dir(void)
     return g_strdup(exec_dir);
 }
 
-static sigjmp_buf sigjump;
+#define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
-static void sigbus_handler(int signal)
+typedef struct MemsetThread {
+    char *addr;
+    size_t numpages;
+    size_t hpagesize;
+    QemuThread pgthread;
+    sigjmp_buf env;
+} MemsetThread;
+
+static MemsetThread *memset_thread;
+static int memset_num_threads;
+static bool memset_thread_failed;
+static struct sigaction sigbus_oldact;
+static __thread MemsetThread *memset_self;
+
+static void sigbus_handler(int sig, siginfo_t *info, void *ctx)
 {
-    siglongjmp(sigjump, 1);
+    /* SIGBUS is synchronous, so it is delivered to the thread that
+     * touched the page.
+     */
+    if (memset_self) {
+        siglongjmp(memset_self->env, 1);
+    }
+
+    /* Not raised by preallocation.  Call the previous handler directly
+     * instead of reinstalling it: the other preallocation threads may
+     * still fault, and they must keep failing through memset_thread_failed.
+     * The default action can only be taken by reinstalling it, but it ends
+     * the process anyway.
+     */
+    if (sigbus_oldact.sa_flags & SA_SIGINFO) {
+        sigbus_oldact.sa_sigaction(sig, info, ctx);
+    } else if (sigbus_oldact.sa_handler == SIG_DFL) {
+        signal(SIGBUS, SIG_DFL);
+        raise(SIGBUS);
+    } else if (sigbus_oldact.sa_handler != SIG_IGN) {
+        sigbus_oldact.sa_handler(sig);
+    }
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, Error **errp)
+static void *do_touch_pages(void *arg)
 {
-    int ret;
-    struct sigaction act, oldact;
+    MemsetThread *memset_args = arg;
     sigset_t set, oldset;
 
+    /* unblock SIGBUS */
+    sigemptyset(&set);
+    sigaddset(&set, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
+
+    memset_self = memset_args;
+    if (sigsetjmp(memset_args->env, 1)) {
+        memset_thread_failed = true;
+    } else {
+        char *addr = memset_args->addr;
+        size_t i;
+
+        /* Read and write back the first byte of each page, so that
+         * memory which already holds data is left alone.  MAP_POPULATE
+         * would silently ignore failures.
+         */
+        for (i = 0; i < memset_args->numpages; i++) {
+            *(volatile char *)addr = *addr;
+            addr += memset_args->hpagesize;
+        }
+    }
+    memset_self = NULL;
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    return NULL;
+}
+
+static int get_memset_num_threads(size_t numpages, int max_threads)
+{
+    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    int ret = 1;
+
+    if (host_procs > 0) {
+        ret = MIN(MIN(host_procs, max_threads), MAX_MEM_PREALLOC_THREAD_COUNT);
+    }
+    /* every thread gets at least one page */
+    ret = MIN(ret, numpages);
+    return MAX(ret, 1);
+}
+
+static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
+                            int max_threads)
+{
+    size_t numpages_per_thread, leftover;
+    char *addr = area;
+    int i;
+
+    memset_thread_failed = false;
+    memset_num_threads = get_memset_num_threads(numpages, max_threads);
+    memset_thread = g_new0(MemsetThread, memset_num_threads);
+    numpages_per_thread = numpages / memset_num_threads;
+    leftover = numpages % memset_num_threads;
+    for (i = 0; i < memset_num_threads; i++) {
+        memset_thread[i].addr = addr;
+        memset_thread[i].numpages = numpages_per_thread + (i < leftover);
+        memset_thread[i].hpagesize = hpagesize;
+        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
+                           do_touch_pages, &memset_thread[i],
+                           QEMU_THREAD_JOINABLE);
+        addr += memset_thread[i].numpages * hpagesize;
+    }
+    for (i = 0; i < memset_num_threads; i++) {
+        qemu_thread_join(&memset_thread[i].pgthread);
+    }
+    g_free(memset_thread);
+    memset_thread = NULL;
+
+    return memset_thread_failed;
+}
+
+void os_mem_prealloc(int fd, char *area, size_t memory, int max_threads,
+                     Error **errp)
+{
+    int ret;
+    struct sigaction act;
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+
     memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
+    act.sa_sigaction = &sigbus_handler;
+    act.sa_flags = SA_SIGINFO;
 
-    ret = sigaction(SIGBUS, &act, &oldact);
+    ret = sigaction(SIGBUS, &act, &sigbus_oldact);
     if (ret) {
         error_setg_errno(errp, errno,
             "os_mem_prealloc: failed to install signal handler");
         return;
     }
 
-    /* unblock SIGBUS */
-    sigemptyset(&set);
-    sigaddset(&set, SIGBUS);
-    pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
-
-    if (sigsetjmp(sigjump, 1)) {
+    /* touch pages simultaneously */
+    if (touch_all_pages(area, hpagesize, numpages, max_threads)) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
-            "pages available to allocate guest RAM\n");
-    } else {
-        int i;
-        size_t hpagesize = qemu_fd_getpagesize(fd);
-        size_t numpages = DIV_ROUND_UP(memory, hpagesize);
-
-        /* MAP_POPULATE silently ignores failures */
-        for (i = 0; i < numpages; i++) {
-            memset(area + (hpagesize * i), 0, 1);
-        }
+            "pages available to allocate guest RAM");
     }
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
+    ret = sigaction(SIGBUS, &sigbus_oldact, NULL);
     if (ret) {
         /* Terminate QEMU since it can't recover from error */
         perror("os_mem_prealloc: failed to reinstall signal handler");
         exit(1);
     }
-    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 }
 
 
@@ -3879,6 +3879,9 @@ int main(int argc, char **argv, char **envp)
                 }
                 configure_rtc(opts);
                 break;
+            case QEMU_OPTION_tb_prefetch:
+                tcg_tb_prefetch = true;
+                break;
             case QEMU_OPTION_tb_size:
                 tcg_tb_size = strtol(optarg, NULL, 0);
                 if (tcg_tb_size < 0) {